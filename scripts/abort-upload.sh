@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+# abort-upload.sh - replaces a file on a loopback server with an upload whose path goes dead
+# half way, and checks that the server keeps the previous version.
+#
+# The client runs with droprecv.c preloaded and DROP_AFTER set, so it stops hearing
+# acknowledgements after a few datagrams, gives up and closes without a COMMIT. The server must
+# then drop what it received instead of publishing it. Build du-ftp first (make).
+#
+# USAGE: scripts/abort-upload.sh [-a acks] [-f file] [-p port]
+#   -a acks   datagrams the client receives before the path goes dead; DEFAULT = 20
+#   -f file   file to upload; DEFAULT = outfile/rfc793.txt
+#   -p port   server port; DEFAULT = 4700
+#
+# Exits 0 if the client reports the failure, the previous version is left untouched and no partial
+# file remains, 1 otherwise.
+# Logs are kept in the printed directory.
+
+set -u
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+EXE="$ROOT/bin/du-ftp"
+
+ACKS=20
+FILE="$ROOT/outfile/rfc793.txt"
+PORT=4700
+
+while getopts "a:f:p:" opt; do
+   case $opt in
+      a) ACKS=$OPTARG ;;
+      f) FILE=$(cd "$(dirname "$OPTARG")" && pwd)/$(basename "$OPTARG") ;;
+      p) PORT=$OPTARG ;;
+      *) sed -n '10,13p' "$0"; exit 2 ;;
+   esac
+done
+
+if [ ! -x "$EXE" ]; then
+   echo "ERROR: $EXE not found, run make first" >&2
+   exit 2
+fi
+
+WORK=$(mktemp -d /tmp/abort-upload.XXXXXX)
+SHIM="$WORK/droprecv.so"
+if ! cc -shared -fPIC -o "$SHIM" "$ROOT/scripts/droprecv.c" -ldl; then
+   echo "ERROR: cannot build the loss shim" >&2
+   exit 2
+fi
+
+NAME=$(basename "$FILE")
+mkdir -p "$WORK/srv" "$WORK/cli"
+echo "previous version of $NAME" > "$WORK/old"
+cp "$WORK/old" "$WORK/srv/$NAME"
+cp "$FILE" "$WORK/cli/$NAME"
+
+(cd "$WORK/srv" && exec timeout 60 "$EXE" -s -p "$PORT" > log 2>&1) &
+SERVER=$!
+sleep 0.5
+
+(cd "$WORK/cli" && LD_PRELOAD="$SHIM" DROP_AFTER="$ACKS" timeout 60 "$EXE" -c -a 127.0.0.1 -p "$PORT" -f "$NAME" > log 2>&1)
+CLIENT=$?
+echo "client exited $CLIENT: $(grep -a "abandoning" "$WORK/cli/log")"
+
+# The CLOSE went out before the client stopped waiting for its acknowledgement.
+sleep 1
+kill "$SERVER" 2> /dev/null
+wait "$SERVER" 2> /dev/null
+
+FAILED=0
+if [ $CLIENT -eq 0 ]; then
+   echo "client: reported success"
+   FAILED=1
+fi
+if cmp -s "$WORK/old" "$WORK/srv/$NAME"; then
+   echo "previous version: untouched"
+else
+   echo "previous version: REPLACED"
+   FAILED=1
+fi
+if ls -A "$WORK/srv" | grep -q "^\.du-ftp-partial\."; then
+   echo "partial file: LEFT BEHIND"
+   FAILED=1
+fi
+
+if [ $FAILED -eq 0 ]; then
+   echo "PASS: upload cut off after $ACKS datagrams was not published"
+else
+   echo "FAIL: logs in $WORK"
+   exit 1
+fi
+rm -rf "$WORK"
@@ -0,0 +1,95 @@
+/**
+ * @file droprecv.c
+ * @brief LD_PRELOAD shim that makes recv() and recvmsg() lose datagrams, for mcast-loss.sh and abort-upload.sh.
+ *
+ * @section Description
+ * A multicast receiver only repairs what it lost, and loopback loses nothing. Preloaded into a
+ * receiver, this shim discards DROP_PERCENT percent of the datagrams it receives, as if the network
+ * had dropped them. Each process draws from its own seed, so the receivers of one run lose different
+ * datagrams and a repair has to serve several losses at once. The datagram is consumed and recv()
+ * fails with EAGAIN, which the receiver takes as nothing having arrived yet.
+ *
+ * With DROP_AFTER set, the first DROP_AFTER datagrams get through and every later one is lost, a
+ * path that goes dead in the middle of a transfer.
+ *
+ * Build: cc -shared -fPIC -o droprecv.so droprecv.c -ldl
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static int      dropPercent = -1; /**< Share of datagrams dropped, read from DROP_PERCENT on the first recv(). */
+static long     dropAfter   = -1; /**< Datagrams let through before all the rest are lost, -1 for no such limit. */
+static long     received;         /**< Datagrams received so far. */
+static unsigned seed;             /**< Seeded from the pid, so every receiver loses different datagrams. */
+
+/**
+ * @brief Decides whether the datagram just received is lost.
+ *
+ * @return int Non-zero to drop it.
+ */
+static int lost(void)
+{
+   if (dropPercent < 0)
+   {
+      const char* env   = getenv("DROP_PERCENT");
+      const char* after = getenv("DROP_AFTER");
+      dropPercent       = (env != NULL) ? atoi(env) : 0;
+      dropAfter         = (after != NULL) ? atol(after) : -1;
+      seed              = (unsigned) getpid();
+   }
+
+   if (dropAfter >= 0 && received++ >= dropAfter)
+      return 1;
+
+   return (int) (rand_r(&seed) % 100) < dropPercent;
+}
+
+ssize_t recv(int fd, void* buf, size_t len, int flags)
+{
+   static ssize_t (*real)(int, void*, size_t, int);
+   if (real == NULL)
+      real = (ssize_t(*)(int, void*, size_t, int)) dlsym(RTLD_NEXT, "recv");
+
+   ssize_t bytes = real(fd, buf, len, flags);
+   if (bytes > 0 && lost())
+   {
+      errno = EAGAIN;
+      return -1;
+   }
+
+   return bytes;
+}
+
+/**
+ * @brief The fortified recv() a build with _FORTIFY_SOURCE calls instead.
+ */
+ssize_t __recv_chk(int fd, void* buf, size_t len, size_t buflen, int flags)
+{
+   (void) buflen;
+   return recv(fd, buf, len, flags);
+}
+
+/**
+ * @brief The recvmsg() unicast clients receive their acknowledgements with.
+ */
+ssize_t recvmsg(int fd, struct msghdr* msg, int flags)
+{
+   static ssize_t (*real)(int, struct msghdr*, int);
+   if (real == NULL)
+      real = (ssize_t(*)(int, struct msghdr*, int)) dlsym(RTLD_NEXT, "recvmsg");
+
+   ssize_t bytes = real(fd, msg, flags);
+   if (bytes > 0 && lost())
+   {
+      errno = EAGAIN;
+      return -1;
+   }
+
+   return bytes;
+}
@@ -0,0 +1,86 @@
+#!/bin/bash
+#
+# mcast-loss.sh - multicasts a file on loopback to several receivers that lose datagrams,
+# and checks that every receiver ends up with an identical copy.
+#
+# Each receiver runs with droprecv.c preloaded, dropping its own random share of what it receives,
+# so the run goes through NACKs, their suppression and parity repairs. Build du-ftp first (make).
+#
+# USAGE: scripts/mcast-loss.sh [-n receivers] [-l loss%] [-f file] [-g group] [-p port]
+#   -n receivers  number of receivers; DEFAULT = 4
+#   -l loss%      percent of datagrams each receiver drops; DEFAULT = 10
+#   -f file       file to multicast; DEFAULT = outfile/rfc793.txt
+#   -g group      multicast group; DEFAULT = 239.1.2.3
+#   -p port       group port; DEFAULT = 4600
+#
+# Exits 0 if every receiver stored an identical copy, 1 otherwise. Logs are kept in the printed directory.
+
+set -u
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+EXE="$ROOT/bin/du-ftp"
+
+RECEIVERS=4
+LOSS=10
+FILE="$ROOT/outfile/rfc793.txt"
+GROUP=239.1.2.3
+PORT=4600
+
+while getopts "n:l:f:g:p:" opt; do
+   case $opt in
+      n) RECEIVERS=$OPTARG ;;
+      l) LOSS=$OPTARG ;;
+      f) FILE=$(cd "$(dirname "$OPTARG")" && pwd)/$(basename "$OPTARG") ;;
+      g) GROUP=$OPTARG ;;
+      p) PORT=$OPTARG ;;
+      *) sed -n '9,14p' "$0"; exit 2 ;;
+   esac
+done
+
+if [ ! -x "$EXE" ]; then
+   echo "ERROR: $EXE not found, run make first" >&2
+   exit 2
+fi
+
+WORK=$(mktemp -d /tmp/mcast-loss.XXXXXX)
+SHIM="$WORK/droprecv.so"
+if ! cc -shared -fPIC -o "$SHIM" "$ROOT/scripts/droprecv.c" -ldl; then
+   echo "ERROR: cannot build the loss shim" >&2
+   exit 2
+fi
+
+# Receivers join first, a multicast is not repeated for late joiners. One that never hears the
+# session would wait for it forever, timeout gives up on it after a minute.
+PIDS=()
+for i in $(seq 1 "$RECEIVERS"); do
+   mkdir -p "$WORK/rcv$i"
+   (cd "$WORK/rcv$i" && LD_PRELOAD="$SHIM" DROP_PERCENT="$LOSS" timeout 60 "$EXE" -g -m "$GROUP" -p "$PORT" -f copy > log 2>&1) &
+   PIDS+=($!)
+done
+sleep 0.5
+
+START=$(date +%s%N)
+(cd "$WORK" && "$EXE" -s -m "$GROUP" -p "$PORT" -f "$FILE" > sender.log 2>&1)
+SENT=$?
+echo "sender exited $SENT after $((($(date +%s%N) - START) / 1000000)) ms: $(grep -a "repair datagrams" "$WORK/sender.log")"
+
+FAILED=0
+for i in $(seq 1 "$RECEIVERS"); do
+   wait "${PIDS[$((i - 1))]}"
+   RC=$?
+   if [ $RC -eq 0 ] && cmp -s "$FILE" "$WORK/rcv$i/copy"; then
+      echo "receiver $i: identical"
+   else
+      echo "receiver $i: FAILED (exit $RC)"
+      FAILED=1
+   fi
+done
+
+[ $SENT -ne 0 ] && FAILED=1
+if [ $FAILED -eq 0 ]; then
+   echo "PASS: $RECEIVERS receivers at $LOSS% loss"
+else
+   echo "FAIL: logs in $WORK"
+   exit 1
+fi
+rm -rf "$WORK"
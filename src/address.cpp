@@ -0,0 +1,175 @@
+/**
+ * @file address.cpp
+ * @brief Implementation of the address helpers.
+ */
+
+#include "drexelprotocol/address.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+using DrexelProtocol::FlowKey;
+
+FlowKey::FlowKey(const struct sockaddr_storage& peer)
+{
+   if (peer.ss_family == AF_INET)
+   {
+      const struct sockaddr_in* in = (const struct sockaddr_in*) &peer;
+      family                       = AF_INET;
+      port                         = in->sin_port;
+      memcpy(addr, &in->sin_addr, 4);
+   }
+   else if (peer.ss_family == AF_INET6)
+   {
+      const struct sockaddr_in6* in6 = (const struct sockaddr_in6*) &peer;
+      port                           = in6->sin6_port;
+
+      // An IPv4 peer of a dual-stack socket, the same flow as over an IPv4 socket.
+      if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr))
+      {
+         family = AF_INET;
+         memcpy(addr, in6->sin6_addr.s6_addr + 12, 4);
+      }
+      else
+      {
+         family = AF_INET6;
+         memcpy(addr, &in6->sin6_addr, 16);
+      }
+   }
+}
+
+FlowKey FlowKey::host() const
+{
+   FlowKey key = *this;
+   key.port    = 0;
+   return key;
+}
+
+bool FlowKey::operator==(const FlowKey& other) const
+{
+   return family == other.family && port == other.port && memcmp(addr, other.addr, sizeof(addr)) == 0;
+}
+
+bool FlowKey::operator!=(const FlowKey& other) const
+{
+   return !(*this == other);
+}
+
+std::string FlowKey::str() const
+{
+   char host[INET6_ADDRSTRLEN];
+   if (inet_ntop(family, addr, host, sizeof(host)) == nullptr)
+      return "?";
+
+   std::string port = std::to_string(ntohs(this->port));
+   return (family == AF_INET6) ? "[" + std::string(host) + "]:" + port : std::string(host) + ":" + port;
+}
+
+std::ostream& DrexelProtocol::operator<<(std::ostream& os, const FlowKey& key)
+{
+   return os << key.str();
+}
+
+size_t std::hash<FlowKey>::operator()(const FlowKey& key) const noexcept
+{
+   // FNV-1a, the key is short and already spread across its bytes.
+   uint64_t h = 14695981039346656037ULL;
+   auto     mix = [&h](const void* data, size_t len) {
+      for (size_t i = 0; i < len; i++)
+         h = (h ^ ((const uint8_t*) data)[i]) * 1099511628211ULL;
+   };
+
+   mix(&key.family, sizeof(key.family));
+   mix(&key.port, sizeof(key.port));
+   mix(key.addr, sizeof(key.addr));
+   return h;
+}
+
+bool DrexelProtocol::resolveAddress(const char* host, int port, struct sockaddr_storage& out, socklen_t& outSz)
+{
+   struct addrinfo hints;
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family   = AF_UNSPEC;
+   hints.ai_socktype = SOCK_DGRAM;
+   hints.ai_flags    = AI_NUMERICSERV;
+
+   struct addrinfo* res = nullptr;
+   std::string      service = std::to_string(port);
+   int              rc      = getaddrinfo(host, service.c_str(), &hints, &res);
+
+   if (rc != 0)
+   {
+      std::cerr << "Cannot resolve " << host << ": " << gai_strerror(rc) << std::endl;
+      return false;
+   }
+
+   memset(&out, 0, sizeof(out));
+   memcpy(&out, res->ai_addr, res->ai_addrlen);
+   outSz = res->ai_addrlen;
+
+   freeaddrinfo(res);
+   return true;
+}
+
+std::string DrexelProtocol::numericHost(const struct sockaddr_storage& addr)
+{
+   char      host[NI_MAXHOST];
+   socklen_t len = (addr.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+   if (getnameinfo((const struct sockaddr*) &addr, len, host, sizeof(host), nullptr, 0, NI_NUMERICHOST) != 0)
+      return "";
+   return host;
+}
+
+int DrexelProtocol::addressPort(const struct sockaddr_storage& addr)
+{
+   if (addr.ss_family == AF_INET)
+      return ntohs(((const struct sockaddr_in*) &addr)->sin_port);
+   if (addr.ss_family == AF_INET6)
+      return ntohs(((const struct sockaddr_in6*) &addr)->sin6_port);
+   return 0;
+}
+
+socklen_t DrexelProtocol::anyAddress(int family, int port, struct sockaddr_storage& out)
+{
+   memset(&out, 0, sizeof(out));
+
+   if (family == AF_INET6)
+   {
+      struct sockaddr_in6* in6 = (struct sockaddr_in6*) &out;
+      in6->sin6_family         = AF_INET6;
+      in6->sin6_addr           = in6addr_any;
+      in6->sin6_port           = htons(port);
+      return sizeof(*in6);
+   }
+
+   struct sockaddr_in* in = (struct sockaddr_in*) &out;
+   in->sin_family         = AF_INET;
+   in->sin_addr.s_addr    = INADDR_ANY;
+   in->sin_port           = htons(port);
+   return sizeof(*in);
+}
+
+bool DrexelProtocol::setTrafficClass(int sock, int tos)
+{
+   int       family   = AF_UNSPEC;
+   socklen_t familySz = sizeof(family);
+   getsockopt(sock, SOL_SOCKET, SO_DOMAIN, &family, &familySz);
+
+   if (family == AF_INET6 && setsockopt(sock, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos)) < 0)
+   {
+      perror("setsockopt(IPV6_TCLASS) failed");
+      return false;
+   }
+
+   if (setsockopt(sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0)
+   {
+      perror("setsockopt(IP_TOS) failed");
+      return false;
+   }
+   return true;
+}
@@ -0,0 +1,225 @@
+/**
+ * @file aead.cpp
+ * @brief Implementation of the datagram AEAD and the X25519 key exchange on top of libcrypto.
+ */
+
+#include "crypto/aead.h"
+
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+
+using Crypto::Aead;
+using Crypto::KeyExchange;
+
+namespace
+{
+
+const EVP_CIPHER* evpCipher(int cipher)
+{
+   switch (cipher)
+   {
+      case Crypto::CIPHER_AES_GCM:
+         return EVP_aes_256_gcm();
+      case Crypto::CIPHER_CHACHA20:
+         return EVP_chacha20_poly1305();
+      default:
+         return nullptr;
+   }
+}
+
+constexpr const char* HKDF_INFO = "du-ftp v1 data stream";
+
+}  // namespace
+
+int Crypto::cipherFromString(const char* name)
+{
+   if (std::strcmp(name, "none") == 0)
+      return CIPHER_NONE;
+   if (std::strcmp(name, "auto") == 0)
+      return CIPHER_AUTO;
+   if (std::strcmp(name, "aes") == 0)
+      return CIPHER_AES_GCM;
+   if (std::strcmp(name, "chacha") == 0)
+      return CIPHER_CHACHA20;
+   return -1;
+}
+
+int Crypto::preferredCipher()
+{
+#if defined(__x86_64__) || defined(__i386__)
+   if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul"))
+      return CIPHER_AES_GCM;
+#elif defined(__aarch64__)
+   if (getauxval(AT_HWCAP) & HWCAP_AES)
+      return CIPHER_AES_GCM;
+#endif
+   return CIPHER_CHACHA20;
+}
+
+Aead::Aead(int cipher, const uint8_t* key, const uint8_t* iv_, bool encrypt) : ctx(EVP_CIPHER_CTX_new()), cipher(cipher), encrypt(encrypt)
+{
+   std::memcpy(iv, iv_, NONCE_SZ);
+
+   const EVP_CIPHER* evp = evpCipher(cipher);
+   if (ctx == nullptr || evp == nullptr || EVP_CipherInit_ex(ctx, evp, nullptr, key, nullptr, encrypt ? 1 : 0) != 1)
+   {
+      std::cerr << "ERROR:  Cannot initialise cipher " << cipher << std::endl;
+      EVP_CIPHER_CTX_free(ctx);
+      ctx = nullptr;
+   }
+}
+
+Aead::~Aead()
+{
+   EVP_CIPHER_CTX_free(ctx);
+}
+
+bool Aead::valid() const
+{
+   return ctx != nullptr;
+}
+
+uint64_t Aead::nonceFor(uint32_t seq, uint8_t* nonce) const
+{
+   // Sequence numbers only move forward, a large backwards jump means the 32-bit counter wrapped.
+   uint64_t counter = ((seq < lastSeq && lastSeq - seq > 0x80000000u) ? epoch + 1 : epoch) << 32 | seq;
+
+   std::memcpy(nonce, iv, NONCE_SZ);
+   for (int i = 0; i < 8; i++)
+   {
+      nonce[NONCE_SZ - 1 - i] ^= static_cast<uint8_t>(counter >> (8 * i));
+   }
+
+   return counter;
+}
+
+void Aead::advance(uint64_t counter)
+{
+   epoch   = counter >> 32;
+   lastSeq = static_cast<uint32_t>(counter);
+}
+
+bool Aead::seal(uint32_t seq, const void* aad, int aadLen, void* data, int len, uint8_t* tag)
+{
+   uint8_t nonce[NONCE_SZ];
+   int     outLen = 0;
+
+   if (ctx == nullptr || !encrypt)
+      return false;
+
+   advance(nonceFor(seq, nonce));
+
+   unsigned char* buf = static_cast<unsigned char*>(data);
+
+   return EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, nonce, -1) == 1 &&
+          EVP_CipherUpdate(ctx, nullptr, &outLen, static_cast<const unsigned char*>(aad), aadLen) == 1 &&
+          EVP_CipherUpdate(ctx, buf, &outLen, buf, len) == 1 && EVP_CipherFinal_ex(ctx, buf + outLen, &outLen) == 1 &&
+          EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, TAG_SZ, tag) == 1;
+}
+
+bool Aead::open(uint32_t seq, const void* aad, int aadLen, void* data, int len, const uint8_t* tag)
+{
+   uint8_t nonce[NONCE_SZ];
+   uint8_t expected[TAG_SZ];
+   int     outLen = 0;
+
+   if (ctx == nullptr || encrypt)
+      return false;
+
+   uint64_t counter = nonceFor(seq, nonce);
+   std::memcpy(expected, tag, TAG_SZ);
+
+   unsigned char* buf = static_cast<unsigned char*>(data);
+
+   bool ok = EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, nonce, -1) == 1 &&
+             EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, TAG_SZ, expected) == 1 &&
+             EVP_CipherUpdate(ctx, nullptr, &outLen, static_cast<const unsigned char*>(aad), aadLen) == 1 &&
+             EVP_CipherUpdate(ctx, buf, &outLen, buf, len) == 1 && EVP_CipherFinal_ex(ctx, buf + outLen, &outLen) == 1;
+
+   // Only authentic datagrams may move the wrap-around tracking, a forged one must not desynchronise it.
+   if (ok)
+      advance(counter);
+
+   return ok;
+}
+
+KeyExchange::KeyExchange() : key(nullptr)
+{
+   EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, nullptr);
+
+   if (pctx == nullptr || EVP_PKEY_keygen_init(pctx) != 1 || EVP_PKEY_keygen(pctx, &key) != 1)
+   {
+      std::cerr << "ERROR:  Cannot generate X25519 key" << std::endl;
+      key = nullptr;
+   }
+
+   EVP_PKEY_CTX_free(pctx);
+}
+
+KeyExchange::~KeyExchange()
+{
+   EVP_PKEY_free(key);
+}
+
+bool KeyExchange::publicKey(uint8_t* out) const
+{
+   size_t len = PUBKEY_SZ;
+   return key != nullptr && EVP_PKEY_get_raw_public_key(key, out, &len) == 1 && len == PUBKEY_SZ;
+}
+
+bool KeyExchange::derive(const uint8_t* peer, const uint8_t* clientPub, const uint8_t* serverPub, const std::string& psk, uint8_t* outKey,
+                         uint8_t* outIv) const
+{
+   if (key == nullptr)
+      return false;
+
+   EVP_PKEY* peerKey = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, nullptr, peer, PUBKEY_SZ);
+   if (peerKey == nullptr)
+      return false;
+
+   std::vector<uint8_t> ikm(PUBKEY_SZ);
+   size_t               secretLen = ikm.size();
+
+   EVP_PKEY_CTX* dctx = EVP_PKEY_CTX_new(key, nullptr);
+   bool ok = dctx != nullptr && EVP_PKEY_derive_init(dctx) == 1 && EVP_PKEY_derive_set_peer(dctx, peerKey) == 1 &&
+             EVP_PKEY_derive(dctx, ikm.data(), &secretLen) == 1;
+
+   EVP_PKEY_CTX_free(dctx);
+   EVP_PKEY_free(peerKey);
+
+   if (!ok)
+      return false;
+
+   ikm.insert(ikm.end(), psk.begin(), psk.end());
+
+   uint8_t salt[2 * PUBKEY_SZ];
+   std::memcpy(salt, clientPub, PUBKEY_SZ);
+   std::memcpy(salt + PUBKEY_SZ, serverPub, PUBKEY_SZ);
+
+   uint8_t okm[KEY_SZ + NONCE_SZ];
+   size_t  okmLen = sizeof(okm);
+
+   EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+   ok = kctx != nullptr && EVP_PKEY_derive_init(kctx) == 1 && EVP_PKEY_CTX_set_hkdf_md(kctx, EVP_sha256()) == 1 &&
+        EVP_PKEY_CTX_set1_hkdf_salt(kctx, salt, sizeof(salt)) == 1 && EVP_PKEY_CTX_set1_hkdf_key(kctx, ikm.data(), ikm.size()) == 1 &&
+        EVP_PKEY_CTX_add1_hkdf_info(kctx, reinterpret_cast<const unsigned char*>(HKDF_INFO), std::strlen(HKDF_INFO)) == 1 &&
+        EVP_PKEY_derive(kctx, okm, &okmLen) == 1;
+
+   EVP_PKEY_CTX_free(kctx);
+
+   if (ok)
+   {
+      std::memcpy(outKey, okm, KEY_SZ);
+      std::memcpy(outIv, okm + KEY_SZ, NONCE_SZ);
+   }
+
+   return ok;
+}
@@ -0,0 +1,154 @@
+/**
+ * @file blockcodec.cpp
+ * @brief Implementation of the per-block compression framing.
+ */
+
+#include "compression/blockcodec.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "compression/lz4.h"
+
+using Compression::BlockDecoder;
+using Compression::BlockHeader;
+
+namespace
+{
+
+/**
+ * @brief A block has to shrink by at least 1/16th to be worth decoding on the other side.
+ */
+bool worthIt(size_t rawSize, size_t encSize)
+{
+   return encSize > 0 && encSize < rawSize - rawSize / 16;
+}
+
+size_t compress(int codec, const char* data, size_t len, char* dst, size_t cap)
+{
+   switch (codec)
+   {
+      case Compression::CODEC_LZ4:
+         return Compression::LZ4::compressFast(data, len, dst, cap);
+      case Compression::CODEC_LZ4HC:
+         return Compression::LZ4::compressHC(data, len, dst, cap);
+      default:
+         return 0;
+   }
+}
+
+std::string rawFrame(const char* data, size_t len)
+{
+   BlockHeader header{Compression::CODEC_NONE, static_cast<uint32_t>(len), static_cast<uint32_t>(len)};
+
+   std::string frame(sizeof(BlockHeader) + len, '\0');
+   std::memcpy(frame.data(), &header, sizeof(header));
+   std::memcpy(frame.data() + sizeof(header), data, len);
+
+   return frame;
+}
+
+}  // namespace
+
+int Compression::codecFromString(const char* name)
+{
+   if (std::strcmp(name, "none") == 0)
+      return CODEC_NONE;
+   if (std::strcmp(name, "lz4") == 0)
+      return CODEC_LZ4;
+   if (std::strcmp(name, "lz4hc") == 0)
+      return CODEC_LZ4HC;
+   return -1;
+}
+
+std::string Compression::encodeBlock(int codec, const char* data, size_t len)
+{
+   if (codec == CODEC_NONE || len == 0)
+      return rawFrame(data, len);
+
+   std::string frame(sizeof(BlockHeader) + LZ4::compressBound(len), '\0');
+   char*       dst = frame.data() + sizeof(BlockHeader);
+
+   // Probe a sample first, incompressible blocks are then skipped for the cost of 4K instead of 64K.
+   if (len > 2 * SAMPLE_SZ)
+   {
+      size_t probe = compress(CODEC_LZ4, data, SAMPLE_SZ, dst, SAMPLE_SZ);
+      if (!worthIt(SAMPLE_SZ, probe))
+         return rawFrame(data, len);
+   }
+
+   size_t encSize = compress(codec, data, len, dst, len);
+   if (!worthIt(len, encSize))
+      return rawFrame(data, len);
+
+   BlockHeader header{static_cast<uint32_t>(codec), static_cast<uint32_t>(len), static_cast<uint32_t>(encSize)};
+   std::memcpy(frame.data(), &header, sizeof(header));
+   frame.resize(sizeof(BlockHeader) + encSize);
+
+   return frame;
+}
+
+BlockDecoder::BlockDecoder() : failed(false)
+{}
+
+void BlockDecoder::reset()
+{
+   pending.clear();
+   failed = false;
+}
+
+bool BlockDecoder::idle() const
+{
+   return pending.empty();
+}
+
+bool BlockDecoder::feed(const char* data, size_t len, std::string& out)
+{
+   if (failed)
+      return false;
+
+   pending.append(data, len);
+
+   size_t consumed = 0;
+   while (pending.size() - consumed >= sizeof(BlockHeader))
+   {
+      BlockHeader header;
+      std::memcpy(&header, pending.data() + consumed, sizeof(header));
+
+      if (header.rawSize > BLOCK_SZ || header.encSize > LZ4::compressBound(BLOCK_SZ) || header.codec >= CODEC_COUNT)
+      {
+         std::cerr << "ERROR:  Malformed compression frame header" << std::endl;
+         failed = true;
+         return false;
+      }
+
+      if (pending.size() - consumed - sizeof(header) < header.encSize)
+         break;
+
+      const char* payload = pending.data() + consumed + sizeof(header);
+
+      if (header.codec == CODEC_NONE)
+      {
+         out.append(payload, header.encSize);
+      }
+      else
+      {
+         size_t base = out.size();
+         out.resize(base + header.rawSize);
+
+         long decoded = LZ4::decompress(payload, header.encSize, out.data() + base, header.rawSize);
+         if (decoded != static_cast<long>(header.rawSize))
+         {
+            std::cerr << "ERROR:  Corrupt compressed block" << std::endl;
+            out.resize(base);
+            failed = true;
+            return false;
+         }
+      }
+
+      consumed += sizeof(header) + header.encSize;
+   }
+
+   pending.erase(0, consumed);
+   return true;
+}
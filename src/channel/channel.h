@@ -8,6 +8,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <utility>
 
 //Generic Channel
 template <class X>
@@ -240,8 +241,8 @@ void bufferedChannel<X>::send(X value){
 	//Wait if the buffer is full
 	sender.wait(lk,[this]{
 		return buffer->size() < maxSize;});
-	//Add to queue
-	buffer->push(value);
+	//Add to queue, moved so a large message is not copied again
+	buffer->push(std::move(value));
 	//Mission Accomplished!
 	receiver.notify_one();
 	return;
@@ -265,7 +266,7 @@ X bufferedChannel<X>::receive(){
 			"Receive on Closed Channel.");
 	}
 	//Get data
-	X data = buffer->front();
+	X data = std::move(buffer->front());
 	buffer->pop();
 	//Release
 	sender.notify_one();
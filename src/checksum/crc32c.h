@@ -0,0 +1,40 @@
+/**
+ * @file crc32c.h
+ * @brief Declares the CRC32C (Castagnoli) checksum used to protect every datagram.
+ *
+ * @section Description
+ * The UDP checksum is only 16 bits wide and is optional on IPv4, so the Drexel Protocol carries its
+ * own CRC32C in the PDU header. The implementation picks the fastest routine the CPU offers at start-up:
+ * the SSE4.2 `crc32` instruction on x86-64, the ARMv8 CRC extension on AArch64, and a slicing-by-8
+ * table walk everywhere else. All three produce identical results.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Checksum
+{
+
+/**
+ * @brief Computes (or continues) a CRC32C over a buffer.
+ *
+ * Passing the result of a previous call as @p crc extends the checksum, so a header and a payload
+ * living in different buffers can be covered by a single value.
+ *
+ * @param data The bytes to checksum.
+ * @param len The number of bytes.
+ * @param crc The running checksum, 0 to start a new one.
+ * @return uint32_t The updated checksum.
+ */
+uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0);
+
+/**
+ * @brief Reports which implementation crc32c() dispatches to.
+ *
+ * @return const char* "sse4.2", "armv8-crc" or "software".
+ */
+const char* crc32cBackend();
+
+}  // namespace Checksum
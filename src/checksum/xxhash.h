@@ -0,0 +1,80 @@
+/**
+ * @file xxhash.h
+ * @brief Declares a streaming XXH64 hasher used as the whole-file digest.
+ *
+ * @section Description
+ * The per-datagram CRC32C catches corruption on the wire, the whole-file digest catches everything
+ * else (reordering, lost appends, bad writes on the receiver). XXH64 was chosen because it runs at
+ * memory bandwidth on a single core and needs nothing outside the standard library. The class can be
+ * fed incrementally, which lets the client hash each block as it is read and the server hash each
+ * chunk as it is written.
+ *
+ * @section Reference
+ * XXH64 algorithm by Yann Collet, https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Checksum
+{
+
+/**
+ * @class XXH64
+ * @brief Incremental XXH64 hash.
+ */
+class XXH64
+{
+private:
+   uint64_t seed;      ///< Seed the hash was started with.
+   uint64_t totalLen;  ///< Number of bytes consumed so far.
+   uint64_t acc[4];    ///< The four lane accumulators.
+   uint8_t  mem[32];   ///< Bytes that do not yet fill a full stripe.
+   size_t   memSize;   ///< Number of valid bytes in mem.
+
+public:
+   /**
+    * @brief Constructs a hasher ready to consume data.
+    *
+    * @param seed The seed for the hash.
+    */
+   explicit XXH64(uint64_t seed = 0);
+
+   /**
+    * @brief Restarts the hash, discarding everything consumed so far.
+    *
+    * @param seed The seed for the hash.
+    */
+   void reset(uint64_t seed = 0);
+
+   /**
+    * @brief Feeds more data into the hash.
+    *
+    * @param data The bytes to hash.
+    * @param len The number of bytes.
+    */
+   void update(const void* data, size_t len);
+
+   /**
+    * @brief Produces the digest of everything consumed so far.
+    *
+    * The hasher is left untouched so more data can still be added.
+    *
+    * @return uint64_t The 64-bit digest.
+    */
+   uint64_t digest() const;
+
+   /**
+    * @brief One-shot helper hashing a single buffer.
+    *
+    * @param data The bytes to hash.
+    * @param len The number of bytes.
+    * @param seed The seed for the hash.
+    * @return uint64_t The 64-bit digest.
+    */
+   static uint64_t hash(const void* data, size_t len, uint64_t seed = 0);
+};
+
+}  // namespace Checksum
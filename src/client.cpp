@@ -1,102 +1,961 @@
 #include "drexelprotocol/client.h"
 
+#include <checksum/xxhash.h>
+#include <compression/blockcodec.h>
+#include <compression/pipeline.h>
+#include <crypto/aead.h>
 #include <drexelprotocol/ftp.h>
+#include <drexelprotocol/tree.h>
+#include <fcntl.h>
+#include <fec/reedsolomon.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
 
 using Client = DrexelProtocol::FTPClient;
 
 Client::FTPClient(const std::string filePath, const char* addr, int port) : FTP(filePath, new connection())
 {
-   struct sockaddr_in* servaddr = &(dpc->getOutSockAddr()->addr);
-   int*                sock     = dpc->getUdpSock();
+   // An unresolved address leaves the family AF_UNSPEC, the socket is not created and validate() fails.
+   memset(&server, 0, sizeof(server));
+   server.isAddrInit = resolveAddress(addr, port, server.addr, server.len);
 
-   if ((*sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+   openSocket();
+}
+
+bool Client::openSocket()
+{
+   int* sock = dpc->getUdpSock();
+
+   if ((*sock = socket(server.addr.ss_family, SOCK_DGRAM, 0)) < 0)
    {
       perror("socket creation failed");
       delete dpc;
+      dpc = nullptr;
+      return false;
    }
 
-   servaddr->sin_family              = AF_INET;
-   servaddr->sin_port                = htons(port);
-   servaddr->sin_addr.s_addr         = inet_addr(addr);
-   dpc->getOutSockAddr()->len        = sizeof(struct sockaddr_in);
-   dpc->getOutSockAddr()->isAddrInit = true;
+   *dpc->getOutSockAddr() = server;
 
    memcpy(dpc->getInSockAddr(), dpc->getOutSockAddr(), sizeof(*dpc->getOutSockAddr()));
+   return true;
+}
+
+bool Client::bindLocal()
+{
+   struct sockaddr_storage local;
+   socklen_t               localSz;
+
+   if (!resolveAddress(localAddr.c_str(), 0, local, localSz))
+      return false;
+
+   if (bind(*dpc->getUdpSock(), (const struct sockaddr*) &local, localSz) < 0)
+   {
+      perror(("bind to " + localAddr + " failed").c_str());
+      return false;
+   }
+   return true;
 }
+
 Client::~FTPClient()
 {
+   delete stripes;
+   delete pacer;
    delete dpc;
+   if (ownsCompressors)
+      delete compressors;
+}
+
+ThreadPool& Client::compressionPool() const
+{
+   std::lock_guard<std::mutex> lock(compressorsLock);
+   if (compressors == nullptr)
+   {
+      compressors     = new ThreadPool(pipelineWorkers > 0 ? pipelineWorkers : std::thread::hardware_concurrency());
+      ownsCompressors = true;
+   }
+   return *compressors;
 }
 
 int Client::connect()
 {
-   return dpc->connect();
+   if (options.cipher == Crypto::CIPHER_AUTO)
+      options.cipher = Crypto::preferredCipher();
+
+   if (!localAddr.empty() && !bindLocal())
+      return connection::ERROR_GENERAL;
+
+   // Every upload over several addresses is a transfer of its own, the server ties the subflows together by its id.
+   if (localAddrs.size() > 1)
+   {
+      std::random_device random;
+      options.transfer = ((uint64_t) random() << 32 | random()) | 1;
+   }
+
+   // Routers along the way queue the datagrams by their DSCP.
+   int tos = priorityTos(priority);
+   if (tos != 0)
+      setTrafficClass(*dpc->getUdpSock(), tos);
+
+   // Stop-and-wait is paced by the acknowledgement turnaround, spinning saves the wakeup.
+   dpc->setBusyPoll(busyPollUs);
+   dpc->watchDrops();
+
+   if (ticket == 0 && !ticketFile.empty())
+      loadTicket();
+
+   // Only a plain upload can send data before the handshake, with nothing to agree on but the ticket.
+   deferred = earlyData && ticket != 0 && !skipIdentical && options.cipher == Crypto::CIPHER_NONE && options.fecK == 0 &&
+              options.transfer == 0 && options.codec == Compression::CODEC_NONE;
+   if (deferred)
+      return 0;
+
+   return handshake();
 }
 
-void Client::start()
+int Client::handshake(const char* early, int earlySz)
 {
-   static char sBuff[sizeof(FTP_PDU) + 500];
+   options.ticket = ticket;
+   options.early  = earlySz;
+   ticket         = 0;
 
-   if (!dpc->isConnected())
+   bool                encrypt = options.cipher != Crypto::CIPHER_NONE;
+   Crypto::KeyExchange kx;
+   uint8_t             clientPub[Crypto::PUBKEY_SZ] = {0};
+
+   if (encrypt && !kx.publicKey(clientPub))
+      return connection::ERROR_GENERAL;
+   memcpy(options.publicKey, clientPub, sizeof(clientPub));
+
+   int rc = dpc->connect(&options, sizeof(options), early, earlySz);
+
+   if (rc >= 0 && options.ticket != 0)
    {
-      std::cout << "Client not connected" << std::endl;
+      ticket = options.ticket;
+      if (!ticketFile.empty())
+         saveTicket();
+   }
+
+   if (rc >= 0 && options.codec != Compression::CODEC_NONE)
+      std::cout << "Compression codec " << options.codec << " negotiated" << std::endl;
+   if (rc >= 0 && localAddrs.size() > 1 && options.transfer == 0)
+      std::cout << "Server does not take multipath uploads, sending from " << localAddr << " only" << std::endl;
+
+   if (rc >= 0 && options.fecK > 0)
+   {
+      delete stripes;
+      stripes = new Fec::StripeEncoder(options.fecK, fecParity);
+      delete pacer;
+      pacer = new Pacer(*dpc->getUdpSock(), server.addr);
+
+      // A stripe at the most parity leaves back to back, the send buffer must hold it twice over.
+      dpc->growBuffers(0, 2 * (options.fecK + Fec::MAX_M) * connection::DGRAM_TRUESIZE);
+      std::cout << "FEC stripes of " << options.fecK << " negotiated, GF(2^8) backend " << Fec::gf256Backend() << ", paced "
+                << (pacer->inKernel() ? "by fq" : "in user space") << std::endl;
+   }
+
+   if (rc < 0 || !encrypt)
+      return rc;
+
+   uint8_t key[Crypto::KEY_SZ];
+   uint8_t iv[Crypto::NONCE_SZ];
+
+   // Never fall back to plaintext behind the user's back.
+   if (options.cipher == Crypto::CIPHER_NONE || options.cipher >= Crypto::CIPHER_AUTO ||
+       !kx.derive(options.publicKey, clientPub, options.publicKey, psk, key, iv))
+   {
+      std::cerr << "ERROR:  Server did not agree on an encrypted session" << std::endl;
+      return connection::ERROR_GENERAL;
+   }
+
+   Crypto::Aead* aead = new Crypto::Aead(options.cipher, key, iv, true);
+   if (!aead->valid())
+   {
+      delete aead;
+      return connection::ERROR_GENERAL;
+   }
+
+   dpc->setAead(aead);
+   std::cout << "Cipher " << options.cipher << " negotiated" << std::endl;
+
+   return rc;
+}
+
+bool Client::sendEarly(FILE* f, FTP_PDU& pdu, Checksum::XXH64& fileHash)
+{
+   char   early[connection::MAX_BUFF_SZ];
+   size_t headerSz = packHeader(early, pdu);
+   size_t room     = std::min<size_t>(CHUNK_SZ, sizeof(early) - sizeof(FTP_OPTIONS) - headerSz);
+   size_t bytes    = fread(early + headerSz, 1, room, f);
+
+   fileHash.update(early + headerSz, bytes);
+
+   deferred = false;
+   if (handshake(early, headerSz + bytes) < 0)
+      return false;
+
+   // The ticket was expired, used or from a restarted server, the data goes the usual way.
+   if (options.early == 0)
+      return sendData(pdu, early + headerSz, bytes);
+
+   std::cout << "Sent the first " << bytes << " bytes with the CONNECT" << std::endl;
+   pdu.status = Status::APPEND;
+   offset += bytes;
+   return true;
+}
+
+bool Client::loadTicket()
+{
+   FILE* f = fopen(ticketFile.c_str(), "r");
+   if (f == nullptr)
+      return false;
+
+   char               host[NI_MAXHOST];
+   int                port;
+   unsigned long long id;
+   bool               loaded = fscanf(f, "%1024s %d %llx", host, &port, &id) == 3 && numericHost(server.addr) == host &&
+                 addressPort(server.addr) == port;
+   fclose(f);
+
+   if (loaded)
+      ticket = id;
+   return loaded;
+}
+
+void Client::saveTicket() const
+{
+   // Tree streams save their tickets side by side, each writes a file of its own and moves it in place.
+   std::string tmp = ticketFile + "." + std::to_string(getpid()) + "." + std::to_string((uintptr_t) this);
+   FILE*       f   = fopen(tmp.c_str(), "w");
+   if (f == nullptr)
+   {
+      perror(("Cannot write ticket file " + tmp).c_str());
       return;
    }
 
-   FILE* f = fopen(filePath.c_str(), "rb");
+   fprintf(f, "%s %d %llx\n", numericHost(server.addr).c_str(), addressPort(server.addr), (unsigned long long) ticket);
+   fclose(f);
+
+   if (std::rename(tmp.c_str(), ticketFile.c_str()) != 0)
+   {
+      perror(("Cannot replace ticket file " + ticketFile).c_str());
+      std::remove(tmp.c_str());
+   }
+}
+
+bool Client::start()
+{
+   if (!dpc->isConnected() && !deferred)
+   {
+      std::cout << "Client not connected" << std::endl;
+      return false;
+   }
+
+   if (std::filesystem::is_directory(filePath))
+      return sendTree();
+
+   return upload(filePath, std::filesystem::path{filePath.c_str()}.filename().string());
+}
+
+bool Client::upload(const std::string& path, const std::string& name)
+{
+   // The STAT is answered like a download and ends the session, a changed file needs a new one.
+   if (skipIdentical)
+   {
+      if (serverHasCopy(path, name))
+      {
+         std::cout << "Server already has an identical " << name << ", skipping the upload" << std::endl;
+         return true;
+      }
+      if (!reconnect())
+      {
+         std::cerr << "ERROR:  Cannot reconnect to upload " << path << std::endl;
+         return false;
+      }
+   }
+
+   FILE* f = fopen(path.c_str(), "rb");
    if (f == nullptr)
    {
-      std::cerr << "ERROR:  Cannot open file " << filePath << std::endl;
-      exit(-1);
+      std::cerr << "ERROR:  Cannot open file " << path << std::endl;
+      dpc->disconnect();
+      return false;
    }
-   if (!dpc->isConnected())
+
+   bool sent = uploadStream(f, name);
+   fclose(f);
+   return sent;
+}
+
+bool Client::uploadStream(FILE* f, const std::string& name)
+{
+   if (!dpc->isConnected() && !deferred)
    {
       perror("Expecting the protocol to be in connect state, but it's not");
       exit(-1);
    }
 
-   int bytes   = 0;
-   int pduSize = sizeof(FTP_PDU);
-
    FTP_PDU pdu;
-   strcpy(pdu.fileName, std::filesystem::path{filePath.c_str()}.filename().c_str());
-   pdu.status = Status::NEW;
-   pdu.err    = Error::NONE;
+   strncpy(pdu.fileName, name.c_str(), sizeof(pdu.fileName) - 1);
+   pdu.fileName[sizeof(pdu.fileName) - 1] = '\0';
+   pdu.status                             = Status::NEW;
+   pdu.err                                = Error::NONE;
+   pdu.digest                             = 0;
+   offset                                 = 0;
 
-   while ((bytes = fread(sBuff + pduSize, 1, 500, f)) > 0)
+   // Announced so the server can reserve the space up front, a stream without an fd has no size.
+   struct stat st;
+   transfer.size     = (fstat(fileno(f), &st) == 0) ? st.st_size : 0;
+   transfer.priority = priority;
+
+   Checksum::XXH64 fileHash;
+
+   if (deferred && !sendEarly(f, pdu, fileHash))
    {
-      size_t remainingBytes = bytes;
+      std::cerr << "ERROR:  Cannot connect to upload " << name << std::endl;
+      return false;
+   }
 
-      char* dataPtr = sBuff + pduSize;
+   // Subflows pread their chunks, a stream without an fd goes over the first subflow in order.
+   bool sent;
+   if (options.transfer != 0 && fileno(f) >= 0)
+      sent = streamMultipath(f, pdu, fileHash);
+   else
+      sent = (options.codec == Compression::CODEC_NONE) ? streamFile(f, pdu, fileHash) : streamCompressed(f, pdu, fileHash);
 
-      while (remainingBytes > 0)
-      {
-         std::memcpy(sBuff, &pdu, pduSize);
+   if (sent && stripes != nullptr)
+      sent = flushStripe();
+
+   // The digest of what was read would match what the server holds, a COMMIT would publish the truncated file.
+   if (!sent)
+   {
+      std::cerr << "ERROR:  Transfer of " << name << " was interrupted, abandoning the upload" << std::endl;
+      dpc->disconnect();
+      return false;
+   }
+
+   // A stream that broke off is not the whole file, closing without a COMMIT makes the server drop it.
+   if (ferror(f))
+   {
+      std::cerr << "ERROR:  Reading " << name << " failed, abandoning the upload" << std::endl;
+      dpc->disconnect();
+      return false;
+   }
+
+   pdu.status = Status::COMMIT;
+   pdu.digest = fileHash.digest();
+
+   int closed = dpc->disconnect(&pdu, sizeof(FTP_PDU));
+   if (closed == connection::ERROR_REJECTED)
+   {
+      std::cerr << "ERROR:  Server rejected " << name << ", it refused the name or the received copy failed digest verification"
+                << std::endl;
+      return false;
+   }
+   if (closed != connection::CONNECTION_CLOSED)
+   {
+      std::cerr << "ERROR:  Server did not confirm the COMMIT of " << name << ", it may not be stored" << std::endl;
+      return false;
+   }
+
+   return true;
+}
+
+Client* Client::fork(const char* addr, int port) const
+{
+   FTPClient* client       = new FTPClient(filePath, addr, port);
+   client->options         = options;
+   client->pipelineWorkers = pipelineWorkers;
+   client->pipelineDepth   = pipelineDepth;
+   client->psk             = psk;
+   client->fecParity       = fecParity;
+   client->skipIdentical   = skipIdentical;
+   client->treeStreams     = treeStreams;
+   client->priority        = priority;
+   client->busyPollUs      = busyPollUs;
+   client->localAddr       = localAddr;
+   client->localAddrs      = localAddrs;
+   client->ticketFile      = ticketFile;
+   client->earlyData       = earlyData;
+
+   // Forks outlive neither a tree upload nor the daemon's settings, they borrow this client's compressors.
+   if (options.codec != Compression::CODEC_NONE)
+      client->compressors = &compressionPool();
+   return client;
+}
+
+bool Client::ready()
+{
+   // The last upload closed its connection, with a ticket the next one costs no round trip.
+   if ((dpc == nullptr || (!dpc->isConnected() && !deferred)) && !reconnect())
+   {
+      std::cerr << "ERROR:  Cannot connect to the server" << std::endl;
+      return false;
+   }
+   return true;
+}
+
+bool Client::push(const std::string& path)
+{
+   return ready() && upload(path, std::filesystem::path{path}.filename().string());
+}
+
+bool Client::push(FILE* f, const std::string& name)
+{
+   return ready() && uploadStream(f, name);
+}
+
+bool Client::sendTree()
+{
+   std::vector<TreeFile> files;
+   {
+      ThreadPool scanners;
+      files = scanTree(filePath, scanners);
+   }
+
+   std::sort(files.begin(), files.end(), [](const TreeFile& a, const TreeFile& b) { return a.size > b.size; });
 
-         size_t sendSize = remainingBytes + pduSize;
+   unsigned streams = std::clamp<unsigned>(treeStreams, 1, std::max<size_t>(files.size(), 1));
+   std::cout << "Uploading " << files.size() << " files from " << filePath << " over " << streams << " streams" << std::endl;
 
-         int sndSz = dpc->sendDgram(sBuff, sendSize);
+   std::atomic<size_t> next{0};
+   std::atomic<size_t> uploaded{0};
+   std::string         addr = numericHost(server.addr);
+
+   // Uploads run on threads of their own, they spend the whole tree waiting on acknowledgements.
+   std::vector<std::thread> threads;
+   for (unsigned i = 0; i < streams; i++)
+   {
+      FTPClient* worker = (i > 0) ? fork(addr.c_str(), addressPort(server.addr)) : this;
 
-         if (sndSz < pduSize)
+      threads.emplace_back([this, worker, &files, &next, &uploaded] {
+         for (size_t idx = next++; idx < files.size(); idx = next++)
          {
-            break;
+            // Every upload closes its connection, the next file gets a new one.
+            if ((worker->dpc == nullptr || (!worker->dpc->isConnected() && !worker->deferred)) && !worker->reconnect())
+            {
+               std::cerr << "ERROR:  Cannot reconnect, " << files[idx].name << " was not uploaded" << std::endl;
+               break;
+            }
+            if (worker->upload(files[idx].path, files[idx].name))
+               uploaded++;
          }
+         if (worker != this)
+            delete worker;
+      });
+   }
+
+   for (std::thread& t : threads)
+   {
+      t.join();
+   }
 
-         remainingBytes -= (sndSz - pduSize);
-         dataPtr += (sndSz - pduSize);
+   std::cout << "Uploaded " << uploaded << " of " << files.size() << " files" << std::endl;
+   return uploaded == files.size();
+}
+
+bool Client::streamFile(FILE* f, FTP_PDU& pdu, Checksum::XXH64& fileHash)
+{
+   char buff[CHUNK_SZ];
+   int  bytes = 0;
+
+   while ((bytes = fread(buff, 1, sizeof(buff), f)) > 0)
+   {
+      fileHash.update(buff, bytes);
+
+      if (!sendData(pdu, buff, bytes))
+         return false;
+   }
+
+   return true;
+}
+
+bool Client::streamCompressed(FILE* f, FTP_PDU& pdu, Checksum::XXH64& fileHash)
+{
+   Compression::CompressPipeline pipeline{compressionPool(), static_cast<int>(options.codec), pipelineDepth};
+
+   return pipeline.run(f, fileHash, [&](const std::string& frame) { return sendData(pdu, frame.data(), frame.size()); });
+}
+
+bool Client::streamMultipath(FILE* f, FTP_PDU& pdu, Checksum::XXH64& fileHash)
+{
+   using Clock = std::chrono::steady_clock;
 
-         if (remainingBytes > 0)
+   std::vector<FTPClient*> subflows{this};
+   std::string             host = numericHost(server.addr);
+
+   for (size_t i = 1; i < localAddrs.size(); i++)
+   {
+      FTPClient* sub  = new FTPClient(filePath, host.c_str(), addressPort(server.addr));
+      sub->options    = options;
+      sub->psk        = psk;
+      sub->fecParity  = fecParity;
+      sub->priority   = priority;
+      sub->busyPollUs = busyPollUs;
+      sub->localAddr  = localAddrs[i];
+
+      if (!sub->validate() || sub->connect() < 0 || sub->options.transfer != options.transfer)
+      {
+         std::cerr << "Subflow from " << localAddrs[i] << " did not connect, carrying on without it" << std::endl;
+         delete sub;
+         continue;
+      }
+      subflows.push_back(sub);
+   }
+
+   // The server opens the file on NEW, it has to be there before any subflow's data.
+   int  headerSz = packHeader(sbuffer, pdu);
+   bool opened   = transmit(sbuffer, headerSz) == headerSz && (stripes == nullptr || flushStripe());
+   pdu.status    = Status::APPEND;
+
+   int      fd     = fileno(f);
+   uint64_t chunks = (transfer.size + MULTIPATH_CHUNK_SZ - 1) / MULTIPATH_CHUNK_SZ;
+
+   std::atomic<uint64_t> next{opened ? 0 : chunks};
+   std::mutex            orphanLock;
+   std::vector<uint64_t> orphans;
+   std::vector<uint64_t> carried(subflows.size(), 0);
+   std::vector<char>     failed(subflows.size(), !opened);
+
+   // Sends one chunk and waits for all of it to be acknowledged, the FEC stripe included.
+   auto sendChunk = [fd, &pdu](FTPClient* sub, uint64_t chunk, std::vector<char>& buff) -> ssize_t {
+      FTP_PDU header = pdu;
+      sub->offset    = chunk * MULTIPATH_CHUNK_SZ;
+
+      ssize_t bytes = pread(fd, buff.data(), buff.size(), sub->offset);
+      if (bytes < 0 || !sub->sendData(header, buff.data(), bytes) || (sub->stripes != nullptr && !sub->flushStripe()))
+         return -1;
+      return bytes;
+   };
+
+   std::thread hasher([fd, &fileHash] {
+      char    buff[1 << 16];
+      off_t   at = 0;
+      ssize_t bytes;
+
+      while ((bytes = pread(fd, buff, sizeof(buff), at)) > 0)
+      {
+         fileHash.update(buff, bytes);
+         at += bytes;
+      }
+   });
+
+   Clock::time_point        started = Clock::now();
+   std::vector<std::thread> threads;
+
+   for (size_t i = 0; i < subflows.size(); i++)
+   {
+      threads.emplace_back([&, i] {
+         std::vector<char> buff(MULTIPATH_CHUNK_SZ);
+
+         for (uint64_t chunk = next++; chunk < chunks; chunk = next++)
          {
-            pdu.status = Status::APPEND;
-            std::memmove(sBuff + pduSize, dataPtr, remainingBytes);
+            ssize_t bytes = sendChunk(subflows[i], chunk, buff);
+            if (bytes < 0)
+            {
+               std::lock_guard<std::mutex> lock(orphanLock);
+               orphans.push_back(chunk);
+               failed[i] = true;
+               return;
+            }
+            carried[i] += bytes;
          }
+      });
+   }
+
+   for (std::thread& t : threads)
+   {
+      t.join();
+   }
+   hasher.join();
+
+   // Chunks of a failed subflow go again over the first one still up, the same offsets overwrite what got through.
+   auto survivor = std::find(failed.begin(), failed.end(), false);
+   if (!orphans.empty() && survivor != failed.end())
+   {
+      size_t            i = survivor - failed.begin();
+      std::vector<char> buff(MULTIPATH_CHUNK_SZ);
+
+      std::cerr << "Resending " << orphans.size() << " chunks of failed subflows over " << subflows[i]->localAddr << std::endl;
+      for (size_t o = 0; o < orphans.size() && !failed[i]; o++)
+      {
+         ssize_t bytes = sendChunk(subflows[i], orphans[o], buff);
+         failed[i]     = bytes < 0;
+         carried[i] += std::max<ssize_t>(bytes, 0);
+      }
+      if (!failed[i])
+         orphans.clear();
+   }
+
+   double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+   for (size_t i = 0; i < subflows.size(); i++)
+   {
+      std::cout << "Subflow from " << subflows[i]->localAddr << " carried " << carried[i] << " bytes, "
+                << (seconds > 0 ? carried[i] / seconds / 1e6 : 0) << " MB/s" << (failed[i] ? ", failed" : "") << std::endl;
+
+      // Closing without a payload leaves the transfer's writer to the first subflow's COMMIT.
+      if (subflows[i] != this)
+      {
+         subflows[i]->dpc->disconnect();
+         delete subflows[i];
+      }
+   }
+
+   return !failed[0] && orphans.empty();
+}
+
+size_t Client::packHeader(char* buff, const FTP_PDU& pdu) const
+{
+   size_t headerSz = ftpHeaderSz(pdu.status);
+   size_t placedSz = ftpHeaderSz(pdu.status, options.transfer != 0);
+
+   std::memcpy(buff, &pdu, sizeof(FTP_PDU));
+   if (headerSz > sizeof(FTP_PDU))
+      std::memcpy(buff + sizeof(FTP_PDU), &transfer, sizeof(FTP_TRANSFER));
+   if (placedSz > headerSz)
+      std::memcpy(buff + headerSz, &offset, sizeof(offset));
+
+   return placedSz;
+}
+
+bool Client::sendData(FTP_PDU& pdu, const char* data, size_t len)
+{
+   while (len > 0)
+   {
+      // Only the first datagram is a NEW, the headers shrink once it is out.
+      size_t headerSz = packHeader(sbuffer, pdu);
+      size_t chunk    = std::min<size_t>(len, CHUNK_SZ);
+      std::memcpy(sbuffer + headerSz, data, chunk);
+
+      // The connection may take less than all of it, the rest goes in the next datagram.
+      int sndSz = transmit(sbuffer, headerSz + chunk);
+
+      if (sndSz < (int) headerSz)
+      {
+         return false;
+      }
+
+      pdu.status = Status::APPEND;
+      offset += sndSz - headerSz;
+
+      data += sndSz - headerSz;
+      len -= sndSz - headerSz;
+   }
+
+   return true;
+}
+
+bool Client::get()
+{
+   if (!dpc->isConnected())
+   {
+      std::cout << "Client not connected" << std::endl;
+      return false;
+   }
+
+   // Downloaded beside the target and renamed over it once verified, a failed GET leaves an existing copy alone.
+   std::string name    = std::filesystem::path{filePath.c_str()}.filename().string();
+   std::string partial = PARTIAL_PREFIX + name + ".XXXXXX";
+   int         fd      = mkostemp(&partial[0], O_CLOEXEC);
+   FILE*       out     = (fd >= 0) ? fdopen(fd, "wb") : nullptr;
+   uint64_t    digest;
+
+   if (out == nullptr)
+   {
+      std::cerr << "ERROR:  Cannot open file " << partial << ": " << strerror(errno) << std::endl;
+      if (fd >= 0)
+      {
+         ::close(fd);
+         std::remove(partial.c_str());
       }
+      return false;
+   }
+   fchmod(fd, 0644);
+
+   int  err     = fetch(Status::GET, name, [out](const char* data, size_t len) { fwrite(data, 1, len, out); }, digest);
+   bool written = !ferror(out);
+   written      = fclose(out) == 0 && written;
+
+   if (dpc->kernelDrops() > 0)
+      std::cerr << "Kernel dropped " << dpc->kernelDrops() << " datagrams on a full receive buffer" << std::endl;
+
+   if (err == Error::NONE && !written)
+      std::cerr << "ERROR:  Cannot write " << partial << ", discarding file" << std::endl;
+   else if (err == Error::NONE && std::rename(partial.c_str(), name.c_str()) != 0)
+      std::cerr << "ERROR:  Cannot store " << name << ": " << strerror(errno) << std::endl;
+   else if (err == Error::NONE)
+   {
+      std::cout << "Verified " << name << " digest " << std::hex << digest << std::dec << std::endl;
+      return true;
+   }
+   else if (err == Error::FILE_NOT_FOUND)
+      std::cerr << "ERROR:  Server has no file " << name << std::endl;
+   else if (err == Error::DIGEST_MISMATCH)
+      std::cerr << "ERROR:  Digest mismatch for " << name << ", discarding file" << std::endl;
+   else
+      std::cerr << "ERROR:  Server did not accept the request for " << name << std::endl;
+
+   std::remove(partial.c_str());
+   return false;
+}
+
+bool Client::list()
+{
+   std::vector<FTP_STAT> records;
+
+   if (!dpc->isConnected() || !query(Status::LIST, "", records))
+   {
+      std::cerr << "ERROR:  Server did not answer the LIST" << std::endl;
+      return false;
+   }
+
+   for (const FTP_STAT& record : records)
+   {
+      printRecord(record);
+   }
+   std::cout << records.size() << " files" << std::endl;
+   return true;
+}
+
+bool Client::stat()
+{
+   std::string           name = std::filesystem::path{filePath.c_str()}.filename().string();
+   std::vector<FTP_STAT> records;
+
+   if (!dpc->isConnected() || !query(Status::STAT, name, records))
+   {
+      std::cerr << "ERROR:  Server did not answer the STAT" << std::endl;
+      return false;
    }
 
+   if (records.empty())
+   {
+      std::cerr << "ERROR:  Server has no file " << name << std::endl;
+      return false;
+   }
+
+   printRecord(records.front());
+   return true;
+}
+
+void Client::printRecord(const FTP_STAT& record)
+{
+   time_t secs = record.mtime / 1000000000;
+   char   when[32];
+   strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+
+   std::cout << std::left << std::setw(40) << std::string(record.fileName, strnlen(record.fileName, sizeof(record.fileName)))
+             << std::right << std::setw(14) << record.size << "  " << when << "  " << std::hex << std::setfill('0') << std::setw(16)
+             << record.digest << std::dec << std::setfill(' ') << std::endl;
+}
+
+int Client::fetch(int status, const std::string& name, const std::function<void(const char*, size_t)>& sink, uint64_t& digest)
+{
+   FTP_PDU request;
+   strncpy(request.fileName, name.c_str(), sizeof(request.fileName) - 1);
+   request.fileName[sizeof(request.fileName) - 1] = '\0';
+   request.status                                 = status;
+   request.err                                    = Error::NONE;
+   request.digest                                 = 0;
+
+   transfer.size     = 0;
+   transfer.priority = priority;
+
+   int headerSz = packHeader(sbuffer, request);
+   if (dpc->sendDgram(sbuffer, headerSz) != headerSz)
+      return Error::UNKOWN;
+
+   Checksum::XXH64 hash;
+   bool            first    = true;
+   unsigned        expected = 0;
+   char            buff[connection::MAX_DGRAM_SZ];
+
+   while (true)
+   {
+      int  rcvSz = dpc->recvDgram(buff, sizeof(buff));
+      PDU* inPdu = reinterpret_cast<PDU*>(buff);
+
+      if (rcvSz == connection::CONNECTION_CLOSED)
+         break;
+      const FTP_PDU* header = reinterpret_cast<const FTP_PDU*>(buff + sizeof(PDU));
+      if (rcvSz < (int) sizeof(PDU) || inPdu->dgram_sz < (int) sizeof(FTP_PDU) || inPdu->dgram_sz < (int) ftpHeaderSz(header->status))
+         continue;
+
+      // A resend after a lost acknowledgement was acknowledged again but must not be delivered twice, sequence numbers wrap.
+      if (!first && (int) (inPdu->seqnum - expected) < 0)
+         continue;
+      first    = false;
+      expected = inPdu->seqnum + inPdu->dgram_sz;
+
+      const char* data    = buff + sizeof(PDU) + ftpHeaderSz(header->status);
+      size_t      dataLen = inPdu->dgram_sz - ftpHeaderSz(header->status);
+
+      sink(data, dataLen);
+      hash.update(data, dataLen);
+   }
+
+   const FTP_PDU* commit = reinterpret_cast<const FTP_PDU*>(buff + sizeof(PDU));
+   PDU*           close  = reinterpret_cast<PDU*>(buff);
+
+   if (close->dgram_sz < (int) sizeof(FTP_PDU) || commit->err == Error::FILE_NOT_FOUND)
+      return Error::FILE_NOT_FOUND;
+
+   digest = commit->digest;
+   return (digest == hash.digest()) ? Error::NONE : Error::DIGEST_MISMATCH;
+}
+
+bool Client::query(int status, const std::string& name, std::vector<FTP_STAT>& records)
+{
+   std::string answer;
+   uint64_t    digest;
+
+   int err = fetch(status, name, [&answer](const char* data, size_t len) { answer.append(data, len); }, digest);
+   if (err != Error::NONE || answer.size() % sizeof(FTP_STAT) != 0)
+      return false;
+
+   records.resize(answer.size() / sizeof(FTP_STAT));
+   memcpy(records.data(), answer.data(), answer.size());
+   return true;
+}
+
+bool Client::serverHasCopy(const std::string& path, const std::string& name)
+{
+   std::vector<FTP_STAT> records;
+
+   if (!query(Status::STAT, name, records) || records.size() != 1)
+      return false;
+
+   FILE* f = fopen(path.c_str(), "rb");
+   if (f == nullptr)
+      return false;
+
+   Checksum::XXH64 hash;
+   char            buff[1 << 16];
+   uint64_t        size = 0;
+   size_t          bytes;
+
+   while ((bytes = fread(buff, 1, sizeof(buff), f)) > 0)
+   {
+      hash.update(buff, bytes);
+      size += bytes;
+   }
    fclose(f);
-   dpc->disconnect();
+
+   return records.front().size == size && records.front().digest == hash.digest();
+}
+
+bool Client::reconnect()
+{
+   delete dpc;
+   dpc = new connection();
+
+   return openSocket() && connect() >= 0;
+}
+
+int Client::transmit(char* buff, size_t len)
+{
+   if (stripes == nullptr)
+      return dpc->sendDgram(buff, len);
+
+   size_t shard = std::min<size_t>(len, dpc->maxDgram() - sizeof(Fec::StripeHeader) - Fec::LEN_SZ);
+
+   if (stripes->add(buff, shard) && !flushStripe())
+      return connection::ERROR_GENERAL;
+
+   return shard;
+}
+
+bool Client::flushStripe()
+{
+   using Clock = std::chrono::steady_clock;
+
+   if (stripes->empty())
+      return true;
+
+   char ackBuff[sizeof(PDU) + sizeof(Fec::StripeAck)];
+
+   for (int attempt = 0; attempt <= connection::MAX_RETRIES; attempt++)
+   {
+      std::vector<std::string> dgrams     = stripes->encode();
+      size_t                   roundBytes = 0;
+      Clock::time_point        firstAt    = Clock::now();
+
+      for (std::string& dgram : dgrams)
+      {
+         pacer->wait(sizeof(PDU) + dgram.size());
+         if (dpc->sendUnacked(dgram.data(), dgram.size(), MsgType::FECSND) < 0)
+            return false;
+         roundBytes += sizeof(PDU) + dgram.size();
+      }
+
+      // Timed from the last datagram, a paced round takes longer to leave than the network takes to answer.
+      Clock::time_point sentAt = Clock::now();
+
+      Clock::time_point deadline = sentAt + std::chrono::milliseconds(stripes->rtoMs());
+      int               busyMs   = 0;
+
+      // Acknowledgements of earlier stripes or rounds can still be in flight, skip them.
+      for (Clock::time_point now = Clock::now(); now < deadline; now = Clock::now())
+      {
+         int waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+         int rcvSz  = dpc->recvTimed(ackBuff, sizeof(ackBuff), waitMs);
+
+         if (rcvSz == 0)
+            break;
+
+         PDU* ackPdu = reinterpret_cast<PDU*>(ackBuff);
+         if (rcvSz == sizeof(PDU) && ackPdu->mtype == MsgType::ERROR && ackPdu->err_num == connection::ERROR_BUSY && ackPdu->verify(nullptr, 0))
+         {
+            busyMs = ackPdu->dgram_sz;
+            break;
+         }
+         if (rcvSz != sizeof(ackBuff) || ackPdu->mtype != MsgType::FECACK || !ackPdu->verify(ackBuff + sizeof(PDU), sizeof(Fec::StripeAck)))
+            continue;
+
+         Fec::StripeAck ack;
+         memcpy(&ack, ackBuff + sizeof(PDU), sizeof(ack));
+         if (ack.stripe != stripes->current())
+            continue;
+
+         Clock::time_point ackAt = Clock::now();
+         stripes->acknowledged(ack, std::chrono::duration<double, std::milli>(ackAt - sentAt).count());
+         stripes->delivered(roundBytes, std::chrono::duration<double, std::milli>(ackAt - firstAt).count());
+         pacer->setRate(stripes->pacingRate());
+         return true;
+      }
+
+      // The server has the stripe but holds its acknowledgement back until our budget recovers.
+      if (busyMs > 0)
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(busyMs));
+
+         // The refusals of the round's other shards are stale by now.
+         while (dpc->recvTimed(ackBuff, sizeof(ackBuff), 0) > 0)
+            continue;
+         attempt--;
+         continue;
+      }
+
+      stripes->timedOut();
+      std::cerr << "Stripe " << stripes->current() << " not acknowledged, resending with " << stripes->parity() << " parity" << std::endl;
+   }
+
+   std::cerr << "ERROR: giving up on stripe " << stripes->current() << " after " << connection::MAX_RETRIES << " retransmissions" << std::endl;
+   return false;
 }
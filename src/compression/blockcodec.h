@@ -0,0 +1,107 @@
+/**
+ * @file blockcodec.h
+ * @brief Declares the per-block framing used to stream compressed files.
+ *
+ * @section Description
+ * The client cuts a file into blocks of BLOCK_SZ bytes and encodes each one independently, which
+ * lets blocks be compressed in parallel and lets every block pick its own codec. A block whose
+ * sample does not compress, or whose encoded form does not save enough, is framed raw so
+ * incompressible data (archives, media) costs nothing but the frame header.
+ *
+ * Each frame is a BlockHeader followed by encSize bytes. The BlockDecoder accepts the stream in
+ * arbitrarily sized pieces, exactly as they come out of the datagrams, and hands back whole blocks.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Compression
+{
+
+/**
+ * @enum Codec
+ * @brief Codecs a transfer can negotiate, a frame records the one actually used for its block.
+ */
+typedef enum
+{
+   CODEC_NONE  = 0, /**< Blocks are sent as they are. */
+   CODEC_LZ4   = 1, /**< LZ4 with the fast match finder, favours throughput. */
+   CODEC_LZ4HC = 2, /**< LZ4 with the hash chain match finder, favours ratio. */
+   CODEC_COUNT      /**< Number of known codecs. */
+} Codec;
+
+constexpr size_t BLOCK_SZ  = 64 * 1024; /**< Raw bytes per block. */
+constexpr size_t SAMPLE_SZ = 4 * 1024;  /**< Bytes probed before committing to compress a block. */
+
+/**
+ * @struct BlockHeader
+ * @brief The header in front of every frame.
+ */
+struct BlockHeader
+{
+   uint32_t codec;   /**< Codec the payload is encoded with. */
+   uint32_t rawSize; /**< Size of the block once decoded. */
+   uint32_t encSize; /**< Size of the payload following the header. */
+};
+
+/**
+ * @brief Parses a codec name as given on the command line.
+ *
+ * @param name "none", "lz4" or "lz4hc".
+ * @return int The codec, or -1 if the name is unknown.
+ */
+int codecFromString(const char* name);
+
+/**
+ * @brief Encodes a block into a frame.
+ *
+ * @param codec The preferred codec, the frame may still fall back to CODEC_NONE.
+ * @param data The raw block.
+ * @param len The size of the raw block, at most BLOCK_SZ.
+ * @return std::string The frame, header included.
+ */
+std::string encodeBlock(int codec, const char* data, size_t len);
+
+/**
+ * @class BlockDecoder
+ * @brief Reassembles frames from a byte stream and decodes them.
+ */
+class BlockDecoder
+{
+private:
+   std::string pending; ///< Bytes of a frame that is not complete yet.
+   bool        failed;  ///< Set once a malformed frame was seen.
+
+public:
+   /**
+    * @brief Constructs an empty decoder.
+    */
+   BlockDecoder();
+
+   /**
+    * @brief Discards any partial frame and clears the error state.
+    */
+   void reset();
+
+   /**
+    * @brief Consumes a piece of the stream, appending every block it completes to @p out.
+    *
+    * @param data The next bytes of the stream.
+    * @param len The number of bytes.
+    * @param out Receives the decoded blocks.
+    * @return bool False if the stream is malformed, the decoder then ignores further input.
+    */
+   bool feed(const char* data, size_t len, std::string& out);
+
+   /**
+    * @brief Reports whether the stream ended on a frame boundary.
+    *
+    * @return bool True if no partial frame is pending.
+    */
+   bool idle() const;
+};
+
+}  // namespace Compression
@@ -0,0 +1,69 @@
+/**
+ * @file lz4.h
+ * @brief Declares an LZ4 block format compressor and decompressor.
+ *
+ * @section Description
+ * The block format is the one documented by the LZ4 project, so blocks produced here can be decoded
+ * by any LZ4 implementation. Two match finders are provided: a single probe hash table that favours
+ * speed, and a hash chain search that spends more time per byte for a better ratio. Both produce
+ * blocks the same decoder understands, the receiver never needs to know which one was used.
+ *
+ * @section Reference
+ * LZ4 Block Format Description, https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace Compression
+{
+
+namespace LZ4
+{
+
+/**
+ * @brief Returns the largest size a block of @p srcSize bytes can compress to.
+ *
+ * @param srcSize The number of input bytes.
+ * @return size_t The worst case output size.
+ */
+size_t compressBound(size_t srcSize);
+
+/**
+ * @brief Compresses a block with the single probe match finder.
+ *
+ * @param src The bytes to compress.
+ * @param srcSize The number of bytes.
+ * @param dst The output buffer.
+ * @param dstCapacity The size of the output buffer.
+ * @return size_t The compressed size, or 0 if the output did not fit in @p dstCapacity.
+ */
+size_t compressFast(const char* src, size_t srcSize, char* dst, size_t dstCapacity);
+
+/**
+ * @brief Compresses a block with the hash chain match finder.
+ *
+ * @param src The bytes to compress.
+ * @param srcSize The number of bytes.
+ * @param dst The output buffer.
+ * @param dstCapacity The size of the output buffer.
+ * @param depth The number of candidates examined per position.
+ * @return size_t The compressed size, or 0 if the output did not fit in @p dstCapacity.
+ */
+size_t compressHC(const char* src, size_t srcSize, char* dst, size_t dstCapacity, int depth = 64);
+
+/**
+ * @brief Decompresses a block, never reading or writing outside the given buffers.
+ *
+ * @param src The compressed block.
+ * @param srcSize The size of the compressed block.
+ * @param dst The output buffer.
+ * @param dstCapacity The size of the output buffer.
+ * @return long The decompressed size, or -1 if the block is malformed.
+ */
+long decompress(const char* src, size_t srcSize, char* dst, size_t dstCapacity);
+
+}  // namespace LZ4
+
+}  // namespace Compression
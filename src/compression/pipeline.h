@@ -0,0 +1,77 @@
+/**
+ * @file pipeline.h
+ * @brief Declares the client side read -> compress -> sequence pipeline.
+ *
+ * @section Description
+ * A single thread compressing a file tops out well below what the link can carry, so the client
+ * spreads the work over three stages:
+ *
+ * 1. **Reader**: reads BLOCK_SZ blocks from the file, feeds the whole-file digest and hands each
+ *    block to the ThreadPool as its own compression task. The pool is the client's and shared by
+ *    every upload it runs, a tree of files does not start a set of workers per file.
+ * 2. **Compressors**: pool tasks encode one block each, the work-stealing queues keep every worker
+ *    busy, and publish the frame on the encoded channel.
+ * 3. **Sequencer**: runs on the calling thread, puts frames back in file order and feeds them to
+ *    the transport.
+ *
+ * A credit channel holding `depth` tokens bounds the number of blocks between the reader and the
+ * transport, which caps memory and keeps the reader from racing ahead of a slow link.
+ */
+
+#pragma once
+
+#include <checksum/xxhash.h>
+
+#include <cstdio>
+#include <functional>
+#include <string>
+
+#include "threadpool/threadpool.h"
+
+namespace Compression
+{
+
+/**
+ * @class CompressPipeline
+ * @brief Reads, compresses in parallel and emits a file as an ordered stream of frames.
+ */
+class CompressPipeline
+{
+private:
+   /**
+    * @struct Block
+    * @brief A block travelling through the pipeline, data is raw until a compressor replaces it with the frame.
+    */
+   struct Block
+   {
+      size_t      index; ///< Position of the block in the file.
+      std::string data;  ///< Raw bytes, then the encoded frame.
+      bool        last;  ///< Marks the end of the file, index then holds the block count.
+   };
+
+   ThreadPool& pool;  ///< Runs the compression tasks, not owned.
+   int         codec; ///< Codec every block is offered to.
+   unsigned    depth; ///< Maximum number of blocks in flight.
+
+public:
+   /**
+    * @brief Constructs a pipeline.
+    *
+    * @param pool The workers to compress on, other pipelines may share them.
+    * @param codec The Compression::Codec to encode with.
+    * @param depth The maximum number of blocks in flight, 0 for twice the pool's threads.
+    */
+   CompressPipeline(ThreadPool& pool, int codec, unsigned depth);
+
+   /**
+    * @brief Streams the whole file through the pipeline.
+    *
+    * @param f The open file, read from its current position to the end.
+    * @param fileHash Receives every raw byte for the whole-file digest.
+    * @param sink Called with each frame in file order, returning false aborts the transfer.
+    * @return bool True if every frame was accepted by the sink.
+    */
+   bool run(FILE* f, Checksum::XXH64& fileHash, const std::function<bool(const std::string&)>& sink);
+};
+
+}  // namespace Compression
@@ -0,0 +1,168 @@
+/**
+ * @file crc32c.cpp
+ * @brief Implementation of the CRC32C checksum with hardware accelerated paths.
+ *
+ * The hardware routines consume eight bytes per instruction which keeps the checksum well above
+ * the rate the network can deliver, the slicing-by-8 fallback is still several GB/s on modern cores.
+ */
+
+#include "checksum/crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
+namespace
+{
+
+constexpr uint32_t POLY = 0x82F63B78;  ///< Reflected Castagnoli polynomial.
+
+struct Tables
+{
+   uint32_t t[8][256];
+
+   Tables()
+   {
+      for (uint32_t i = 0; i < 256; ++i)
+      {
+         uint32_t crc = i;
+         for (int k = 0; k < 8; ++k)
+         {
+            crc = (crc & 1) ? (crc >> 1) ^ POLY : crc >> 1;
+         }
+         t[0][i] = crc;
+      }
+
+      for (uint32_t i = 0; i < 256; ++i)
+      {
+         for (int s = 1; s < 8; ++s)
+         {
+            t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+         }
+      }
+   }
+};
+
+const Tables tables;
+
+uint32_t crc32cSoftware(const void* data, size_t len, uint32_t crc)
+{
+   const uint8_t* p = static_cast<const uint8_t*>(data);
+   crc              = ~crc;
+
+   while (len >= 8)
+   {
+      uint64_t word;
+      std::memcpy(&word, p, sizeof(word));
+      word ^= crc;
+
+      crc = tables.t[7][word & 0xFF] ^ tables.t[6][(word >> 8) & 0xFF] ^ tables.t[5][(word >> 16) & 0xFF] ^
+            tables.t[4][(word >> 24) & 0xFF] ^ tables.t[3][(word >> 32) & 0xFF] ^ tables.t[2][(word >> 40) & 0xFF] ^
+            tables.t[1][(word >> 48) & 0xFF] ^ tables.t[0][word >> 56];
+
+      p += 8;
+      len -= 8;
+   }
+
+   while (len--)
+   {
+      crc = (crc >> 8) ^ tables.t[0][(crc ^ *p++) & 0xFF];
+   }
+
+   return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t crc32cHardware(const void* data, size_t len, uint32_t crc)
+{
+   const uint8_t* p   = static_cast<const uint8_t*>(data);
+   uint64_t       acc = ~crc;
+
+   while (len >= 8)
+   {
+      uint64_t word;
+      std::memcpy(&word, p, sizeof(word));
+      acc = _mm_crc32_u64(acc, word);
+      p += 8;
+      len -= 8;
+   }
+
+   uint32_t acc32 = static_cast<uint32_t>(acc);
+   while (len--)
+   {
+      acc32 = _mm_crc32_u8(acc32, *p++);
+   }
+
+   return ~acc32;
+}
+
+bool hasHardware()
+{
+   return __builtin_cpu_supports("sse4.2");
+}
+
+constexpr const char* HW_NAME = "sse4.2";
+#elif defined(__aarch64__)
+__attribute__((target("+crc"))) uint32_t crc32cHardware(const void* data, size_t len, uint32_t crc)
+{
+   const uint8_t* p = static_cast<const uint8_t*>(data);
+   crc              = ~crc;
+
+   while (len >= 8)
+   {
+      uint64_t word;
+      std::memcpy(&word, p, sizeof(word));
+      crc = __crc32cd(crc, word);
+      p += 8;
+      len -= 8;
+   }
+
+   while (len--)
+   {
+      crc = __crc32cb(crc, *p++);
+   }
+
+   return ~crc;
+}
+
+bool hasHardware()
+{
+   return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+constexpr const char* HW_NAME = "armv8-crc";
+#else
+uint32_t crc32cHardware(const void* data, size_t len, uint32_t crc)
+{
+   return crc32cSoftware(data, len, crc);
+}
+
+bool hasHardware()
+{
+   return false;
+}
+
+constexpr const char* HW_NAME = "software";
+#endif
+
+using Crc32cFn = uint32_t (*)(const void*, size_t, uint32_t);
+
+const bool     useHardware = hasHardware();
+const Crc32cFn impl        = useHardware ? crc32cHardware : crc32cSoftware;
+
+}  // namespace
+
+uint32_t Checksum::crc32c(const void* data, size_t len, uint32_t crc)
+{
+   return impl(data, len, crc);
+}
+
+const char* Checksum::crc32cBackend()
+{
+   return useHardware ? HW_NAME : "software";
+}
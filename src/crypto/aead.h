@@ -0,0 +1,194 @@
+/**
+ * @file aead.h
+ * @brief Declares the authenticated encryption used to protect the data stream.
+ *
+ * @section Description
+ * Each data datagram is sealed on its own with an AEAD cipher: the PDU header is authenticated as
+ * associated data, the payload is encrypted and a 16 byte tag follows it on the wire. The nonce is
+ * derived from the datagram's sequence number so nothing extra has to travel with the packet, and
+ * a retransmission is byte for byte identical to the original so a nonce is never reused for
+ * different data.
+ *
+ * The session key comes from an X25519 exchange piggybacked on CONNECT/CNTACK and expanded with
+ * HKDF-SHA256. The exchange on its own is unauthenticated, mixing in a pre-shared key ties the
+ * session to peers that know it.
+ *
+ * The primitives come from OpenSSL's libcrypto, which dispatches AES-GCM to AES-NI/VAES+PCLMUL
+ * (or the ARMv8 crypto extensions) and ChaCha20-Poly1305 to its AVX2/AVX-512/NEON code.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
+typedef struct evp_pkey_st       EVP_PKEY;
+
+namespace Crypto
+{
+
+/**
+ * @enum Cipher
+ * @brief Ciphers a transfer can negotiate.
+ */
+typedef enum
+{
+   CIPHER_NONE     = 0, /**< Plaintext transfer. */
+   CIPHER_AES_GCM  = 1, /**< AES-256-GCM, the fast path on CPUs with AES instructions. */
+   CIPHER_CHACHA20 = 2, /**< ChaCha20-Poly1305, the fast path everywhere else. */
+   CIPHER_AUTO     = 3, /**< Client side only: pick the best cipher for this CPU. */
+   CIPHER_COUNT         /**< Number of known ciphers. */
+} Cipher;
+
+constexpr int KEY_SZ    = 32; /**< Size of the session key. */
+constexpr int NONCE_SZ  = 12; /**< Size of the AEAD nonce. */
+constexpr int TAG_SZ    = 16; /**< Size of the authentication tag. */
+constexpr int PUBKEY_SZ = 32; /**< Size of an X25519 public key. */
+
+/**
+ * @brief Parses a cipher name as given on the command line.
+ *
+ * @param name "none", "auto", "aes" or "chacha".
+ * @return int The cipher, or -1 if the name is unknown.
+ */
+int cipherFromString(const char* name);
+
+/**
+ * @brief Picks the cipher that runs fastest on this CPU.
+ *
+ * @return int CIPHER_AES_GCM when AES and carry-less multiply instructions are present, CIPHER_CHACHA20 otherwise.
+ */
+int preferredCipher();
+
+/**
+ * @class Aead
+ * @brief Seals or opens datagrams for one direction of a session.
+ *
+ * The key schedule is computed once, each datagram only resets the nonce.
+ */
+class Aead
+{
+private:
+   EVP_CIPHER_CTX* ctx;            ///< OpenSSL cipher context holding the expanded key.
+   int             cipher;         ///< The negotiated Cipher.
+   bool            encrypt;        ///< True to seal, false to open.
+   uint8_t         iv[NONCE_SZ];   ///< Per-session IV the counter is mixed into.
+   uint32_t        lastSeq{0};     ///< Last sequence number seen, to notice 32-bit wrap-around.
+   uint64_t        epoch{0};       ///< Number of times the sequence number wrapped.
+
+   /**
+    * @brief Builds the nonce for a sequence number, accounting for wrap-around so nonces stay unique.
+    *
+    * @return uint64_t The 64-bit counter the nonce was built from.
+    */
+   uint64_t nonceFor(uint32_t seq, uint8_t* nonce) const;
+
+   /**
+    * @brief Records the counter of a datagram that was sealed or successfully opened.
+    */
+   void advance(uint64_t counter);
+
+public:
+   /**
+    * @brief Constructs a cipher for one direction.
+    *
+    * @param cipher CIPHER_AES_GCM or CIPHER_CHACHA20.
+    * @param key The KEY_SZ byte session key.
+    * @param iv The NONCE_SZ byte session IV.
+    * @param encrypt True for the sending side, false for the receiving side.
+    */
+   Aead(int cipher, const uint8_t* key, const uint8_t* iv, bool encrypt);
+
+   /**
+    * @brief Releases the cipher context.
+    */
+   ~Aead();
+
+   Aead(const Aead&)            = delete;
+   Aead& operator=(const Aead&) = delete;
+
+   /**
+    * @brief Reports whether the context was set up successfully.
+    *
+    * @return bool True if the cipher is usable.
+    */
+   bool valid() const;
+
+   /**
+    * @brief Encrypts a payload in place and writes its tag.
+    *
+    * @param seq The datagram's sequence number.
+    * @param aad The associated data, authenticated but not encrypted.
+    * @param aadLen The size of the associated data.
+    * @param data The payload, replaced by its ciphertext.
+    * @param len The size of the payload.
+    * @param tag Receives TAG_SZ bytes.
+    * @return bool False if the cipher failed.
+    */
+   bool seal(uint32_t seq, const void* aad, int aadLen, void* data, int len, uint8_t* tag);
+
+   /**
+    * @brief Decrypts a payload in place after checking its tag.
+    *
+    * @param seq The datagram's sequence number.
+    * @param aad The associated data the sender authenticated.
+    * @param aadLen The size of the associated data.
+    * @param data The ciphertext, replaced by the payload.
+    * @param len The size of the ciphertext.
+    * @param tag The TAG_SZ byte tag.
+    * @return bool False if the datagram was forged or corrupted.
+    */
+   bool open(uint32_t seq, const void* aad, int aadLen, void* data, int len, const uint8_t* tag);
+};
+
+/**
+ * @class KeyExchange
+ * @brief An ephemeral X25519 key pair and the HKDF step that turns the shared secret into session keys.
+ */
+class KeyExchange
+{
+private:
+   EVP_PKEY* key; ///< The ephemeral private key.
+
+public:
+   /**
+    * @brief Generates a fresh key pair.
+    */
+   KeyExchange();
+
+   /**
+    * @brief Releases the key pair.
+    */
+   ~KeyExchange();
+
+   KeyExchange(const KeyExchange&)            = delete;
+   KeyExchange& operator=(const KeyExchange&) = delete;
+
+   /**
+    * @brief Copies out the public half.
+    *
+    * @param out Receives PUBKEY_SZ bytes.
+    * @return bool False if the key could not be generated.
+    */
+   bool publicKey(uint8_t* out) const;
+
+   /**
+    * @brief Derives the session key and IV.
+    *
+    * Both sides pass the public keys in the same (client, server) order so they agree on the HKDF salt.
+    *
+    * @param peer The other side's public key.
+    * @param clientPub The client's public key.
+    * @param serverPub The server's public key.
+    * @param psk Optional pre-shared key mixed into the input keying material, empty for none.
+    * @param key Receives KEY_SZ bytes.
+    * @param iv Receives NONCE_SZ bytes.
+    * @return bool False if the exchange failed.
+    */
+   bool derive(const uint8_t* peer, const uint8_t* clientPub, const uint8_t* serverPub, const std::string& psk, uint8_t* key,
+               uint8_t* iv) const;
+};
+
+}  // namespace Crypto
@@ -0,0 +1,283 @@
+/**
+ * @file daemon.cpp
+ * @brief Implementation of the client daemon.
+ */
+
+#include "drexelprotocol/daemon.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+using DrexelProtocol::ClientDaemon;
+
+namespace
+{
+
+constexpr int ACCEPT_BACKLOG = 128;   ///< Submitters waiting to be accepted while the daemon queues a burst.
+constexpr int JOB_TIMEOUT_MS = 5000;  ///< A submitter has this long to send its job once connected.
+
+bool unixAddress(const std::string& path, struct sockaddr_un& addr)
+{
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+
+   if (path.size() >= sizeof(addr.sun_path))
+   {
+      std::cerr << "Socket path " << path << " is longer than " << sizeof(addr.sun_path) - 1 << " bytes" << std::endl;
+      return false;
+   }
+   memcpy(addr.sun_path, path.c_str(), path.size());
+   return true;
+}
+
+/// Receives a job and the fd that may come with it, -1 if none did.
+bool recvJob(int conn, DrexelProtocol::UploadJob& job, int& fd)
+{
+   char          control[CMSG_SPACE(sizeof(int))];
+   struct iovec  iov = {&job, sizeof(job)};
+   struct msghdr msg;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov        = &iov;
+   msg.msg_iovlen     = 1;
+   msg.msg_control    = control;
+   msg.msg_controllen = sizeof(control);
+
+   fd          = -1;
+   ssize_t got = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+   if (got < 0)
+      return false;
+
+   struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+   if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+
+   return got == sizeof(job);
+}
+
+}  // namespace
+
+ClientDaemon::ClientDaemon(const std::string& socketPath, const FTPClient& settings, unsigned uploadStreams)
+    : settings(settings), socketPath(socketPath), jobs(new ThreadPool(uploadStreams))
+{
+   struct sockaddr_un addr;
+   if (!unixAddress(socketPath, addr))
+      return;
+
+   if ((listenSock = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0)
+   {
+      perror("socket(AF_UNIX) failed");
+      return;
+   }
+
+   // A socket nobody accepts on is left over from a daemon that died, one that answers is in use.
+   int probe = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+   if (probe >= 0 && ::connect(probe, (const struct sockaddr*) &addr, sizeof(addr)) == 0)
+   {
+      std::cerr << "A daemon is already running on " << socketPath << std::endl;
+      ::close(probe);
+      ::close(listenSock);
+      listenSock = -1;
+      return;
+   }
+   if (probe >= 0)
+      ::close(probe);
+   unlink(socketPath.c_str());
+
+   if (bind(listenSock, (const struct sockaddr*) &addr, sizeof(addr)) < 0 || ::listen(listenSock, ACCEPT_BACKLOG) < 0)
+   {
+      perror(("Cannot listen on " + socketPath).c_str());
+      ::close(listenSock);
+      listenSock = -1;
+   }
+}
+
+ClientDaemon::~ClientDaemon()
+{
+   delete jobs;
+
+   for (auto& server : idle)
+   {
+      for (FTPClient* client : server.second)
+      {
+         delete client;
+      }
+   }
+
+   if (listenSock >= 0)
+   {
+      ::close(listenSock);
+      unlink(socketPath.c_str());
+   }
+}
+
+bool ClientDaemon::validate() const
+{
+   return listenSock >= 0;
+}
+
+void ClientDaemon::run()
+{
+   std::cout << "Waiting for jobs on " << socketPath << " with " << jobs->getThreadCount() << " upload streams" << std::endl;
+
+   while (true)
+   {
+      int conn = accept(listenSock, nullptr, nullptr);
+      if (conn < 0)
+      {
+         if (errno != EINTR)
+            perror("accept failed");
+         continue;
+      }
+
+      // A submitter that connects and goes quiet holds a pool thread for JOB_TIMEOUT_MS, never the accept loop.
+      struct timeval timeout = {JOB_TIMEOUT_MS / 1000, (JOB_TIMEOUT_MS % 1000) * 1000};
+      if (setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+         perror("setsockopt(SO_RCVTIMEO) failed");
+
+      jobs->submit([this, conn] { serveJob(conn); });
+   }
+}
+
+void ClientDaemon::serveJob(int conn)
+{
+   UploadJob job;
+   int       ringFd;
+   if (!recvJob(conn, job, ringFd) || job.ring != (ringFd >= 0))
+   {
+      std::cerr << "Ignoring a malformed or late job" << std::endl;
+      if (ringFd >= 0)
+         ::close(ringFd);
+      ::close(conn);
+      return;
+   }
+   job.path[sizeof(job.path) - 1]     = '\0';
+   job.server[sizeof(job.server) - 1] = '\0';
+
+   runJob(conn, job, ringFd);
+}
+
+void ClientDaemon::runJob(int conn, const UploadJob& job, int ringFd)
+{
+   std::string key    = std::string(job.server) + " " + std::to_string(job.port);
+   FTPClient*  client = nullptr;
+
+   {
+      std::lock_guard<std::mutex> lock(idleLock);
+      std::vector<FTPClient*>&    warm = idle[key];
+      if (!warm.empty())
+      {
+         client = warm.back();
+         warm.pop_back();
+      }
+   }
+   if (client == nullptr)
+      client = settings.fork(job.server, job.port);
+
+   UploadResult    result{Error::UNKOWN};
+   std::error_code ec;
+
+   if (job.ring)
+   {
+      // Stored under the name the producer gave, whatever directories it named.
+      RecordRing  ring{ringFd, conn};
+      FILE*       f    = ring.validate() ? ring.stream() : nullptr;
+      std::string name = std::filesystem::path{job.path}.filename().string();
+
+      if (f != nullptr && client->validate() && client->push(f, name))
+         result.err = Error::NONE;
+      else if (ring.validate())
+         ring.abort();
+
+      if (f != nullptr)
+         fclose(f);
+   }
+   else if (!std::filesystem::is_regular_file(job.path, ec))
+      result.err = Error::FILE_NOT_FOUND;
+   else if (client->validate() && client->push(job.path))
+      result.err = Error::NONE;
+
+   std::cout << "Job " << job.path << " to " << key << ((result.err == Error::NONE) ? " done" : " failed") << std::endl;
+
+   if (send(conn, &result, sizeof(result), MSG_NOSIGNAL) != sizeof(result))
+      std::cerr << "Submitter of " << job.path << " hung up before its result" << std::endl;
+   ::close(conn);
+
+   // A client whose socket could not be opened again is no use to the next job.
+   if (!client->validate())
+   {
+      delete client;
+      return;
+   }
+
+   std::lock_guard<std::mutex> lock(idleLock);
+   idle[key].push_back(client);
+}
+
+int ClientDaemon::startJob(const std::string& socketPath, const UploadJob& job, int ringFd)
+{
+   struct sockaddr_un addr;
+   if (!unixAddress(socketPath, addr))
+      return -1;
+
+   int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+   if (sock < 0)
+   {
+      perror("socket(AF_UNIX) failed");
+      return -1;
+   }
+
+   if (::connect(sock, (const struct sockaddr*) &addr, sizeof(addr)) < 0)
+   {
+      perror(("Cannot reach the daemon on " + socketPath).c_str());
+      ::close(sock);
+      return -1;
+   }
+
+   char          control[CMSG_SPACE(sizeof(int))];
+   struct iovec  iov = {const_cast<UploadJob*>(&job), sizeof(job)};
+   struct msghdr msg;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov    = &iov;
+   msg.msg_iovlen = 1;
+
+   if (ringFd >= 0)
+   {
+      memset(control, 0, sizeof(control));
+      msg.msg_control    = control;
+      msg.msg_controllen = sizeof(control);
+
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level     = SOL_SOCKET;
+      cmsg->cmsg_type      = SCM_RIGHTS;
+      cmsg->cmsg_len       = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &ringFd, sizeof(int));
+   }
+
+   if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(job))
+   {
+      perror("Cannot send the job");
+      ::close(sock);
+      return -1;
+   }
+   return sock;
+}
+
+bool ClientDaemon::awaitJob(int conn, UploadResult& result)
+{
+   bool answered = recv(conn, &result, sizeof(result), 0) == sizeof(result);
+   ::close(conn);
+   return answered;
+}
+
+bool ClientDaemon::submit(const std::string& socketPath, const UploadJob& job, UploadResult& result)
+{
+   int conn = startJob(socketPath, job);
+   return conn >= 0 && awaitJob(conn, result);
+}
@@ -0,0 +1,192 @@
+/**
+ * @file directio.cpp
+ * @brief Implementation of the O_DIRECT write path.
+ */
+
+#include "drexelprotocol/directio.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using DrexelProtocol::AlignedPool;
+using DrexelProtocol::DirectWriter;
+
+AlignedPool::AlignedPool(size_t bufferSz, size_t keep) : bufferSz((bufferSz + ALIGN - 1) / ALIGN * ALIGN), keep(keep)
+{}
+
+AlignedPool::~AlignedPool()
+{
+   for (char* buffer : spare)
+      std::free(buffer);
+}
+
+char* AlignedPool::acquire()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!spare.empty())
+      {
+         char* buffer = spare.back();
+         spare.pop_back();
+         return buffer;
+      }
+   }
+
+   return static_cast<char*>(std::aligned_alloc(ALIGN, bufferSz));
+}
+
+void AlignedPool::release(char* buffer)
+{
+   if (buffer == nullptr)
+      return;
+
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (spare.size() < keep)
+      {
+         spare.push_back(buffer);
+         return;
+      }
+   }
+
+   std::free(buffer);
+}
+
+size_t AlignedPool::bufferSize() const
+{
+   return bufferSz;
+}
+
+DirectWriter::DirectWriter(int fd, AlignedPool& pool) : fd(fd), pool(pool)
+{
+   memset(io, 0, sizeof(io));
+   buffers[0] = pool.acquire();
+   buffers[1] = pool.acquire();
+}
+
+DirectWriter::~DirectWriter()
+{
+   // The kernel may still be reading the buffers, they go back to the pool only once the writes are done.
+   wait(0);
+   wait(1);
+   pool.release(buffers[0]);
+   pool.release(buffers[1]);
+}
+
+bool DirectWriter::valid() const
+{
+   return buffers[0] != nullptr && buffers[1] != nullptr;
+}
+
+bool DirectWriter::wait(int idx)
+{
+   if (!busy[idx])
+      return true;
+
+   const struct aiocb* list[1] = {&io[idx]};
+   while (aio_error(&io[idx]) == EINPROGRESS)
+   {
+      if (aio_suspend(list, 1, nullptr) < 0 && errno != EINTR)
+         break;
+   }
+   busy[idx] = false;
+
+   ssize_t wr = aio_return(&io[idx]);
+   if (wr != (ssize_t) io[idx].aio_nbytes)
+   {
+      errno = (wr < 0) ? aio_error(&io[idx]) : EIO;
+      perror("aio_write failed");
+      failed = true;
+   }
+
+   return !failed;
+}
+
+bool DirectWriter::submit()
+{
+   struct aiocb& cb = io[current];
+
+   memset(&cb, 0, sizeof(cb));
+   cb.aio_fildes = fd;
+   cb.aio_buf    = buffers[current];
+   cb.aio_nbytes = pool.bufferSize();
+   cb.aio_offset = offset;
+
+   if (aio_write(&cb) < 0)
+   {
+      perror("aio_write failed");
+      failed = true;
+      return false;
+   }
+   busy[current] = true;
+
+   offset += pool.bufferSize();
+   current ^= 1;
+   fill = 0;
+
+   // The other buffer was submitted one round ago, it is usually written by now.
+   return wait(current);
+}
+
+bool DirectWriter::write(const char* data, size_t len)
+{
+   size_t bufferSz = pool.bufferSize();
+
+   while (len > 0 && !failed)
+   {
+      size_t take = std::min(bufferSz - fill, len);
+
+      memcpy(buffers[current] + fill, data, take);
+      fill += take;
+      data += take;
+      len -= take;
+
+      if (fill == bufferSz)
+         submit();
+   }
+
+   return !failed;
+}
+
+bool DirectWriter::finish()
+{
+   if (!wait(0) || !wait(1))
+      return false;
+
+   size_t aligned = fill / AlignedPool::ALIGN * AlignedPool::ALIGN;
+   size_t done    = 0;
+
+   while (done < fill)
+   {
+      // The tail is shorter than a block, O_DIRECT would refuse it.
+      if (done == aligned)
+         fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+
+      size_t  len = (done < aligned) ? aligned - done : fill - done;
+      ssize_t wr  = pwrite(fd, buffers[current] + done, len, offset + done);
+      if (wr < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         perror("pwrite failed");
+         failed = true;
+         return false;
+      }
+      done += wr;
+   }
+
+   offset += fill;
+   fill = 0;
+   return true;
+}
+
+off_t DirectWriter::written() const
+{
+   return offset + fill;
+}
@@ -0,0 +1,130 @@
+/**
+ * @file address.h
+ * @brief Declares the address helpers that keep the socket layer independent of the IP version.
+ *
+ * @section Description
+ * Addresses live in a sockaddr_storage next to their length, so a Sock holds an IPv4 or an IPv6
+ * peer alike. Names and literals go through getaddrinfo(), which takes "10.0.0.1", "fe80::1%eth0"
+ * and host names, and prints go through getnameinfo().
+ *
+ * The server listens on a dual-stack IPv6 socket, where IPv4 peers show up as IPv4-mapped
+ * addresses (::ffff:10.0.0.1). A FlowKey stores them as plain IPv4, so a peer keys the same
+ * flow, and the same host budget, whichever socket family it reached the server through.
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+
+namespace DrexelProtocol
+{
+
+/**
+ * @struct FlowKey
+ * @brief A peer's address family, address and port in binary, what flows are kept by.
+ */
+struct FlowKey
+{
+   sa_family_t family{AF_UNSPEC}; /**< AF_INET or AF_INET6, IPv4-mapped addresses count as AF_INET. */
+   uint16_t    port{0};           /**< The port in network order, 0 for a whole host. */
+   uint8_t     addr[16]{};        /**< The address, an IPv4 one in its first 4 bytes. */
+
+   FlowKey() = default;
+
+   /**
+    * @brief Builds the key of a peer.
+    *
+    * @param peer An AF_INET or AF_INET6 address, anything else gives an AF_UNSPEC key.
+    */
+   explicit FlowKey(const struct sockaddr_storage& peer);
+
+   /**
+    * @brief The key of the peer's host, all of its ports.
+    *
+    * @return FlowKey The key with the port cleared.
+    */
+   FlowKey host() const;
+
+   bool operator==(const FlowKey& other) const;
+   bool operator!=(const FlowKey& other) const;
+
+   /**
+    * @brief Prints the key as "10.0.0.1:5000" or "[fe80::1]:5000".
+    *
+    * @return std::string The printable key.
+    */
+   std::string str() const;
+};
+
+std::ostream& operator<<(std::ostream& os, const FlowKey& key);
+
+/**
+ * @brief Resolves a host name or address literal, IPv4 or IPv6.
+ *
+ * @param host The name or literal.
+ * @param port The port, host order.
+ * @param out Receives the first address returned.
+ * @param outSz Receives its length.
+ * @return bool False if it does not resolve, the reason is printed.
+ */
+bool resolveAddress(const char* host, int port, struct sockaddr_storage& out, socklen_t& outSz);
+
+/**
+ * @brief Prints the address of a socket address without its port, in a form resolveAddress() takes back.
+ *
+ * @param addr The address.
+ * @return std::string The numeric host, with the scope of a link-local IPv6 address.
+ */
+std::string numericHost(const struct sockaddr_storage& addr);
+
+/**
+ * @brief Reads the port of a socket address.
+ *
+ * @param addr An AF_INET or AF_INET6 address.
+ * @return int The port in host order, 0 for other families.
+ */
+int addressPort(const struct sockaddr_storage& addr);
+
+/**
+ * @brief Builds the wildcard address of a family for binding.
+ *
+ * @param family AF_INET or AF_INET6.
+ * @param port The port, host order, 0 for any.
+ * @param out Receives the address.
+ * @return socklen_t Its length.
+ */
+socklen_t anyAddress(int family, int port, struct sockaddr_storage& out);
+
+/**
+ * @brief Marks a socket's datagrams with a TOS byte, in the IPv6 traffic class too on IPv6 sockets.
+ *
+ * A dual-stack socket sends IPv4-mapped peers IPv4 datagrams, which take the IP_TOS value.
+ *
+ * @param sock The socket.
+ * @param tos The TOS byte.
+ * @return bool False if the kernel refused, the reason is printed.
+ */
+bool setTrafficClass(int sock, int tos);
+
+}  // namespace DrexelProtocol
+
+namespace std
+{
+
+/**
+ * @brief Hashes a FlowKey, so flows can be kept in unordered maps.
+ */
+template <>
+struct hash<DrexelProtocol::FlowKey>
+{
+   size_t operator()(const DrexelProtocol::FlowKey& key) const noexcept;
+};
+
+}  // namespace std
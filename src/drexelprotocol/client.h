@@ -11,10 +11,19 @@
 
 #pragma once
 
+#include <checksum/xxhash.h>
 #include <drexelprotocol/ftp.h>
 #include <drexelprotocol/connection.h>
+#include <drexelprotocol/pacing.h>
+#include <fec/stripe.h>
+#include <threadpool/threadpool.h>
 
+#include <cstdio>
 #include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace DrexelProtocol
 {
@@ -28,14 +37,264 @@ namespace DrexelProtocol
  */
 class FTPClient : public FTP
 {
+private:
+   Fec::StripeEncoder* stripes{nullptr}; /**< FEC stage in front of the connection, nullptr without FEC. */
+   Pacer*              pacer{nullptr};   /**< Spreads each stripe out at the delivery rate, created with stripes. */
+   Sock                server;           /**< The server's listening address, the connection moves to a sender's port on downloads. */
+   uint64_t            ticket{0};        /**< Ticket of the last CNTACK, offered at the next connect, 0 for none. */
+   bool                deferred{false};  /**< connect() left the CONNECT to the upload, to carry its first datagram. */
+   FTP_TRANSFER        transfer;         /**< Sent behind the FTP_PDU of the upload's NEW or of a request. */
+   uint64_t            offset{0};        /**< Where the next datagram's data starts in the file, sent by multipath flows. */
+
+   mutable std::mutex  compressorsLock;        /**< Guards creating compressors. */
+   mutable ThreadPool* compressors{nullptr};   /**< Compresses the blocks of every upload, shared with the forks of this client. */
+   mutable bool        ownsCompressors{false}; /**< This client created compressors and deletes it. */
+
+   /**
+    * @brief Gets the compression workers, starting pipelineWorkers of them on first use.
+    *
+    * @return ThreadPool& The pool this client and every client forked from it compress on.
+    */
+   ThreadPool& compressionPool() const;
+
+   /**
+    * @brief Opens a fresh socket for dpc aimed at the server.
+    *
+    * @return bool False if the socket could not be created, dpc is then released.
+    */
+   bool openSocket();
+
+   /**
+    * @brief Binds the socket to localAddr, so the upload leaves through that address's interface.
+    *
+    * @return bool False if the address does not resolve or cannot be bound.
+    */
+   bool bindLocal();
+
+   /**
+    * @brief Sends the CONNECT and sets up what the server accepted: FEC stripes, the session key.
+    *
+    * @param early The first datagram of an upload to send along, or nullptr.
+    * @param earlySz Its size.
+    * @return int 0 or more on success, or an error code.
+    */
+   int handshake(const char* early = nullptr, int earlySz = 0);
+
+   /**
+    * @brief Completes a deferred connect, sending the upload's first datagram with the CONNECT.
+    *
+    * If the server does not take it the datagram is sent again after the handshake.
+    *
+    * @param f The open file, read from its start.
+    * @param pdu The FTP header for the transfer, APPEND once the data was sent.
+    * @param fileHash Receives the bytes sent.
+    * @return bool False if the server could not be reached.
+    */
+   bool sendEarly(FILE* f, FTP_PDU& pdu, Checksum::XXH64& fileHash);
+
+   /**
+    * @brief Reads the ticket kept in ticketFile, if it was issued by this server.
+    *
+    * @return bool True if a ticket was loaded.
+    */
+   bool loadTicket();
+
+   /**
+    * @brief Replaces ticketFile with the current ticket.
+    */
+   void saveTicket() const;
+
+   /**
+    * @brief Replaces a connection a download closed with a new one and negotiates the options again.
+    *
+    * @return bool False if the server could not be reached.
+    */
+   bool reconnect();
+
+   /**
+    * @brief Sends a GET, LIST or STAT and receives the answer from the server's sender.
+    *
+    * The answer comes from a port of its own, the connection follows it there and is closed by its CLOSE.
+    *
+    * @param status The request's Status.
+    * @param name The file the request is about.
+    * @param sink Called with the answer, piece by piece and in order.
+    * @param digest Receives the sender's digest of the answer.
+    * @return int Error::NONE if the answer matched the digest, Error::FILE_NOT_FOUND, Error::DIGEST_MISMATCH,
+    *             or Error::UNKOWN if the request was not accepted.
+    */
+   int fetch(int status, const std::string& name, const std::function<void(const char*, size_t)>& sink, uint64_t& digest);
+
+   /**
+    * @brief Asks the server for file metadata.
+    *
+    * @param status Status::LIST or Status::STAT.
+    * @param name The file for a STAT.
+    * @param records Receives one entry per file, none if a STAT found nothing.
+    * @return bool False if the server did not answer.
+    */
+   bool query(int status, const std::string& name, std::vector<FTP_STAT>& records);
+
+   /**
+    * @brief Checks whether the server already holds a file with a local file's size and digest.
+    *
+    * @param path The local file.
+    * @param name The name the server knows it by.
+    * @return bool True if the upload can be skipped.
+    */
+   bool serverHasCopy(const std::string& path, const std::string& name);
+
+   /**
+    * @brief Uploads one file over the current connection, which the upload closes.
+    *
+    * @param path The local file.
+    * @param name The name to store it under on the server, may be a relative path.
+    * @return bool True if the server verified the file or already had it.
+    */
+   bool upload(const std::string& path, const std::string& name);
+
+   /**
+    * @brief Uploads a stream read to its end over the current connection, which the upload closes.
+    *
+    * A stream without an fd, a RecordRing's, is sent without a size. A read error abandons the
+    * upload without a COMMIT, so the server never stores part of a stream as the whole of it.
+    *
+    * @param f The open stream.
+    * @param name The name to store it under on the server.
+    * @return bool True if the server verified the upload.
+    */
+   bool uploadStream(FILE* f, const std::string& name);
+
+   /**
+    * @brief Connects again if the last upload closed the connection.
+    *
+    * @return bool False if the server could not be reached.
+    */
+   bool ready();
+
+   /**
+    * @brief Uploads every file under the directory filePath, keeping their relative paths.
+    *
+    * The tree is scanned in parallel and the files are handed out largest first to treeStreams
+    * uploads running side by side, each over a connection of its own. The big files start early
+    * and the small ones fill in behind them, so no stream is left with a large file at the end.
+    *
+    * @return bool True if every file was uploaded and verified.
+    */
+   bool sendTree();
+
+   /**
+    * @brief Prints one line of a listing.
+    *
+    * @param record The file to describe.
+    */
+   static void printRecord(const FTP_STAT& record);
+
+   /**
+    * @brief Hands one datagram worth of the stream to the connection, or to the FEC stage.
+    *
+    * @param buff The FTP header followed by data.
+    * @param len The number of bytes available.
+    * @return int The number of bytes consumed, or an error code.
+    */
+   int transmit(char* buff, size_t len);
+
+   /**
+    * @brief Sends the current FEC stripe until the server acknowledges it.
+    *
+    * Each unacknowledged round is resent with more parity, up to connection::MAX_RETRIES times.
+    *
+    * @return bool False if the server never acknowledged the stripe.
+    */
+   bool flushStripe();
+
+   /**
+    * @brief Writes the headers of a datagram, the FTP_PDU and, for a NEW or a request, the transfer.
+    *
+    * A multipath flow adds the offset to its NEWs and APPENDs.
+    *
+    * @param buff Receives them, room for FTP_HEADER_MAX_SZ bytes.
+    * @param pdu The FTP header.
+    * @return size_t Where the datagram's data goes, ftpHeaderSz() of its status.
+    */
+   size_t packHeader(char* buff, const FTP_PDU& pdu) const;
+
+   /**
+    * @brief Sends a piece of the data stream, splitting it into as many datagrams as needed.
+    *
+    * @param pdu The FTP header stamped on every datagram, its status moves to APPEND once data is sent.
+    *            offset follows the data.
+    * @param data The bytes to send.
+    * @param len The number of bytes.
+    * @return bool False if the connection gave up on a datagram.
+    */
+   bool sendData(FTP_PDU& pdu, const char* data, size_t len);
+
+   /**
+    * @brief Streams the file as is.
+    *
+    * @param f The open file.
+    * @param pdu The FTP header for the transfer.
+    * @param fileHash Receives every byte read for the whole-file digest.
+    * @return bool False if the transfer failed.
+    */
+   bool streamFile(FILE* f, FTP_PDU& pdu, Checksum::XXH64& fileHash);
+
+   /**
+    * @brief Streams the file as compressed frames.
+    *
+    * Blocks flow through a Compression::CompressPipeline, compressed in parallel on the
+    * compressionPool() and handed back in file order.
+    *
+    * @param f The open file.
+    * @param pdu The FTP header for the transfer.
+    * @param fileHash Receives every byte read for the whole-file digest.
+    * @return bool False if the transfer failed.
+    */
+   bool streamCompressed(FILE* f, FTP_PDU& pdu, Checksum::XXH64& fileHash);
+
+   /**
+    * @brief Streams the file over one subflow per local address, each datagram placed by its offset.
+    *
+    * The connection already open is the first subflow, the others join its transfer. The file is
+    * cut into MULTIPATH_CHUNK_SZ chunks that every subflow takes from a shared counter as soon as its
+    * previous chunk is acknowledged, so each path carries a share in proportion to its capacity.
+    * A subflow that fails hands its chunk back to the ones still up. The digest is computed on a
+    * thread of its own, the chunks leave out of order.
+    *
+    * @param f The open file.
+    * @param pdu The FTP header for the transfer.
+    * @param fileHash Receives the whole file for the digest.
+    * @return bool False if the first subflow failed or a chunk could not be sent on any subflow.
+    */
+   bool streamMultipath(FILE* f, FTP_PDU& pdu, Checksum::XXH64& fileHash);
+
 public:
+   static constexpr int    CHUNK_SZ           = 500;      /**< File bytes carried behind each FTP header. */
+   static constexpr size_t MULTIPATH_CHUNK_SZ = 64 << 10; /**< File bytes a subflow takes at a time. */
+
+   FTP_OPTIONS options{};                  /**< Options offered at connect, replaced by the ones the server accepted. */
+   unsigned    pipelineWorkers{0};         /**< Compression threads, 0 for one per hardware thread. */
+   unsigned    pipelineDepth{0};           /**< Blocks in flight in the compression pipeline, 0 for twice the workers. */
+   std::string psk;                        /**< Pre-shared key mixed into the session key, empty for none. */
+   unsigned    fecParity{1};               /**< Parity datagrams per stripe on a loss free link. */
+   bool        skipIdentical{false};       /**< Ask the server first and skip uploads it already has. */
+   unsigned    treeStreams{4};             /**< Files of a tree in flight at the same time. */
+   int         priority{Priority::NORMAL}; /**< Priority of the transfers, sent in their FTP_TRANSFER and marked on the socket. */
+   int         busyPollUs{0};              /**< Microseconds every wait for an acknowledgement spins before blocking, 0 for none. */
+   std::string localAddr;                  /**< Local address the socket is bound to, empty to let the kernel pick. */
+   std::string ticketFile;                 /**< File the ticket is kept in between runs, empty to keep it in memory. */
+   bool        earlyData{false};           /**< Send the first datagram of an upload with the CONNECT when a ticket allows it. */
+
+   std::vector<std::string> localAddrs; /**< Local addresses to upload from, one subflow each, two or more for multipath. */
+
    /**
     * @brief Constructs an FTPClient object.
     *
     * Initializes the FTP client with the specified file path, address, and port.
     *
     * @param filePath The file path for FTP operations.
-    * @param addr The address of the FTP server.
+    * @param addr The address of the FTP server, a host name or an IPv4 or IPv6 literal.
     * @param port The port number of the FTP server.
     */
    FTPClient(const std::string filePath, const char* addr, int port);
@@ -50,18 +309,80 @@ public:
    /**
     * @brief Connects to the FTP server.
     *
-    * Establishes a connection to the FTP server using the provided address and port.
+    * Establishes a connection to the FTP server using the provided address and port
+    * and negotiates the transfer options. When a cipher is requested the session key is
+    * agreed during the handshake and the connection fails if the server declines it.
+    *
+    * With earlyData and a ticket for a plain upload the CONNECT is held back, the upload sends
+    * it together with its first datagram and saves the round trip.
     *
     * @return int Returns 0 on success, or an error code on failure.
     */
    int connect();
 
+   /**
+    * @brief Creates a client with the same settings for another connection, to the same server or another one.
+    *
+    * @param addr The address of the server.
+    * @param port The port number of the server.
+    * @return FTPClient* The new client, not connected yet, the caller deletes it.
+    */
+   FTPClient* fork(const char* addr, int port) const;
+
+   /**
+    * @brief Uploads one file over the connection, connecting again first if the last upload closed it.
+    *
+    * Lets one client carry upload after upload, see ClientDaemon.
+    *
+    * @param path The local file, stored under its file name.
+    * @return bool True if the server verified the file or already had it.
+    */
+   bool push(const std::string& path);
+
+   /**
+    * @brief Uploads a stream, read to its end, like push() a file.
+    *
+    * @param f The stream, e.g. a RecordRing's.
+    * @param name The name to store it under.
+    * @return bool True if the server verified the upload.
+    */
+   bool push(FILE* f, const std::string& name);
+
    /**
     * @brief Starts the FTP operation.
     *
     * Overrides the start method from the FTP base class to begin FTP operations.
+    * A directory is uploaded as a tree, see sendTree().
+    *
+    * @return bool True if the server verified every file uploaded.
+    */
+   bool start() override;
+
+   /**
+    * @brief Downloads filePath from the server into the current directory.
+    *
+    * The server answers the GET from a port of its own, the connection follows it there.
+    * The copy is written to a temporary file beside the target and checked against the digest
+    * in the server's CLOSE. Only a verified copy is renamed over the target, a failed download
+    * leaves an existing file of that name untouched.
+    *
+    * @return bool True if the file was downloaded and verified.
+    */
+   bool get();
+
+   /**
+    * @brief Prints name, size, modification time and digest of every file on the server.
+    *
+    * @return bool True if the server answered.
+    */
+   bool list();
+
+   /**
+    * @brief Prints name, size, modification time and digest of filePath on the server.
+    *
+    * @return bool True if the server has the file.
     */
-   void start() override;
+   bool stat();
 };
 
 }  // namespace DrexelProtocol
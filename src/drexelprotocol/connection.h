@@ -11,14 +11,22 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <crypto/aead.h>
+#include <drexelprotocol/address.h>
 #include <drexelprotocol/msgtype.h>
+#include <drexelprotocol/xdp.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <iostream>
+#include <thread>
 #include <unordered_map>
 
 namespace DrexelProtocol
@@ -28,13 +36,13 @@ namespace DrexelProtocol
  * @brief Represents a socket address structure.
  *
  * This structure contains information about a socket address, including its length,
- * initialization status, and the sockaddr_in structure.
+ * initialization status, and the address itself, IPv4 or IPv6.
  */
 typedef struct
 {
-   socklen_t          len;        /**< The length of the socket address. */
-   bool               isAddrInit; /**< Indicates if the address is initialized. */
-   struct sockaddr_in addr;       /**< The socket address. */
+   socklen_t               len;        /**< The length of the socket address. */
+   bool                    isAddrInit; /**< Indicates if the address is initialized. */
+   struct sockaddr_storage addr;       /**< The socket address, its ss_family tells sockaddr_in from sockaddr_in6. */
 } Sock;
 
 /**
@@ -48,26 +56,89 @@ template <typename PDU>
 class Connection
 {
 public:
-   static constexpr int MAX_BUFF_SZ       = 512;                       /**< Maximum buffer size. */
-   static constexpr int MAX_DGRAM_SZ      = MAX_BUFF_SZ + sizeof(PDU); /**< Maximum datagram size. */
-   static constexpr int NO_ERROR          = 0;                         /**< No error. */
-   static constexpr int ERROR_GENERAL     = -1;                        /**< General error. */
-   static constexpr int ERROR_PROTOCOL    = -2;                        /**< Protocol error. */
-   static constexpr int ERROR_BAD_DGRAM   = -32;                       /**< Bad datagram error. */
-   static constexpr int BUFF_UNDERSIZED   = -4;                        /**< Buffer undersized error. */
-   static constexpr int BUFF_OVERSIZED    = -8;                        /**< Buffer oversized error. */
-   static constexpr int CONNECTION_CLOSED = -16;                       /**< Connection closed error. */
+   static constexpr int MAX_BUFF_SZ       = 512;                                        /**< Maximum buffer size. */
+   static constexpr int MAX_DGRAM_SZ      = MAX_BUFF_SZ + sizeof(PDU) + Crypto::TAG_SZ; /**< Maximum datagram size, room for an AEAD tag. */
+   static constexpr int NO_ERROR          = 0;                                          /**< No error. */
+   static constexpr int ERROR_GENERAL     = -1;                                         /**< General error. */
+   static constexpr int ERROR_PROTOCOL    = -2;                                         /**< Protocol error. */
+   static constexpr int ERROR_BAD_DGRAM   = -32;                                        /**< Bad datagram error. */
+   static constexpr int BUFF_UNDERSIZED   = -4;                                         /**< Buffer undersized error. */
+   static constexpr int BUFF_OVERSIZED    = -8;                                         /**< Buffer oversized error. */
+   static constexpr int CONNECTION_CLOSED = -16;                                        /**< Connection closed error. */
+   static constexpr int ERROR_REJECTED    = -64;                                        /**< Peer rejected the transfer at close. */
+   static constexpr int ERROR_AUTH        = -128;                                       /**< Datagram failed AEAD authentication. */
+   static constexpr int ERROR_BUSY        = -256;                                       /**< Peer is overloaded, the ERROR's dgram_sz is the milliseconds to wait. */
+   static constexpr int MAX_RETRIES       = 5;                                          /**< Retransmissions of a corrupted datagram. */
+   static constexpr int MAX_BUSY_RETRIES  = 30;                                         /**< CONNECTs refused with ERROR_BUSY before giving up. */
+   static constexpr int DGRAM_TRUESIZE    = 2048;                                       /**< Buffer space the kernel charges a full datagram, 1280 on loopback, up to 4096 on some NICs. */
 
 private:
-   int          udpSock;     /**< UDP socket. */
-   unsigned int seqNum;      /**< Sequence number. */
-   bool         connected;   /**< Connection status. */
-   int          dbgMode;     /**< Debug mode flag. */
-   Sock         outSockAddr; /**< Outgoing socket address. */
-   Sock         inSockAddr;  /**< Incoming socket address. */
+   int           udpSock;     /**< UDP socket. */
+   unsigned int  seqNum;      /**< Sequence number. */
+   bool          connected;   /**< Connection status. */
+   int           dbgMode;     /**< Debug mode flag. */
+   Sock          outSockAddr; /**< Outgoing socket address. */
+   Sock          inSockAddr;  /**< Incoming socket address. */
+   Crypto::Aead* aead;        /**< Seals outgoing payloads once a cipher is negotiated, owned. */
+   XdpDatapath*  datapath;    /**< Carries the raw datagrams instead of udpSock when set, not owned. */
+   int           busyPollUs;  /**< Microseconds a receive spins on the socket before blocking, 0 to block at once. */
+   uint32_t      drops;       /**< Datagrams the kernel dropped on a full receive buffer, as of the last SO_RXQ_OVFL report. */
+
+   /**
+    * @brief Encrypts the payload staged in _buffer behind its header and appends the tag.
+    *
+    * The header, with its checksum zeroed, is authenticated as associated data and the
+    * sequence number selects the nonce.
+    *
+    * @return int The number of tag bytes appended, 0 when no cipher is set, or ERROR_GENERAL.
+    */
+   int sealPayload();
+
+   /**
+    * @brief Receives the acknowledgement of a datagram, skipping stale ones.
+    *
+    * Stripe acknowledgements are skipped, and so are the late acknowledgements of earlier datagrams
+    * a retransmission leaves behind: an acknowledgement counts only if it carries next, an ERROR
+    * only if it names the datagram itself. Corrupted and timed out receives are returned as they are.
+    *
+    * @param pdu Receives the acknowledgement header.
+    * @param seqnum The sequence number of the datagram.
+    * @param next The sequence number that follows the datagram.
+    * @return int The number of bytes received, or an error code.
+    */
+   int recvAck(PDU* pdu, unsigned int seqnum, unsigned int next);
+
+   /**
+    * @brief Polls the socket without blocking until a datagram arrives or the budget is spent.
+    *
+    * @param buff The buffer to receive into.
+    * @param buffSz The size of the buffer.
+    * @param budgetUs How long to keep trying, in microseconds.
+    * @return int The number of bytes received, 0 once the budget is spent, or -1 on error.
+    */
+   int spinRecv(void* buff, int buffSz, int budgetUs);
+
+   /**
+    * @brief Receives one datagram from the socket, picking up the SO_RXQ_OVFL drop count on the way.
+    *
+    * @param buff The buffer to receive into.
+    * @param buffSz The size of the buffer.
+    * @param flags Flags for recvmsg().
+    * @return int What recvmsg() returned.
+    */
+   int recvDatagram(void* buff, int buffSz, int flags);
+
+   /**
+    * @brief Finishes a receive: reports errors, remembers the sender and traces the header.
+    *
+    * @param buff The received datagram.
+    * @param bytes What recvfrom() or the datapath returned.
+    * @return int bytes, or -1 on error.
+    */
+   int received(void* buff, int bytes);
 
 public:
-   std::unordered_map<std::string, unsigned int> seqNums; /**< Sequence numbers map. */
+   std::unordered_map<FlowKey, unsigned int> seqNums; /**< Sequence numbers map. */
 
    char _buffer[MAX_DGRAM_SZ]; /**< Buffer for datagrams. */
 
@@ -86,6 +157,57 @@ public:
     */
    void close();
 
+   /**
+    * @brief Encrypts every payload sent from now on.
+    *
+    * @param cipher The sending half of the negotiated cipher, the connection takes ownership.
+    */
+   void setAead(Crypto::Aead* cipher);
+
+   /**
+    * @brief Receives and sends the raw datagrams through an AF_XDP datapath.
+    *
+    * @param xdp The datapath, bound to this connection's port, or nullptr for the socket alone.
+    */
+   void setDatapath(XdpDatapath* xdp);
+
+   /**
+    * @brief Spins on the socket for a while before every blocking receive.
+    *
+    * Marks the socket with SO_BUSY_POLL and SO_PREFER_BUSY_POLL so the spin also polls the
+    * device queue. Raising SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN, without
+    * it only the spin in user space is done. On a single CPU the spin is left off.
+    *
+    * @param us The spin budget in microseconds, 0 to block at once.
+    */
+   void setBusyPoll(int us);
+
+   /**
+    * @brief Grows the socket's buffers, never shrinking them.
+    *
+    * SO_RCVBUFFORCE and SO_SNDBUFFORCE are tried first, they go past net.core.rmem_max and
+    * wmem_max when the process has CAP_NET_ADMIN. Otherwise the kernel caps the request.
+    *
+    * @param rcvBytes The receive buffer wanted, in bytes of kernel accounting, 0 to leave it.
+    * @param sndBytes The send buffer wanted, 0 to leave it.
+    * @return int The receive buffer the kernel granted.
+    */
+   int growBuffers(int rcvBytes, int sndBytes);
+
+   /**
+    * @brief Asks the kernel to report datagrams dropped on a full receive buffer, see kernelDrops().
+    */
+   void watchDrops();
+
+   /**
+    * @brief Gets the number of datagrams the kernel dropped on this socket's full receive buffer.
+    *
+    * The kernel only reports the count along with the next datagram that does get through.
+    *
+    * @return uint32_t The drops since the socket was opened, 0 unless watchDrops() was called.
+    */
+   uint32_t kernelDrops() const;
+
    /**
     * @brief Gets the incoming socket address.
     *
@@ -107,6 +229,13 @@ public:
     */
    int* getUdpSock();
 
+   /**
+    * @brief Continues the sequence numbers of a session another connection started.
+    *
+    * @param seq The sequence number the peer expects next.
+    */
+   void setSeqNum(unsigned int seq);
+
    /**
     * @brief Gets the maximum datagram size.
     *
@@ -135,12 +264,40 @@ public:
    /**
     * @brief Sends a datagram from a buffer.
     *
+    * The datagram is retransmitted, up to MAX_RETRIES times, when the peer reports that it
+    * failed its checksum or when the acknowledgement itself arrives corrupted. With a cipher
+    * set the payload travels encrypted with its tag appended. A datagram refused with ERROR_BUSY
+    * is sent again once the delay the peer asked for has passed, as often as it takes.
+    *
     * @param sbuff The buffer to send data from.
     * @param sbuff_sz The size of the buffer.
     * @return int The number of bytes sent, or an error code.
     */
    int sendDgram(void* sbuff, int sbuff_sz);
 
+   /**
+    * @brief Sends a datagram without waiting for its acknowledgement.
+    *
+    * The datagram consumes sequence numbers like any other, the caller collects whatever
+    * acknowledgement the peer sends for it with recvTimed().
+    *
+    * @param sbuff The payload.
+    * @param sbuff_sz The size of the payload, at most MAX_BUFF_SZ.
+    * @param mtype The MsgType to stamp on it.
+    * @return int The number of payload bytes sent, or an error code.
+    */
+   int sendUnacked(void* sbuff, int sbuff_sz, int mtype);
+
+   /**
+    * @brief Receives a raw datagram, giving up after a timeout.
+    *
+    * @param buff The buffer to receive data into.
+    * @param buff_sz The size of the buffer.
+    * @param timeoutMs How long to wait in milliseconds.
+    * @return int The number of bytes received, 0 on timeout, or an error code.
+    */
+   int recvTimed(void* buff, int buff_sz, int timeoutMs);
+
    /**
     * @brief Receives a raw datagram into a buffer.
     *
@@ -165,12 +322,27 @@ public:
    /**
     * @brief Sends a raw datagram from a buffer.
     *
+    * The buffer must start with a PDU, its checksum is sealed over the header and payload before sending.
+    *
     * @param sbuff The buffer to send data from.
     * @param sbuff_sz The size of the buffer.
     * @return int The number of bytes sent, or an error code.
     */
    int sendRaw(void* sbuff, int sbuff_sz);
 
+   /**
+    * @brief Sends a raw datagram to a given peer.
+    *
+    * Unlike sendRaw() the connection's own peer is neither used nor changed, so another thread can
+    * answer a peer on the socket while the owner keeps receiving on it.
+    *
+    * @param sbuff The buffer to send data from, starting with a PDU.
+    * @param sbuff_sz The size of the buffer.
+    * @param to The peer to send it to.
+    * @return int The number of bytes sent, or an error code.
+    */
+   int sendTo(void* sbuff, int sbuff_sz, const Sock& to);
+
    /**
     * @brief Listens for incoming connections.
     *
@@ -181,16 +353,32 @@ public:
    /**
     * @brief Establishes a connection.
     *
+    * The optional payload carries the options the application wants to negotiate, on success it is
+    * overwritten with the options the peer accepted (zeroed if the peer sent none back). A peer
+    * that refuses with ERROR_BUSY is asked again after the delay it names, up to MAX_BUSY_RETRIES times.
+    *
+    * Early data follows the options in the same datagram. A peer that takes it counts it like a
+    * datagram sent after the handshake and says so with the sequence number of its CNTACK.
+    *
+    * @param opts The options to offer, or nullptr.
+    * @param optsSz The size of the options.
+    * @param early Data to send along with the CONNECT, or nullptr.
+    * @param earlySz The size of the early data.
     * @return int The status of the connect operation.
     */
-   int connect();
+   int connect(void* opts = nullptr, int optsSz = 0, const void* early = nullptr, int earlySz = 0);
 
    /**
     * @brief Disconnects the connection.
     *
-    * @return int The status of the disconnect operation.
+    * An optional payload rides along with the CLOSE, which lets the application hand its peer
+    * a final verdict to check (e.g. the whole-file digest).
+    *
+    * @param sbuff The payload to send with the CLOSE, or nullptr.
+    * @param sbuff_sz The size of the payload.
+    * @return int CONNECTION_CLOSED on success, ERROR_REJECTED if the peer refused the close, or an error code.
     */
-   int disconnect();
+   int disconnect(void* sbuff = nullptr, int sbuff_sz = 0);
 
    /**
     * @brief Generates a random number with a threshold.
@@ -232,19 +420,129 @@ int Connection<PDU>::rand(int threshold)
 }
 
 template <typename PDU>
-Connection<PDU>::Connection() : udpSock(0), seqNum(0), connected(false), dbgMode(1)
+Connection<PDU>::Connection() : udpSock(0), seqNum(0), connected(false), dbgMode(1), aead(nullptr), datapath(nullptr), busyPollUs(0), drops(0)
 {}
 
 template <typename PDU>
 Connection<PDU>::~Connection()
 {
    close();
+   delete aead;
 }
 
 template <typename PDU>
 void Connection<PDU>::close()
 {
-   ::close(udpSock);
+   // disconnect() closes early and the destructor closes again, the descriptor may have been reused by then.
+   if (udpSock > 0)
+      ::close(udpSock);
+   udpSock   = -1;
+   connected = false;
+}
+
+template <typename PDU>
+void Connection<PDU>::setAead(Crypto::Aead* cipher)
+{
+   delete aead;
+   aead = cipher;
+}
+
+template <typename PDU>
+void Connection<PDU>::setDatapath(XdpDatapath* xdp)
+{
+   datapath = xdp;
+}
+
+template <typename PDU>
+void Connection<PDU>::setBusyPoll(int us)
+{
+   busyPollUs = 0;
+   if (us <= 0)
+      return;
+
+   // With a single CPU the spin only keeps the peer, or the thread that would answer us, off it.
+   if (std::thread::hardware_concurrency() < 2)
+   {
+      std::cerr << "Busy polling needs more than one CPU, blocking instead" << std::endl;
+      return;
+   }
+
+   busyPollUs = us;
+
+   int prefer = 1;
+   if (setsockopt(udpSock, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) < 0)
+      perror("setsockopt(SO_BUSY_POLL) failed, spinning in user space only");
+   else if (setsockopt(udpSock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) < 0)
+      perror("setsockopt(SO_PREFER_BUSY_POLL) failed");
+}
+
+template <typename PDU>
+int Connection<PDU>::growBuffers(int rcvBytes, int sndBytes)
+{
+   struct
+   {
+      int want;
+      int option;
+      int forced;
+   } buffers[] = {{rcvBytes, SO_RCVBUF, SO_RCVBUFFORCE}, {sndBytes, SO_SNDBUF, SO_SNDBUFFORCE}};
+
+   for (auto& buffer : buffers)
+   {
+      int       have   = 0;
+      socklen_t haveSz = sizeof(have);
+      if (buffer.want <= 0 || getsockopt(udpSock, SOL_SOCKET, buffer.option, &have, &haveSz) < 0 || have >= buffer.want)
+         continue;
+
+      // The kernel doubles the value it is given, what it reports back is already doubled.
+      int half = buffer.want / 2;
+      if (setsockopt(udpSock, SOL_SOCKET, buffer.forced, &half, sizeof(half)) < 0 &&
+          setsockopt(udpSock, SOL_SOCKET, buffer.option, &half, sizeof(half)) < 0)
+         perror("setsockopt(SO_RCVBUF/SO_SNDBUF) failed");
+   }
+
+   int       granted   = 0;
+   socklen_t grantedSz = sizeof(granted);
+   getsockopt(udpSock, SOL_SOCKET, SO_RCVBUF, &granted, &grantedSz);
+   return granted;
+}
+
+template <typename PDU>
+void Connection<PDU>::watchDrops()
+{
+   int on = 1;
+   if (setsockopt(udpSock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0)
+      perror("setsockopt(SO_RXQ_OVFL) failed");
+}
+
+template <typename PDU>
+uint32_t Connection<PDU>::kernelDrops() const
+{
+   return drops;
+}
+
+template <typename PDU>
+int Connection<PDU>::sealPayload()
+{
+   if (aead == nullptr)
+      return 0;
+
+   PDU*  outPdu     = (PDU*) _buffer;
+   char* payload    = _buffer + sizeof(PDU);
+   outPdu->checksum = 0;
+
+   if (!aead->seal(outPdu->seqnum, outPdu, sizeof(PDU), payload, outPdu->dgram_sz, (uint8_t*) payload + outPdu->dgram_sz))
+   {
+      std::cerr << "ERROR: cannot encrypt seq " << outPdu->seqnum << std::endl;
+      return ERROR_GENERAL;
+   }
+
+   return Crypto::TAG_SZ;
+}
+
+template <typename PDU>
+void Connection<PDU>::setSeqNum(unsigned int seq)
+{
+   seqNum = seq;
 }
 
 template <typename PDU>
@@ -267,6 +565,8 @@ int Connection<PDU>::recv(void* buff, int buffSz)
 
       if (rcvLen == CONNECTION_CLOSED)
          return CONNECTION_CLOSED;
+      if (rcvLen < 0)
+         continue;  // the peer was asked to retransmit
 
       int copied = (total + (rcvLen - sizeof(PDU)) > buffSz) ? (buffSz - total) : rcvLen - sizeof(PDU);
       memcpy(rPtr, _buffer + sizeof(PDU), copied);
@@ -279,6 +579,85 @@ int Connection<PDU>::recv(void* buff, int buffSz)
    return total;
 }
 
+template <typename PDU>
+int Connection<PDU>::recvAck(PDU* pdu, unsigned int seqnum, unsigned int next)
+{
+   while (true)
+   {
+      int bytesIn = recvRaw(pdu, sizeof(PDU));
+      if (bytesIn != sizeof(PDU) || !pdu->verify(nullptr, 0))
+         return bytesIn;
+
+      if ((pdu->mtype & MsgType::FEC) == MsgType::FEC)
+         continue;
+
+      // Taking the late acknowledgement of a resent datagram for this one would move on before the peer has it.
+      unsigned int acked = (pdu->mtype == MsgType::ERROR) ? seqnum : next;
+      if ((unsigned int) pdu->seqnum == acked)
+         return bytesIn;
+
+      std::cerr << "Stale acknowledgement " << pdu->seqnum << " while waiting for " << acked << ", dropped" << std::endl;
+   }
+}
+
+template <typename PDU>
+int Connection<PDU>::recvTimed(void* buff, int buffSz, int timeoutMs)
+{
+   struct pollfd pfd = {udpSock, POLLIN, 0};
+
+   // An acknowledgement arriving within the spin budget is taken without going to sleep in poll().
+   if (busyPollUs > 0 && timeoutMs > 0 && datapath == nullptr)
+   {
+      int bytes = spinRecv(buff, buffSz, std::min(busyPollUs, timeoutMs * 1000));
+      if (bytes != 0)
+         return received(buff, bytes);
+   }
+
+   int ready = poll(&pfd, 1, timeoutMs);
+   if (ready < 0)
+   {
+      perror("recvTimed: poll failed");
+      return ERROR_GENERAL;
+   }
+   if (ready == 0)
+      return 0;
+
+   return recvRaw(buff, buffSz);
+}
+
+template <typename PDU>
+int Connection<PDU>::sendUnacked(void* sbuff, int sbuff_sz, int mtype)
+{
+   if (!outSockAddr.isAddrInit)
+   {
+      perror("sendUnacked: connection not setup properly");
+      return ERROR_GENERAL;
+   }
+   if (sbuff_sz > MAX_BUFF_SZ)
+      return BUFF_OVERSIZED;
+
+   PDU* outPdu      = (PDU*) _buffer;
+   outPdu->seqnum   = seqNum;
+   outPdu->mtype    = mtype;
+   outPdu->dgram_sz = sbuff_sz;
+   outPdu->err_num  = NO_ERROR;
+
+   memcpy(_buffer + sizeof(PDU), sbuff, sbuff_sz);
+
+   int tagSz = sealPayload();
+   if (tagSz < 0)
+      return ERROR_GENERAL;
+
+   int totalSendSz = sbuff_sz + sizeof(PDU) + tagSz;
+   if (sendRaw(_buffer, totalSendSz) != totalSendSz)
+      return ERROR_GENERAL;
+
+   // Every datagram takes fresh sequence numbers, which also keeps the AEAD nonces unique across resends.
+   seqNum += (sbuff_sz == 0) ? 1 : sbuff_sz;
+
+   return sbuff_sz;
+}
+
 template <typename PDU>
 int Connection<PDU>::recvDgram(void* buff, int buffSz)
 {
@@ -297,18 +676,13 @@ int Connection<PDU>::recvDgram(void* buff, int buffSz)
    memcpy(&inPdu, buff, sizeof(PDU));
    if (inPdu.dgram_sz > buffSz)
       errCode = BUFF_UNDERSIZED;
+   else if (errCode == NO_ERROR && !inPdu.verify((char*) buff + sizeof(PDU), bytesIn - sizeof(PDU)))
+      errCode = ERROR_BAD_DGRAM;
 
-   if (errCode == NO_ERROR)
-   {
-      if (inPdu.dgram_sz == 0)
-         seqNum++;
-      else
-         seqNum += inPdu.dgram_sz;
-   }
-   else
-   {
-      seqNum++;
-   }
+   // A resend after a lost acknowledgement is acknowledged again without being counted twice.
+   bool duplicate = (int) (inPdu.seqnum - seqNum) < 0;
+   if (errCode == NO_ERROR && !duplicate)
+      seqNum = inPdu.seqnum + ((inPdu.dgram_sz == 0) ? 1 : inPdu.dgram_sz);
 
    PDU outPdu;
    outPdu.dgram_sz = 0;
@@ -322,6 +696,7 @@ int Connection<PDU>::recvDgram(void* buff, int buffSz)
       actSndSz     = sendRaw(&outPdu, sizeof(PDU));
       if (actSndSz != sizeof(PDU))
          return ERROR_PROTOCOL;
+      return errCode;
    }
 
    else if ((inPdu.mtype & MsgType::FRAGMENT) == MsgType::FRAGMENT)
@@ -367,8 +742,68 @@ int Connection<PDU>::recvRaw(void* buff, int buffSz)
       return -1;
    }
 
-   bytes = recvfrom(udpSock, (char*) buff, buffSz, MSG_WAITALL, (struct sockaddr*) &(outSockAddr.addr), &(outSockAddr.len));
+   if (datapath != nullptr)
+   {
+      bytes = datapath->recv(buff, buffSz, outSockAddr.addr, outSockAddr.len);
+   }
+   else
+   {
+      bytes = (busyPollUs > 0) ? spinRecv(buff, buffSz, busyPollUs) : 0;
+      if (bytes == 0)
+         bytes = recvDatagram(buff, buffSz, MSG_WAITALL);
+   }
 
+   return received(buff, bytes);
+}
+
+template <typename PDU>
+int Connection<PDU>::spinRecv(void* buff, int buffSz, int budgetUs)
+{
+   auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(budgetUs);
+
+   do
+   {
+      int bytes = recvDatagram(buff, buffSz, MSG_DONTWAIT);
+      if (bytes > 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+         return bytes;
+   } while (std::chrono::steady_clock::now() < deadline);
+
+   return 0;
+}
+
+template <typename PDU>
+int Connection<PDU>::recvDatagram(void* buff, int buffSz, int flags)
+{
+   char          control[CMSG_SPACE(sizeof(uint32_t))];
+   struct iovec  iov = {buff, (size_t) buffSz};
+   struct msghdr msg;
+
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_name       = &outSockAddr.addr;
+   msg.msg_namelen    = sizeof(outSockAddr.addr);
+   msg.msg_iov        = &iov;
+   msg.msg_iovlen     = 1;
+   msg.msg_control    = control;
+   msg.msg_controllen = sizeof(control);
+
+   int bytes = recvmsg(udpSock, &msg, flags);
+   if (bytes < 0)
+      return bytes;
+   outSockAddr.len = msg.msg_namelen;
+
+   // Only attached once something was dropped, the count covers the socket's whole life.
+   for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+   {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+         memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+   }
+
+   return bytes;
+}
+
+template <typename PDU>
+int Connection<PDU>::received(void* buff, int bytes)
+{
    if (bytes < 0)
    {
       perror("recv: received error from recvfrom()");
@@ -431,45 +866,89 @@ int Connection<PDU>::sendDgram(void* sbuff, int sbuff_sz)
    outPdu->seqnum   = seqNum;
    outPdu->mtype    = (sbuff_sz > MAX_BUFF_SZ) ? MsgType::SENDFRAGMENT : MsgType::SND;
    outPdu->dgram_sz = sbuff_sz > MAX_BUFF_SZ ? MAX_BUFF_SZ : sbuff_sz;
+   outPdu->err_num  = NO_ERROR;
 
    memcpy((_buffer + sizeof(PDU)), sbuff, outPdu->dgram_sz);
 
-   int totalSendSz = outPdu->dgram_sz + sizeof(PDU);
-   bytesOut        = sendRaw(_buffer, totalSendSz);
+   // Sealed once, a retransmission resends the same ciphertext under the same nonce.
+   int tagSz = sealPayload();
+   if (tagSz < 0)
+      return ERROR_GENERAL;
+
+   int          totalSendSz = outPdu->dgram_sz + sizeof(PDU) + tagSz;
+   unsigned int next        = seqNum + ((outPdu->dgram_sz == 0) ? 1 : outPdu->dgram_sz);
 
-   if (bytesOut != totalSendSz)
+   for (int attempt = 0; attempt <= MAX_RETRIES; attempt++)
    {
-      std::cerr << "Warning send " << bytesOut << ", but expected " << totalSendSz << "!" << std::endl;
-   }
+      bytesOut = sendRaw(_buffer, totalSendSz);
 
-   if (outPdu->dgram_sz == 0)
-      seqNum++;
-   else
-      seqNum += outPdu->dgram_sz;
+      if (bytesOut != totalSendSz)
+      {
+         std::cerr << "Warning send " << bytesOut << ", but expected " << totalSendSz << "!" << std::endl;
+      }
 
-   PDU inPdu   = {0};
-   int bytesIn = recvRaw(&inPdu, sizeof(PDU));
-   if ((bytesIn < sizeof(PDU)) && (inPdu.mtype != MsgType::SNDACK))
-   {
-      std::cerr << "Expected SND/ACK but got a different mtype " << inPdu.mtype << std::endl;
+      PDU inPdu   = {0};
+      int bytesIn = recvAck(&inPdu, seqNum, next);
+
+      if (bytesIn != sizeof(PDU) || !inPdu.verify(nullptr, 0))
+      {
+         std::cerr << "Corrupted acknowledgement for seq " << outPdu->seqnum << ", retransmitting" << std::endl;
+         continue;
+      }
+
+      if (inPdu.mtype == MsgType::ERROR && inPdu.err_num == ERROR_BUSY)
+      {
+         // Throttled, not lost: waiting does not use up a retransmission.
+         std::this_thread::sleep_for(std::chrono::milliseconds(inPdu.dgram_sz));
+         attempt--;
+         continue;
+      }
+
+      if (inPdu.mtype == MsgType::ERROR)
+      {
+         if (inPdu.err_num != ERROR_BAD_DGRAM)
+            return inPdu.err_num;
+
+         std::cerr << "Peer rejected seq " << outPdu->seqnum << " (bad checksum), retransmitting" << std::endl;
+         continue;
+      }
+
+      if ((inPdu.mtype & MsgType::SNDACK) != MsgType::SNDACK)
+      {
+         std::cerr << "Expected SND/ACK but got a different mtype " << inPdu.mtype << std::endl;
+      }
+
+      seqNum = next;
+      return bytesOut - sizeof(PDU) - tagSz;
    }
 
-   return bytesOut - sizeof(PDU);
+   std::cerr << "ERROR: giving up on seq " << outPdu->seqnum << " after " << MAX_RETRIES << " retransmissions" << std::endl;
+   return ERROR_GENERAL;
 }
 
 template <typename PDU>
 int Connection<PDU>::sendRaw(void* sbuff, int sbuff_sz)
 {
-   int bytesOut = 0;
-
    if (!outSockAddr.isAddrInit)
    {
       perror("sendRaw: connection not setup properly");
       return -1;
    }
 
+   return sendTo(sbuff, sbuff_sz, outSockAddr);
+}
+
+template <typename PDU>
+int Connection<PDU>::sendTo(void* sbuff, int sbuff_sz, const Sock& to)
+{
+   int bytesOut = 0;
+
    PDU* outPdu = (PDU*) sbuff;
-   bytesOut    = sendto(udpSock, (const char*) sbuff, sbuff_sz, 0, (const struct sockaddr*) &(outSockAddr.addr), outSockAddr.len);
+   outPdu->seal((char*) sbuff + sizeof(PDU), sbuff_sz - sizeof(PDU));
+   if (datapath != nullptr)
+      bytesOut = datapath->send(sbuff, sbuff_sz, to.addr, to.len);
+   else
+      bytesOut = sendto(udpSock, (const char*) sbuff, sbuff_sz, 0, (const struct sockaddr*) &(to.addr), to.len);
 
    outPdu->printOut(dbgMode);
 
@@ -522,7 +1001,7 @@ bool Connection<PDU>::isConnected()
 }
 
 template <typename PDU>
-int Connection<PDU>::connect()
+int Connection<PDU>::connect(void* opts, int optsSz, const void* early, int earlySz)
 {
    int sndSz, rcvSz;
 
@@ -532,31 +1011,63 @@ int Connection<PDU>::connect()
       return ERROR_GENERAL;
    }
 
-   PDU pdu      = {0};
-   pdu.mtype    = MsgType::CONNECT;
-   pdu.seqnum   = seqNum;
-   pdu.dgram_sz = 0;
+   if (optsSz + earlySz > MAX_BUFF_SZ)
+      return BUFF_OVERSIZED;
 
-   sndSz = sendRaw(&pdu, sizeof(pdu));
-   if (sndSz != sizeof(PDU))
+   PDU* pdu = (PDU*) _buffer;
+
+   for (int attempt = 0;; attempt++)
    {
-      perror("connect: Wrong amount of connection data sent");
-      return -1;
+      pdu->mtype    = MsgType::CONNECT;
+      pdu->seqnum   = seqNum;
+      pdu->dgram_sz = optsSz + earlySz;
+      pdu->err_num  = NO_ERROR;
+
+      if (optsSz > 0)
+         memcpy(_buffer + sizeof(PDU), opts, optsSz);
+      if (earlySz > 0)
+         memcpy(_buffer + sizeof(PDU) + optsSz, early, earlySz);
+
+      sndSz = sendRaw(_buffer, sizeof(PDU) + optsSz + earlySz);
+      if (sndSz != (int) sizeof(PDU) + optsSz + earlySz)
+      {
+         perror("connect: Wrong amount of connection data sent");
+         return -1;
+      }
+
+      rcvSz = recvRaw(_buffer, sizeof(_buffer));
+      if (rcvSz < (int) sizeof(PDU) || !pdu->verify(_buffer + sizeof(PDU), rcvSz - sizeof(PDU)))
+      {
+         perror("connect: Wrong amount of connection data received");
+         return -1;
+      }
+      if (pdu->mtype != MsgType::ERROR || pdu->err_num != ERROR_BUSY)
+         break;
+
+      if (attempt == MAX_BUSY_RETRIES)
+      {
+         std::cerr << "ERROR: server still busy after " << MAX_BUSY_RETRIES << " attempts" << std::endl;
+         return ERROR_BUSY;
+      }
+      std::cerr << "Server busy, retrying in " << pdu->dgram_sz << " ms" << std::endl;
+      std::this_thread::sleep_for(std::chrono::milliseconds(pdu->dgram_sz));
    }
 
-   rcvSz = recvRaw(&pdu, sizeof(pdu));
-   if (rcvSz != sizeof(PDU))
+   if (pdu->mtype != MsgType::CNTACK)
    {
-      perror("connect: Wrong amount of connection data received");
+      perror("connect: Expected CNTACT Message but didn't get it");
       return -1;
    }
-   if (pdu.mtype != MsgType::CNTACK)
+
+   if (optsSz > 0)
    {
-      perror("connect: Expected CNTACT Message but didn't get it");
-      return -1;
+      int accepted = rcvSz - (int) sizeof(PDU);
+      memset(opts, 0, optsSz);
+      memcpy(opts, _buffer + sizeof(PDU), (accepted < optsSz) ? accepted : optsSz);
    }
 
-   seqNum++;
+   // Early data the peer took moved its sequence number past it.
+   seqNum    = (earlySz > 0) ? pdu->seqnum : seqNum + 1;
    connected = true;
    std::cout << "Connection established OK!" << std::endl;
 
@@ -564,36 +1075,55 @@ int Connection<PDU>::connect()
 }
 
 template <typename PDU>
-int Connection<PDU>::disconnect()
+int Connection<PDU>::disconnect(void* sbuff, int sbuff_sz)
 {
    int sndSz, rcvSz;
 
-   PDU pdu      = {};
-   pdu.mtype    = MsgType::CLOSE;
-   pdu.seqnum   = seqNum;
-   pdu.dgram_sz = 0;
+   if (sbuff_sz > MAX_BUFF_SZ)
+      return BUFF_OVERSIZED;
 
-   sndSz = sendRaw(&pdu, sizeof(pdu));
-   if (sndSz != sizeof(PDU))
-   {
-      perror("disconnect: Wrong amount of connection data sent");
+   PDU* pdu      = (PDU*) _buffer;
+   pdu->mtype    = MsgType::CLOSE;
+   pdu->seqnum   = seqNum;
+   pdu->dgram_sz = sbuff_sz;
+   pdu->err_num  = NO_ERROR;
+
+   if (sbuff_sz > 0)
+      memcpy(_buffer + sizeof(PDU), sbuff, sbuff_sz);
+
+   int tagSz = sealPayload();
+   if (tagSz < 0)
       return ERROR_GENERAL;
-   }
 
-   rcvSz = recvRaw(&pdu, sizeof(pdu));
-   if (rcvSz != sizeof(PDU))
+   PDU inPdu = {};
+   for (int attempt = 0; attempt <= MAX_RETRIES; attempt++)
    {
-      perror("disconnect: Wrong amount of connection data received");
-      return ERROR_GENERAL;
+      sndSz = sendRaw(_buffer, sizeof(PDU) + sbuff_sz + tagSz);
+      if (sndSz != (int) sizeof(PDU) + sbuff_sz + tagSz)
+      {
+         perror("disconnect: Wrong amount of connection data sent");
+         return ERROR_GENERAL;
+      }
+
+      rcvSz = recvAck(&inPdu, seqNum, seqNum + ((sbuff_sz == 0) ? 1 : sbuff_sz));
+      if (rcvSz != sizeof(PDU))
+      {
+         perror("disconnect: Wrong amount of connection data received");
+         return ERROR_GENERAL;
+      }
+      if (inPdu.mtype != MsgType::ERROR || inPdu.err_num != ERROR_BAD_DGRAM)
+         break;
+
+      std::cerr << "Peer rejected CLOSE (bad checksum), retransmitting" << std::endl;
    }
-   if (pdu.mtype != MsgType::CLOSEACK)
+   if (inPdu.mtype != MsgType::CLOSEACK)
    {
-      perror("disconnect: Expected CNTACT Message but didn't get it");
+      perror("disconnect: Expected CLOSEACK Message but didn't get it");
       return ERROR_GENERAL;
    }
    close();
 
-   return CONNECTION_CLOSED;
+   return (inPdu.err_num == NO_ERROR) ? CONNECTION_CLOSED : ERROR_REJECTED;
 }
 
 template <typename PDU>
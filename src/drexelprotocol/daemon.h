@@ -0,0 +1,147 @@
+/**
+ * @file daemon.h
+ * @brief Declares the long-lived client daemon and the jobs local programs hand it.
+ *
+ * @section Description
+ * A process per upload pays for its startup, the resolution of the server's name and a
+ * CONNECT/CNTACK round trip before the first byte leaves. The daemon pays them once: it keeps
+ * an FTPClient per server between jobs, with its socket open and the session ticket of its last
+ * CNTACK, so the next upload to the same server sends its first datagram with the CONNECT.
+ *
+ * Jobs arrive over a Unix SOCK_SEQPACKET socket, one UploadJob per connection, and run on a
+ * ThreadPool of uploadStreams threads. The submitter's connection stays open until the job is
+ * done and receives its UploadResult. A client is used by one job at a time, a burst of jobs
+ * to one server opens one client per job in flight and they all stay warm for the next burst.
+ *
+ * Instead of a file a job may bring a RecordRing, its memfd passed as SCM_RIGHTS with the job. The
+ * daemon uploads what the producer writes into the ring as it comes, with no file on either side,
+ * and stops waiting for more when the producer closes the ring or its job socket hangs up.
+ */
+
+#pragma once
+
+#include <drexelprotocol/client.h>
+#include <drexelprotocol/ftp.h>
+#include <drexelprotocol/ring.h>
+
+#include <climits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "threadpool/threadpool.h"
+
+namespace DrexelProtocol
+{
+
+/**
+ * @struct UploadJob
+ * @brief What a local program asks the daemon to upload.
+ */
+struct UploadJob
+{
+   char path[PATH_MAX]; /**< The local file, absolute or relative to the daemon's directory, or the name of a ring's upload. */
+   char server[256];    /**< Host name or address of the server. */
+   int  port;           /**< Port of the server. */
+   bool ring;           /**< The data comes from the RecordRing sent with the job, stored under path. */
+};
+
+/**
+ * @struct UploadResult
+ * @brief The daemon's answer once a job is done.
+ */
+struct UploadResult
+{
+   int err; /**< Error::NONE if the server verified the file, Error::FILE_NOT_FOUND or Error::UNKOWN otherwise. */
+};
+
+/**
+ * @class ClientDaemon
+ * @brief Runs uploads for local programs over clients it keeps between jobs.
+ */
+class ClientDaemon
+{
+private:
+   const FTPClient& settings;       /**< Template of every client, forked per server. */
+   std::string      socketPath;     /**< Where the jobs come in. */
+   int              listenSock{-1}; /**< The Unix socket accepting submitters. */
+   ThreadPool*      jobs;           /**< Runs the uploads. */
+   std::mutex       idleLock;       /**< Guards idle. */
+
+   std::unordered_map<std::string, std::vector<FTPClient*>> idle; /**< Clients not in use, by "host port". */
+
+   /**
+    * @brief Reads a job from a submitter's connection on a pool thread and runs it.
+    *
+    * @param conn The submitter's connection, closed once answered or if no valid job arrives in time.
+    */
+   void serveJob(int conn);
+
+   /**
+    * @brief Runs one job and answers its submitter.
+    *
+    * @param conn The submitter's connection, closed once answered.
+    * @param job The job it sent.
+    * @param ringFd The memfd of a ring job, -1 for a file.
+    */
+   void runJob(int conn, const UploadJob& job, int ringFd);
+
+public:
+   /**
+    * @brief Binds the job socket, replacing a stale one a previous daemon left behind.
+    *
+    * @param socketPath Path of the Unix socket.
+    * @param settings Options of every upload, only its settings are used, it is never connected.
+    * @param uploadStreams Uploads running at the same time.
+    */
+   ClientDaemon(const std::string& socketPath, const FTPClient& settings, unsigned uploadStreams);
+
+   /**
+    * @brief Waits for the running jobs, closes the clients and removes the socket.
+    */
+   ~ClientDaemon();
+
+   /**
+    * @brief Checks that the job socket is listening.
+    *
+    * @return bool False if it could not be bound.
+    */
+   bool validate() const;
+
+   /**
+    * @brief Accepts jobs until the process is stopped.
+    */
+   void run();
+
+   /**
+    * @brief Hands a job to a running daemon without waiting for it.
+    *
+    * @param socketPath Path of the daemon's socket.
+    * @param job The upload.
+    * @param ringFd The memfd of a RecordRing for a ring job, -1 for a file. The daemon gets a copy.
+    * @return int The job's connection for awaitJob(), -1 if the daemon could not be reached.
+    */
+   static int startJob(const std::string& socketPath, const UploadJob& job, int ringFd = -1);
+
+   /**
+    * @brief Waits for the result of a job and closes its connection.
+    *
+    * @param conn The connection startJob() returned.
+    * @param result Receives the daemon's answer.
+    * @return bool False if the daemon hung up before answering.
+    */
+   static bool awaitJob(int conn, UploadResult& result);
+
+   /**
+    * @brief Hands a job to a running daemon and waits for its result.
+    *
+    * @param socketPath Path of the daemon's socket.
+    * @param job The upload.
+    * @param result Receives the daemon's answer.
+    * @return bool False if the daemon could not be reached or hung up before answering.
+    */
+   static bool submit(const std::string& socketPath, const UploadJob& job, UploadResult& result);
+};
+
+}  // namespace DrexelProtocol
@@ -0,0 +1,164 @@
+/**
+ * @file directio.h
+ * @brief Declares the O_DIRECT write path the server uses for large uploads.
+ *
+ * @section Description
+ * A multi-gigabyte upload written through the page cache evicts everything else on the machine
+ * only to be written back and never read again. With O_DIRECT the data goes from our buffer to
+ * the device, but every write must start at an aligned offset from an aligned buffer and cover
+ * a multiple of the block size.
+ *
+ * DirectWriter fills one aligned buffer while the other is being written with aio_write, so the
+ * disk and the network are busy at the same time. The buffers come from an AlignedPool shared by
+ * all uploads, so a busy server does not allocate and free a megabyte per file. The unaligned tail of
+ * the file is written through the page cache once the last aligned block is out.
+ */
+
+#pragma once
+
+#include <aio.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace DrexelProtocol
+{
+
+/**
+ * @class AlignedPool
+ * @brief Hands out equally sized buffers aligned for O_DIRECT and keeps returned ones for reuse.
+ */
+class AlignedPool
+{
+private:
+   size_t             bufferSz; /**< Size of every buffer, a multiple of ALIGN. */
+   size_t             keep;     /**< Returned buffers kept for reuse, the rest are freed. */
+   std::mutex         mutex;    /**< Guards spare. */
+   std::vector<char*> spare;    /**< Buffers ready to be handed out again. */
+
+public:
+   static constexpr size_t ALIGN = 4096; /**< Alignment of buffers, offsets and lengths of direct writes. */
+
+   /**
+    * @brief Constructs an empty pool, buffers are allocated on demand.
+    *
+    * @param bufferSz The size of every buffer, rounded up to a multiple of ALIGN.
+    * @param keep How many returned buffers to keep.
+    */
+   AlignedPool(size_t bufferSz, size_t keep);
+
+   /**
+    * @brief Frees the spare buffers, every acquired buffer must have been released.
+    */
+   ~AlignedPool();
+
+   AlignedPool(const AlignedPool&)            = delete;
+   AlignedPool& operator=(const AlignedPool&) = delete;
+
+   /**
+    * @brief Takes a buffer from the pool.
+    *
+    * @return char* An ALIGN aligned buffer of bufferSize() bytes, or nullptr if none could be allocated.
+    */
+   char* acquire();
+
+   /**
+    * @brief Gives a buffer back to the pool.
+    *
+    * @param buffer A buffer from acquire(), or nullptr.
+    */
+   void release(char* buffer);
+
+   /**
+    * @brief The size of the buffers.
+    *
+    * @return size_t Bytes per buffer.
+    */
+   size_t bufferSize() const;
+};
+
+/**
+ * @class DirectWriter
+ * @brief Appends to a file opened with O_DIRECT through two buffers written asynchronously.
+ */
+class DirectWriter
+{
+private:
+   int          fd;                    /**< The file, O_DIRECT set. */
+   AlignedPool& pool;                  /**< Where the buffers come from. */
+   char*        buffers[2]{};          /**< The buffer being filled and the one being written. */
+   struct aiocb io[2];                 /**< The write of each buffer. */
+   bool         busy[2]{false, false}; /**< A write of the buffer is in flight. */
+   int          current{0};            /**< The buffer being filled. */
+   size_t       fill{0};               /**< Bytes in the current buffer. */
+   off_t        offset{0};             /**< File offset of the current buffer. */
+   bool         failed{false};         /**< A write failed, the file is incomplete. */
+
+   /**
+    * @brief Waits for the write of a buffer to complete.
+    *
+    * @param idx The buffer.
+    * @return bool False if the write failed or came up short.
+    */
+   bool wait(int idx);
+
+   /**
+    * @brief Starts writing the full current buffer and switches to the other one once it is free.
+    *
+    * @return bool False if a write failed.
+    */
+   bool submit();
+
+public:
+   /**
+    * @brief Takes two buffers from the pool for a file.
+    *
+    * @param fd The file, opened with O_DIRECT and positioned at offset 0.
+    * @param pool The buffer pool.
+    */
+   DirectWriter(int fd, AlignedPool& pool);
+
+   /**
+    * @brief Waits for writes in flight and returns the buffers.
+    */
+   ~DirectWriter();
+
+   DirectWriter(const DirectWriter&)            = delete;
+   DirectWriter& operator=(const DirectWriter&) = delete;
+
+   /**
+    * @brief Reports whether both buffers could be had.
+    *
+    * @return bool True if the writer can be used.
+    */
+   bool valid() const;
+
+   /**
+    * @brief Appends data to the file.
+    *
+    * @param data The bytes to write.
+    * @param len The number of bytes.
+    * @return bool False if a write failed.
+    */
+   bool write(const char* data, size_t len);
+
+   /**
+    * @brief Writes what is left, the aligned part directly and the tail through the page cache.
+    *
+    * O_DIRECT is cleared from the file for the tail, the caller syncs and closes it.
+    *
+    * @return bool False if a write failed.
+    */
+   bool finish();
+
+   /**
+    * @brief The number of bytes appended so far.
+    *
+    * @return off_t The size of the file once finished.
+    */
+   off_t written() const;
+};
+
+}  // namespace DrexelProtocol
@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <crypto/aead.h>
 #include <drexelprotocol/pdu.h>
 
 #include <cstdint>
@@ -27,10 +28,11 @@ using connection = DrexelProtocol::Connection<PDU>;
  */
 typedef enum
 {
-   ACCESS_DENIED = -2, /**< Access to the requested resource is denied. */
-   FILE_NOT_FOUND,     /**< The requested file was not found. */
-   NONE,               /**< No error. */
-   UNKOWN = 99         /**< An unknown error occurred. */
+   DIGEST_MISMATCH = -3, /**< The received file does not match the sender's digest. */
+   ACCESS_DENIED,        /**< Access to the requested resource is denied. */
+   FILE_NOT_FOUND,       /**< The requested file was not found. */
+   NONE,                 /**< No error. */
+   UNKOWN = 99           /**< An unknown error occurred. */
 } Error;
 
 /**
@@ -40,9 +42,62 @@ typedef enum
 typedef enum
 {
    NEW = 0, /**< The operation is new. */
-   APPEND   /**< The operation is an append. */
+   APPEND,  /**< The operation is an append. */
+   COMMIT,  /**< The transfer is complete, digest holds the whole-file hash. */
+   GET,     /**< The client asks the server to send it fileName. */
+   LIST,    /**< The client asks for an FTP_STAT of every file on the server. */
+   STAT     /**< The client asks for the FTP_STAT of fileName. */
 } Status;
 
+/**
+ * @enum Priority
+ * @brief Defines how a transfer is scheduled against the others.
+ */
+typedef enum
+{
+   BULK = 0, /**< Backups and other large transfers that can wait. */
+   NORMAL,   /**< The default. */
+   URGENT    /**< Small pushes that must not queue behind bulk transfers. */
+} Priority;
+
+/**
+ * @brief The IP_TOS byte a transfer's datagrams are marked with, its DSCP above the two ECN bits.
+ *
+ * Bulk is CS1 (lower effort) and urgent is AF21 (low-latency data), following RFC 4594.
+ *
+ * @param priority A Priority.
+ * @return int The TOS byte, 0 for normal transfers.
+ */
+inline int priorityTos(int priority)
+{
+   switch (priority)
+   {
+      case Priority::BULK:
+         return 8 << 2;
+      case Priority::URGENT:
+         return 18 << 2;
+      default:
+         return 0;
+   }
+}
+
+/**
+ * @brief Parses a priority name as given on the command line.
+ *
+ * @param name "bulk", "normal" or "urgent".
+ * @return int The Priority, or -1 if the name is unknown.
+ */
+inline int priorityFromString(const std::string& name)
+{
+   if (name == "bulk")
+      return Priority::BULK;
+   if (name == "normal")
+      return Priority::NORMAL;
+   if (name == "urgent")
+      return Priority::URGENT;
+   return -1;
+}
+
 /**
  * @struct FTP_PDU
  * @brief Defines the protocol data unit for FTP operations.
@@ -53,6 +108,72 @@ struct FTP_PDU
    const uint32_t proto_ver = 1; /**< The protocol version. */
    int            status;        /**< The status of the operation. */
    int            err;           /**< The error code, if any. */
+   uint64_t       digest;        /**< XXH64 of the whole file, only meaningful with Status::COMMIT. */
+};
+
+/**
+ * @struct FTP_TRANSFER
+ * @brief What the receiver needs to know about a whole transfer, sent once, behind the FTP_PDU of its NEW.
+ *
+ * A GET, LIST or STAT carries one as well, for the priority the answer is sent with.
+ */
+struct FTP_TRANSFER
+{
+   uint64_t size     = 0;                /**< Size of the whole file when known, 0 otherwise, lets the receiver reserve space. */
+   int      priority = Priority::NORMAL; /**< A Priority, how the receiver schedules the transfer's disk writes and budget. */
+};
+
+/**
+ * @brief Size of the headers in front of a datagram's data, the FTP_PDU and the FTP_TRANSFER of a NEW or a request.
+ *
+ * The NEWs and APPENDs of a multipath upload end with a uint64_t, where their data starts in the file,
+ * the subflows deliver it out of order.
+ *
+ * @param status The Status of the datagram's FTP_PDU.
+ * @param multipath The datagram belongs to a multipath upload.
+ * @return size_t Where the data starts.
+ */
+inline size_t ftpHeaderSz(int status, bool multipath = false)
+{
+   bool first  = status == Status::NEW || status == Status::GET || status == Status::LIST || status == Status::STAT;
+   bool placed = multipath && (status == Status::NEW || status == Status::APPEND);
+   return sizeof(FTP_PDU) + (first ? sizeof(FTP_TRANSFER) : 0) + (placed ? sizeof(uint64_t) : 0);
+}
+
+constexpr size_t FTP_HEADER_MAX_SZ = sizeof(FTP_PDU) + sizeof(FTP_TRANSFER) + sizeof(uint64_t); /**< The largest ftpHeaderSz(). */
+
+/**
+ * @struct FTP_STAT
+ * @brief Describes a file on the server, LIST and STAT are answered with an array of them.
+ */
+struct FTP_STAT
+{
+   char     fileName[100]; /**< The name of the file. */
+   uint64_t size;          /**< Its size in bytes. */
+   int64_t  mtime;         /**< Last modification, nanoseconds since the epoch. */
+   uint64_t digest;        /**< XXH64 of the contents, the digest transfers are verified with. */
+};
+
+/**
+ * @struct FTP_OPTIONS
+ * @brief Transfer options negotiated by the CONNECT/CNTACK handshake.
+ *
+ * The client sends the options it would like as the CONNECT payload, the server answers
+ * with the subset it accepted as the CNTACK payload. A zeroed struct means plain transfer.
+ * When a cipher is offered each side puts its X25519 public key in publicKey. The subflows of a
+ * multipath upload offer the same random transfer id, the server writes them all to one file.
+ * A client holding a ticket from an earlier CNTACK may put the first datagram of a plain upload,
+ * headers and data, right behind the options, and the server writes it without a round trip.
+ */
+struct FTP_OPTIONS
+{
+   uint32_t codec;                         /**< Compression::Codec the data stream is framed with. */
+   uint32_t cipher;                        /**< Crypto::Cipher the data stream is sealed with. */
+   uint8_t  publicKey[Crypto::PUBKEY_SZ]; /**< The sender's key exchange public key. */
+   uint32_t fecK;                          /**< Data datagrams per FEC stripe, 0 without FEC. */
+   uint64_t transfer;                      /**< Multipath upload the connection is a subflow of, 0 for a single path. */
+   uint64_t ticket;                        /**< Session ticket, offered by the client and issued afresh by the server, 0 for none. */
+   uint32_t early;                         /**< Size of the early datagram behind the options, echoed only if the server took it. */
 };
 
 /**
@@ -69,9 +190,9 @@ public:
 
    connection* dpc; /**< The connection for FTP operations. */
 
-   std::string filePath;                           /**< The file path for FTP operations. */
-   char        sbuffer[BUFF_SZ + sizeof(FTP_PDU)]; /**< The send buffer. */
-   char        rbuffer[BUFF_SZ + sizeof(FTP_PDU)]; /**< The receive buffer. */
+   std::string filePath;                             /**< The file path for FTP operations. */
+   char        sbuffer[BUFF_SZ + FTP_HEADER_MAX_SZ]; /**< The send buffer. */
+   char        rbuffer[BUFF_SZ + FTP_HEADER_MAX_SZ]; /**< The receive buffer. */
 
    /**
     * @brief Constructs an FTP object with the specified file path.
@@ -91,7 +212,7 @@ public:
    /**
     * @brief Destroys the FTP object.
     */
-   ~FTP()
+   virtual ~FTP()
    {}
 
    /**
@@ -106,9 +227,13 @@ public:
 
    /**
     * @brief Starts the FTP operation.
+    *
+    * @return bool Returns true if the operation succeeded.
     */
-   virtual void start()
-   {}
+   virtual bool start()
+   {
+      return true;
+   }
 
    /**
     * @brief Starts the FTP operation with an index.
@@ -0,0 +1,116 @@
+/**
+ * @file metadata.h
+ * @brief Declares the server's cache of file metadata that answers LIST and STAT.
+ *
+ * @section Description
+ * Hashing every file for every LIST would read the whole directory each time. The cache keeps
+ * the size, modification time and XXH64 digest of every file instead. Writers hand it the digest
+ * they already verified at COMMIT, so an uploaded file is never read back. A file changed behind
+ * the server's back shows a different size or mtime and is hashed again the next time it is asked for.
+ * Files in subdirectories are named by their path relative to the served directory.
+ */
+
+#pragma once
+
+#include <drexelprotocol/ftp.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "threadpool/threadpool.h"
+
+namespace DrexelProtocol
+{
+
+/**
+ * @class MetadataCache
+ * @brief Size, mtime and digest of the files in a directory, safe to use from any thread.
+ */
+class MetadataCache
+{
+private:
+   /**
+    * @struct Entry
+    * @brief What is known about one file.
+    */
+   struct Entry
+   {
+      uint64_t size;   ///< Size when the digest was taken.
+      int64_t  mtime;  ///< Modification time when the digest was taken, in nanoseconds.
+      uint64_t digest; ///< XXH64 of the contents.
+   };
+
+   std::string                            dir;     ///< The directory served.
+   std::mutex                             mutex;   ///< Guards entries, hashing happens outside it.
+   std::unordered_map<std::string, Entry> entries; ///< Entries by file name.
+
+   /**
+    * @brief Reads a file and computes its entry.
+    *
+    * @param path The file.
+    * @param entry Receives size, mtime and digest.
+    * @return bool False if the file cannot be read or is not a regular file.
+    */
+   static bool hashFile(const std::string& path, Entry& entry);
+
+   /**
+    * @brief Returns the entry of a file, hashing it again if it changed since it was cached.
+    *
+    * @param name The file name.
+    * @param entry Receives the entry.
+    * @return bool False if the file does not exist, its entry is dropped.
+    */
+   bool fresh(const std::string& name, Entry& entry);
+
+public:
+   /**
+    * @brief Constructs an empty cache.
+    *
+    * @param dir The directory to describe.
+    */
+   explicit MetadataCache(std::string dir);
+
+   /**
+    * @brief Hashes every file of the directory, spread over a thread pool.
+    *
+    * @param pool The pool to hash on, the call returns once every file is done.
+    * @return size_t The number of files indexed.
+    */
+   size_t rescan(ThreadPool& pool);
+
+   /**
+    * @brief Records a file that was just written and verified.
+    *
+    * @param name The file name.
+    * @param digest Its XXH64 digest.
+    */
+   void update(const std::string& name, uint64_t digest);
+
+   /**
+    * @brief Forgets a file that is being rewritten or was removed.
+    *
+    * @param name The file name.
+    */
+   void invalidate(const std::string& name);
+
+   /**
+    * @brief Describes one file.
+    *
+    * @param name The file name.
+    * @param out Receives the description.
+    * @return bool False if there is no such file.
+    */
+   bool stat(const std::string& name, FTP_STAT& out);
+
+   /**
+    * @brief Describes every file of the directory, in name order.
+    *
+    * @return std::vector<FTP_STAT> One description per file.
+    */
+   std::vector<FTP_STAT> list();
+};
+
+}  // namespace DrexelProtocol
@@ -32,12 +32,19 @@ typedef enum
    NACK     = 16,  /**< Negative acknowledgment */
    FRAGMENT = 32,  /**< Datagram is a fragment */
    ERROR    = 64,  /**< Simulate error */
+   FEC      = 128, /**< Datagram belongs to an FEC stripe */
+   MCAST    = 256, /**< Datagram belongs to a multicast session */
 
    SNDACK          = (SND | ACK),             /**< Send acknowledgment message */
    CNTACK          = (CONNECT | ACK),         /**< Connect acknowledgment message */
    CLOSEACK        = (CLOSE | ACK),           /**< Close acknowledgment message */
    SENDFRAGMENT    = (FRAGMENT | SND),        /**< Send fragment message */
    SENDFRAGMENTACK = (FRAGMENT | SNDACK),     /**< Send fragment acknowledgment message */
+   FECSND          = (FEC | SND),             /**< Stripe shard, acknowledged per stripe */
+   FECACK          = (FEC | ACK),             /**< Stripe acknowledgment message */
+   MCASTSND        = (MCAST | SND),           /**< Multicast data or repair shard */
+   MCASTNACK       = (MCAST | NACK),          /**< Multicast repair request, sent to the group */
+   MCASTCLOSE      = (MCAST | CLOSE),         /**< Multicast end of object, carries the digest */
 } MsgType;
 
 /**
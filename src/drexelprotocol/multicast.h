@@ -0,0 +1,326 @@
+/**
+ * @file multicast.h
+ * @brief Declares the one-to-many distribution mode of Drexel Protocol.
+ *
+ * @section Description
+ * Instead of one unicast transfer per host, the sender multicasts the file once to a group and
+ * every receiver in the group picks it up. Nobody acknowledges anything: a receiver that misses
+ * datagrams asks for repairs with a NACK, the sender answers the NACKs and stops once the group
+ * has been quiet for a while.
+ *
+ * The file is cut into blocks of BLOCK_K symbols. A repair is not a retransmission but a fresh
+ * Reed-Solomon parity shard of the block, and any K shards rebuild a block, so one repair datagram
+ * fixes a different loss at every receiver. A NACK therefore only says how many shards of a block
+ * are missing, and the sender sends the largest count it was asked for.
+ *
+ * NACKs go to the group as well. Each receiver waits a random backoff before sending its own and
+ * drops the entries another receiver already asked for, so a loss shared by the whole group is
+ * reported about once rather than once per receiver.
+ *
+ * @section Reference
+ * B. Adamson et al., "NACK-Oriented Reliable Multicast (NORM) Transport Protocol", RFC 5740.
+ */
+
+#pragma once
+
+#include <drexelprotocol/ftp.h>
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace DrexelProtocol
+{
+
+/**
+ * @struct McastHeader
+ * @brief Leads the payload of every multicast data and repair datagram.
+ */
+struct McastHeader
+{
+   uint32_t session; /**< Random per transfer, receivers ignore other sessions. */
+   uint32_t block;   /**< Block number. */
+   uint64_t fileSz;  /**< Size of the file, lets a receiver join at any datagram. */
+   uint16_t index;   /**< Shard index, data shards first then parity. */
+   uint16_t blockK;  /**< Data shards in a full block. */
+   uint16_t symSz;   /**< Size of a shard, the last data shard of the file is sent short. */
+   uint16_t reserved;
+};
+
+/**
+ * @struct McastClose
+ * @brief Payload of the end of object announcement the sender repeats while it lingers.
+ */
+struct McastClose
+{
+   McastHeader object; /**< Describes the file, index is unused. */
+   uint64_t    digest; /**< XXH64 of the whole file. */
+};
+
+/**
+ * @struct NackEntry
+ * @brief One block a receiver cannot rebuild yet.
+ */
+struct NackEntry
+{
+   uint32_t block;   /**< Block number. */
+   uint16_t missing; /**< Shards still needed to rebuild it. */
+   uint16_t reserved;
+};
+
+/**
+ * @struct McastNack
+ * @brief Leads the payload of a NACK, count NackEntry follow it.
+ */
+struct McastNack
+{
+   uint32_t session; /**< Session the NACK is about. */
+   uint16_t count;   /**< Number of entries. */
+   uint16_t reserved;
+};
+
+/**
+ * @class Multicast
+ * @brief The group socket shared by both ends of a multicast session.
+ */
+class Multicast
+{
+protected:
+   using Clock = std::chrono::steady_clock;
+
+   int                udpSock{-1}; /**< Socket bound to the group port and joined to the group. */
+   struct sockaddr_in group;       /**< The group address datagrams are sent to. */
+   uint32_t           seqNum{0};   /**< Sequence number stamped on outgoing datagrams. */
+   char               buffer[connection::MAX_BUFF_SZ + sizeof(PDU)]; /**< Datagram being sent or received. */
+
+   /**
+    * @brief Seals and sends a datagram to the group.
+    *
+    * @param mtype The MsgType to stamp on it.
+    * @param payload The payload, or nullptr.
+    * @param len The size of the payload, at most MAX_BUFF_SZ.
+    * @return bool False if the datagram could not be sent.
+    */
+   bool sendGroup(int mtype, const void* payload, int len);
+
+   /**
+    * @brief Receives a datagram from the group, giving up at a deadline.
+    *
+    * Datagrams that fail their checksum are dropped, the NACK machinery recovers them.
+    *
+    * @param deadline When to stop waiting.
+    * @return int The size of the datagram now in buffer, 0 on timeout, or an error code.
+    */
+   int recvGroup(Clock::time_point deadline);
+
+public:
+   static constexpr int BLOCK_K = 32;                                             /**< Data shards per block. */
+   static constexpr int SYM_SZ  = connection::MAX_BUFF_SZ - sizeof(McastHeader); /**< File bytes per data shard. */
+
+   /**
+    * @brief Opens a socket on the group port and joins the group.
+    *
+    * @param groupAddr The multicast group, e.g. 239.1.2.3.
+    * @param port The group port.
+    * @param iface The address of the local interface to join and send on.
+    */
+   Multicast(const char* groupAddr, int port, const char* iface);
+
+   /**
+    * @brief Leaves the group and closes the socket.
+    */
+   virtual ~Multicast();
+
+   Multicast(const Multicast&)            = delete;
+   Multicast& operator=(const Multicast&) = delete;
+
+   /**
+    * @brief Reports whether the socket joined the group.
+    *
+    * @return bool True if the session can start.
+    */
+   bool validate() const;
+};
+
+/**
+ * @class MulticastSender
+ * @brief Sends a file to the group once and repairs whatever the receivers NACK.
+ */
+class MulticastSender : public Multicast
+{
+private:
+   /**
+    * @struct Repair
+    * @brief Repair state of one block.
+    */
+   struct Repair
+   {
+      uint16_t requested{0}; /**< Largest missing count NACKed since the last repair round. */
+      uint16_t next{0};      /**< Parity rows handed out so far. */
+   };
+
+   const char*         map{nullptr};   /**< The file, mapped read only. */
+   uint64_t            fileSz{0};      /**< Size of the file. */
+   uint32_t            session{0};     /**< This transfer's session. */
+   uint32_t            blocks{0};      /**< Number of blocks. */
+   std::vector<Repair> repairs;        /**< Repair state by block. */
+   bool                pending{false}; /**< NACKs are waiting for a repair round. */
+   Clock::time_point   firstNack;      /**< When the oldest unanswered NACK arrived. */
+   Clock::time_point   lastNack;       /**< When the latest NACK arrived. */
+   Clock::time_point   nextSend;       /**< Pacing, when the next datagram may leave. */
+
+   /**
+    * @brief Describes the file in a header.
+    */
+   McastHeader header(uint32_t block, uint16_t index) const;
+
+   /**
+    * @brief The number of data shards of a block, only the last one may be short.
+    */
+   int blockK(uint32_t block) const;
+
+   /**
+    * @brief Sends one shard of a block, data straight from the mapping, parity computed on demand.
+    *
+    * @return bool False if the datagram could not be sent.
+    */
+   bool sendShard(uint32_t block, int index);
+
+   /**
+    * @brief Collects NACKs until a deadline, or until the hold-off of a pending repair round ran out.
+    *
+    * @return bool False if the socket failed.
+    */
+   bool serve(Clock::time_point deadline);
+
+   /**
+    * @brief Sends the repairs collected since the last round.
+    *
+    * @return bool False if a repair could not be sent.
+    */
+   bool sendRepairs();
+
+public:
+   static constexpr int NACK_HOLDOFF_MS   = 20;       /**< NACKs collected before a repair round, so one round answers all receivers. */
+   static constexpr int CLOSE_INTERVAL_MS = 100;      /**< Period of the end of object announcement. */
+   static constexpr int LINGER_MS         = 1000;     /**< Quiet time after which no receiver is assumed to need anything. */
+   static constexpr int DEFAULT_RATE      = 10000000; /**< Default sending rate in bytes per second. */
+
+   int rate{DEFAULT_RATE}; /**< Sending rate in bytes per second, the group gets no congestion feedback. */
+
+   using Multicast::Multicast;
+
+   /**
+    * @brief Multicasts a file and serves repairs until the group is quiet.
+    *
+    * @param fileName The file to send.
+    * @return bool False if the file could not be read or sent.
+    */
+   bool send(const std::string& fileName);
+};
+
+/**
+ * @class MulticastReceiver
+ * @brief Joins a session, rebuilds the file and NACKs what it cannot rebuild.
+ */
+class MulticastReceiver : public Multicast
+{
+private:
+   /**
+    * @struct Block
+    * @brief Reassembly state of one block.
+    */
+   struct Block
+   {
+      std::vector<std::string> shards;      /**< Shards by index, empty until received, dropped once done. */
+      int                      have{0};     /**< Distinct shards received. */
+      bool                     done{false}; /**< Rebuilt and written out. */
+      Clock::time_point        quietUntil;  /**< No NACK for this block before then, a repair is under way. */
+   };
+
+   int                fd{-1};          /**< The output file. */
+   uint32_t           session{0};      /**< The session being received, 0 before the first datagram. */
+   uint64_t           fileSz{0};       /**< Size of the file. */
+   int                k{0};            /**< Data shards in a full block. */
+   int                symSz{0};        /**< Size of a shard. */
+   std::vector<Block> blocks;          /**< Blocks of the file. */
+   uint32_t           completed{0};    /**< Blocks rebuilt and written. */
+   uint32_t           horizon{0};      /**< Blocks below this one should be complete, data of later ones was seen. */
+   bool               closed{false};   /**< The end of object announcement arrived. */
+   uint64_t           digest{0};       /**< The sender's digest, once closed. */
+   bool               nackDue{false};  /**< A NACK is scheduled. */
+   Clock::time_point  nackAt;          /**< When the scheduled NACK goes out. */
+   std::mt19937       rng;             /**< Draws NACK backoffs. */
+
+   /**
+    * @brief Adopts the session of the first datagram and sizes the output file.
+    *
+    * @return bool False if the description is unusable or the file cannot be created.
+    */
+   bool start(const McastHeader& hdr, const std::string& fileName);
+
+   /**
+    * @brief The number of data shards of a block, only the last one may be short.
+    */
+   int blockK(uint32_t block) const;
+
+   /**
+    * @brief Stores a shard and writes its block out once it can be rebuilt.
+    *
+    * @return bool False if the file could not be written.
+    */
+   bool addShard(const McastHeader& hdr, const char* sym, int len);
+
+   /**
+    * @brief Schedules a NACK after a random backoff, unless one is already scheduled.
+    */
+   void scheduleNack();
+
+   /**
+    * @brief Sends the scheduled NACK for every incomplete block nobody else asked for.
+    */
+   void sendNack();
+
+   /**
+    * @brief Drops the entries of our next NACK another receiver just asked for.
+    */
+   void overhear(const char* payload, int len);
+
+   /**
+    * @brief Checks the finished file against the sender's digest.
+    *
+    * @return bool True if the file matches.
+    */
+   bool verify() const;
+
+public:
+   static constexpr int NACK_BACKOFF_MS = 30;    /**< NACKs are spread over this window so others can suppress theirs. */
+   static constexpr int REPAIR_WAIT_MS  = 150;   /**< Time the sender gets to answer a NACK before it is repeated. */
+   static constexpr int IDLE_TIMEOUT_MS = 10000; /**< Silence after which the sender is considered gone. */
+
+   /**
+    * @brief Joins a group.
+    *
+    * @param groupAddr The multicast group.
+    * @param port The group port.
+    * @param iface The address of the local interface to join on.
+    */
+   MulticastReceiver(const char* groupAddr, int port, const char* iface);
+
+   /**
+    * @brief Closes the output file.
+    */
+   ~MulticastReceiver();
+
+   /**
+    * @brief Receives the next session's file.
+    *
+    * @param fileName Where to store it, removed again if it cannot be completed or verified.
+    * @return bool True if the file arrived intact.
+    */
+   bool receive(const std::string& fileName);
+};
+
+}  // namespace DrexelProtocol
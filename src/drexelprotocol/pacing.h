@@ -0,0 +1,84 @@
+/**
+ * @file pacing.h
+ * @brief Declares the pacer that spreads an FEC stripe out at the delivery rate instead of bursting it.
+ *
+ * @section Description
+ * A stripe of k + m datagrams leaves back to back at line rate. On a path whose bottleneck is
+ * slower than the sender's link the burst piles up in the bottleneck's queue, and a short queue
+ * drops its tail, which the parity then has to cover. Spacing the datagrams a little above the
+ * rate the receiver acknowledges them at delivers the same stripe without the spike.
+ *
+ * Where the interface towards the peer runs the fq qdisc, the kernel does the spacing: the rate
+ * is set on the socket with SO_MAX_PACING_RATE and fq releases the datagrams on time, with no
+ * work on our side. Anywhere else the pacer sleeps until each datagram is due, sending those due
+ * within SLACK at once, since a sleep shorter than that oversleeps, and crediting up to SLACK of
+ * oversleep to the next datagrams.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace DrexelProtocol
+{
+
+/**
+ * @class Pacer
+ * @brief Paces the datagrams of one socket, through fq when the egress interface has it.
+ */
+class Pacer
+{
+private:
+   using Clock = std::chrono::steady_clock;
+
+   int               sock;          /**< The paced socket, not owned. */
+   bool              kernel{false}; /**< fq paces the socket, SO_MAX_PACING_RATE is set instead of sleeping. */
+   uint64_t          rate{0};       /**< Bytes per second, 0 for unpaced. */
+   Clock::time_point next;          /**< When the next datagram is due. */
+
+public:
+   static constexpr std::chrono::microseconds SLACK{500}; /**< Datagrams due this soon leave at once. */
+
+   /**
+    * @brief Looks up the qdisc of the interface the peer is reached through.
+    *
+    * @param sock The socket to pace.
+    * @param peer The address the socket sends to.
+    */
+   Pacer(int sock, const struct sockaddr_storage& peer);
+
+   /**
+    * @brief Changes the pacing rate.
+    *
+    * @param bytesPerSec The new rate, 0 to stop pacing.
+    */
+   void setRate(uint64_t bytesPerSec);
+
+   /**
+    * @brief Waits until a datagram is due, returns at once when fq does the pacing.
+    *
+    * @param len The size of the datagram about to be sent.
+    */
+   void wait(size_t len);
+
+   /**
+    * @brief Reports whether fq paces the socket.
+    *
+    * @return bool False if the pacer sleeps in user space.
+    */
+   bool inKernel() const;
+};
+
+/**
+ * @brief Finds out whether an interface runs the fq qdisc, at its root or under mq.
+ *
+ * @param ifindex The interface.
+ * @return bool False if it does not or the qdiscs could not be listed.
+ */
+bool interfaceHasFq(int ifindex);
+
+}  // namespace DrexelProtocol
@@ -11,9 +11,13 @@
 
 #pragma once
 
+#include <checksum/crc32c.h>
 #include <drexelprotocol/msgtype.h>
 #include <drexelprotocol/connection.h>
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 
 namespace DrexelProtocol
@@ -25,8 +29,8 @@ namespace DrexelProtocol
  *
  * The PDU structure represents the protocol data unit used in Drexel Protocol,
  * containing information such as protocol version, message type, sequence number,
- * datagram size, and error number. It also includes methods to print the details
- * of the PDU.
+ * datagram size, error number and a CRC32C over the header and payload. It also includes
+ * methods to seal/verify the checksum and to print the details of the PDU.
  */
 struct PDU
 {
@@ -35,6 +39,47 @@ struct PDU
    int       seqnum;        /**< The sequence number. */
    int       dgram_sz;      /**< The datagram size. */
    int       err_num;       /**< The error number. */
+   uint32_t  checksum;      /**< CRC32C of the header (with this field zeroed) and the payload. */
+
+   /**
+    * @brief Computes the checksum this PDU should carry for the given payload.
+    *
+    * @param payload The bytes following the header.
+    * @param payloadSz The number of payload bytes.
+    * @return uint32_t The CRC32C of the header and payload.
+    */
+   uint32_t computeChecksum(const void* payload, int payloadSz) const
+   {
+      char header[sizeof(PDU)];
+      std::memcpy(header, this, sizeof(PDU));
+      std::memset(header + offsetof(PDU, checksum), 0, sizeof(checksum));
+
+      uint32_t crc = Checksum::crc32c(header, sizeof(PDU));
+      return (payloadSz > 0) ? Checksum::crc32c(payload, payloadSz, crc) : crc;
+   }
+
+   /**
+    * @brief Stamps the checksum of the header and payload into the PDU.
+    *
+    * @param payload The bytes following the header.
+    * @param payloadSz The number of payload bytes.
+    */
+   void seal(const void* payload, int payloadSz)
+   {
+      checksum = computeChecksum(payload, payloadSz);
+   }
+
+   /**
+    * @brief Checks that the header and payload match the carried checksum.
+    *
+    * @param payload The bytes following the header.
+    * @param payloadSz The number of payload bytes.
+    * @return bool True if the datagram arrived intact.
+    */
+   bool verify(const void* payload, int payloadSz) const
+   {
+      return checksum == computeChecksum(payload, payloadSz);
+   }
 
    /**
     * @brief Prints the PDU details when sending, if debug mode is enabled.
@@ -71,6 +116,7 @@ struct PDU
       std::cout << "\tMsg Type: " << msgToString(mtype) << std::endl;
       std::cout << "\tMsg Size: " << dgram_sz << std::endl;
       std::cout << "\tSeq Numb: " << seqnum << std::endl;
+      std::cout << "\tChecksum: " << std::hex << checksum << std::dec << std::endl;
       std::cout << std::endl;
    }
 };
@@ -0,0 +1,179 @@
+/**
+ * @file ring.h
+ * @brief Declares the shared-memory ring local producers stream records to the client through.
+ *
+ * @section Description
+ * A program that ships its data by writing a file for the client to read back pays a disk write
+ * and a read for every byte. A RecordRing replaces the file with a memfd that the producer and the
+ * client map, holding a single-producer single-consumer byte ring. Nothing is locked: the producer
+ * copies a record in and publishes it by moving head past it, the consumer copies records out and
+ * frees their space by moving tail. A record is published whole, the consumer never sees part of one.
+ *
+ * The producer hands the memfd to the client daemon along with an UploadJob, as SCM_RIGHTS on the
+ * job socket. The daemon reads the ring through stream(), an ordinary FILE*, so the upload goes
+ * through the same compression, FEC and encryption as a file. The upload ends when the producer
+ * closes the ring, and is abandoned without a COMMIT if the producer aborts it or goes away.
+ *
+ * A side that finds the ring empty or full spins WAIT_SPINS times, then sleeps WAIT_SLEEP_US
+ * between looks, trading a little latency for not burning a core while a producer is quiet.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace DrexelProtocol
+{
+
+/**
+ * @struct RingHeader
+ * @brief Starts the shared mapping, the data area follows it. Head and tail only ever grow.
+ */
+struct RingHeader
+{
+   uint64_t                          magic;    /**< RecordRing::MAGIC, tells a ring from any other fd. */
+   uint64_t                          capacity; /**< Size of the data area, a power of two. */
+   alignas(64) std::atomic<uint64_t> head;     /**< Bytes published by the producer. */
+   alignas(64) std::atomic<uint64_t> tail;     /**< Bytes consumed. */
+   alignas(64) std::atomic<uint32_t> state;    /**< A RecordRing::State. */
+};
+
+/**
+ * @class RecordRing
+ * @brief One side of a memfd record ring, the producer's or the consumer's.
+ */
+class RecordRing
+{
+private:
+   int         fd{-1};          /**< The memfd. */
+   int         peer{-1};        /**< Socket whose hangup means the producer is gone, -1 to wait for it forever. */
+   RingHeader* header{nullptr}; /**< The shared mapping. */
+   char*       data{nullptr};   /**< The data area behind the header. */
+   size_t      mapSz{0};        /**< Size of the mapping. */
+   uint64_t    capacity{0};     /**< Size of the data area, kept apart from the header the other side can write to. */
+
+   /**
+    * @brief Maps the memfd.
+    *
+    * @param size Size of the memfd.
+    * @return bool False if it cannot be mapped.
+    */
+   bool map(size_t size);
+
+   /**
+    * @brief Waits a little longer each round, for the other side to catch up.
+    *
+    * @param round Rounds waited so far.
+    */
+   static void backoff(unsigned round);
+
+   /**
+    * @brief Checks whether the producer's socket hung up.
+    *
+    * @return bool True if the producer is gone.
+    */
+   bool producerGone() const;
+
+   /**
+    * @brief Reads for the FILE* of stream().
+    */
+   static ssize_t cookieRead(void* cookie, char* buff, size_t size);
+
+public:
+   static constexpr uint64_t MAGIC            = 0x676e69722d707464; /**< "dtp-ring". */
+   static constexpr size_t   DEFAULT_CAPACITY = 4 << 20;            /**< Data area of a ring, records are at most this large. */
+   static constexpr unsigned WAIT_SPINS       = 1000;               /**< Looks at the other side before sleeping between looks. */
+   static constexpr int      WAIT_SLEEP_US    = 50;                 /**< Sleep between looks once the spins are used up. */
+
+   /**
+    * @enum State
+    * @brief Where the stream stands.
+    */
+   enum State : uint32_t
+   {
+      OPEN = 0, /**< The producer may publish more. */
+      CLOSED,   /**< The producer is done, the consumer reads what is left. */
+      ABORTED   /**< Either side gave up, the data must not be committed. */
+   };
+
+   /**
+    * @brief Creates a ring, the producer's side.
+    *
+    * @param name Name of the memfd, shows in /proc/PID/fd.
+    * @param capacity Size of the data area, rounded up to a power of two.
+    */
+   RecordRing(const std::string& name, size_t capacity = DEFAULT_CAPACITY);
+
+   /**
+    * @brief Maps a ring received from a producer, the consumer's side. The fd is the ring's from now on.
+    *
+    * @param fd The memfd.
+    * @param peer The producer's socket, watched while the ring is empty, -1 for none.
+    */
+   RecordRing(int fd, int peer);
+
+   /**
+    * @brief Unmaps the ring and closes its fd, the other side keeps its own.
+    */
+   ~RecordRing();
+
+   /**
+    * @brief Checks that the ring is mapped.
+    *
+    * @return bool False if it could not be created or is not a ring.
+    */
+   bool validate() const;
+
+   /**
+    * @brief The memfd, to send to the consumer.
+    *
+    * @return int The fd.
+    */
+   int getFd() const;
+
+   /**
+    * @brief Publishes a record, waiting while the ring is too full to take it.
+    *
+    * @param record The bytes.
+    * @param len Their number, at most the capacity.
+    * @return bool False if the record is too large or the consumer aborted.
+    */
+   bool write(const void* record, size_t len);
+
+   /**
+    * @brief Copies out the oldest published bytes, waiting while there are none.
+    *
+    * @param buff Receives the bytes.
+    * @param len Room in buff.
+    * @return ssize_t The bytes copied, 0 once the producer closed the ring and it is drained,
+    *                 -1 if the ring was aborted or the producer went away.
+    */
+   ssize_t read(char* buff, size_t len);
+
+   /**
+    * @brief Ends the stream, the consumer reads what is left then sees the end.
+    */
+   void close();
+
+   /**
+    * @brief Ends the stream as failed, used by either side.
+    */
+   void abort();
+
+   /**
+    * @brief Opens the consumer's side as a FILE*, read until the end of the stream.
+    *
+    * A read error is set if the ring is aborted. The FILE* has no fd, fclose() it before the ring is deleted.
+    *
+    * @return FILE* The stream, nullptr on failure.
+    */
+   FILE* stream();
+};
+
+}  // namespace DrexelProtocol
@@ -10,10 +10,19 @@
  */
 
 #pragma once
+#include <checksum/xxhash.h>
+#include <compression/blockcodec.h>
+#include <crypto/aead.h>
 #include <drexelprotocol/ftp.h>
+#include <drexelprotocol/directio.h>
+#include <drexelprotocol/metadata.h>
+#include <drexelprotocol/tree.h>
+#include <fec/stripe.h>
 
+#include <chrono>
 #include <cstring>
 #include <ctime>
+#include <limits>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -29,24 +38,151 @@ namespace DrexelProtocol
  * @brief A class for handling file writing operations in an FTP server.
  *
  * The FTPFileWriter class manages file writing operations, including pushing data
- * to a channel and running a server loop.
+ * to a channel and running a server loop. It keeps a running digest of everything it
+ * writes so the transfer can be verified against the sender's digest at CLOSE. When the
+ * transfer negotiated compression the stream is decoded before it reaches the file. A file
+ * name may be a relative path, its directories are created under the server's directory.
+ *
+ * The file stays open for the whole upload. Its announced size is reserved with fallocate so
+ * it lands in a few large extents. Datagrams are collected into WRITE_BEHIND_SZ writes, and
+ * writeback is started every SYNC_WINDOW_SZ bytes, which keeps the dirty pages of a large upload
+ * bounded instead of flushing them all at once. The file is synced once, at COMMIT.
+ *
+ * The upload goes to a hidden PARTIAL_PREFIX file next to its target and is renamed over the
+ * target only once its digest is verified. Readers therefore see the previous version or the
+ * complete new one, never a partial file. Concurrent uploads of one name resolve last writer
+ * wins, or with keepVersions into name.1, name.2 and so on.
+ *
+ * Given an AlignedPool, uploads of at least DIRECT_MIN_SZ bytes bypass the page cache altogether
+ * through a DirectWriter. Filesystems that refuse O_DIRECT get the buffered path. With mmapWrites
+ * the other uploads of an announced size are sized up front, mapped, and copied straight into
+ * the mapping, with no write call at all.
  */
 class FTPFileWriter
 {
 private:
-   bool closed{false}; /**< Indicates if the file writer is closed. */
+   bool closed{false};  /**< Indicates if the file writer is closed. */
+   bool started{false}; /**< A file was begun and not committed yet. */
+   bool failed{false};  /**< Writing the file failed, it was abandoned and its COMMIT is rejected. */
+
+   channel<std::string>* stream;            /**< The channel for data communication. */
+   connection*           listener{nullptr}; /**< The server's listen connection a COMMIT's CLOSE is answered through, not owned. */
+   Sock                  replyTo;           /**< The client whose CLOSE carried the COMMIT. */
+   int                   replySeq{0};       /**< The sequence number the CLOSEACK answering it carries. */
+   Checksum::XXH64       fileHash;          /**< Running digest of the bytes written so far. */
+   FTP_OPTIONS           options;           /**< Options negotiated for this transfer. */
+   MetadataCache*        cache;             /**< Learns the digest of every verified file, not owned, may be nullptr. */
+   std::string           path;              /**< The file being written, empty if the client named one outside the directory. */
+   int                   fd{-1};            /**< The open file. */
+   std::string           behind;            /**< Data collected for the next write. */
+   off_t                 offset{0};         /**< Bytes written to the file so far, the end of the furthest write for multipath. */
+   off_t                 synced{0};         /**< Start of the window whose writeback has not been started yet. */
+   off_t                 announced{0};      /**< Size the client announced, reserved up front. */
+   DirectWriter*         direct{nullptr};   /**< The O_DIRECT path of a large upload, nullptr when buffered. */
+   std::string           partial;           /**< The temporary file the upload is written to, empty once published. */
+   char*                 map{nullptr};      /**< The file mapped for writing, nullptr when it is written with pwrite(). */
+   size_t                mapSz{0};          /**< Size of the mapping, the announced size. */
+   off_t                 settled{0};        /**< Everything before this offset is on disk and out of the page cache. */
+
+   Compression::BlockDecoder decoder; /**< Reassembles and decodes compressed frames. */
+
+   /**
+    * @brief Starts the file a header names: checks the name, creates its directories and truncates it.
+    *
+    * @param pdu The first header of the file.
+    * @param transfer What its NEW announced, defaults for a file begun by its COMMIT.
+    */
+   void begin(const FTP_PDU& pdu, const FTP_TRANSFER& transfer);
+
+   /**
+    * @brief Appends data to the file through the write-behind buffer.
+    *
+    * @param data The bytes to write.
+    * @param len The number of bytes.
+    * @return bool False if the file could not be written.
+    */
+   bool write(const char* data, size_t len);
+
+   /**
+    * @brief Writes data of a multipath upload where its header says, subflows deliver it out of order.
+    *
+    * @param data The bytes to write.
+    * @param len The number of bytes.
+    * @param at Their offset in the file.
+    * @return bool False if the file could not be written.
+    */
+   bool writeAt(const char* data, size_t len, off_t at);
+
+   /**
+    * @brief Hashes the file as written, for uploads whose data did not arrive in order.
+    *
+    * @return uint64_t XXH64 of the first offset bytes.
+    */
+   uint64_t digestWritten();
+
+   /**
+    * @brief Writes the buffered data out and starts writeback once a window is full.
+    *
+    * @return bool False if the file could not be written.
+    */
+   bool flush();
+
+   /**
+    * @brief Starts writeback once a window is full and drops the window before it from the page cache.
+    */
+   void writeback();
+
+   /**
+    * @brief Flushes, trims the reservation to the real size, syncs if asked to and closes the file.
+    *
+    * @return bool False if the file could not be written or synced.
+    */
+   bool finish();
+
+   /**
+    * @brief Closes a file that is not going to be committed and removes its temporary file.
+    */
+   void abandon();
+
+   /**
+    * @brief Renames the verified temporary file to its name and makes the rename durable.
+    *
+    * @return std::string The name the file was stored under, empty if it could not be stored.
+    */
+   std::string publish();
 
-   channel<std::string>* stream; /**< The channel for data communication. */
+   /**
+    * @brief Verifies the written file against the sender's digest.
+    *
+    * A mismatching file is removed so a corrupt copy is never left behind.
+    *
+    * @param pdu The COMMIT header carrying the sender's digest.
+    * @return int Error::NONE if the digests match, Error::DIGEST_MISMATCH otherwise, Error::ACCESS_DENIED
+    *             if the file was refused, Error::UNKOWN if it could not be written.
+    */
+   int commit(const FTP_PDU& pdu);
 
 public:
-   std::string address; /**< The address of the file writer. */
+   static constexpr size_t WRITE_BEHIND_SZ = 1 << 20; /**< Datagrams are collected into writes of this size. */
+   static constexpr off_t  SYNC_WINDOW_SZ  = 8 << 20;  /**< Writeback is started every this many bytes. */
+   static constexpr off_t  DIRECT_MIN_SZ   = 64 << 20; /**< Smaller uploads are not worth bypassing the page cache for. */
+   static constexpr int    MAX_VERSIONS    = 999;      /**< Highest suffix tried when versions are kept. */
+
+   std::string  address;             /**< The address of the file writer. */
+   bool         fsyncOnCommit{true}; /**< Sync the file before a COMMIT is answered. */
+   AlignedPool* directPool{nullptr}; /**< Buffers for O_DIRECT writes, nullptr to always write through the page cache. */
+   bool         keepVersions{false}; /**< Store an upload under a free name.N instead of replacing an existing file. */
+   bool         mmapWrites{false};   /**< Write uploads of a known size through a shared mapping instead of pwrite(). */
+   bool         multipath{false};    /**< The subflows of a multipath upload share the writer, data goes to its header's offset. */
 
    /**
     * @brief Constructs an FTPFileWriter object.
     *
     * @param address The address of the file writer.
+    * @param options The options negotiated for the transfer.
+    * @param cache The server's metadata cache, or nullptr.
     */
-   FTPFileWriter(std::string address);
+   FTPFileWriter(std::string address, FTP_OPTIONS options = {}, MetadataCache* cache = nullptr);
 
    /**
     * @brief Gets the channel for data communication.
@@ -63,12 +199,105 @@ public:
     */
    void pushToChannel(char* buff, int buffSz);
 
+   /**
+    * @brief Pushes the COMMIT a CLOSE carried, the writer answers the CLOSE once the file is verified.
+    *
+    * Hashing and syncing the file happen on the writer's thread, the listen thread goes on serving the other flows.
+    *
+    * @param buff The CLOSE's payload, the COMMIT header.
+    * @param buffSz The size of the payload.
+    * @param listener The server's listen connection to answer through.
+    * @param peer The client.
+    * @param seqnum The sequence number the CLOSEACK carries.
+    */
+   void pushCommit(char* buff, int buffSz, connection* listener, const Sock& peer, int seqnum);
+
    /**
     * @brief Runs the server loop for the file writer.
     */
    void serverLoop();
 };
 
+/**
+ * @class FTPFileSender
+ * @brief Streams a file back to a client that asked for it with Status::GET.
+ *
+ * Every download gets its own socket on an ephemeral port, the client learns the port from the
+ * first datagram and acknowledges to it, which keeps the acknowledgements of hundreds of
+ * concurrent downloads away from the listen loop. The file is mapped rather than read, the
+ * datagrams are cut straight out of the page cache. The answers to LIST and STAT travel the
+ * same way, as a download of an array of FTP_STAT.
+ */
+class FTPFileSender
+{
+private:
+   connection* dpc;      /**< The download's own connection. */
+   std::string fileName; /**< The file to send, relative to the server's directory. */
+   int         priority; /**< The Priority the client asked for, sent back in the download's FTP_TRANSFER and marked as its DSCP. */
+
+   /**
+    * @brief Sends a buffer as the file's contents followed by a CLOSE carrying its digest.
+    *
+    * @param pdu The FTP header stamped on every datagram.
+    * @param data The contents.
+    * @param size Their size.
+    * @return bool False if the client stopped acknowledging.
+    */
+   bool stream(FTP_PDU& pdu, const char* data, size_t size);
+
+public:
+   static constexpr int ACK_TIMEOUT_MS = 1000; /**< A datagram is resent when its acknowledgement takes longer. */
+
+   /**
+    * @brief Constructs a sender for one download.
+    *
+    * @param peer The client's address.
+    * @param fileName The file the client asked for.
+    * @param seqnum The sequence number the client expects next.
+    * @param priority The Priority of the request.
+    * @param busyPollUs Spin budget of every wait for an acknowledgement, 0 to block at once.
+    */
+   FTPFileSender(const Sock& peer, std::string fileName, unsigned int seqnum, int priority, int busyPollUs = 0);
+
+   /**
+    * @brief Closes the download's socket.
+    */
+   ~FTPFileSender();
+
+   /**
+    * @brief Sends the file followed by a CLOSE carrying its digest, or Error::FILE_NOT_FOUND.
+    */
+   void serverLoop();
+
+   /**
+    * @brief Answers a LIST with every file of the cache, or a STAT with fileName's entry if there is one.
+    *
+    * @param status Status::LIST or Status::STAT.
+    * @param cache The server's metadata cache.
+    */
+   void answerQuery(int status, MetadataCache& cache);
+};
+
+/**
+ * @struct TokenBucket
+ * @brief The upload budget of one client host.
+ */
+struct TokenBucket
+{
+   double                                tokens; /**< Bytes the host may send right now, negative once FEC shards ran it into debt. */
+   std::chrono::steady_clock::time_point last;   /**< When tokens was last refilled. */
+};
+
+/**
+ * @struct SessionTicket
+ * @brief What the server remembers of a ticket it handed out in a CNTACK.
+ */
+struct SessionTicket
+{
+   FlowKey                               host;    /**< The host it was issued to, the key's port cleared. */
+   std::chrono::steady_clock::time_point expires; /**< When it stops being accepted. */
+};
+
 /**
  * @class FTPServer
  * @brief A class for managing an FTP server.
@@ -79,21 +308,210 @@ public:
 class FTPServer : public FTP
 {
 private:
-   int                         connected{0}; /**< Indicates if the server is connected. */
-   ThreadPool*                 pool;         /**< The thread pool for handling tasks. */
-   std::vector<FTPFileWriter*> fw;           /**< Vector of file writers. */
+   int                         connected{0};  /**< Indicates if the server is connected. */
+   ThreadPool*                 pool;          /**< The thread pool for handling tasks. */
+   ThreadPool*                 writers;       /**< Runs the file writers, each holds a thread until its upload ends. */
+   ThreadPool*                 senders;       /**< Runs the downloads, they mostly wait on the network. */
+   MetadataCache*              cache;         /**< Size, mtime and digest of the served files. */
+   AlignedPool                 directBuffers; /**< Buffers of the uploads written with O_DIRECT. */
+   XdpDatapath*                xdp{nullptr};  /**< Carries the listen socket's datagrams over AF_XDP once attached. */
+   int                         busyPollUs{0}; /**< Spin budget of the listen socket and of every download's socket. */
+   int                         rcvBuf{0};     /**< Receive buffer of the listen socket, as granted by the kernel. */
+   uint32_t                    drops{0};      /**< Kernel drops on the listen socket already reported. */
+   std::vector<FTPFileWriter*> fw;            /**< Vector of file writers. */
+
+   std::unordered_map<FlowKey, FTPFileWriter*>      ftpWriters; /**< Map of file writers by address and port. */
+   std::unordered_map<FlowKey, Crypto::Aead*>       ciphers;    /**< Receiving ciphers of encrypted transfers by address. */
+   std::unordered_map<FlowKey, int>                 authFails;  /**< Datagrams in a row an encrypted flow failed to authenticate. */
+   std::unordered_map<FlowKey, Fec::StripeDecoder*> stripes;    /**< FEC stripe decoders by address. */
+   std::unordered_map<FlowKey, TokenBucket>         buckets;    /**< Upload budgets by host, the key's port cleared, shared by all its flows. */
+   std::unordered_map<FlowKey, int>                 windows;    /**< Datagrams each flow may have in flight, they size the receive buffer. */
+   std::unordered_map<FlowKey, int>                 priorities; /**< Priority of each flow's transfer, from the FTP_TRANSFER of its NEW. */
+   std::unordered_map<uint64_t, FTPFileWriter*>     transfers;  /**< Writers of multipath uploads by transfer id, while a subflow is open. */
+   std::unordered_map<uint64_t, SessionTicket>      tickets;    /**< Tickets handed out and not used yet, by id. */
+
+   /**
+    * @brief Accepts a CONNECT and starts a file writer for the sender.
+    *
+    * The options offered in the CONNECT payload are narrowed to what the server supports
+    * and echoed back in the CNTACK. An offered cipher is answered with the server's half of
+    * the key exchange.
+    *
+    * Every CNTACK carries a new ticket. A CONNECT redeeming one may carry the first datagram
+    * of a plain upload behind its options, which is written as if it came after the handshake.
+    *
+    * @param address The address of the sender.
+    * @param rcvSz The number of bytes received into the connection buffer.
+    */
+   void acceptConnection(const FlowKey& address, int rcvSz);
+
+   /**
+    * @brief Validates, acknowledges and dispatches a datagram of an established transfer.
+    *
+    * Datagrams failing their checksum are answered with an ERROR so the sender retransmits,
+    * retransmitted datagrams that were already delivered are acknowledged again but not written twice.
+    * Payloads of encrypted transfers are opened in place, forged ones are refused with ERROR_AUTH.
+    *
+    * @param address The address of the sender.
+    * @param rcvSz The number of bytes received into the connection buffer.
+    */
+   void handleDatagram(const FlowKey& address, int rcvSz);
+
+   /**
+    * @brief Authenticates and decrypts the payload of an encrypted transfer in place.
+    *
+    * @param address The address of the sender.
+    * @param inPdu The datagram's header.
+    * @param payload The payload, ciphertext followed by the tag.
+    * @param payloadSz The size of the payload, reduced to the plaintext size on success.
+    * @return bool False if the payload is forged or corrupted, true for plaintext transfers.
+    */
+   bool openPayload(const FlowKey& address, const PDU& inPdu, char* payload, int& payloadSz);
+
+   /**
+    * @brief Feeds a shard of an FEC stripe to the sender's decoder.
+    *
+    * A stripe is acknowledged once K of its shards arrived, its data datagrams are then
+    * pushed to the writer in order.
+    *
+    * @param address The address of the sender.
+    * @param inPdu The datagram's header.
+    * @param payload The shard, StripeHeader first.
+    * @param payloadSz The size of the shard.
+    */
+   void handleStripe(const FlowKey& address, const PDU& inPdu, char* payload, int payloadSz);
+
+   /**
+    * @brief Forgets everything kept for a sender: its writer, sequence number, cipher and FEC state.
+    *
+    * @param address The address of the sender.
+    */
+   void releaseFlow(const FlowKey& address);
+
+   /**
+    * @brief Keeps the priority a NEW or a request carries for every flow of its writer.
+    *
+    * The subflows of a multipath upload join before the NEW on the first of them, they share its writer
+    * and take its priority with it.
+    *
+    * @param writer The writer of the flow the datagram came in on.
+    * @param payload The datagram's payload, FTP_PDU first.
+    * @param payloadSz The size of the payload.
+    */
+   void notePriority(FTPFileWriter* writer, const char* payload, int payloadSz);
 
-   std::unordered_map<std::string, FTPFileWriter*> ftpWriters; /**< Map of file writers by address. */
+   /**
+    * @brief Hands out a ticket for a host's next CONNECT.
+    *
+    * @param address The address of the client.
+    * @return uint64_t The ticket, 0 if MAX_TICKETS are outstanding.
+    */
+   uint64_t issueTicket(const FlowKey& address);
+
+   /**
+    * @brief Uses up a ticket, it is good for one CONNECT only.
+    *
+    * @param address The address of the client.
+    * @param id The ticket it offered.
+    * @return bool True if the ticket was issued to the client's host and has not expired.
+    */
+   bool redeemTicket(const FlowKey& address, uint64_t id);
+
+   /**
+    * @brief Grows the listen socket's receive buffer to hold the windows of every open flow.
+    *
+    * A stop-and-wait flow has one datagram in flight, an FEC flow a whole stripe at the most parity.
+    * They may all be queued at once while the listen thread works through a burst of them, so the buffer
+    * is sized for their sum with BUFFER_HEADROOM for retransmissions. It never shrinks.
+    */
+   void tuneBuffers();
+
+   /**
+    * @brief Reports the datagrams the kernel dropped on a full listen socket and doubles its buffer.
+    */
+   void checkDrops();
+
+   /**
+    * @brief Charges a datagram to the budget of the host it came from.
+    *
+    * @param address The address and port of the sender, the bucket is the host's.
+    * @param bytes The size of the payload.
+    * @param overdraftMs How many milliseconds of budget the datagram may leave the host in debt,
+    *                    NEVER_REFUSE for datagrams that cannot be sent again alone.
+    * @return int 0 if the datagram was admitted, otherwise the milliseconds until it would be.
+    */
+   int throttle(const FlowKey& address, int bytes, int overdraftMs);
+
+   /**
+    * @brief Answers a datagram with an ERROR_BUSY carrying how long to wait before sending it again.
+    *
+    * @param seqnum The sequence number of the refused datagram.
+    * @param retryMs The delay in milliseconds.
+    */
+   void refuse(int seqnum, int retryMs);
+
+   /**
+    * @brief Hands a GET, LIST or STAT request to a new FTPFileSender on the senders pool.
+    *
+    * @param address The address of the client.
+    * @param request The request header, naming the file for GET and STAT.
+    * @param priority The Priority from the request's FTP_TRANSFER.
+    */
+   void startDownload(const FlowKey& address, const FTP_PDU& request, int priority);
 
 public:
+   static constexpr unsigned WRITER_THREADS       = 64;                              /**< Uploads received at the same time. */
+   static constexpr unsigned SENDER_THREADS       = 64;                              /**< Downloads served at the same time, the rest queue. */
+   static constexpr unsigned DIRECT_SPARE_BUFFERS = 16;                              /**< O_DIRECT buffers kept for the next uploads. */
+   static constexpr int      BURST_MS             = 250;                             /**< A host may send this long at its full rate at once. */
+   static constexpr int      SESSION_RETRY_MS     = 1000;                            /**< Delay suggested to a CONNECT refused for lack of sessions. */
+   static constexpr int      NEVER_REFUSE         = std::numeric_limits<int>::max(); /**< Overdraft of datagrams that are charged but never refused. */
+   static constexpr int      BUFFER_HEADROOM      = 2;                               /**< Receive buffer kept per byte of the open flows' windows. */
+   static constexpr int      RCVBUF_MAX           = 64 << 20;                        /**< Largest receive buffer asked for. */
+   static constexpr int      TICKET_LIFETIME_S    = 600;                             /**< Seconds a ticket stays good for. */
+   static constexpr size_t   MAX_TICKETS          = 1 << 16;                         /**< Tickets outstanding at the most. */
+   static constexpr int      MAX_AUTH_FAILS       = connection::MAX_RETRIES + 1;     /**< A flow failing this many datagrams in a row has the wrong key. */
+
+   std::string psk;                 /**< Pre-shared key mixed into session keys, empty for none. */
+   unsigned    maxSessions{0};      /**< Flows served at the same time, further CONNECTs are refused. 0 for no limit. */
+   uint64_t    clientRate{0};       /**< Upload bytes per second allowed to each client host. 0 for no limit. */
+   bool        fsyncOnCommit{true}; /**< Sync every uploaded file before its COMMIT is answered. */
+   bool        keepVersions{false}; /**< Store uploads of an existing name as name.N instead of replacing it. */
+   bool        mmapWrites{false};   /**< Write uploads of a known size through a shared mapping. */
+   bool        directIo{false};     /**< Write uploads of at least FTPFileWriter::DIRECT_MIN_SZ bytes with O_DIRECT. */
+
    /**
     * @brief Constructs an FTPServer object.
     *
+    * Temporary files of uploads a previous run left unfinished are removed, then the files already in the
+    * working directory are indexed into the metadata cache, hashed in parallel on the pool.
+    *
     * @param filePath The file path for the FTP server.
     * @param port The port number for the FTP server.
     */
    FTPServer(const std::string filePath, int port);
 
+   /**
+    * @brief Receives uploads through AF_XDP sockets on an interface, bypassing the kernel's UDP stack.
+    *
+    * The listen socket keeps working alongside, for peers on other interfaces and for replies
+    * that cannot go over AF_XDP.
+    *
+    * @param ifname The interface the clients reach the server on.
+    * @return bool False if AF_XDP is unavailable, the server keeps using the kernel socket alone.
+    */
+   bool attachXdp(const std::string& ifname);
+
+   /**
+    * @brief Spins on the listen socket, and on the socket of every later download, before blocking.
+    *
+    * Costs a core while transfers are active but answers a datagram microseconds after it
+    * arrives instead of after a wakeup, which is what a stop-and-wait sender waits on.
+    *
+    * @param us The spin budget in microseconds, 0 to block at once.
+    */
+   void setBusyPoll(int us);
+
    /**
     * @brief Listens for incoming connections.
     */
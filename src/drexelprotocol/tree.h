@@ -0,0 +1,65 @@
+/**
+ * @file tree.h
+ * @brief Declares the helpers that let a directory tree travel as a set of relative file names.
+ *
+ * @section Description
+ * A tree is uploaded file by file, each FTP_PDU naming its file by its path relative to the
+ * root of the tree. The server recreates the directories under its own directory and refuses
+ * names that would leave it. The client walks the tree in parallel, one task per directory,
+ * so a deep or wide tree on a slow disk or network file system is listed at the speed of the
+ * whole pool rather than one stat at a time.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "threadpool/threadpool.h"
+
+namespace DrexelProtocol
+{
+
+constexpr const char* PARTIAL_PREFIX = ".du-ftp-partial."; ///< Uploads in progress are written to hidden files named with this prefix.
+
+/**
+ * @struct TreeFile
+ * @brief A regular file found under the root of a tree.
+ */
+struct TreeFile
+{
+   std::string path; ///< Where the file is on the local disk.
+   std::string name; ///< Its path relative to the root, with '/' separators, as sent in FTP_PDU::fileName.
+   uint64_t    size; ///< Its size when the tree was scanned.
+};
+
+/**
+ * @brief Checks that a file name received from a peer stays inside the directory it is resolved against.
+ *
+ * @param name The relative path, with '/' separators.
+ * @return bool False for empty or absolute names and for names with a ".." component.
+ */
+bool safeRelativePath(const std::string& name);
+
+/**
+ * @brief Lists every regular file under a directory, one directory per task on a thread pool.
+ *
+ * Symbolic links to directories are not followed, so a tree with a cycle still terminates.
+ * Files whose relative name does not fit in FTP_PDU::fileName are reported and left out.
+ *
+ * @param root The directory to walk.
+ * @param pool The pool to walk on, the call returns once every directory is listed.
+ * @return std::vector<TreeFile> The files, in no particular order.
+ */
+std::vector<TreeFile> scanTree(const std::string& root, ThreadPool& pool);
+
+/**
+ * @brief Recognizes the temporary file of an upload in progress.
+ *
+ * @param name A file name or path.
+ * @return bool True if the last component starts with PARTIAL_PREFIX.
+ */
+bool partialFile(const std::string& name);
+
+}  // namespace DrexelProtocol
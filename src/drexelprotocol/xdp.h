@@ -0,0 +1,249 @@
+/**
+ * @file xdp.h
+ * @brief Declares the AF_XDP datapath the server can receive and send through instead of the kernel UDP stack.
+ *
+ * @section Description
+ * On a fast ingest node the kernel's UDP stack, not the disk, ends up the ceiling: every datagram
+ * walks the IP layer, a socket lookup and a socket buffer before recvfrom() copies it out. An
+ * AF_XDP socket gets the raw frames straight from the driver into a UMEM, a memory area we own
+ * and share with the kernel through four rings:
+ *
+ * - **Fill**: frames we hand the driver to receive into.
+ * - **RX**: frames the driver filled, with their length.
+ * - **TX**: frames we built and want sent.
+ * - **Completion**: frames the driver is done sending, ready to be reused.
+ *
+ * A small XDP program on the interface picks the IPv4 UDP datagrams sent to the server's port
+ * and redirects them to the socket of the queue they arrived on. Everything else, ARP included,
+ * goes on to the kernel as usual. Each receive queue of the interface gets its own socket, UMEM
+ * and thread, which drains its RX ring in batches and refills the fill ring with the same frames.
+ *
+ * Replies are built in the UMEM of the queue the peer's datagrams arrive on, addressed with
+ * the MAC addresses learned from them. Peers never seen on the AF_XDP path, datagrams that do not
+ * fit a frame and a full TX ring go through the kernel socket, which the datapath also keeps
+ * reading. Traffic on other interfaces, or a host without AF_XDP, is therefore still served.
+ *
+ * The program is attached through a BPF link. It is detached when the link is closed, including
+ * when the server dies. Everything is done with raw bpf() and socket calls, so the build needs
+ * no libbpf.
+ */
+
+#pragma once
+
+#include <drexelprotocol/address.h>
+#include <netinet/in.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace DrexelProtocol
+{
+
+/**
+ * @class XdpDatapath
+ * @brief Receives and sends the server's datagrams through AF_XDP sockets, one per interface queue.
+ */
+class XdpDatapath
+{
+private:
+   /**
+    * @struct Ring
+    * @brief One of the single producer, single consumer rings shared with the kernel.
+    */
+   struct Ring
+   {
+      uint32_t* producer{nullptr}; /**< Advanced by the side that fills the ring. */
+      uint32_t* consumer{nullptr}; /**< Advanced by the side that drains it. */
+      uint32_t* flags{nullptr};    /**< XDP_RING_NEED_WAKEUP when the kernel must be kicked. */
+      void*     descs{nullptr};    /**< The entries, xdp_desc or UMEM addresses. */
+      uint32_t  mask{0};           /**< Entries minus one, the size is a power of two. */
+      void*     area{nullptr};     /**< The mapping holding all of the above. */
+      size_t    areaSz{0};         /**< Size of the mapping. */
+   };
+
+   /**
+    * @struct Queue
+    * @brief The socket, UMEM and rings of one receive queue of the interface.
+    */
+   struct Queue
+   {
+      unsigned              id{0};         /**< The interface queue the socket is bound to. */
+      int                   fd{-1};        /**< The AF_XDP socket. */
+      char*                 umem{nullptr}; /**< NUM_FRAMES frames of FRAME_SZ bytes. */
+      Ring                  rx;            /**< Received frames. */
+      Ring                  tx;            /**< Frames to send. */
+      Ring                  fill;          /**< Frames lent to the driver for receiving. */
+      Ring                  done;          /**< Sent frames coming back. */
+      std::vector<uint64_t> txFree;        /**< Frames available to build replies in. */
+      std::mutex            txLock;        /**< Guards tx, done and txFree. */
+      std::thread           thread;        /**< Drains rx. */
+   };
+
+   /**
+    * @struct Route
+    * @brief How to reach a peer over AF_XDP, learned from its last datagram.
+    */
+   struct Route
+   {
+      uint8_t  peerMac[6];  /**< Source MAC of the peer's frames, the next hop towards it. */
+      uint8_t  localMac[6]; /**< Destination MAC of its frames, the interface's. */
+      uint32_t localIp;     /**< Destination address of its datagrams, network order. */
+      Queue*   queue;       /**< The queue its datagrams arrive on, replies leave from it. */
+   };
+
+   /**
+    * @struct Datagram
+    * @brief A received UDP payload waiting for the listen loop.
+    */
+   struct Datagram
+   {
+      struct sockaddr_storage from;   /**< The sender. */
+      socklen_t               fromSz; /**< Length of its address. */
+      std::string             data;   /**< The UDP payload. */
+   };
+
+   std::string                         ifname;          /**< The interface the program is attached to. */
+   unsigned                            ifindex{0};      /**< Its index. */
+   int                                 udpSock;         /**< The server's kernel socket, read too and used as the fallback for sending. */
+   int                                 family{AF_INET}; /**< Its family, AF_INET6 reports IPv4 senders IPv4-mapped. */
+   uint16_t                            port;            /**< The server's UDP port, host order. */
+   int                                 mapFd{-1};       /**< XSKMAP from queue id to socket. */
+   int                                 progFd{-1};      /**< The redirecting XDP program. */
+   int                                 linkFd{-1};      /**< Keeps the program attached while open. */
+   std::vector<Queue*>                 queues;          /**< One per receive queue. */
+   std::thread                         kernelThread;    /**< Reads udpSock. */
+   std::atomic<bool>                   running{false};  /**< Cleared to stop the threads. */
+   std::mutex                          routeLock;       /**< Guards routes. */
+   std::unordered_map<uint64_t, Route> routes;          /**< Routes by peer address and port. */
+   std::mutex                          inboxLock;       /**< Guards inbox. */
+   std::condition_variable             inboxReady;      /**< Signalled when inbox gets a datagram. */
+   std::deque<Datagram>                inbox;           /**< Received datagrams, oldest first. */
+   uint64_t                            dropped{0};      /**< Datagrams lost to a full inbox. */
+
+   /**
+    * @brief Creates the socket, UMEM and rings of a queue and binds it.
+    *
+    * @param queue The queue, its id set.
+    * @return bool False if the kernel refused any step.
+    */
+   bool openQueue(Queue& queue);
+
+   /**
+    * @brief Unmaps and closes everything openQueue() set up.
+    *
+    * @param queue The queue.
+    */
+   void closeQueue(Queue& queue);
+
+   /**
+    * @brief Loads the XDP program redirecting the server's datagrams into the XSKMAP.
+    *
+    * @return bool False if the kernel refused the map or the program.
+    */
+   bool loadProgram();
+
+   /**
+    * @brief Drains a queue's RX ring in batches until the datapath is stopped.
+    *
+    * @param queue The queue.
+    */
+   void rxLoop(Queue* queue);
+
+   /**
+    * @brief Reads the kernel socket until the datapath is stopped.
+    */
+   void kernelLoop();
+
+   /**
+    * @brief Checks a received frame, learns the route to its sender and keeps its UDP payload.
+    *
+    * @param queue The queue it arrived on.
+    * @param frame The frame.
+    * @param len Its length.
+    * @param out Receives the sender and payload.
+    * @return bool False for frames that are not an IPv4 UDP datagram to our port.
+    */
+   bool parse(Queue* queue, const uint8_t* frame, uint32_t len, Datagram& out);
+
+   /**
+    * @brief Queues received datagrams for recv(), dropping what does not fit like a full socket buffer would.
+    *
+    * @param batch The datagrams, moved from.
+    */
+   void deliver(std::vector<Datagram>& batch);
+
+   /**
+    * @brief Builds a datagram in a free frame of a queue and puts it on the TX ring.
+    *
+    * @param route How to reach the peer.
+    * @param buff The UDP payload.
+    * @param len Its size.
+    * @param to The peer, an IPv4 one.
+    * @return bool False if the frame or the ring is full, the caller sends through the kernel instead.
+    */
+   bool transmit(const Route& route, const void* buff, int len, const FlowKey& to);
+
+public:
+   static constexpr uint32_t FRAME_SZ   = 2048; /**< Size of a UMEM frame, one datagram each. */
+   static constexpr uint32_t NUM_FRAMES = 4096; /**< Frames per queue, half for receiving and half for sending. */
+   static constexpr uint32_t RING_SZ    = 2048; /**< Entries of every ring. */
+   static constexpr uint32_t BATCH      = 64;   /**< RX descriptors taken per pass. */
+   static constexpr size_t   INBOX_SZ   = 4096; /**< Received datagrams waiting for the listen loop at most. */
+   static constexpr int      POLL_MS    = 100;  /**< How often the threads check whether to stop. */
+
+   /**
+    * @brief Attaches to an interface, one AF_XDP socket per receive queue.
+    *
+    * @param ifname The interface.
+    * @param udpSock The server's bound kernel socket.
+    * @param port The port it is bound to, host order.
+    */
+   XdpDatapath(const std::string& ifname, int udpSock, uint16_t port);
+
+   /**
+    * @brief Stops the threads, detaches the program and frees the UMEMs.
+    */
+   ~XdpDatapath();
+
+   XdpDatapath(const XdpDatapath&)            = delete;
+   XdpDatapath& operator=(const XdpDatapath&) = delete;
+
+   /**
+    * @brief Reports whether the program is attached and the sockets are bound.
+    *
+    * @return bool False if AF_XDP is unavailable, the caller keeps using the kernel socket alone.
+    */
+   bool valid() const;
+
+   /**
+    * @brief Waits for the next datagram from either path.
+    *
+    * @param buff Receives the UDP payload.
+    * @param buffSz Its size, longer datagrams are truncated.
+    * @param from Receives the sender.
+    * @param fromSz Receives the length of its address.
+    * @return int The number of bytes received.
+    */
+   int recv(void* buff, int buffSz, struct sockaddr_storage& from, socklen_t& fromSz);
+
+   /**
+    * @brief Sends a datagram, over AF_XDP if the peer was seen there, otherwise through the kernel.
+    *
+    * @param buff The UDP payload.
+    * @param len Its size.
+    * @param to The peer.
+    * @param toSz The length of its address.
+    * @return int The number of bytes sent, or -1.
+    */
+   int send(const void* buff, int len, const struct sockaddr_storage& to, socklen_t toSz);
+};
+
+}  // namespace DrexelProtocol
@@ -0,0 +1,101 @@
+/**
+ * @file reedsolomon.h
+ * @brief Declares the systematic Reed-Solomon erasure code used for forward error correction.
+ *
+ * @section Description
+ * A stripe of K equally sized data shards is extended with M parity shards, any K of the K + M
+ * shards are enough to rebuild the data. The code works over GF(2^8) with a Cauchy generator
+ * matrix, every square submatrix of a Cauchy matrix is invertible so the code is MDS for any
+ * K + M <= 256.
+ *
+ * All the work is multiply-accumulate of a whole shard by a field constant. That runs on the
+ * split nibble table method: the constant's products with the 16 low and 16 high nibbles sit in
+ * two vector registers and one shuffle per half multiplies 16 (SSSE3, NEON) or 32 (AVX2) bytes
+ * at a time. The routine is picked at start-up, a table walk covers everything else.
+ *
+ * @section Reference
+ * J. Bloemer et al., "An XOR-Based Erasure-Resilient Coding Scheme", 1995.
+ * J. Plank, K. Greenan, E. Miller, "Screaming Fast Galois Field Arithmetic Using Intel SIMD Instructions", FAST 2013.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Fec
+{
+
+constexpr int MAX_SHARDS = 256; /**< K + M may not exceed the field size. */
+
+/**
+ * @brief Computes dst ^= c * src over GF(2^8), byte by byte.
+ *
+ * @param dst The accumulator.
+ * @param src The shard to scale.
+ * @param c The field constant.
+ * @param len The number of bytes.
+ */
+void mulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len);
+
+/**
+ * @brief Reports which implementation mulAdd() dispatches to.
+ *
+ * @return const char* "avx2", "ssse3", "neon" or "software".
+ */
+const char* gf256Backend();
+
+/**
+ * @class ReedSolomon
+ * @brief Encodes and repairs stripes of K data and M parity shards.
+ */
+class ReedSolomon
+{
+private:
+   int                  k;      ///< Data shards per stripe.
+   int                  m;      ///< Parity shards per stripe.
+   std::vector<uint8_t> matrix; ///< The M x K Cauchy rows producing the parity.
+
+public:
+   /**
+    * @brief Builds the code for a stripe shape.
+    *
+    * @param k The number of data shards, at least 1.
+    * @param m The number of parity shards, k + m at most MAX_SHARDS.
+    */
+   ReedSolomon(int k, int m);
+
+   /**
+    * @brief Computes the parity shards.
+    *
+    * @param data K data shards of @p len bytes.
+    * @param parity M buffers of @p len bytes receiving the parity.
+    * @param len The shard size.
+    */
+   void encode(const uint8_t* const* data, uint8_t* const* parity, size_t len) const;
+
+   /**
+    * @brief Computes a single parity shard.
+    *
+    * Row j only depends on K and j, so a sender can hand out parity one shard at a time.
+    *
+    * @param data K data shards of @p len bytes.
+    * @param row The parity row, below M.
+    * @param out Receives the parity shard.
+    * @param len The shard size.
+    */
+   void encodeRow(const uint8_t* const* data, int row, uint8_t* out, size_t len) const;
+
+   /**
+    * @brief Rebuilds the missing data shards in place.
+    *
+    * @param shards K + M shards of @p len bytes, data first, missing ones are overwritten.
+    * @param present Which of the K + M shards arrived.
+    * @param len The shard size.
+    * @return bool False if fewer than K shards arrived.
+    */
+   bool reconstruct(uint8_t* const* shards, const std::vector<bool>& present, size_t len) const;
+};
+
+}  // namespace Fec
@@ -0,0 +1,203 @@
+/**
+ * @file stripe.h
+ * @brief Declares the stripe layer that carries the data stream under forward error correction.
+ *
+ * @section Description
+ * With FEC negotiated the sender no longer waits a round trip per datagram. It gathers K data
+ * datagrams into a stripe, adds M Reed-Solomon parity datagrams and sends all of them back to back.
+ * The receiver acknowledges the stripe as soon as any K of them arrived, rebuilding lost data
+ * datagrams from the parity, so a loss only costs a round trip when more than M datagrams of a
+ * stripe go missing.
+ *
+ * Every datagram of a stripe carries a StripeHeader. Data shards travel unpadded, each starts with
+ * its length so a rebuilt shard can be cut back to size. The acknowledgement reports how far into
+ * the stripe the receiver had to read, which is the loss the sender sizes the next stripe's M on.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Fec
+{
+
+constexpr int    MAX_K  = 64; /**< Largest number of data datagrams per stripe. */
+constexpr int    MAX_M  = 64; /**< Largest number of parity datagrams per stripe. */
+constexpr size_t LEN_SZ = 2;  /**< Length prefix in front of every data shard. */
+
+/**
+ * @struct StripeHeader
+ * @brief Leads the payload of every datagram of a stripe.
+ */
+struct StripeHeader
+{
+   uint32_t stripe; /**< Stripe number, counted from 0 per transfer. */
+   uint16_t index;  /**< Shard index, data shards first then parity. */
+   uint8_t  k;      /**< Data shards in this stripe, the last one may be short. */
+   uint8_t  m;      /**< Parity shards sent in this round. */
+   uint16_t symSz;  /**< Size of a padded shard. */
+   uint16_t round;  /**< Transmission round, a resend of the stripe bumps it. */
+};
+
+/**
+ * @struct StripeAck
+ * @brief Payload of the acknowledgement of a decoded stripe.
+ */
+struct StripeAck
+{
+   uint32_t stripe; /**< The stripe that was delivered. */
+   uint16_t seen;   /**< Shard indexes the receiver went through to collect K shards. */
+   uint16_t k;      /**< Data shards of the stripe. */
+};
+
+/**
+ * @class StripeEncoder
+ * @brief Gathers data shards into stripes and sizes their parity on the measured loss rate.
+ */
+class StripeEncoder
+{
+private:
+   int                      k;         ///< Data shards per full stripe.
+   int                      minParity; ///< Parity never drops below this.
+   uint32_t                 stripe{0}; ///< Number of the stripe being filled.
+   uint16_t                 round{0};  ///< Rounds the current stripe was sent in.
+   std::vector<std::string> symbols;   ///< Data shards of the current stripe.
+   double                   loss{0};   ///< Smoothed fraction of datagrams lost.
+   double                   srtt{0};   ///< Smoothed stripe round trip time in milliseconds.
+   double                   rate{0};   ///< Smoothed delivery rate in bytes per millisecond.
+
+public:
+   /**
+    * @brief Constructs an encoder.
+    *
+    * @param k The number of data shards per stripe, clamped to [1, MAX_K].
+    * @param minParity The parity of a loss free link, clamped to [0, MAX_M].
+    */
+   StripeEncoder(int k, int minParity);
+
+   /**
+    * @brief Adds a data shard to the current stripe.
+    *
+    * @param data The datagram payload.
+    * @param len Its size.
+    * @return bool True once the stripe holds K shards and should be sent.
+    */
+   bool add(const char* data, size_t len);
+
+   /**
+    * @brief Reports whether the current stripe has no shards.
+    *
+    * @return bool True if there is nothing to send.
+    */
+   bool empty() const;
+
+   /**
+    * @brief Builds the datagram payloads of the current stripe for the next round.
+    *
+    * @return std::vector<std::string> The data shards followed by the parity shards, headers included.
+    */
+   std::vector<std::string> encode();
+
+   /**
+    * @brief Retires the current stripe and feeds its acknowledgement into the loss and RTT estimates.
+    *
+    * @param ack The receiver's acknowledgement.
+    * @param rttMs The time from the last send of the last round to the acknowledgement.
+    */
+   void acknowledged(const StripeAck& ack, double rttMs);
+
+   /**
+    * @brief Feeds an acknowledged round into the delivery rate estimate.
+    *
+    * @param bytes The bytes the round put on the wire, headers included.
+    * @param elapsedMs The time from its first send to the acknowledgement.
+    */
+   void delivered(size_t bytes, double elapsedMs);
+
+   /**
+    * @brief Records that a round went unacknowledged, the next round is sent with more parity.
+    */
+   void timedOut();
+
+   /**
+    * @brief The number of parity shards the current loss estimate calls for.
+    *
+    * @return int M for the current stripe.
+    */
+   int parity() const;
+
+   /**
+    * @brief How long to wait for an acknowledgement before resending the stripe.
+    *
+    * @return int The retransmission timeout in milliseconds.
+    */
+   int rtoMs() const;
+
+   /**
+    * @brief The rate to pace rounds at, a little above the measured delivery rate so it can still grow.
+    *
+    * @return uint64_t Bytes per second, 0 before the first round was delivered.
+    */
+   uint64_t pacingRate() const;
+
+   /**
+    * @brief The number of the stripe being filled.
+    *
+    * @return uint32_t The stripe number.
+    */
+   uint32_t current() const;
+};
+
+/**
+ * @class StripeDecoder
+ * @brief Collects the shards of the current stripe on the receiver and rebuilds lost data shards.
+ */
+class StripeDecoder
+{
+private:
+   uint32_t                 next{0};       ///< Stripe being collected.
+   uint16_t                 ackedRound{0}; ///< Latest round of the previous stripe that was acknowledged.
+   int                      k{0};          ///< Data shards of the current stripe, 0 before its first shard.
+   uint16_t                 symSz{0};      ///< Shard size of the current stripe.
+   int                      have{0};       ///< Distinct shards received.
+   int                      seen{0};       ///< Highest shard index received, plus one.
+   std::vector<std::string> shards;        ///< Shards by index, zero padded to symSz.
+   std::vector<bool>        present;       ///< Which shards arrived.
+   StripeAck                last{};        ///< Acknowledgement of the previous stripe.
+
+public:
+   /**
+    * @enum Status
+    * @brief Outcome of adding a shard.
+    */
+   typedef enum
+   {
+      PENDING,   /**< The stripe still needs more shards. */
+      COMPLETE,  /**< The stripe was decoded, acknowledge it. */
+      ACK_AGAIN, /**< The previous stripe was resent, its acknowledgement was lost. */
+      IGNORED    /**< A late or malformed shard. */
+   } Status;
+
+   /**
+    * @brief Adds a received shard.
+    *
+    * @param hdr The shard's header.
+    * @param sym The shard, after the header.
+    * @param len The size of the shard.
+    * @param out Receives the stripe's data shards in order when it completes.
+    * @return int A Status.
+    */
+   int add(const StripeHeader& hdr, const char* sym, size_t len, std::vector<std::string>& out);
+
+   /**
+    * @brief The acknowledgement of the most recently completed stripe.
+    *
+    * @return StripeAck The acknowledgement.
+    */
+   StripeAck ack() const;
+};
+
+}  // namespace Fec
@@ -0,0 +1,349 @@
+/**
+ * @file lz4.cpp
+ * @brief Implementation of the LZ4 block format compressor and decompressor.
+ */
+
+#include "compression/lz4.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace LZ4 = Compression::LZ4;
+
+namespace
+{
+
+constexpr size_t MINMATCH     = 4;      ///< Shortest match the format can express.
+constexpr size_t LASTLITERALS = 5;      ///< The last bytes of a block are always literals.
+constexpr size_t MFLIMIT      = 12;     ///< The last match must start this far from the end.
+constexpr size_t MAX_DISTANCE = 65535;  ///< Offsets are 16 bits.
+constexpr int    HASH_LOG     = 16;     ///< log2 of the hash chain table size.
+constexpr int    FAST_LOG     = 12;     ///< log2 of the single probe table, small enough to stay in L1.
+constexpr size_t CHAIN_SZ     = 65536;  ///< Chain table covers the whole match window.
+
+inline uint32_t read32(const uint8_t* p)
+{
+   uint32_t v;
+   std::memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+template <int LOG = HASH_LOG>
+inline uint32_t hash4(const uint8_t* p)
+{
+   return (read32(p) * 2654435761U) >> (32 - LOG);
+}
+
+inline size_t matchLength(const uint8_t* ip, const uint8_t* match, const uint8_t* limit)
+{
+   const uint8_t* start = ip;
+   while (ip + 8 <= limit)
+   {
+      uint64_t a, b;
+      std::memcpy(&a, ip, sizeof(a));
+      std::memcpy(&b, match, sizeof(b));
+      if (a != b)
+         return (ip - start) + (__builtin_ctzll(a ^ b) >> 3);
+      ip += 8;
+      match += 8;
+   }
+   while (ip < limit && *ip == *match)
+   {
+      ip++;
+      match++;
+   }
+   return ip - start;
+}
+
+/**
+ * @brief Writes the variable length continuation of a literal or match length.
+ */
+inline uint8_t* writeLength(uint8_t* op, size_t len)
+{
+   while (len >= 255)
+   {
+      *op++ = 255;
+      len -= 255;
+   }
+   *op++ = static_cast<uint8_t>(len);
+   return op;
+}
+
+/**
+ * @brief Emits one sequence, a match length of 0 marks the final literal-only sequence.
+ *
+ * @return uint8_t* The new output position, or nullptr if the output would overflow.
+ */
+uint8_t* emitSequence(uint8_t* op, uint8_t* oend, const uint8_t* literals, size_t litLen, size_t offset, size_t matchLen)
+{
+   size_t worst = 1 + litLen / 255 + 1 + litLen + 2 + matchLen / 255 + 1;
+   if (worst > static_cast<size_t>(oend - op))
+      return nullptr;
+
+   uint8_t* token = op++;
+   *token         = (litLen >= 15) ? 0xF0 : static_cast<uint8_t>(litLen << 4);
+   if (litLen >= 15)
+      op = writeLength(op, litLen - 15);
+
+   std::memcpy(op, literals, litLen);
+   op += litLen;
+
+   if (matchLen == 0)
+      return op;
+
+   *op++ = static_cast<uint8_t>(offset & 0xFF);
+   *op++ = static_cast<uint8_t>(offset >> 8);
+
+   size_t ml = matchLen - MINMATCH;
+   *token |= (ml >= 15) ? 0x0F : static_cast<uint8_t>(ml);
+   if (ml >= 15)
+      op = writeLength(op, ml - 15);
+
+   return op;
+}
+
+/**
+ * @brief Shared compression loop, @p Finder locates the best match for the current position.
+ */
+template <typename Finder>
+size_t compressWith(const char* source, size_t srcSize, char* dest, size_t dstCapacity, Finder& finder)
+{
+   const uint8_t* src    = reinterpret_cast<const uint8_t*>(source);
+   const uint8_t* ip     = src;
+   const uint8_t* anchor = src;
+   const uint8_t* iend   = src + srcSize;
+   uint8_t*       op     = reinterpret_cast<uint8_t*>(dest);
+   uint8_t*       oend   = op + dstCapacity;
+
+   if (srcSize > MFLIMIT)
+   {
+      const uint8_t* mflimit    = iend - MFLIMIT;
+      const uint8_t* matchlimit = iend - LASTLITERALS;
+      size_t         misses     = 0;
+
+      while (ip < mflimit)
+      {
+         const uint8_t* match = nullptr;
+         size_t         len   = finder.find(src, ip, matchlimit, match);
+
+         if (len < MINMATCH)
+         {
+            ip += 1 + (misses++ >> 6);
+            continue;
+         }
+         misses = 0;
+
+         while (ip > anchor && match > src && ip[-1] == match[-1])
+         {
+            ip--;
+            match--;
+            len++;
+         }
+
+         op = emitSequence(op, oend, anchor, ip - anchor, ip - match, len);
+         if (op == nullptr)
+            return 0;
+
+         finder.skip(src, ip, ip + len);
+         ip += len;
+         anchor = ip;
+      }
+   }
+
+   op = emitSequence(op, oend, anchor, iend - anchor, 0, 0);
+   if (op == nullptr)
+      return 0;
+
+   return op - reinterpret_cast<uint8_t*>(dest);
+}
+
+/**
+ * @brief Single probe finder, the most recent position with the same hash is the only candidate.
+ */
+struct FastFinder
+{
+   std::vector<uint32_t> table;
+
+   FastFinder() : table(1 << FAST_LOG, UINT32_MAX)
+   {}
+
+   size_t find(const uint8_t* src, const uint8_t* ip, const uint8_t* limit, const uint8_t*& match)
+   {
+      uint32_t h    = hash4<FAST_LOG>(ip);
+      uint32_t cand = table[h];
+      uint32_t pos  = ip - src;
+      table[h]      = pos;
+
+      if (cand == UINT32_MAX || pos - cand > MAX_DISTANCE || read32(src + cand) != read32(ip))
+         return 0;
+
+      match = src + cand;
+      return MINMATCH + matchLength(ip + MINMATCH, match + MINMATCH, limit);
+   }
+
+   void skip(const uint8_t* src, const uint8_t* from, const uint8_t* to)
+   {
+      if (to - from > 2)
+         table[hash4<FAST_LOG>(to - 2)] = (to - 2) - src;
+   }
+};
+
+/**
+ * @brief Hash chain finder, walks up to depth earlier positions sharing the hash and keeps the longest match.
+ */
+struct ChainFinder
+{
+   std::vector<uint32_t> table;
+   std::vector<uint16_t> chain;
+   int                   depth;
+   uint32_t              nextToUpdate{0};
+
+   ChainFinder(int depth) : table(1 << HASH_LOG, UINT32_MAX), chain(CHAIN_SZ, 0), depth(depth)
+   {}
+
+   void insertUpTo(const uint8_t* src, uint32_t target)
+   {
+      while (nextToUpdate < target)
+      {
+         uint32_t h     = hash4(src + nextToUpdate);
+         uint32_t prev  = table[h];
+         uint32_t delta = (prev == UINT32_MAX) ? 0 : nextToUpdate - prev;
+
+         chain[nextToUpdate & (CHAIN_SZ - 1)] = (delta > MAX_DISTANCE) ? 0 : static_cast<uint16_t>(delta);
+         table[h]                             = nextToUpdate;
+         nextToUpdate++;
+      }
+   }
+
+   size_t find(const uint8_t* src, const uint8_t* ip, const uint8_t* limit, const uint8_t*& match)
+   {
+      uint32_t pos = ip - src;
+      insertUpTo(src, pos);
+
+      size_t   best     = 0;
+      uint32_t cand     = table[hash4(ip)];
+      int      attempts = depth;
+
+      while (cand != UINT32_MAX && pos - cand <= MAX_DISTANCE && attempts-- > 0)
+      {
+         if (read32(src + cand) == read32(ip))
+         {
+            size_t len = MINMATCH + matchLength(ip + MINMATCH, src + cand + MINMATCH, limit);
+            if (len > best)
+            {
+               best  = len;
+               match = src + cand;
+            }
+         }
+
+         uint16_t delta = chain[cand & (CHAIN_SZ - 1)];
+         if (delta == 0 || delta > cand)
+            break;
+         cand -= delta;
+      }
+
+      insertUpTo(src, pos + 1);
+      return best;
+   }
+
+   void skip(const uint8_t* src, const uint8_t* from, const uint8_t* to)
+   {
+      insertUpTo(src, to - src);
+   }
+};
+
+}  // namespace
+
+size_t LZ4::compressBound(size_t srcSize)
+{
+   return srcSize + srcSize / 255 + 16;
+}
+
+size_t LZ4::compressFast(const char* src, size_t srcSize, char* dst, size_t dstCapacity)
+{
+   thread_local FastFinder finder;
+   std::fill(finder.table.begin(), finder.table.end(), UINT32_MAX);
+   return compressWith(src, srcSize, dst, dstCapacity, finder);
+}
+
+size_t LZ4::compressHC(const char* src, size_t srcSize, char* dst, size_t dstCapacity, int depth)
+{
+   ChainFinder finder{depth};
+   return compressWith(src, srcSize, dst, dstCapacity, finder);
+}
+
+long LZ4::decompress(const char* source, size_t srcSize, char* dest, size_t dstCapacity)
+{
+   const uint8_t* ip   = reinterpret_cast<const uint8_t*>(source);
+   const uint8_t* iend = ip + srcSize;
+   uint8_t*       dst  = reinterpret_cast<uint8_t*>(dest);
+   uint8_t*       op   = dst;
+   uint8_t*       oend = dst + dstCapacity;
+
+   while (ip < iend)
+   {
+      uint8_t token = *ip++;
+
+      size_t litLen = token >> 4;
+      if (litLen == 15)
+      {
+         uint8_t b;
+         do
+         {
+            if (ip >= iend)
+               return -1;
+            b = *ip++;
+            litLen += b;
+         } while (b == 255);
+      }
+
+      if (litLen > static_cast<size_t>(iend - ip) || litLen > static_cast<size_t>(oend - op))
+         return -1;
+      std::memcpy(op, ip, litLen);
+      ip += litLen;
+      op += litLen;
+
+      if (ip >= iend)
+         break;
+
+      if (iend - ip < 2)
+         return -1;
+      size_t offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > static_cast<size_t>(op - dst))
+         return -1;
+
+      size_t matchLen = token & 0x0F;
+      if (matchLen == 15)
+      {
+         uint8_t b;
+         do
+         {
+            if (ip >= iend)
+               return -1;
+            b = *ip++;
+            matchLen += b;
+         } while (b == 255);
+      }
+      matchLen += MINMATCH;
+
+      if (matchLen > static_cast<size_t>(oend - op))
+         return -1;
+
+      const uint8_t* match = op - offset;
+      if (offset >= matchLen)
+      {
+         std::memcpy(op, match, matchLen);
+         op += matchLen;
+      }
+      else
+      {
+         while (matchLen--)
+            *op++ = *match++;
+      }
+   }
+
+   return op - dst;
+}
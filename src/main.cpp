@@ -14,13 +14,39 @@
  * To build the application, run `make`.
  *
  * @section usage_sec Usage
- * USAGE: ./bin/du-ftp [-p port] [-f fname] [-a svr_addr] [-s] [-c] [-h]
+ * USAGE: ./bin/du-ftp [-p port] [-f fname] [-a svr_addr] [-z codec] [-j workers] [-q depth] [-e cipher] [-k psk] [-r k[:m]] [-n streams] [-i priority] [-x sessions] [-b rate] [-d ifname] [-B us] [-P addrs] [-T file] [-D sock] [-S sock] [-R] [-m group] [-s] [-c] [-g] [-l] [-t] [-u] [-y] [-o] [-v] [-w] [-h]
  *
  * WHERE:
  * - [-c] runs in client mode, [-s] runs in server mode; DEFAULT= client_mode
- * - [-a svr_addr] specifies the server's IP address as a string; DEFAULT = 127.0.0.1
+ * - [-g] runs in client mode and downloads fname from the server instead of uploading it
+ * - [-l] runs in client mode and lists the files on the server with their size, mtime and digest
+ * - [-t] runs in client mode and shows size, mtime and digest of fname on the server
+ * - [-y] in server mode, answers CLOSE without syncing the file to disk first
+ * - [-o] in server mode, writes uploads of 64 MB or more with O_DIRECT, bypassing the page cache
+ * - [-v] in server mode, stores an upload of an existing name as name.1, name.2, ... instead of replacing it
+ * - [-w] in server mode, writes uploads into a shared mapping of the file instead of calling write
+ * - [-u] skips the upload when the server already has a file with the same size and digest
+ * - [-a svr_addr] specifies the server's host name or IPv4 or IPv6 address; DEFAULT = 127.0.0.1
  * - [-p portnum] specifies the port number; DEFAULT = 2080
- * - [-f fname] specifies the filename to send or receive; DEFAULT = test.c
+ * - [-f fname] specifies the filename to send or receive, a directory is uploaded with its whole tree; DEFAULT = test.c
+ * - [-z codec] compresses the upload with none, lz4 or lz4hc; DEFAULT = none
+ * - [-j workers] sets the number of compression threads; DEFAULT = one per hardware thread
+ * - [-q depth] sets the number of blocks in flight in the compression pipeline; DEFAULT = 2 * workers
+ * - [-e cipher] encrypts the upload with none, auto, aes or chacha; DEFAULT = none
+ * - [-k psk] mixes a pre-shared key into the session key, give the same key to both sides; DEFAULT = none
+ * - [-r k[:m]] protects every k datagrams with at least m Reed-Solomon parity datagrams, adapted to loss; DEFAULT = off
+ * - [-n streams] sets the number of files of a tree uploaded at the same time; DEFAULT = 4
+ * - [-i priority] schedules the transfer as bulk, normal or urgent, on the network (DSCP) and on the server's disk; DEFAULT = normal
+ * - [-x sessions] in server mode, refuses connections beyond this many; DEFAULT = no limit
+ * - [-b rate] in server mode, limits the uploads of each client host to rate bytes per second; DEFAULT = no limit
+ * - [-d ifname] in server mode, receives through AF_XDP sockets on the interface, falling back to the kernel socket; DEFAULT = off
+ * - [-B us] spins up to us microseconds on the socket before every blocking receive, for low latency at the cost of CPU; DEFAULT = 0
+ * - [-P addrs] uploads over one path per comma separated local address, binds to the address when only one is given; DEFAULT = any
+ * - [-T file] keeps a session ticket in file, so the next upload to the same server sends its first datagram with the CONNECT; DEFAULT = none
+ * - [-D sock] runs as a client daemon, uploading the files submitted on the Unix socket sock over clients it keeps between jobs, -n at a time
+ * - [-S sock] submits fname to the daemon on sock for svr_addr and waits until it is uploaded
+ * - [-R] with [-S], streams stdin line by line to the daemon through a shared-memory ring, uploaded as fname
+ * - [-m group] multicasts fname to the group with [-s], or receives it from the group with [-g]; svr_addr is then the local interface
  * - [-h] displays what you are looking at now - the help
  *
  *
@@ -31,16 +57,33 @@
 
 #include <getopt.h>
 
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <sstream>
+#include <string>
 
+#include "compression/blockcodec.h"
+#include "crypto/aead.h"
+#include "fec/stripe.h"
 #include "drexelprotocol/client.h"
+#include "drexelprotocol/daemon.h"
+#include "drexelprotocol/multicast.h"
 #include "drexelprotocol/server.h"
 
 namespace DPv1 = DrexelProtocol;
 
 constexpr int PROG_MD_CLI = 0;
 constexpr int PROG_MD_SVR = 1;
+constexpr int PROG_MD_GET = 2;
+constexpr int PROG_MD_MCS = 3;
+constexpr int PROG_MD_MCR = 4;
+constexpr int PROG_MD_LST = 5;
+constexpr int PROG_MD_STA = 6;
+constexpr int PROG_MD_DMN = 7;
+constexpr int PROG_MD_SUB = 8;
 constexpr int DEF_PORT_NO = 2080;
 // constexpr int FNAME_SZ    = 150;
 
@@ -51,11 +94,35 @@ typedef struct ProgConfig
 {
    int  progMode;
    int  portNumber;
-   char svrIpAddr[16];
+   char svrIpAddr[256];
    char fileName[128];
+   int  codec;
+   int  workers;
+   int  depth;
+   int  cipher;
+   char psk[128];
+   int  fecK;
+   int  fecM;
+   char mcastGroup[16];
+   bool skipIdentical;
+   int  streams;
+   bool fsyncOnCommit;
+   bool directIo;
+   bool keepVersions;
+   bool mmapWrites;
+   int  priority;
+   int  maxSessions;
+   long clientRate;
+   char xdpIf[16];
+   int  busyPollUs;
+   char localAddrs[256];
+   char ticketFile[256];
+   char daemonSock[108];
+   bool ringStdin;
 } ProgConfig;
 
-static int initParams(int argc, char* argv[], ProgConfig& cfg);
+static int  initParams(int argc, char* argv[], ProgConfig& cfg);
+static void configureClient(DPv1::FTPClient& client, const ProgConfig& cfg);
 
 int main(int argc, char* argv[])
 {
@@ -71,7 +138,10 @@ int main(int argc, char* argv[])
 
    switch (cmd)
    {
-      case PROG_MD_CLI: {
+      case PROG_MD_CLI:
+      case PROG_MD_GET:
+      case PROG_MD_LST:
+      case PROG_MD_STA: {
          DPv1::FTPClient client{std::string(cfg.fileName), cfg.svrIpAddr, cfg.portNumber};
 
          if (!client.validate())
@@ -80,6 +150,9 @@ int main(int argc, char* argv[])
             exit(-1);
          }
 
+         configureClient(client, cfg);
+         client.earlyData = cmd == PROG_MD_CLI;
+
          rc = client.connect();
          if (rc < 0)
          {
@@ -87,7 +160,92 @@ int main(int argc, char* argv[])
             exit(-1);
          }
 
-         client.start();
+         bool done;
+         if (cmd == PROG_MD_GET)
+            done = client.get();
+         else if (cmd == PROG_MD_LST)
+            done = client.list();
+         else if (cmd == PROG_MD_STA)
+            done = client.stat();
+         else
+            done = client.start();
+
+         if (!done)
+            exit(-1);
+         break;
+      }
+      case PROG_MD_DMN: {
+         // Never connected, every job forks it for its server.
+         DPv1::FTPClient settings{"", cfg.svrIpAddr, cfg.portNumber};
+         configureClient(settings, cfg);
+         settings.earlyData = true;
+
+         DPv1::ClientDaemon daemon{cfg.daemonSock, settings, static_cast<unsigned>(cfg.streams)};
+         if (!daemon.validate())
+            exit(-1);
+
+         daemon.run();
+         break;
+      }
+      case PROG_MD_SUB: {
+         DPv1::UploadJob    job{};
+         DPv1::UploadResult result;
+         std::string        path = cfg.ringStdin ? std::string(cfg.fileName) : std::filesystem::absolute(cfg.fileName).string();
+
+         // A name cut to fit would upload the wrong file or reach the wrong server, one too long is refused.
+         size_t serverSz = strlen(cfg.svrIpAddr);
+         if (path.size() >= sizeof(job.path))
+         {
+            std::cerr << "ERROR:  Path " << path << " is too long for the daemon" << std::endl;
+            exit(-1);
+         }
+         if (serverSz >= sizeof(job.server))
+         {
+            std::cerr << "ERROR:  Server name " << cfg.svrIpAddr << " is too long for the daemon" << std::endl;
+            exit(-1);
+         }
+
+         // job is zeroed, the copies stay terminated.
+         memcpy(job.path, path.data(), path.size());
+         memcpy(job.server, cfg.svrIpAddr, serverSz);
+         job.port = cfg.portNumber;
+         job.ring = cfg.ringStdin;
+
+         if (cfg.ringStdin)
+         {
+            DPv1::RecordRing ring{"du-ftp " + path};
+            int              conn = ring.validate() ? DPv1::ClientDaemon::startJob(cfg.daemonSock, job, ring.getFd()) : -1;
+            if (conn < 0)
+               exit(-1);
+
+            // Every line is a record, the daemon never uploads half of one.
+            std::string line;
+            bool        written = true;
+            while (written && std::getline(std::cin, line))
+            {
+               if (!std::cin.eof())
+                  line += '\n';
+               written = ring.write(line.data(), line.size());
+            }
+
+            if (written)
+               ring.close();
+            else
+               ring.abort();
+
+            if (!DPv1::ClientDaemon::awaitJob(conn, result))
+               exit(-1);
+         }
+         else if (!DPv1::ClientDaemon::submit(cfg.daemonSock, job, result))
+            exit(-1);
+
+         if (result.err != DPv1::Error::NONE)
+         {
+            std::cerr << "ERROR:  Daemon could not upload " << path << ((result.err == DPv1::Error::FILE_NOT_FOUND) ? ", no such file" : "")
+                      << std::endl;
+            exit(-1);
+         }
+         std::cout << "Uploaded " << path << std::endl;
          break;
       }
       case PROG_MD_SVR: {
@@ -98,12 +256,39 @@ int main(int argc, char* argv[])
             perror("Error initilizing server: ");
             exit(-1);
          }
+         server.psk           = cfg.psk;
+         server.fsyncOnCommit = cfg.fsyncOnCommit;
+         server.directIo      = cfg.directIo;
+         server.keepVersions  = cfg.keepVersions;
+         server.mmapWrites    = cfg.mmapWrites;
+         server.maxSessions   = cfg.maxSessions;
+         server.clientRate    = cfg.clientRate;
+
+         server.setBusyPoll(cfg.busyPollUs);
+
+         if (cfg.xdpIf[0] != '\0' && !server.attachXdp(cfg.xdpIf))
+            std::cerr << "AF_XDP unavailable on " << cfg.xdpIf << ", receiving through the kernel socket" << std::endl;
+
          while (true)
          {
             server.listen();
          }
          break;
       }
+      case PROG_MD_MCS: {
+         DPv1::MulticastSender sender{cfg.mcastGroup, cfg.portNumber, cfg.svrIpAddr};
+
+         if (!sender.validate() || !sender.send(cfg.fileName))
+            exit(-1);
+         break;
+      }
+      case PROG_MD_MCR: {
+         DPv1::MulticastReceiver receiver{cfg.mcastGroup, cfg.portNumber, cfg.svrIpAddr};
+
+         if (!receiver.validate() || !receiver.receive(cfg.fileName))
+            exit(-1);
+         break;
+      }
       default: {
          std::cerr << "ERROR: Unknown Program Mode.  Mode set is " << cmd << std::endl;
          break;
@@ -113,6 +298,32 @@ int main(int argc, char* argv[])
    return 0;
 }
 
+void configureClient(DPv1::FTPClient& client, const ProgConfig& cfg)
+{
+   client.options.codec   = cfg.codec;
+   client.pipelineWorkers = cfg.workers;
+   client.pipelineDepth   = cfg.depth;
+   client.options.cipher  = cfg.cipher;
+   client.psk             = cfg.psk;
+   client.options.fecK    = cfg.fecK;
+   client.fecParity       = cfg.fecM;
+   client.skipIdentical   = cfg.skipIdentical;
+   client.treeStreams     = cfg.streams;
+   client.priority        = cfg.priority;
+   client.busyPollUs      = cfg.busyPollUs;
+   client.ticketFile      = cfg.ticketFile;
+
+   std::stringstream localAddrs(cfg.localAddrs);
+   std::string       localAddr;
+   while (std::getline(localAddrs, localAddr, ','))
+   {
+      if (!localAddr.empty())
+         client.localAddrs.push_back(localAddr);
+   }
+   if (!client.localAddrs.empty())
+      client.localAddr = client.localAddrs.front();
+}
+
 int initParams(int argc, char* argv[], ProgConfig& cfg)
 {
    int         option;
@@ -122,20 +333,125 @@ int initParams(int argc, char* argv[], ProgConfig& cfg)
    cfg.portNumber = DEF_PORT_NO;
    strcpy(cfg.fileName, PROG_DEF_FNAME);
    strcpy(cfg.svrIpAddr, PROG_DEF_SVR_ADDR);
+   cfg.codec         = Compression::CODEC_NONE;
+   cfg.workers       = 0;
+   cfg.depth         = 0;
+   cfg.cipher        = Crypto::CIPHER_NONE;
+   cfg.psk[0]        = '\0';
+   cfg.fecK          = 0;
+   cfg.fecM          = 1;
+   cfg.mcastGroup[0] = '\0';
+   cfg.skipIdentical = false;
+   cfg.streams       = 4;
+   cfg.fsyncOnCommit = true;
+   cfg.directIo      = false;
+   cfg.keepVersions  = false;
+   cfg.mmapWrites    = false;
+   cfg.priority      = DPv1::Priority::NORMAL;
+   cfg.maxSessions   = 0;
+   cfg.clientRate    = 0;
+   cfg.xdpIf[0]      = '\0';
+   cfg.busyPollUs    = 0;
+   cfg.localAddrs[0] = '\0';
+   cfg.ticketFile[0] = '\0';
+   cfg.daemonSock[0] = '\0';
+   cfg.ringStdin     = false;
 
-   while ((option = getopt(argc, argv, ":p:f:a:csh")) != -1)
+   while ((option = getopt(argc, argv, ":p:f:a:z:j:q:e:k:r:n:i:x:b:d:B:P:T:D:S:Rm:csgltuyovwh")) != -1)
    {
       switch (option)
       {
          case 'p':
-            strncpy(cmdBuffer, optarg, sizeof(cmdBuffer));
+            strncpy(cmdBuffer, optarg, sizeof(cmdBuffer) - 1);
+            cmdBuffer[sizeof(cmdBuffer) - 1] = '\0';
             cfg.portNumber = std::atoi(cmdBuffer);
             break;
          case 'f':
-            strncpy(cfg.fileName, optarg, sizeof(cfg.fileName));
+            strncpy(cfg.fileName, optarg, sizeof(cfg.fileName) - 1);
+            cfg.fileName[sizeof(cfg.fileName) - 1] = '\0';
             break;
          case 'a':
-            strncpy(cfg.svrIpAddr, optarg, sizeof(cfg.svrIpAddr));
+            strncpy(cfg.svrIpAddr, optarg, sizeof(cfg.svrIpAddr) - 1);
+            cfg.svrIpAddr[sizeof(cfg.svrIpAddr) - 1] = '\0';
+            break;
+         case 'z':
+            cfg.codec = Compression::codecFromString(optarg);
+            if (cfg.codec < 0)
+            {
+               std::cerr << "Unknown codec " << optarg << ", expected none, lz4 or lz4hc" << std::endl;
+               exit(-1);
+            }
+            break;
+         case 'j':
+            cfg.workers = std::max(0, std::atoi(optarg));
+            break;
+         case 'q':
+            cfg.depth = std::max(0, std::atoi(optarg));
+            break;
+         case 'n':
+            cfg.streams = std::max(1, std::atoi(optarg));
+            break;
+         case 'i':
+            cfg.priority = DPv1::priorityFromString(optarg);
+            if (cfg.priority < 0)
+            {
+               std::cerr << "Unknown priority " << optarg << ", expected bulk, normal or urgent" << std::endl;
+               exit(-1);
+            }
+            break;
+         case 'x':
+            cfg.maxSessions = std::max(0, std::atoi(optarg));
+            break;
+         case 'b':
+            cfg.clientRate = std::max(0L, std::atol(optarg));
+            break;
+         case 'B':
+            cfg.busyPollUs = std::max(0, std::atoi(optarg));
+            break;
+         case 'P':
+            strncpy(cfg.localAddrs, optarg, sizeof(cfg.localAddrs) - 1);
+            cfg.localAddrs[sizeof(cfg.localAddrs) - 1] = '\0';
+            break;
+         case 'T':
+            strncpy(cfg.ticketFile, optarg, sizeof(cfg.ticketFile) - 1);
+            cfg.ticketFile[sizeof(cfg.ticketFile) - 1] = '\0';
+            break;
+         case 'D':
+         case 'S':
+            strncpy(cfg.daemonSock, optarg, sizeof(cfg.daemonSock) - 1);
+            cfg.daemonSock[sizeof(cfg.daemonSock) - 1] = '\0';
+            cfg.progMode                                = (option == 'D') ? PROG_MD_DMN : PROG_MD_SUB;
+            break;
+         case 'R':
+            cfg.ringStdin = true;
+            break;
+         case 'd':
+            strncpy(cfg.xdpIf, optarg, sizeof(cfg.xdpIf) - 1);
+            cfg.xdpIf[sizeof(cfg.xdpIf) - 1] = '\0';
+            break;
+         case 'e':
+            cfg.cipher = Crypto::cipherFromString(optarg);
+            if (cfg.cipher < 0)
+            {
+               std::cerr << "Unknown cipher " << optarg << ", expected none, auto, aes or chacha" << std::endl;
+               exit(-1);
+            }
+            break;
+         case 'k':
+            strncpy(cfg.psk, optarg, sizeof(cfg.psk) - 1);
+            cfg.psk[sizeof(cfg.psk) - 1] = '\0';
+            break;
+         case 'r':
+            if (sscanf(optarg, "%d:%d", &cfg.fecK, &cfg.fecM) < 1 || cfg.fecK < 1 || cfg.fecK > Fec::MAX_K || cfg.fecM < 0 ||
+                cfg.fecM > Fec::MAX_M)
+            {
+               std::cerr << "Bad FEC stripe " << optarg << ", expected k[:m] with k in 1.." << Fec::MAX_K << std::endl;
+               exit(-1);
+            }
+            break;
+         case 'm':
+            strncpy(cfg.mcastGroup, optarg, sizeof(cfg.mcastGroup) - 1);
+            cfg.mcastGroup[sizeof(cfg.mcastGroup) - 1] = '\0';
             break;
          case 'c':
             cfg.progMode = PROG_MD_CLI;
@@ -143,12 +459,62 @@ int initParams(int argc, char* argv[], ProgConfig& cfg)
          case 's':
             cfg.progMode = PROG_MD_SVR;
             break;
+         case 'g':
+            cfg.progMode = PROG_MD_GET;
+            break;
+         case 'l':
+            cfg.progMode = PROG_MD_LST;
+            break;
+         case 't':
+            cfg.progMode = PROG_MD_STA;
+            break;
+         case 'u':
+            cfg.skipIdentical = true;
+            break;
+         case 'y':
+            cfg.fsyncOnCommit = false;
+            break;
+         case 'o':
+            cfg.directIo = true;
+            break;
+         case 'v':
+            cfg.keepVersions = true;
+            break;
+         case 'w':
+            cfg.mmapWrites = true;
+            break;
          case 'h':
-            std::cout << "USAGE: " << argv[0] << " [-p port] [-f fname] [-a svr_addr] [-s] [-c] [-h]\n";
+            std::cout << "USAGE: " << argv[0] << " [-p port] [-f fname] [-a svr_addr] [-z codec] [-j workers] [-q depth] [-e cipher] [-k psk] [-r k[:m]] [-n streams] [-i priority] [-x sessions] [-b rate] [-d ifname] [-B us] [-P addrs] [-T file] [-D sock] [-S sock] [-R] [-m group] [-s] [-c] [-g] [-l] [-t] [-u] [-y] [-o] [-v] [-w] [-h]\n";
             std::cout << "WHERE:\n\t[-c] runs in client mode, [-s] runs in server mode; DEFAULT= client_mode\n";
-            std::cout << "\t[-a svr_addr] specifies the server's IP address as a string; DEFAULT = " << cfg.svrIpAddr << "\n";
+            std::cout << "\t[-g] runs in client mode and downloads fname from the server instead of uploading it\n";
+            std::cout << "\t[-l] runs in client mode and lists the files on the server with their size, mtime and digest\n";
+            std::cout << "\t[-t] runs in client mode and shows size, mtime and digest of fname on the server\n";
+            std::cout << "\t[-y] in server mode, answers CLOSE without syncing the file to disk first\n";
+            std::cout << "\t[-o] in server mode, writes uploads of 64 MB or more with O_DIRECT, bypassing the page cache\n";
+            std::cout << "\t[-v] in server mode, stores an upload of an existing name as name.1, name.2, ... instead of replacing it\n";
+            std::cout << "\t[-w] in server mode, writes uploads into a shared mapping of the file instead of calling write\n";
+            std::cout << "\t[-u] skips the upload when the server already has a file with the same size and digest\n";
+            std::cout << "\t[-a svr_addr] specifies the server's host name or IPv4 or IPv6 address; DEFAULT = " << cfg.svrIpAddr << "\n";
             std::cout << "\t[-p portnum] specifies the port number; DEFAULT = " << cfg.portNumber << "\n";
-            std::cout << "\t[-f fname] specifies the filename to send or recv; DEFAULT = " << cfg.fileName << "\n";
+            std::cout << "\t[-f fname] specifies the filename to send or recv, a directory is uploaded with its whole tree; DEFAULT = " << cfg.fileName << "\n";
+            std::cout << "\t[-z codec] compresses the upload with none, lz4 or lz4hc; DEFAULT = none\n";
+            std::cout << "\t[-j workers] sets the number of compression threads; DEFAULT = one per hardware thread\n";
+            std::cout << "\t[-q depth] sets the number of blocks in flight in the compression pipeline; DEFAULT = 2 * workers\n";
+            std::cout << "\t[-e cipher] encrypts the upload with none, auto, aes or chacha; DEFAULT = none\n";
+            std::cout << "\t[-k psk] mixes a pre-shared key into the session key, give the same key to both sides; DEFAULT = none\n";
+            std::cout << "\t[-r k[:m]] protects every k datagrams with at least m Reed-Solomon parity datagrams, adapted to loss; DEFAULT = off\n";
+            std::cout << "\t[-n streams] sets the number of files of a tree uploaded at the same time; DEFAULT = 4\n";
+            std::cout << "\t[-i priority] schedules the transfer as bulk, normal or urgent, on the network (DSCP) and on the server's disk; DEFAULT = normal\n";
+            std::cout << "\t[-x sessions] in server mode, refuses connections beyond this many; DEFAULT = no limit\n";
+            std::cout << "\t[-b rate] in server mode, limits the uploads of each client host to rate bytes per second; DEFAULT = no limit\n";
+            std::cout << "\t[-d ifname] in server mode, receives through AF_XDP sockets on the interface, falling back to the kernel socket; DEFAULT = off\n";
+            std::cout << "\t[-B us] spins up to us microseconds on the socket before every blocking receive, for low latency at the cost of CPU; DEFAULT = 0\n";
+            std::cout << "\t[-P addrs] uploads over one path per comma separated local address, binds to the address when only one is given; DEFAULT = any\n";
+            std::cout << "\t[-T file] keeps a session ticket in file, so the next upload to the same server sends its first datagram with the CONNECT; DEFAULT = none\n";
+            std::cout << "\t[-D sock] runs as a client daemon, uploading the files submitted on the Unix socket sock over clients it keeps between jobs, -n at a time\n";
+            std::cout << "\t[-S sock] submits fname to the daemon on sock for svr_addr and waits until it is uploaded\n";
+            std::cout << "\t[-R] with [-S], streams stdin line by line to the daemon through a shared-memory ring, uploaded as fname\n";
+            std::cout << "\t[-m group] multicasts fname to the group with [-s], or receives it from the group with [-g]; svr_addr is then the local interface\n";
             std::cout << "\t[-h] displays what you are looking at now - the help\n\n";
             exit(0);
          case ':':
@@ -160,5 +526,23 @@ int initParams(int argc, char* argv[], ProgConfig& cfg)
             exit(-1);
       }
    }
+
+   bool query = cfg.progMode == PROG_MD_GET || cfg.progMode == PROG_MD_LST || cfg.progMode == PROG_MD_STA;
+   if (query && (cfg.codec != Compression::CODEC_NONE || cfg.cipher != Crypto::CIPHER_NONE || cfg.fecK > 0))
+   {
+      std::cerr << "-z, -e and -r only apply to uploads" << std::endl;
+      exit(-1);
+   }
+
+   if (cfg.mcastGroup[0] != '\0')
+   {
+      if ((cfg.progMode != PROG_MD_SVR && cfg.progMode != PROG_MD_GET) || cfg.codec != Compression::CODEC_NONE || cfg.cipher != Crypto::CIPHER_NONE || cfg.fecK > 0)
+      {
+         std::cerr << "-m needs -s to send or -g to receive, and does not combine with -z, -e or -r" << std::endl;
+         exit(-1);
+      }
+      cfg.progMode = (cfg.progMode == PROG_MD_SVR) ? PROG_MD_MCS : PROG_MD_MCR;
+   }
+
    return cfg.progMode;
 }
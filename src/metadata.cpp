@@ -0,0 +1,208 @@
+/**
+ * @file metadata.cpp
+ * @brief Implementation of the server's file metadata cache.
+ */
+
+#include "drexelprotocol/metadata.h"
+
+#include <checksum/xxhash.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <unordered_set>
+
+#include "channel/channel.h"
+#include "drexelprotocol/tree.h"
+
+using DrexelProtocol::MetadataCache;
+
+namespace
+{
+
+int64_t mtimeOf(const struct stat& st)
+{
+   return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Lists the regular files under a directory, by their path relative to it, whose names fit an FTP_STAT.
+ *
+ * Uploads still in progress are left out.
+ */
+std::vector<std::string> filesIn(const std::string& dir)
+{
+   std::vector<std::string> names;
+   std::error_code          ec;
+
+   for (const auto& item : std::filesystem::recursive_directory_iterator(dir, std::filesystem::directory_options::skip_permission_denied, ec))
+   {
+      std::string name = item.path().lexically_relative(dir).generic_string();
+      if (item.is_regular_file(ec) && name.size() < sizeof(DrexelProtocol::FTP_STAT::fileName) && !DrexelProtocol::partialFile(name))
+         names.push_back(name);
+   }
+
+   return names;
+}
+
+}  // namespace
+
+MetadataCache::MetadataCache(std::string dir) : dir(dir)
+{}
+
+bool MetadataCache::hashFile(const std::string& path, Entry& entry)
+{
+   struct stat st;
+   int         fd = open(path.c_str(), O_RDONLY);
+
+   if (fd < 0)
+      return false;
+   if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+   {
+      ::close(fd);
+      return false;
+   }
+
+   entry.size   = st.st_size;
+   entry.mtime  = mtimeOf(st);
+   entry.digest = Checksum::XXH64::hash(nullptr, 0);
+
+   if (st.st_size > 0)
+   {
+      void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED)
+      {
+         ::close(fd);
+         return false;
+      }
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      entry.digest = Checksum::XXH64::hash(map, st.st_size);
+      munmap(map, st.st_size);
+   }
+
+   ::close(fd);
+   return true;
+}
+
+bool MetadataCache::fresh(const std::string& name, Entry& entry)
+{
+   std::string path = dir + "/" + name;
+   struct stat st;
+
+   if (::stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+   {
+      invalidate(name);
+      return false;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto                        it = entries.find(name);
+      if (it != entries.end() && it->second.size == (uint64_t) st.st_size && it->second.mtime == mtimeOf(st))
+      {
+         entry = it->second;
+         return true;
+      }
+   }
+
+   if (!hashFile(path, entry))
+   {
+      invalidate(name);
+      return false;
+   }
+
+   std::lock_guard<std::mutex> lock(mutex);
+   entries[name] = entry;
+   return true;
+}
+
+size_t MetadataCache::rescan(ThreadPool& pool)
+{
+   std::vector<std::string> names = filesIn(dir);
+   channel<int>*            done  = makeChannel<int>(std::max<size_t>(names.size(), 1));
+
+   for (const std::string& name : names)
+   {
+      pool.submit([this, name, done] {
+         Entry entry;
+         fresh(name, entry);
+         done->send(0);
+      });
+   }
+   for (size_t i = 0; i < names.size(); i++)
+   {
+      done->receive();
+   }
+   delete done;
+
+   std::lock_guard<std::mutex> lock(mutex);
+   return entries.size();
+}
+
+void MetadataCache::update(const std::string& name, uint64_t digest)
+{
+   struct stat st;
+   if (::stat((dir + "/" + name).c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+   {
+      invalidate(name);
+      return;
+   }
+
+   std::lock_guard<std::mutex> lock(mutex);
+   entries[name] = Entry{static_cast<uint64_t>(st.st_size), mtimeOf(st), digest};
+}
+
+void MetadataCache::invalidate(const std::string& name)
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   entries.erase(name);
+}
+
+bool MetadataCache::stat(const std::string& name, FTP_STAT& out)
+{
+   Entry entry;
+   if (name.size() >= sizeof(out.fileName) || !fresh(name, entry))
+      return false;
+
+   memset(&out, 0, sizeof(out));
+   memcpy(out.fileName, name.data(), name.size());
+   out.size   = entry.size;
+   out.mtime  = entry.mtime;
+   out.digest = entry.digest;
+
+   return true;
+}
+
+std::vector<DrexelProtocol::FTP_STAT> MetadataCache::list()
+{
+   std::vector<std::string> names = filesIn(dir);
+   std::vector<FTP_STAT>    out;
+
+   std::sort(names.begin(), names.end());
+   out.reserve(names.size());
+
+   for (const std::string& name : names)
+   {
+      FTP_STAT st;
+      if (stat(name, st))
+         out.push_back(st);
+   }
+
+   // Drop the entries of files that were deleted behind our back.
+   std::unordered_set<std::string> present(names.begin(), names.end());
+   std::lock_guard<std::mutex>     lock(mutex);
+
+   for (auto it = entries.begin(); it != entries.end();)
+   {
+      if (present.count(it->first) == 0)
+         it = entries.erase(it);
+      else
+         ++it;
+   }
+
+   return out;
+}
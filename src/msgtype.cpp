@@ -25,6 +25,16 @@ const char* DrexelProtocol::msgToString(int mtype)
          return "SEND FRAGMENT";
       case MsgType::SENDFRAGMENTACK:
          return "SEND FRAGMENT/ACK";
+      case MsgType::FECSND:
+         return "FEC SEND";
+      case MsgType::FECACK:
+         return "FEC/ACK";
+      case MsgType::MCASTSND:
+         return "MCAST SEND";
+      case MsgType::MCASTNACK:
+         return "MCAST NACK";
+      case MsgType::MCASTCLOSE:
+         return "MCAST CLOSE";
       default:
          return "***UNKNOWN***";
    }
@@ -0,0 +1,677 @@
+/**
+ * @file multicast.cpp
+ * @brief Implementation of the NACK based multicast sender and receiver.
+ */
+
+#include "drexelprotocol/multicast.h"
+
+#include <checksum/xxhash.h>
+#include <fcntl.h>
+#include <fec/reedsolomon.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+using DrexelProtocol::Multicast;
+using DrexelProtocol::MulticastReceiver;
+using DrexelProtocol::MulticastSender;
+
+namespace
+{
+
+constexpr int RCVBUF_SZ = 4 << 20;  ///< Socket buffer for the bursts of a whole group sending at once.
+
+uint64_t symbolsOf(uint64_t fileSz, int symSz)
+{
+   return (fileSz + symSz - 1) / symSz;
+}
+
+}  // namespace
+
+Multicast::Multicast(const char* groupAddr, int port, const char* iface)
+{
+   memset(&group, 0, sizeof(group));
+   group.sin_family      = AF_INET;
+   group.sin_port        = htons(port);
+   group.sin_addr.s_addr = inet_addr(groupAddr);
+
+   if (!IN_MULTICAST(ntohl(group.sin_addr.s_addr)))
+   {
+      std::cerr << "ERROR:  " << groupAddr << " is not a multicast group" << std::endl;
+      return;
+   }
+
+   if ((udpSock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+   {
+      perror("socket creation failed");
+      return;
+   }
+
+   // Every member of the group on this host binds the same port.
+   int on = 1;
+   if (setsockopt(udpSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0)
+      perror("setsockopt(SO_REUSEADDR) failed");
+
+   int rcvBuf = RCVBUF_SZ;
+   if (setsockopt(udpSock, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf)) < 0)
+      perror("setsockopt(SO_RCVBUF) failed");
+
+   // Binding the group address rather than INADDR_ANY keeps unicast traffic to the port out.
+   if (bind(udpSock, (const struct sockaddr*) &group, sizeof(group)) < 0)
+   {
+      perror("bind failed");
+      ::close(udpSock);
+      udpSock = -1;
+      return;
+   }
+
+   struct ip_mreq mreq;
+   mreq.imr_multiaddr        = group.sin_addr;
+   mreq.imr_interface.s_addr = inet_addr(iface);
+
+   // Loopback keeps the sender and receivers on one host in the same group, which also lets them overhear each other's NACKs.
+   unsigned char loop = 1;
+
+   if (setsockopt(udpSock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+       setsockopt(udpSock, IPPROTO_IP, IP_MULTICAST_IF, &mreq.imr_interface, sizeof(mreq.imr_interface)) < 0 ||
+       setsockopt(udpSock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0)
+   {
+      perror("cannot join the multicast group");
+      ::close(udpSock);
+      udpSock = -1;
+   }
+}
+
+Multicast::~Multicast()
+{
+   // Closing the socket leaves the group.
+   if (udpSock >= 0)
+      ::close(udpSock);
+}
+
+bool Multicast::validate() const
+{
+   return udpSock >= 0;
+}
+
+bool Multicast::sendGroup(int mtype, const void* payload, int len)
+{
+   PDU hdr;
+   hdr.mtype    = mtype;
+   hdr.seqnum   = seqNum;
+   hdr.dgram_sz = len;
+   hdr.err_num  = connection::NO_ERROR;
+
+   memcpy(buffer, &hdr, sizeof(hdr));
+   if (len > 0)
+      memcpy(buffer + sizeof(PDU), payload, len);
+
+   PDU* pdu = reinterpret_cast<PDU*>(buffer);
+   pdu->seal(buffer + sizeof(PDU), len);
+
+   int total = sizeof(PDU) + len;
+   if (sendto(udpSock, buffer, total, 0, (const struct sockaddr*) &group, sizeof(group)) != total)
+   {
+      perror("sendGroup: sendto failed");
+      return false;
+   }
+
+   seqNum += (len == 0) ? 1 : len;
+   return true;
+}
+
+int Multicast::recvGroup(Clock::time_point deadline)
+{
+   for (;;)
+   {
+      // Pacing needs finer waits than poll()'s milliseconds.
+      auto            left = std::max(deadline - Clock::now(), Clock::duration::zero());
+      auto            ns   = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+      struct timespec ts   = {static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+      struct pollfd   pfd  = {udpSock, POLLIN, 0};
+
+      int ready = ppoll(&pfd, 1, &ts, nullptr);
+      if (ready < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         perror("recvGroup: poll failed");
+         return connection::ERROR_GENERAL;
+      }
+      if (ready == 0)
+         return 0;
+
+      int bytes = recv(udpSock, buffer, sizeof(buffer), 0);
+      if (bytes < (int) sizeof(PDU))
+         continue;
+
+      PDU* pdu = reinterpret_cast<PDU*>(buffer);
+      if (pdu->dgram_sz != bytes - (int) sizeof(PDU) || !pdu->verify(buffer + sizeof(PDU), pdu->dgram_sz))
+         continue;
+
+      return bytes;
+   }
+}
+
+DrexelProtocol::McastHeader MulticastSender::header(uint32_t block, uint16_t index) const
+{
+   return McastHeader{session, block, fileSz, index, BLOCK_K, SYM_SZ, 0};
+}
+
+int MulticastSender::blockK(uint32_t block) const
+{
+   return static_cast<int>(std::min<uint64_t>(BLOCK_K, symbolsOf(fileSz, SYM_SZ) - (uint64_t) block * BLOCK_K));
+}
+
+bool MulticastSender::sendShard(uint32_t block, int index)
+{
+   while (Clock::now() < nextSend)
+   {
+      if (!serve(nextSend))
+         return false;
+   }
+
+   char        payload[connection::MAX_BUFF_SZ];
+   McastHeader hdr  = header(block, index);
+   char*       sym  = payload + sizeof(hdr);
+   int         k    = blockK(block);
+   uint64_t    base = (uint64_t) block * BLOCK_K * SYM_SZ;
+   int         len  = SYM_SZ;
+
+   memcpy(payload, &hdr, sizeof(hdr));
+
+   if (index < k)
+   {
+      uint64_t off = base + (uint64_t) index * SYM_SZ;
+      len          = static_cast<int>(std::min<uint64_t>(SYM_SZ, fileSz - off));
+      memcpy(sym, map + off, len);
+   }
+   else
+   {
+      // Only the file's last data shard is short, it is padded for the parity.
+      std::vector<uint8_t>        last;
+      std::vector<const uint8_t*> data(k);
+
+      for (int i = 0; i < k; i++)
+      {
+         uint64_t off = base + (uint64_t) i * SYM_SZ;
+         if (off + SYM_SZ <= fileSz)
+         {
+            data[i] = reinterpret_cast<const uint8_t*>(map + off);
+            continue;
+         }
+         last.assign(SYM_SZ, 0);
+         memcpy(last.data(), map + off, fileSz - off);
+         data[i] = last.data();
+      }
+
+      int row = index - k;
+      Fec::ReedSolomon{k, row + 1}.encodeRow(data.data(), row, reinterpret_cast<uint8_t*>(sym), SYM_SZ);
+   }
+
+   int total = sizeof(hdr) + len;
+   if (!sendGroup(MsgType::MCASTSND, payload, total))
+      return false;
+
+   auto gap = std::chrono::nanoseconds(1000000000LL * (int64_t) (total + sizeof(PDU)) / rate);
+   nextSend = std::max(nextSend + gap, Clock::now());
+
+   return true;
+}
+
+bool MulticastSender::serve(Clock::time_point deadline)
+{
+   for (;;)
+   {
+      Clock::time_point until = pending ? std::min(deadline, firstNack + std::chrono::milliseconds(NACK_HOLDOFF_MS)) : deadline;
+
+      int rcvSz = recvGroup(until);
+      if (rcvSz <= 0)
+         return rcvSz == 0;
+
+      // Our own data loops back, only the NACKs are of interest.
+      PDU*      pdu = reinterpret_cast<PDU*>(buffer);
+      McastNack nack;
+      if (pdu->mtype != MsgType::MCASTNACK || pdu->dgram_sz < (int) sizeof(nack))
+         continue;
+
+      memcpy(&nack, buffer + sizeof(PDU), sizeof(nack));
+      if (nack.session != session)
+         continue;
+
+      int count = std::min<int>(nack.count, (pdu->dgram_sz - sizeof(nack)) / sizeof(NackEntry));
+      for (int i = 0; i < count; i++)
+      {
+         NackEntry entry;
+         memcpy(&entry, buffer + sizeof(PDU) + sizeof(nack) + i * sizeof(entry), sizeof(entry));
+         if (entry.block >= blocks || entry.missing == 0)
+            continue;
+
+         Repair& r   = repairs[entry.block];
+         r.requested = std::max<uint16_t>(r.requested, std::min<int>(entry.missing, blockK(entry.block)));
+
+         if (!pending)
+            firstNack = Clock::now();
+         pending  = true;
+         lastNack = Clock::now();
+      }
+   }
+}
+
+bool MulticastSender::sendRepairs()
+{
+   pending = false;
+
+   for (uint32_t b = 0; b < blocks; b++)
+   {
+      Repair& r = repairs[b];
+      int     k = blockK(b);
+      int     n = r.requested;
+
+      r.requested = 0;
+      for (int i = 0; i < n; i++, r.next++)
+      {
+         // Past the last parity row the data shards go round again.
+         int index = k + r.next;
+         if (index >= Fec::MAX_SHARDS)
+            index = (index - Fec::MAX_SHARDS) % k;
+
+         if (!sendShard(b, index))
+            return false;
+      }
+   }
+
+   return true;
+}
+
+bool MulticastSender::send(const std::string& fileName)
+{
+   struct stat st;
+   int         fd = open(fileName.c_str(), O_RDONLY);
+
+   if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+   {
+      std::cerr << "ERROR:  Cannot read file " << fileName << std::endl;
+      if (fd >= 0)
+         ::close(fd);
+      return false;
+   }
+
+   fileSz = st.st_size;
+   if (fileSz > 0)
+   {
+      void* m = mmap(nullptr, fileSz, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m == MAP_FAILED)
+      {
+         perror("mmap failed");
+         ::close(fd);
+         return false;
+      }
+      // Repairs revisit earlier blocks, so no MADV_SEQUENTIAL here.
+      madvise(m, fileSz, MADV_WILLNEED);
+      map = static_cast<const char*>(m);
+   }
+   ::close(fd);
+
+   std::random_device rd;
+   session = rd() | 1;
+   blocks  = static_cast<uint32_t>((symbolsOf(fileSz, SYM_SZ) + BLOCK_K - 1) / BLOCK_K);
+   repairs.assign(blocks, Repair{});
+
+   McastClose close{header(blocks, 0), Checksum::XXH64::hash(map, fileSz)};
+
+   std::cout << "Multicasting " << fileName << " (" << fileSz << " bytes, " << blocks << " blocks) to " << inet_ntoa(group.sin_addr)
+             << ":" << ntohs(group.sin_port) << std::endl;
+
+   bool ok  = true;
+   nextSend = Clock::now();
+
+   for (uint32_t b = 0; ok && b < blocks; b++)
+   {
+      for (int i = 0; ok && i < blockK(b); i++)
+      {
+         ok = sendShard(b, i);
+         if (ok && pending && Clock::now() >= firstNack + std::chrono::milliseconds(NACK_HOLDOFF_MS))
+            ok = sendRepairs();
+      }
+   }
+
+   // Keep announcing the end of the object, receivers NACK whatever they still miss, until nobody has for a while.
+   Clock::time_point nextClose = Clock::now();
+   lastNack                    = Clock::now();
+
+   while (ok)
+   {
+      Clock::time_point now = Clock::now();
+
+      if (now >= nextClose)
+      {
+         ok        = sendGroup(MsgType::MCASTCLOSE, &close, sizeof(close));
+         nextClose = now + std::chrono::milliseconds(CLOSE_INTERVAL_MS);
+      }
+      else if (pending && now >= firstNack + std::chrono::milliseconds(NACK_HOLDOFF_MS))
+         ok = sendRepairs();
+      else if (!pending && now >= lastNack + std::chrono::milliseconds(LINGER_MS))
+         break;
+      else
+         ok = serve(nextClose);
+   }
+
+   uint64_t repaired = 0;
+   for (const Repair& r : repairs)
+   {
+      repaired += r.next;
+   }
+
+   if (map != nullptr)
+      munmap(const_cast<char*>(map), fileSz);
+   map = nullptr;
+
+   if (ok)
+      std::cout << "Multicast of " << fileName << " done, " << repaired << " repair datagrams" << std::endl;
+   return ok;
+}
+
+MulticastReceiver::MulticastReceiver(const char* groupAddr, int port, const char* iface)
+    : Multicast(groupAddr, port, iface), rng(std::random_device{}())
+{}
+
+MulticastReceiver::~MulticastReceiver()
+{
+   if (fd >= 0)
+      ::close(fd);
+}
+
+int MulticastReceiver::blockK(uint32_t block) const
+{
+   return static_cast<int>(std::min<uint64_t>(k, symbolsOf(fileSz, symSz) - (uint64_t) block * k));
+}
+
+bool MulticastReceiver::start(const McastHeader& hdr, const std::string& fileName)
+{
+   if (hdr.blockK == 0 || hdr.blockK >= Fec::MAX_SHARDS || hdr.symSz == 0 || hdr.symSz > SYM_SZ)
+   {
+      std::cerr << "ERROR:  Unusable session description" << std::endl;
+      return false;
+   }
+
+   session = hdr.session;
+   fileSz  = hdr.fileSz;
+   k       = hdr.blockK;
+   symSz   = hdr.symSz;
+   blocks.resize((symbolsOf(fileSz, symSz) + k - 1) / k);
+
+   fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0 || ftruncate(fd, fileSz) < 0)
+   {
+      std::cerr << "ERROR:  Cannot open file " << fileName << std::endl;
+      return false;
+   }
+
+   std::cout << "Joined session " << std::hex << session << std::dec << ": " << fileSz << " bytes in " << blocks.size() << " blocks"
+             << std::endl;
+   return true;
+}
+
+bool MulticastReceiver::addShard(const McastHeader& hdr, const char* sym, int len)
+{
+   if (hdr.block >= blocks.size() || hdr.index >= Fec::MAX_SHARDS || len > symSz)
+      return true;
+
+   // Data of a later block means the earlier ones should be complete by now.
+   if (hdr.block > horizon)
+   {
+      horizon = hdr.block;
+      if (completed < horizon)
+         scheduleNack();
+   }
+
+   Block& blk = blocks[hdr.block];
+   int    n   = blockK(hdr.block);
+
+   if (blk.done)
+      return true;
+   if (blk.shards.empty())
+      blk.shards.resize(Fec::MAX_SHARDS);
+   if (!blk.shards[hdr.index].empty())
+      return true;
+
+   blk.shards[hdr.index].assign(symSz, '\0');
+   memcpy(&blk.shards[hdr.index][0], sym, len);
+   blk.have++;
+
+   if (hdr.index >= n)
+      blk.quietUntil = Clock::now() + std::chrono::milliseconds(REPAIR_WAIT_MS);
+
+   if (blk.have < n)
+      return true;
+
+   std::vector<bool>     present(Fec::MAX_SHARDS);
+   std::vector<uint8_t*> ptrs(Fec::MAX_SHARDS, nullptr);
+
+   for (int i = 0; i < Fec::MAX_SHARDS; i++)
+   {
+      present[i] = !blk.shards[i].empty();
+      if (i < n && !present[i])
+         blk.shards[i].assign(symSz, '\0');
+      if (!blk.shards[i].empty())
+         ptrs[i] = reinterpret_cast<uint8_t*>(&blk.shards[i][0]);
+   }
+
+   if (!Fec::ReedSolomon{n, Fec::MAX_SHARDS - n}.reconstruct(ptrs.data(), present, symSz))
+   {
+      std::cerr << "ERROR:  Cannot rebuild block " << hdr.block << std::endl;
+      return false;
+   }
+
+   for (int i = 0; i < n; i++)
+   {
+      uint64_t off = ((uint64_t) hdr.block * k + i) * symSz;
+      size_t   sz  = std::min<uint64_t>(symSz, fileSz - off);
+
+      if (pwrite(fd, blk.shards[i].data(), sz, off) != (ssize_t) sz)
+      {
+         perror("pwrite failed");
+         return false;
+      }
+   }
+
+   std::vector<std::string>().swap(blk.shards);
+   blk.done = true;
+   completed++;
+
+   return true;
+}
+
+void MulticastReceiver::scheduleNack()
+{
+   if (nackDue)
+      return;
+
+   std::uniform_int_distribution<int> backoff(0, NACK_BACKOFF_MS);
+   nackDue = true;
+   nackAt  = Clock::now() + std::chrono::milliseconds(backoff(rng));
+}
+
+void MulticastReceiver::sendNack()
+{
+   constexpr int MAX_ENTRIES = (connection::MAX_BUFF_SZ - sizeof(McastNack)) / sizeof(NackEntry);
+
+   char              payload[connection::MAX_BUFF_SZ];
+   McastNack         nack{session, 0, 0};
+   uint32_t          limit = closed ? blocks.size() : horizon;
+   Clock::time_point now   = Clock::now();
+   bool              owed  = false;
+
+   nackDue = false;
+
+   for (uint32_t b = 0; b < limit; b++)
+   {
+      Block& blk = blocks[b];
+      if (blk.done)
+         continue;
+
+      owed = true;
+      if (now < blk.quietUntil)
+         continue;
+      if (nack.count == MAX_ENTRIES)
+         break;
+
+      NackEntry entry{b, static_cast<uint16_t>(blockK(b) - blk.have), 0};
+      memcpy(payload + sizeof(nack) + nack.count * sizeof(entry), &entry, sizeof(entry));
+      nack.count++;
+      blk.quietUntil = now + std::chrono::milliseconds(REPAIR_WAIT_MS);
+   }
+
+   if (nack.count > 0)
+   {
+      memcpy(payload, &nack, sizeof(nack));
+      sendGroup(MsgType::MCASTNACK, payload, sizeof(nack) + nack.count * sizeof(NackEntry));
+   }
+
+   // Ask again if the repairs do not show up.
+   if (owed)
+   {
+      std::uniform_int_distribution<int> backoff(0, NACK_BACKOFF_MS);
+      nackDue = true;
+      nackAt  = now + std::chrono::milliseconds(REPAIR_WAIT_MS + backoff(rng));
+   }
+}
+
+void MulticastReceiver::overhear(const char* payload, int len)
+{
+   McastNack nack;
+   if (len < (int) sizeof(nack))
+      return;
+
+   memcpy(&nack, payload, sizeof(nack));
+   if (session == 0 || nack.session != session)
+      return;
+
+   int count = std::min<int>(nack.count, (len - sizeof(nack)) / sizeof(NackEntry));
+   for (int i = 0; i < count; i++)
+   {
+      NackEntry entry;
+      memcpy(&entry, payload + sizeof(nack) + i * sizeof(entry), sizeof(entry));
+      if (entry.block >= blocks.size())
+         continue;
+
+      // The repair asked for covers us too.
+      Block& blk = blocks[entry.block];
+      if (!blk.done && entry.missing >= blockK(entry.block) - blk.have)
+         blk.quietUntil = Clock::now() + std::chrono::milliseconds(REPAIR_WAIT_MS);
+   }
+}
+
+bool MulticastReceiver::verify() const
+{
+   if (fileSz == 0)
+      return Checksum::XXH64::hash(nullptr, 0) == digest;
+
+   void* m = mmap(nullptr, fileSz, PROT_READ, MAP_SHARED, fd, 0);
+   if (m == MAP_FAILED)
+   {
+      perror("mmap failed");
+      return false;
+   }
+
+   uint64_t received = Checksum::XXH64::hash(m, fileSz);
+   munmap(m, fileSz);
+
+   return received == digest;
+}
+
+bool MulticastReceiver::receive(const std::string& fileName)
+{
+   Clock::time_point lastHeard = Clock::now();
+   bool              ok        = true;
+
+   std::cout << "Waiting for a multicast session on " << inet_ntoa(group.sin_addr) << ":" << ntohs(group.sin_port) << std::endl;
+
+   while (ok && !(closed && completed == blocks.size()))
+   {
+      Clock::time_point now = Clock::now();
+
+      if (nackDue && now >= nackAt)
+         sendNack();
+
+      if (session != 0 && now >= lastHeard + std::chrono::milliseconds(IDLE_TIMEOUT_MS))
+      {
+         std::cerr << "ERROR:  Sender went quiet with " << blocks.size() - completed << " blocks missing" << std::endl;
+         ok = false;
+         break;
+      }
+
+      Clock::time_point until = now + std::chrono::milliseconds(IDLE_TIMEOUT_MS);
+      if (nackDue)
+         until = std::min(until, nackAt);
+
+      int rcvSz = recvGroup(until);
+      if (rcvSz <= 0)
+      {
+         ok = rcvSz == 0;
+         continue;
+      }
+
+      PDU*        pdu     = reinterpret_cast<PDU*>(buffer);
+      const char* payload = buffer + sizeof(PDU);
+
+      if (pdu->mtype == MsgType::MCASTNACK)
+      {
+         overhear(payload, pdu->dgram_sz);
+         continue;
+      }
+
+      McastClose close;
+      size_t     need = (pdu->mtype == MsgType::MCASTCLOSE) ? sizeof(close) : sizeof(McastHeader);
+      if ((pdu->mtype != MsgType::MCASTSND && pdu->mtype != MsgType::MCASTCLOSE) || pdu->dgram_sz < (int) need)
+         continue;
+
+      memcpy(&close, payload, need);
+      if (session == 0 && !(ok = start(close.object, fileName)))
+         break;
+      if (close.object.session != session)
+         continue;
+
+      lastHeard = Clock::now();
+
+      if (pdu->mtype == MsgType::MCASTSND)
+      {
+         ok = addShard(close.object, payload + sizeof(McastHeader), pdu->dgram_sz - sizeof(McastHeader));
+         continue;
+      }
+
+      closed  = true;
+      digest  = close.digest;
+      horizon = blocks.size();
+      if (completed < blocks.size())
+         scheduleNack();
+   }
+
+   if (ok && !verify())
+   {
+      std::cerr << "ERROR:  Digest mismatch for " << fileName << ", discarding file" << std::endl;
+      ok = false;
+   }
+
+   if (fd >= 0)
+      ::close(fd);
+   fd = -1;
+
+   if (!ok)
+   {
+      if (session != 0)
+         std::remove(fileName.c_str());
+      return false;
+   }
+
+   std::cout << "Verified " << fileName << " digest " << std::hex << digest << std::dec << std::endl;
+   return true;
+}
@@ -0,0 +1,168 @@
+/**
+ * @file pacing.cpp
+ * @brief Implementation of the datagram pacer.
+ */
+
+#include "drexelprotocol/pacing.h"
+
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+using DrexelProtocol::Pacer;
+
+namespace
+{
+
+constexpr size_t NETLINK_BUFF_SZ = 16384; ///< Room for a batch of a qdisc dump.
+
+/**
+ * @brief Finds the interface the kernel routes a peer through, by the source address it would pick.
+ */
+int egressInterface(const struct sockaddr_storage& peer)
+{
+   int sock = socket(peer.ss_family, SOCK_DGRAM, 0);
+   if (sock < 0)
+      return 0;
+
+   // Connecting a datagram socket sends nothing, it only picks the route and the source address.
+   struct sockaddr_storage local;
+   socklen_t               localSz = sizeof(local);
+   socklen_t               peerSz  = (peer.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+   bool                    routed  = connect(sock, (const struct sockaddr*) &peer, peerSz) == 0;
+
+   routed = routed && getsockname(sock, (struct sockaddr*) &local, &localSz) == 0;
+   ::close(sock);
+   if (!routed)
+      return 0;
+
+   // A link-local source names its interface outright.
+   if (local.ss_family == AF_INET6 && ((struct sockaddr_in6*) &local)->sin6_scope_id != 0)
+      return ((struct sockaddr_in6*) &local)->sin6_scope_id;
+
+   struct ifaddrs* addrs = nullptr;
+   int             index = 0;
+   if (getifaddrs(&addrs) < 0)
+      return 0;
+
+   for (struct ifaddrs* ifa = addrs; ifa != nullptr && index == 0; ifa = ifa->ifa_next)
+   {
+      if (ifa->ifa_addr == nullptr || ifa->ifa_addr->sa_family != local.ss_family)
+         continue;
+
+      bool same = (local.ss_family == AF_INET6)
+                      ? memcmp(&((struct sockaddr_in6*) ifa->ifa_addr)->sin6_addr, &((struct sockaddr_in6*) &local)->sin6_addr, 16) == 0
+                      : ((struct sockaddr_in*) ifa->ifa_addr)->sin_addr.s_addr == ((struct sockaddr_in*) &local)->sin_addr.s_addr;
+      if (same)
+         index = if_nametoindex(ifa->ifa_name);
+   }
+
+   freeifaddrs(addrs);
+   return index;
+}
+
+}  // namespace
+
+bool DrexelProtocol::interfaceHasFq(int ifindex)
+{
+   int sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+   if (sock < 0)
+      return false;
+
+   struct
+   {
+      struct nlmsghdr nh;
+      struct tcmsg    tc;
+   } req;
+
+   memset(&req, 0, sizeof(req));
+   req.nh.nlmsg_len   = sizeof(req);
+   req.nh.nlmsg_type  = RTM_GETQDISC;
+   req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+   req.tc.tcm_family  = AF_UNSPEC;
+   req.tc.tcm_ifindex = ifindex;
+
+   char buff[NETLINK_BUFF_SZ];
+   bool found = false;
+   bool done  = send(sock, &req, sizeof(req), 0) < 0;
+
+   while (!done)
+   {
+      int len = recv(sock, buff, sizeof(buff), 0);
+      if (len <= 0)
+         break;
+
+      for (struct nlmsghdr* nh = (struct nlmsghdr*) buff; NLMSG_OK(nh, (unsigned) len); nh = NLMSG_NEXT(nh, len))
+      {
+         if (nh->nlmsg_type == NLMSG_DONE || nh->nlmsg_type == NLMSG_ERROR)
+         {
+            done = true;
+            break;
+         }
+
+         struct tcmsg* tc = (struct tcmsg*) NLMSG_DATA(nh);
+         if (nh->nlmsg_type != RTM_NEWQDISC || tc->tcm_ifindex != ifindex)
+            continue;
+
+         int attrLen = TCA_PAYLOAD(nh);
+         for (struct rtattr* attr = TCA_RTA(tc); RTA_OK(attr, attrLen); attr = RTA_NEXT(attr, attrLen))
+         {
+            if (attr->rta_type == TCA_KIND && strcmp((const char*) RTA_DATA(attr), "fq") == 0)
+               found = true;
+         }
+      }
+   }
+
+   ::close(sock);
+   return found;
+}
+
+Pacer::Pacer(int sock, const struct sockaddr_storage& peer) : sock(sock), next(Clock::now())
+{
+   int ifindex = egressInterface(peer);
+   kernel      = ifindex > 0 && interfaceHasFq(ifindex);
+}
+
+void Pacer::setRate(uint64_t bytesPerSec)
+{
+   rate = bytesPerSec;
+
+   if (kernel)
+   {
+      // fq reads the cap on every dequeue, ~0 lifts it.
+      unsigned long cap = (bytesPerSec == 0) ? ~0UL : bytesPerSec;
+      if (setsockopt(sock, SOL_SOCKET, SO_MAX_PACING_RATE, &cap, sizeof(cap)) < 0)
+      {
+         perror("setsockopt(SO_MAX_PACING_RATE) failed, pacing in user space");
+         kernel = false;
+      }
+   }
+}
+
+void Pacer::wait(size_t len)
+{
+   if (kernel || rate == 0)
+      return;
+
+   // Idle time earns at most SLACK of credit, which makes up for oversleeping without letting a round start with a burst.
+   Clock::time_point now = Clock::now();
+   Clock::time_point due = std::max(next, now - SLACK);
+   next                  = due + std::chrono::nanoseconds(1000000000ULL * len / rate);
+
+   if (due - now > SLACK)
+      std::this_thread::sleep_until(due);
+}
+
+bool Pacer::inKernel() const
+{
+   return kernel;
+}
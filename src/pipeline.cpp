@@ -0,0 +1,100 @@
+/**
+ * @file pipeline.cpp
+ * @brief Implementation of the client side compression pipeline.
+ */
+
+#include "compression/pipeline.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include "channel/channel.h"
+#include "compression/blockcodec.h"
+
+using Compression::CompressPipeline;
+
+CompressPipeline::CompressPipeline(ThreadPool& pool, int codec, unsigned depth)
+    : pool(pool), codec(codec), depth(depth > 0 ? depth : 2 * pool.getThreadCount())
+{}
+
+bool CompressPipeline::run(FILE* f, Checksum::XXH64& fileHash, const std::function<bool(const std::string&)>& sink)
+{
+   channel<Block*>* encoded = makeChannel<Block*>(depth + 1);
+   channel<int>*    credits = makeChannel<int>(depth);
+   std::atomic<bool> abort{false};
+
+   // The reader blocks on credits, it gets its own thread so it can never starve the pool's workers.
+   std::thread reader([&] {
+      size_t index = 0;
+
+      while (!abort)
+      {
+         Block* block = new Block{index, std::string(BLOCK_SZ, '\0'), false};
+         size_t got   = fread(block->data.data(), 1, BLOCK_SZ, f);
+         block->data.resize(got);
+
+         if (got == 0)
+         {
+            delete block;
+            break;
+         }
+
+         fileHash.update(block->data.data(), got);
+
+         credits->send(0);
+         pool.submit([this, block, encoded] {
+            block->data = encodeBlock(codec, block->data.data(), block->data.size());
+            encoded->send(block);
+         });
+         index++;
+
+         if (got < BLOCK_SZ)
+            break;
+      }
+
+      encoded->send(new Block{index, std::string(), true});
+   });
+
+   std::map<size_t, Block*> reorder;
+   size_t                   next  = 0;
+   size_t                   total = SIZE_MAX;
+   bool                     ok    = true;
+
+   while (next < total)
+   {
+      Block* block = encoded->receive();
+
+      if (block->last)
+      {
+         total = block->index;
+         delete block;
+         continue;
+      }
+
+      reorder[block->index] = block;
+
+      for (auto it = reorder.find(next); it != reorder.end(); it = reorder.find(next))
+      {
+         if (ok)
+            ok = sink(it->second->data);
+
+         delete it->second;
+         reorder.erase(it);
+         credits->receive();
+         next++;
+      }
+
+      if (!ok)
+         abort = true;
+   }
+
+   reader.join();
+
+   delete encoded;
+   delete credits;
+
+   return ok;
+}
@@ -0,0 +1,313 @@
+/**
+ * @file reedsolomon.cpp
+ * @brief Implementation of GF(2^8) region arithmetic and the Cauchy Reed-Solomon code.
+ */
+
+#include "fec/reedsolomon.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+constexpr unsigned POLY = 0x11D;  ///< x^8 + x^4 + x^3 + x^2 + 1, the usual Reed-Solomon field.
+
+struct Tables
+{
+   uint8_t exp[512];
+   uint8_t log[256];
+   uint8_t mul[256][256];
+   alignas(16) uint8_t lo[256][16];  ///< c * x for every low nibble x.
+   alignas(16) uint8_t hi[256][16];  ///< c * (x << 4) for every high nibble x.
+
+   Tables()
+   {
+      unsigned x = 1;
+      for (int i = 0; i < 255; i++)
+      {
+         exp[i] = static_cast<uint8_t>(x);
+         log[x] = static_cast<uint8_t>(i);
+         x <<= 1;
+         if (x & 0x100)
+            x ^= POLY;
+      }
+      for (int i = 255; i < 512; i++)
+      {
+         exp[i] = exp[i - 255];
+      }
+      log[0] = 0;
+
+      for (int a = 0; a < 256; a++)
+      {
+         for (int b = 0; b < 256; b++)
+         {
+            mul[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+         }
+         for (int n = 0; n < 16; n++)
+         {
+            lo[a][n] = mul[a][n];
+            hi[a][n] = mul[a][n << 4];
+         }
+      }
+   }
+
+   uint8_t inv(uint8_t a) const
+   {
+      return exp[255 - log[a]];
+   }
+};
+
+const Tables gf;
+
+void mulAddSoftware(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+{
+   const uint8_t* row = gf.mul[c];
+   for (size_t i = 0; i < len; i++)
+   {
+      dst[i] ^= row[src[i]];
+   }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3"))) void mulAddSsse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+{
+   const __m128i lo   = _mm_load_si128(reinterpret_cast<const __m128i*>(gf.lo[c]));
+   const __m128i hi   = _mm_load_si128(reinterpret_cast<const __m128i*>(gf.hi[c]));
+   const __m128i mask = _mm_set1_epi8(0x0F);
+
+   size_t i = 0;
+   for (; i + 16 <= len; i += 16)
+   {
+      __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+      __m128i p = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(s, mask)),
+                                _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(d, p));
+   }
+
+   mulAddSoftware(dst + i, src + i, c, len - i);
+}
+
+__attribute__((target("avx2"))) void mulAddAvx2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+{
+   const __m256i lo   = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(gf.lo[c])));
+   const __m256i hi   = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(gf.hi[c])));
+   const __m256i mask = _mm256_set1_epi8(0x0F);
+
+   size_t i = 0;
+   for (; i + 32 <= len; i += 32)
+   {
+      __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+      __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)),
+                                   _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+      __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(d, p));
+   }
+
+   mulAddSsse3(dst + i, src + i, c, len - i);
+}
+
+using MulAddFn = void (*)(uint8_t*, const uint8_t*, uint8_t, size_t);
+
+const char* pickBackend(MulAddFn& fn)
+{
+   if (__builtin_cpu_supports("avx2"))
+   {
+      fn = mulAddAvx2;
+      return "avx2";
+   }
+   if (__builtin_cpu_supports("ssse3"))
+   {
+      fn = mulAddSsse3;
+      return "ssse3";
+   }
+   fn = mulAddSoftware;
+   return "software";
+}
+#elif defined(__aarch64__)
+void mulAddNeon(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+{
+   const uint8x16_t lo   = vld1q_u8(gf.lo[c]);
+   const uint8x16_t hi   = vld1q_u8(gf.hi[c]);
+   const uint8x16_t mask = vdupq_n_u8(0x0F);
+
+   size_t i = 0;
+   for (; i + 16 <= len; i += 16)
+   {
+      uint8x16_t s = vld1q_u8(src + i);
+      uint8x16_t p = veorq_u8(vqtbl1q_u8(lo, vandq_u8(s, mask)), vqtbl1q_u8(hi, vshrq_n_u8(s, 4)));
+      vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), p));
+   }
+
+   mulAddSoftware(dst + i, src + i, c, len - i);
+}
+
+using MulAddFn = void (*)(uint8_t*, const uint8_t*, uint8_t, size_t);
+
+const char* pickBackend(MulAddFn& fn)
+{
+   fn = mulAddNeon;
+   return "neon";
+}
+#else
+using MulAddFn = void (*)(uint8_t*, const uint8_t*, uint8_t, size_t);
+
+const char* pickBackend(MulAddFn& fn)
+{
+   fn = mulAddSoftware;
+   return "software";
+}
+#endif
+
+MulAddFn    impl    = nullptr;
+const char* backend = pickBackend(impl);
+
+/**
+ * @brief Inverts a square matrix over GF(2^8) by Gauss-Jordan elimination.
+ *
+ * @return bool False if the matrix is singular.
+ */
+bool invert(std::vector<uint8_t>& a, std::vector<uint8_t>& out, int n)
+{
+   out.assign(n * n, 0);
+   for (int i = 0; i < n; i++)
+   {
+      out[i * n + i] = 1;
+   }
+
+   for (int col = 0; col < n; col++)
+   {
+      int pivot = col;
+      while (pivot < n && a[pivot * n + col] == 0)
+         pivot++;
+      if (pivot == n)
+         return false;
+
+      if (pivot != col)
+      {
+         for (int j = 0; j < n; j++)
+         {
+            std::swap(a[pivot * n + j], a[col * n + j]);
+            std::swap(out[pivot * n + j], out[col * n + j]);
+         }
+      }
+
+      uint8_t scale = gf.inv(a[col * n + col]);
+      for (int j = 0; j < n; j++)
+      {
+         a[col * n + j]   = gf.mul[scale][a[col * n + j]];
+         out[col * n + j] = gf.mul[scale][out[col * n + j]];
+      }
+
+      for (int row = 0; row < n; row++)
+      {
+         uint8_t f = a[row * n + col];
+         if (row == col || f == 0)
+            continue;
+         for (int j = 0; j < n; j++)
+         {
+            a[row * n + j] ^= gf.mul[f][a[col * n + j]];
+            out[row * n + j] ^= gf.mul[f][out[col * n + j]];
+         }
+      }
+   }
+
+   return true;
+}
+
+}  // namespace
+
+void Fec::mulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+{
+   if (c == 0)
+      return;
+   impl(dst, src, c, len);
+}
+
+const char* Fec::gf256Backend()
+{
+   return backend;
+}
+
+Fec::ReedSolomon::ReedSolomon(int k, int m) : k(k), m(m), matrix(m * k)
+{
+   // Cauchy rows 1 / (x_j + y_i) with x_j = k + j and y_i = i, the two sets never overlap.
+   for (int j = 0; j < m; j++)
+   {
+      for (int i = 0; i < k; i++)
+      {
+         matrix[j * k + i] = gf.inv(static_cast<uint8_t>((k + j) ^ i));
+      }
+   }
+}
+
+void Fec::ReedSolomon::encode(const uint8_t* const* data, uint8_t* const* parity, size_t len) const
+{
+   for (int j = 0; j < m; j++)
+   {
+      encodeRow(data, j, parity[j], len);
+   }
+}
+
+void Fec::ReedSolomon::encodeRow(const uint8_t* const* data, int row, uint8_t* out, size_t len) const
+{
+   std::memset(out, 0, len);
+   for (int i = 0; i < k; i++)
+   {
+      mulAdd(out, data[i], matrix[row * k + i], len);
+   }
+}
+
+bool Fec::ReedSolomon::reconstruct(uint8_t* const* shards, const std::vector<bool>& present, size_t len) const
+{
+   std::vector<int> rows;
+   bool             complete = true;
+
+   for (int s = 0; s < k + m && static_cast<int>(rows.size()) < k; s++)
+   {
+      if (present[s])
+         rows.push_back(s);
+      else if (s < k)
+         complete = false;
+   }
+
+   if (complete)
+      return true;
+   if (static_cast<int>(rows.size()) < k)
+      return false;
+
+   // The rows of the generator matrix for the shards we have, inverted, map them back to the data.
+   std::vector<uint8_t> a(k * k, 0);
+   std::vector<uint8_t> decode;
+
+   for (int r = 0; r < k; r++)
+   {
+      if (rows[r] < k)
+         a[r * k + rows[r]] = 1;
+      else
+         std::memcpy(&a[r * k], &matrix[(rows[r] - k) * k], k);
+   }
+
+   if (!invert(a, decode, k))
+      return false;
+
+   for (int d = 0; d < k; d++)
+   {
+      if (present[d])
+         continue;
+
+      std::memset(shards[d], 0, len);
+      for (int r = 0; r < k; r++)
+      {
+         mulAdd(shards[d], shards[rows[r]], decode[d * k + r], len);
+      }
+   }
+
+   return true;
+}
@@ -0,0 +1,207 @@
+/**
+ * @file ring.cpp
+ * @brief Implementation of the memfd record ring.
+ */
+
+#include "drexelprotocol/ring.h"
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+using DrexelProtocol::RecordRing;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring's indexes are shared between processes");
+
+RecordRing::RecordRing(const std::string& name, size_t capacity)
+{
+   size_t size = 1;
+   while (size < capacity)
+   {
+      size <<= 1;
+   }
+
+   if ((fd = memfd_create(name.c_str(), MFD_CLOEXEC)) < 0)
+   {
+      perror("memfd_create failed");
+      return;
+   }
+
+   if (ftruncate(fd, sizeof(RingHeader) + size) < 0)
+   {
+      perror("ftruncate of the ring failed");
+      return;
+   }
+
+   if (!map(sizeof(RingHeader) + size))
+      return;
+
+   // A new memfd reads as zeros, head, tail and state start out right.
+   this->capacity   = size;
+   header->capacity = size;
+   header->magic    = MAGIC;
+}
+
+RecordRing::RecordRing(int fd, int peer) : fd(fd), peer(peer)
+{
+   struct stat st;
+   if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(RingHeader) || !map(st.st_size))
+      return;
+
+   // The size is checked against the mapping, a bad producer cannot make the consumer read past it.
+   if (header->magic != MAGIC || header->capacity == 0 || (header->capacity & (header->capacity - 1)) != 0 ||
+       sizeof(RingHeader) + header->capacity > mapSz)
+   {
+      std::cerr << "fd " << fd << " is not a record ring" << std::endl;
+      munmap(header, mapSz);
+      header = nullptr;
+      return;
+   }
+   capacity = header->capacity;
+}
+
+RecordRing::~RecordRing()
+{
+   if (header != nullptr)
+      munmap(header, mapSz);
+   if (fd >= 0)
+      ::close(fd);
+}
+
+bool RecordRing::map(size_t size)
+{
+   void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (mapped == MAP_FAILED)
+   {
+      perror("mmap of the ring failed");
+      return false;
+   }
+
+   mapSz  = size;
+   header = static_cast<RingHeader*>(mapped);
+   data   = static_cast<char*>(mapped) + sizeof(RingHeader);
+   return true;
+}
+
+bool RecordRing::validate() const
+{
+   return header != nullptr;
+}
+
+int RecordRing::getFd() const
+{
+   return fd;
+}
+
+void RecordRing::backoff(unsigned round)
+{
+   if (round < WAIT_SPINS)
+      std::this_thread::yield();
+   else
+      std::this_thread::sleep_for(std::chrono::microseconds(WAIT_SLEEP_US));
+}
+
+bool RecordRing::producerGone() const
+{
+   struct pollfd pfd = {peer, 0, 0};
+   return peer >= 0 && poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR)) != 0;
+}
+
+bool RecordRing::write(const void* record, size_t len)
+{
+   if (len > capacity)
+   {
+      std::cerr << "Record of " << len << " bytes does not fit a ring of " << capacity << std::endl;
+      return false;
+   }
+
+   uint64_t head = header->head.load(std::memory_order_relaxed);
+   for (unsigned round = 0; capacity - (head - header->tail.load(std::memory_order_acquire)) < len; round++)
+   {
+      if (header->state.load(std::memory_order_relaxed) == ABORTED)
+         return false;
+      backoff(round);
+   }
+
+   // The record may wrap around the end of the data area.
+   size_t at    = head & (capacity - 1);
+   size_t first = std::min<size_t>(len, capacity - at);
+   memcpy(data + at, record, first);
+   memcpy(data, static_cast<const char*>(record) + first, len - first);
+
+   header->head.store(head + len, std::memory_order_release);
+   return true;
+}
+
+ssize_t RecordRing::read(char* buff, size_t len)
+{
+   uint64_t tail = header->tail.load(std::memory_order_relaxed);
+   uint64_t head;
+
+   for (unsigned round = 0; (head = header->head.load(std::memory_order_acquire)) == tail; round++)
+   {
+      // The state is read after head came up empty, whatever was published before CLOSED is already seen.
+      uint32_t state = header->state.load(std::memory_order_acquire);
+      if (state == CLOSED && header->head.load(std::memory_order_acquire) == tail)
+         return 0;
+      if (state == ABORTED || (round >= WAIT_SPINS && producerGone()))
+         return -1;
+      backoff(round);
+   }
+
+   if (header->state.load(std::memory_order_relaxed) == ABORTED)
+      return -1;
+
+   // A head past the data area is a broken producer, not something to copy from.
+   if (head - tail > capacity)
+   {
+      abort();
+      return -1;
+   }
+
+   size_t bytes = std::min<uint64_t>(len, head - tail);
+   size_t at    = tail & (capacity - 1);
+   size_t first = std::min<size_t>(bytes, capacity - at);
+   memcpy(buff, data + at, first);
+   memcpy(buff + first, data, bytes - first);
+
+   header->tail.store(tail + bytes, std::memory_order_release);
+   return bytes;
+}
+
+void RecordRing::close()
+{
+   uint32_t open = OPEN;
+   header->state.compare_exchange_strong(open, CLOSED, std::memory_order_release);
+}
+
+void RecordRing::abort()
+{
+   header->state.store(ABORTED, std::memory_order_release);
+}
+
+ssize_t RecordRing::cookieRead(void* cookie, char* buff, size_t size)
+{
+   ssize_t bytes = static_cast<RecordRing*>(cookie)->read(buff, size);
+   if (bytes < 0)
+      errno = EPIPE;
+   return bytes;
+}
+
+FILE* RecordRing::stream()
+{
+   cookie_io_functions_t io = {cookieRead, nullptr, nullptr, nullptr};
+
+   FILE* f = fopencookie(this, "r", io);
+   if (f == nullptr)
+      perror("fopencookie failed");
+   return f;
+}
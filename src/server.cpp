@@ -1,19 +1,56 @@
 
 #include "drexelprotocol/server.h"
 
+#include <fcntl.h>
+#include <linux/ioprio.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
-#include <fstream>
+#include <filesystem>
 #include <iostream>
+#include <random>
 #include <string>
 
 #include "channel/channel.h"
 
 using writer = DrexelProtocol::FTPFileWriter;
+using sender = DrexelProtocol::FTPFileSender;
 using server = DrexelProtocol::FTPServer;
 
-writer::FTPFileWriter::FTPFileWriter(std::string address) : stream(makeChannel<std::string>(20)), address(address)
+namespace
+{
+
+/**
+ * @brief Gives the calling thread the disk share of a transfer priority.
+ *
+ * Writers and senders are pool threads, the priority is set per transfer and put back after it.
+ * Only the best-effort levels are used, they need no privileges.
+ */
+void ioPriority(int priority)
+{
+   static const int levels[] = {7, 4, 0};
+
+   if (priority < DrexelProtocol::Priority::BULK || priority > DrexelProtocol::Priority::URGENT)
+      priority = DrexelProtocol::Priority::NORMAL;
+
+   if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, levels[priority])) < 0)
+      perror("ioprio_set failed");
+}
+
+}  // namespace
+
+writer::FTPFileWriter::FTPFileWriter(std::string address, FTP_OPTIONS options, MetadataCache* cache)
+    : stream(makeChannel<std::string>(20)), options(options), cache(cache), address(address)
 {}
 
 ::channel<std::string>* writer::getChannel()
@@ -23,12 +60,361 @@ writer::FTPFileWriter::FTPFileWriter(std::string address) : stream(makeChannel<s
 
 void writer::pushToChannel(char* buff, int buffSz)
 {
-   std::cout << "========================> \n"
-             << "Size :" << buffSz << std::endl
-             << "========================> \n";
+   // The one copy a datagram takes on its way to disk, out of the listen buffer the next datagram overwrites.
    stream->send(std::string(buff, buffSz));
 }
 
+void writer::pushCommit(char* buff, int buffSz, connection* listener, const Sock& peer, int seqnum)
+{
+   this->listener = listener;
+   replyTo        = peer;
+   replySeq       = seqnum;
+   pushToChannel(buff, buffSz);
+}
+
+void writer::begin(const FTP_PDU& pdu, const FTP_TRANSFER& transfer)
+{
+   fileHash.reset();
+   decoder.reset();
+   started = true;
+   failed  = false;
+   abandon();
+   ioPriority(transfer.priority);
+   behind.reserve(WRITE_BEHIND_SZ);
+
+   path.assign(pdu.fileName, strnlen(pdu.fileName, sizeof(pdu.fileName)));
+   if (!safeRelativePath(path))
+   {
+      std::cerr << "ERROR:  Refusing file " << path << " outside the server's directory" << std::endl;
+      path.clear();
+      return;
+   }
+
+   // A component of the path may already be a file, only this upload is refused then, its COMMIT with ACCESS_DENIED.
+   std::filesystem::path target{path};
+   std::error_code       ec;
+   if (target.has_parent_path() && !std::filesystem::create_directories(target.parent_path(), ec) && ec)
+   {
+      std::cerr << "ERROR:  Cannot create the directories of " << path << ": " << ec.message() << std::endl;
+      path.clear();
+      return;
+   }
+
+   // Readers keep seeing the previous version until the verified upload is renamed over it.
+   std::string name = (target.parent_path() / (PARTIAL_PREFIX + target.filename().string() + ".XXXXXX")).string();
+   fd               = mkostemp(&name[0], O_CLOEXEC);
+   if (fd < 0)
+   {
+      std::cerr << "ERROR:  Cannot open file " << name << ": " << strerror(errno) << std::endl;
+      path.clear();
+      return;
+   }
+   partial = name;
+   fchmod(fd, 0644);
+
+   // Reserve the extents in one go, the file's size still grows with the data.
+   announced = transfer.size;
+   if (announced > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, announced) < 0 && errno != EOPNOTSUPP)
+      perror("fallocate failed");
+
+   // tmpfs and a few network filesystems refuse O_DIRECT, those uploads stay buffered. O_DIRECT writes
+   // are sequential, a multipath upload's subflows deliver out of order.
+   if (directPool != nullptr && !multipath && announced >= DIRECT_MIN_SZ && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == 0)
+   {
+      direct = new DirectWriter(fd, *directPool);
+      if (!direct->valid())
+      {
+         delete direct;
+         direct = nullptr;
+         fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+      }
+   }
+
+   // The file is sized first, the reserved extents are then mapped and filled in place.
+   if (direct == nullptr && mmapWrites && announced > 0 && ftruncate(fd, announced) == 0)
+   {
+      void* area = mmap(nullptr, announced, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (area != MAP_FAILED)
+      {
+         map   = static_cast<char*>(area);
+         mapSz = announced;
+      }
+   }
+}
+
+bool writer::write(const char* data, size_t len)
+{
+   if (direct != nullptr)
+      return direct->write(data, len);
+
+   if (map != nullptr)
+   {
+      if (offset + (off_t) len <= (off_t) mapSz)
+      {
+         memcpy(map + offset, data, len);
+         offset += len;
+         writeback();
+         return true;
+      }
+
+      // More data than announced, the rest goes through pwrite() behind what was mapped.
+      munmap(map, mapSz);
+      map = nullptr;
+   }
+
+   while (len > 0)
+   {
+      size_t room = WRITE_BEHIND_SZ - behind.size();
+      size_t take = std::min(room, len);
+
+      behind.append(data, take);
+      data += take;
+      len -= take;
+
+      if (behind.size() == WRITE_BEHIND_SZ && !flush())
+         return false;
+   }
+
+   return true;
+}
+
+bool writer::writeAt(const char* data, size_t len, off_t at)
+{
+   if (map != nullptr && at + (off_t) len <= (off_t) mapSz)
+      memcpy(map + at, data, len);
+   else
+   {
+      size_t done = 0;
+
+      while (done < len)
+      {
+         ssize_t wr = pwrite(fd, data + done, len - done, at + done);
+         if (wr < 0)
+         {
+            if (errno == EINTR)
+               continue;
+            perror("pwrite failed");
+            return false;
+         }
+         done += wr;
+      }
+   }
+
+   offset = std::max(offset, at + (off_t) len);
+   return true;
+}
+
+uint64_t writer::digestWritten()
+{
+   if (fd < 0 || offset == 0)
+      return Checksum::XXH64::hash(nullptr, 0);
+
+   if (map != nullptr && offset <= (off_t) mapSz)
+      return Checksum::XXH64::hash(map, offset);
+
+   void* area = mmap(nullptr, offset, PROT_READ, MAP_SHARED, fd, 0);
+   if (area == MAP_FAILED)
+   {
+      perror("mmap failed");
+      return 0;
+   }
+   madvise(area, offset, MADV_SEQUENTIAL);
+   uint64_t digest = Checksum::XXH64::hash(area, offset);
+   munmap(area, offset);
+   return digest;
+}
+
+bool writer::flush()
+{
+   size_t done = 0;
+
+   while (done < behind.size())
+   {
+      ssize_t wr = pwrite(fd, behind.data() + done, behind.size() - done, offset + done);
+      if (wr < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         perror("pwrite failed");
+         return false;
+      }
+      done += wr;
+   }
+   offset += done;
+   behind.clear();
+
+   writeback();
+   return true;
+}
+
+void writer::writeback()
+{
+   static const off_t page = sysconf(_SC_PAGESIZE);
+
+   if (offset - synced < SYNC_WINDOW_SZ)
+      return;
+
+   // Start writeback of the window just filled and wait for the one before it, so at most two windows
+   // of dirty pages are outstanding. Pages already on disk are dropped, the upload will not read them again.
+   sync_file_range(fd, synced, offset - synced, SYNC_FILE_RANGE_WRITE);
+   if (synced > settled)
+   {
+      off_t len = synced - settled;
+      sync_file_range(fd, settled, len, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+      if (map != nullptr)
+         madvise(map + settled, len, MADV_DONTNEED);
+      posix_fadvise(fd, settled, len, POSIX_FADV_DONTNEED);
+      settled = synced;
+   }
+
+   // Mapped writes end anywhere, windows start on a page so the mapping can be released by window.
+   synced = offset / page * page;
+}
+
+bool writer::finish()
+{
+   bool ok = true;
+
+   if (direct != nullptr)
+   {
+      ok     = direct->finish();
+      offset = direct->written();
+      delete direct;
+      direct = nullptr;
+   }
+   else if (map != nullptr)
+   {
+      // The fsync below writes the mapped pages, msync would only duplicate it.
+      munmap(map, mapSz);
+      map = nullptr;
+   }
+   else
+      ok = flush();
+
+   // A shorter file than announced gives back the blocks reserved past its end.
+   if (ok && announced > offset && ftruncate(fd, offset) < 0)
+      perror("ftruncate failed");
+   if (ok && fsyncOnCommit && fsync(fd) < 0)
+   {
+      perror("fsync failed");
+      ok = false;
+   }
+
+   ::close(fd);
+   fd = -1;
+   return ok;
+}
+
+void writer::abandon()
+{
+   // Waits for the direct writes in flight before the descriptor goes away.
+   delete direct;
+   direct = nullptr;
+
+   if (map != nullptr)
+      munmap(map, mapSz);
+   map = nullptr;
+
+   if (fd >= 0)
+      ::close(fd);
+   if (!partial.empty())
+      unlink(partial.c_str());
+   partial.clear();
+   fd        = -1;
+   offset    = 0;
+   synced    = 0;
+   settled   = 0;
+   announced = 0;
+   behind.clear();
+}
+
+int writer::commit(const FTP_PDU& pdu)
+{
+   if (path.empty())
+      return Error::ACCESS_DENIED;
+   if (failed)
+      return Error::UNKOWN;
+
+   uint64_t received = multipath ? digestWritten() : fileHash.digest();
+
+   if (!finish())
+   {
+      std::cerr << "ERROR:  Cannot write " << pdu.fileName << ", discarding file" << std::endl;
+      abandon();
+      return Error::UNKOWN;
+   }
+
+   if (received != pdu.digest)
+   {
+      std::cerr << "ERROR:  Digest mismatch for " << pdu.fileName << " expected " << std::hex << pdu.digest << " got " << received
+                << std::dec << ", discarding file" << std::endl;
+      abandon();
+      return Error::DIGEST_MISMATCH;
+   }
+
+   std::string stored = publish();
+   if (stored.empty())
+   {
+      abandon();
+      return Error::UNKOWN;
+   }
+
+   std::cout << "Verified " << stored << " digest " << std::hex << received << std::dec << std::endl;
+   if (cache != nullptr)
+      cache->update(stored, received);
+
+   return Error::NONE;
+}
+
+std::string writer::publish()
+{
+   std::filesystem::path target{path};
+   std::string           stored;
+
+   for (int version = 0; version <= MAX_VERSIONS && stored.empty(); version++)
+   {
+      std::string name = (version == 0) ? path : path + "." + std::to_string(version);
+
+      // Last writer wins unless versions are kept, then the first free name.N is taken.
+      if (!keepVersions)
+      {
+         if (renameat2(AT_FDCWD, partial.c_str(), AT_FDCWD, name.c_str(), 0) < 0)
+            break;
+         stored = name;
+      }
+      else if (renameat2(AT_FDCWD, partial.c_str(), AT_FDCWD, name.c_str(), RENAME_NOREPLACE) == 0)
+         stored = name;
+      else if (errno == EINVAL && link(partial.c_str(), name.c_str()) == 0)
+      {
+         // The filesystem cannot rename without replacing, link() fails on an existing name just the same.
+         unlink(partial.c_str());
+         stored = name;
+      }
+      else if (errno != EEXIST)
+         break;
+   }
+
+   if (stored.empty())
+   {
+      std::cerr << "ERROR:  Cannot store " << path << ": " << strerror(errno) << std::endl;
+      return stored;
+   }
+   partial.clear();
+
+   // The rename is only durable once the directory entry is.
+   if (fsyncOnCommit)
+   {
+      std::string dir = target.parent_path().empty() ? "." : target.parent_path().string();
+      int         dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+      if (dfd < 0 || fsync(dfd) < 0)
+         perror("fsync of directory failed");
+      if (dfd >= 0)
+         ::close(dfd);
+   }
+
+   return stored;
+}
+
 void writer::serverLoop()
 {
    while (!stream->isClosed())
@@ -43,43 +429,271 @@ void writer::serverLoop()
       {
          break;
       }
-      FTP_PDU* pdu = reinterpret_cast<FTP_PDU*>(buff.data());
-      std::cout << "filename: " << pdu->fileName << std::endl;
+      if (buff.size() < sizeof(FTP_PDU))
+         continue;
 
-      auto mode = (pdu->status == Status::NEW) ? std::ios::trunc : std::ios::app;
+      FTP_PDU* pdu      = reinterpret_cast<FTP_PDU*>(buff.data());
+      size_t   headerSz = ftpHeaderSz(pdu->status, multipath);
+      if (buff.size() < headerSz)
+         continue;
 
-      std::ofstream outFile{pdu->fileName, std::ios::out | mode};
+      // An empty file sends no data, its COMMIT is the first the writer hears of it and announces nothing.
+      FTP_TRANSFER transfer;
+      if (pdu->status == Status::NEW)
+         memcpy(&transfer, buff.data() + sizeof(FTP_PDU), sizeof(transfer));
+      if (pdu->status == Status::NEW || (pdu->status == Status::COMMIT && !started))
+         begin(*pdu, transfer);
 
-      if (!outFile.is_open())
+      if (pdu->status == Status::COMMIT)
       {
-         std::cerr << "ERROR:  Cannot open file " << pdu->fileName << std::endl;
-         exit(-1);
+         PDU closeAck;
+         closeAck.mtype    = MsgType::CLOSEACK;
+         closeAck.seqnum   = replySeq;
+         closeAck.dgram_sz = 0;
+         closeAck.err_num  = commit(*pdu);
+         started           = false;
+
+         if (listener != nullptr && listener->sendTo(&closeAck, sizeof(PDU), replyTo) != sizeof(PDU))
+            std::cerr << "ERROR:  Cannot answer the CLOSE of " << address << std::endl;
+         continue;
       }
-      buff.erase(0, sizeof(FTP_PDU));
-      outFile << buff;
 
-      // fwrite(dataPtr, 1, dataSz, f);
-      std::cout << "========================> \n" << buff << "\n========================> \n";
+      if (path.empty() || failed)
+         continue;
+
+      // Plain flows are written from the datagram as received, the header is skipped rather than cut off.
+      const char* data   = buff.data() + headerSz;
+      size_t      dataSz = buff.size() - headerSz;
+      std::string decoded;
+
+      // A multipath datagram's last header is the offset its data goes to.
+      uint64_t at = 0;
+      if (multipath)
+         memcpy(&at, data - sizeof(at), sizeof(at));
+
+      if (options.codec != Compression::CODEC_NONE)
+      {
+         decoder.feed(data, dataSz, decoded);
+         data   = decoded.data();
+         dataSz = decoded.size();
+      }
+
+      // Multipath data is hashed at the COMMIT, once every subflow's part is in place.
+      bool ok = multipath ? writeAt(data, dataSz, at) : write(data, dataSz);
+      if (!ok)
+      {
+         // A full or failing disk costs this upload only, the rest of it is dropped and its COMMIT rejected.
+         std::cerr << "ERROR:  Cannot write file " << path << ", abandoning the upload" << std::endl;
+         abandon();
+         failed = true;
+         continue;
+      }
+      if (!multipath)
+         fileHash.update(data, dataSz);
    }
+   abandon();
+   ioPriority(Priority::NORMAL);
    delete stream;
    closed = true;
 }
 
-server::FTPServer(const std::string filePath, int port) : FTP(filePath, new connection()), pool(new ThreadPool())
+sender::FTPFileSender(const Sock& peer, std::string fileName, unsigned int seqnum, int priority, int busyPollUs)
+    : dpc(new connection()), fileName(fileName), priority(priority)
 {
-   struct sockaddr_in* servaddr = &(dpc->getInSockAddr()->addr);
-   int*                sock     = dpc->getUdpSock();
+   int* sock = dpc->getUdpSock();
 
-   if ((*sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+   // The family of the listen socket the request came in on, IPv4-mapped peers included.
+   if ((*sock = socket(peer.addr.ss_family, SOCK_DGRAM, 0)) < 0)
+   {
+      perror("socket creation failed");
+      return;
+   }
+
+   struct sockaddr_storage local;
+   socklen_t               localSz = anyAddress(peer.addr.ss_family, 0, local);
+
+   if (bind(*sock, (const struct sockaddr*) &local, localSz) < 0)
+      perror("bind failed");
+
+   // A lost datagram or acknowledgement times out and sendDgram() resends.
+   struct timeval timeout = {ACK_TIMEOUT_MS / 1000, (ACK_TIMEOUT_MS % 1000) * 1000};
+   if (setsockopt(*sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+      perror("setsockopt(SO_RCVTIMEO) failed");
+
+   int tos = priorityTos(priority);
+   if (tos != 0)
+      setTrafficClass(*sock, tos);
+
+   dpc->setBusyPoll(busyPollUs);
+   dpc->setSeqNum(seqnum);
+
+   *dpc->getOutSockAddr()            = peer;
+   dpc->getOutSockAddr()->isAddrInit = true;
+   dpc->getInSockAddr()->isAddrInit  = true;
+}
+
+sender::~FTPFileSender()
+{
+   delete dpc;
+}
+
+void sender::serverLoop()
+{
+   FTP_PDU pdu;
+   strncpy(pdu.fileName, fileName.c_str(), sizeof(pdu.fileName) - 1);
+   pdu.fileName[sizeof(pdu.fileName) - 1] = '\0';
+   pdu.status                             = Status::NEW;
+   pdu.err                                = Error::NONE;
+   pdu.digest                             = 0;
+
+   struct stat st;
+   int         fd  = open(fileName.c_str(), O_RDONLY);
+   char*       map = nullptr;
+
+   if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+   {
+      map = (char*) mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED)
+         map = nullptr;
+      else
+         madvise(map, st.st_size, MADV_SEQUENTIAL);
+   }
+
+   if (fd < 0 || !S_ISREG(st.st_mode) || (st.st_size > 0 && map == nullptr))
+   {
+      std::cerr << "ERROR:  Cannot serve file " << fileName << std::endl;
+      if (fd >= 0)
+         ::close(fd);
+
+      pdu.status = Status::COMMIT;
+      pdu.err    = Error::FILE_NOT_FOUND;
+      dpc->disconnect(&pdu, sizeof(FTP_PDU));
+      return;
+   }
+   ::close(fd);
+
+   size_t size = st.st_size;
+   bool   sent = stream(pdu, map, size);
+
+   if (map != nullptr)
+      munmap(map, size);
+
+   if (sent)
+      std::cout << "Served " << fileName << " (" << size << " bytes)" << std::endl;
+}
+
+void sender::answerQuery(int status, MetadataCache& cache)
+{
+   std::vector<FTP_STAT> records;
+
+   if (status == Status::LIST)
+      records = cache.list();
+   else
+   {
+      FTP_STAT record;
+      if (cache.stat(fileName, record))
+         records.push_back(record);
+   }
+
+   FTP_PDU pdu;
+   strncpy(pdu.fileName, fileName.c_str(), sizeof(pdu.fileName) - 1);
+   pdu.fileName[sizeof(pdu.fileName) - 1] = '\0';
+   pdu.status                             = Status::NEW;
+   pdu.err                                = Error::NONE;
+   pdu.digest                             = 0;
+
+   if (stream(pdu, reinterpret_cast<const char*>(records.data()), records.size() * sizeof(FTP_STAT)))
+      std::cout << "Answered " << ((status == Status::LIST) ? "LIST" : "STAT") << " with " << records.size() << " entries" << std::endl;
+}
+
+bool sender::stream(FTP_PDU& pdu, const char* data, size_t size)
+{
+   Checksum::XXH64 fileHash;
+   char            buff[connection::MAX_BUFF_SZ];
+   FTP_TRANSFER    transfer;
+   bool            sent = true;
+
+   transfer.size     = size;
+   transfer.priority = priority;
+
+   for (size_t offset = 0, len = 0; offset < size && sent; offset += len)
+   {
+      // The first datagram is a NEW and carries the transfer, it has less room for data.
+      size_t headerSz = ftpHeaderSz(pdu.status);
+      len             = std::min(dpc->maxDgram() - headerSz, size - offset);
+
+      memcpy(buff, &pdu, sizeof(FTP_PDU));
+      if (pdu.status == Status::NEW)
+         memcpy(buff + sizeof(FTP_PDU), &transfer, sizeof(transfer));
+      memcpy(buff + headerSz, data + offset, len);
+      fileHash.update(data + offset, len);
+
+      sent       = dpc->sendDgram(buff, headerSz + len) == (int) (headerSz + len);
+      pdu.status = Status::APPEND;
+   }
+
+   if (!sent)
+   {
+      std::cerr << "ERROR:  Download of " << fileName << " aborted, the client stopped acknowledging" << std::endl;
+      return false;
+   }
+
+   pdu.status = Status::COMMIT;
+   pdu.digest = fileHash.digest();
+
+   if (dpc->disconnect(&pdu, sizeof(FTP_PDU)) == connection::ERROR_REJECTED)
+   {
+      std::cerr << "ERROR:  Client rejected " << fileName << ", its copy failed digest verification" << std::endl;
+      return false;
+   }
+
+   return true;
+}
+
+server::FTPServer(const std::string filePath, int port)
+    : FTP(filePath, new connection()),
+      pool(new ThreadPool()),
+      writers(new ThreadPool(WRITER_THREADS)),
+      senders(new ThreadPool(SENDER_THREADS)),
+      cache(new MetadataCache(".")),
+      directBuffers(FTPFileWriter::WRITE_BEHIND_SZ, DIRECT_SPARE_BUFFERS)
+{
+   // Uploads that were in progress when a previous server stopped will never be committed.
+   std::error_code ec;
+   for (const auto& item : std::filesystem::recursive_directory_iterator(".", std::filesystem::directory_options::skip_permission_denied, ec))
+   {
+      if (item.is_regular_file(ec) && partialFile(item.path().string()))
+         std::filesystem::remove(item.path(), ec);
+   }
+
+   auto   scanStart = std::chrono::steady_clock::now();
+   size_t indexed   = cache->rescan(*pool);
+   std::cout << "Indexed " << indexed << " files in "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - scanStart).count() << " ms"
+             << std::endl;
+
+   Sock* servaddr = dpc->getInSockAddr();
+   int*  sock     = dpc->getUdpSock();
+
+   // One dual-stack socket serves both families, IPv4 peers arrive as IPv4-mapped addresses.
+   // Hosts with IPv6 disabled get an IPv4 socket.
+   int family = AF_INET6;
+   int v6only = 0;
+   if ((*sock = socket(AF_INET6, SOCK_DGRAM, 0)) < 0 || setsockopt(*sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0)
+   {
+      if (*sock >= 0)
+         ::close(*sock);
+      family = AF_INET;
+      *sock  = socket(AF_INET, SOCK_DGRAM, 0);
+   }
+
+   if (*sock < 0)
    {
       perror("socket creation failed");
       delete dpc;
    }
 
-   memset(servaddr, 0, sizeof(*servaddr));  // Initialize servaddr
-   servaddr->sin_family      = AF_INET;
-   servaddr->sin_addr.s_addr = INADDR_ANY;
-   servaddr->sin_port        = htons(port);
+   servaddr->len = anyAddress(family, port, servaddr->addr);
 
    int val = 1;
    if (setsockopt(*sock, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(int)) < 0)
@@ -89,7 +703,7 @@ server::FTPServer(const std::string filePath, int port) : FTP(filePath, new conn
       delete dpc;
    }
 
-   if (bind(*sock, (const struct sockaddr*) servaddr, sizeof(*servaddr)) < 0)
+   if (bind(*sock, (const struct sockaddr*) &servaddr->addr, servaddr->len) < 0)
    {
       perror("bind failed");
       ::close(*sock);
@@ -97,12 +711,15 @@ server::FTPServer(const std::string filePath, int port) : FTP(filePath, new conn
    }
 
    dpc->getInSockAddr()->isAddrInit = true;
-   dpc->getOutSockAddr()->len       = sizeof(struct sockaddr_in);
+   dpc->getOutSockAddr()->len       = servaddr->len;
+
+   dpc->watchDrops();
+   tuneBuffers();
 }
 
 void server::listen()
 {
-   int sndSz, rcvSz;
+   int rcvSz;
 
    if (!dpc->getInSockAddr()->isAddrInit)
    {
@@ -114,115 +731,600 @@ void server::listen()
    memset(dpc->_buffer, 0, sizeof(dpc->_buffer));
 
    rcvSz = dpc->recvRaw(dpc->_buffer, sizeof(dpc->_buffer));
+   checkDrops();
+
+   // Flows are told apart by port too, a host may run several transfers at once.
+   FlowKey address{dpc->getOutSockAddr()->addr};
 
-   std::string address = inet_ntoa(dpc->getOutSockAddr()->addr.sin_addr);
+   PDU* inPdu = reinterpret_cast<PDU*>(dpc->_buffer);
 
-   if (rcvSz == sizeof(PDU))
+   if (rcvSz >= (int) sizeof(PDU) && inPdu->mtype == MsgType::CONNECT)
+      acceptConnection(address, rcvSz);
+   else
+      handleDatagram(address, rcvSz);
+}
+
+void server::acceptConnection(const FlowKey& address, int rcvSz)
+{
+   PDU* inPdu     = reinterpret_cast<PDU*>(dpc->_buffer);
+   int  payloadSz = rcvSz - (int) sizeof(PDU);
+
+   FTP_OPTIONS options{};
+   if (!inPdu->verify(dpc->_buffer + sizeof(PDU), payloadSz))
+   {
+      std::cerr << "ERROR: corrupted CONNECT from " << address << ", ignoring" << std::endl;
+      return;
+   }
+   memcpy(&options, dpc->_buffer + sizeof(PDU), std::min<int>(payloadSz, sizeof(options)));
+
+   // The first datagram of an upload a ticket holder sent without waiting for the CNTACK.
+   char*       early   = dpc->_buffer + sizeof(PDU) + sizeof(options);
+   int         earlySz = std::max<int>(0, payloadSz - sizeof(options));
+
+   // Compressed frames span datagrams and must be decoded in order, subflows are not.
+   if (options.codec >= Compression::CODEC_COUNT || options.transfer != 0)
+      options.codec = Compression::CODEC_NONE;
+
+   releaseFlow(address);
+
+   if (maxSessions > 0 && ftpWriters.size() >= maxSessions)
    {
-      PDU pdu;
-      pdu.seqnum = 0;
-      pdu.mtype  = MsgType::CNTACK;
+      std::cerr << "Refusing " << address << ", " << ftpWriters.size() << " sessions open" << std::endl;
+      refuse(inPdu->seqnum, SESSION_RETRY_MS);
+      return;
+   }
 
-      dpc->seqNums[inet_ntoa(dpc->getOutSockAddr()->addr.sin_addr)] = pdu.seqnum + 1;
+   if (options.fecK > Fec::MAX_K)
+      options.fecK = Fec::MAX_K;
+   if (options.fecK > 0)
+      stripes[address] = new Fec::StripeDecoder();
 
-      pdu.seqnum = dpc->seqNums[inet_ntoa(dpc->getOutSockAddr()->addr.sin_addr)];
+   if (options.cipher == Crypto::CIPHER_AES_GCM || options.cipher == Crypto::CIPHER_CHACHA20)
+   {
+      Crypto::KeyExchange kx;
+      uint8_t             clientPub[Crypto::PUBKEY_SZ];
+      uint8_t             key[Crypto::KEY_SZ];
+      uint8_t             iv[Crypto::NONCE_SZ];
+
+      memcpy(clientPub, options.publicKey, sizeof(clientPub));
 
-      sndSz = dpc->sendRaw(&pdu, sizeof(PDU));
+      Crypto::Aead* aead = nullptr;
+      if (kx.publicKey(options.publicKey) && kx.derive(clientPub, clientPub, options.publicKey, psk, key, iv))
+         aead = new Crypto::Aead(options.cipher, key, iv, false);
 
-      if (sndSz != sizeof(PDU))
+      if (aead != nullptr && aead->valid())
+         ciphers[address] = aead;
+      else
       {
-         perror("listen: The wrong number of bytes were sent");
+         delete aead;
+         options.cipher = Crypto::CIPHER_NONE;
       }
+   }
+   else
+      options.cipher = Crypto::CIPHER_NONE;
+
+   if (options.cipher == Crypto::CIPHER_NONE)
+      memset(options.publicKey, 0, sizeof(options.publicKey));
+
+   // Early data is taken from plain uploads only, it would be sent before a session key or a stripe exists.
+   // A ticket is good for one CONNECT, a replayed one finds it gone.
+   const FTP_PDU* first     = reinterpret_cast<const FTP_PDU*>(early);
+   bool           redeemed  = options.ticket != 0 && redeemTicket(address, options.ticket);
+   bool           tookEarly = redeemed && earlySz >= (int) ftpHeaderSz(Status::NEW) && first->status == Status::NEW &&
+                    options.cipher == Crypto::CIPHER_NONE && options.fecK == 0 && options.transfer == 0 &&
+                    options.codec == Compression::CODEC_NONE && throttle(address, earlySz, 0) == 0;
 
-      connected++;
-      fw.push_back(new FTPFileWriter{address});
+   options.early  = tookEarly ? earlySz : 0;
+   options.ticket = issueTicket(address);
 
-      pool->submit([&] {
-         FTPFileWriter* writer = fw.back();
-         fw.pop_back();
-         writer->serverLoop();
-         delete writer;
-         ftpWriters.erase(writer->address);
-      });
+   PDU pdu;
+   pdu.seqnum   = 0;
+   pdu.mtype    = MsgType::CNTACK;
+   pdu.dgram_sz = sizeof(options);
+   pdu.err_num  = dpc->NO_ERROR;
 
-      ftpWriters[address] = fw.back();
-      std::cout << "Connection established OK!" << std::endl;
+   dpc->seqNums[address] = pdu.seqnum + 1 + options.early;
+
+   pdu.seqnum = dpc->seqNums[address];
+
+   char reply[sizeof(PDU) + sizeof(FTP_OPTIONS)];
+   memcpy(reply, &pdu, sizeof(PDU));
+   memcpy(reply + sizeof(PDU), &options, sizeof(options));
+
+   int sndSz = dpc->sendRaw(reply, sizeof(reply));
+
+   if (sndSz != sizeof(reply))
+   {
+      perror("listen: The wrong number of bytes were sent");
    }
-   else
+
+   connected++;
+
+   windows[address] = (options.fecK > 0) ? options.fecK + Fec::MAX_M : 1;
+   tuneBuffers();
+
+   // Later subflows of a multipath upload feed the writer the first one started.
+   auto transfer = transfers.find(options.transfer);
+   if (options.transfer != 0 && transfer != transfers.end())
    {
-      int errCode = dpc->NO_ERROR;
-      int buffSz  = sizeof(dpc->_buffer);
+      ftpWriters[address] = transfer->second;
+      std::cout << "Subflow " << address << " joined transfer " << std::hex << options.transfer << std::dec << std::endl;
+      return;
+   }
+
+   FTPFileWriter* writer = new FTPFileWriter{address.str(), options, cache};
+   writer->fsyncOnCommit = fsyncOnCommit;
+   writer->directPool    = directIo ? &directBuffers : nullptr;
+   writer->keepVersions  = keepVersions;
+   writer->mmapWrites    = mmapWrites;
+   writer->multipath     = options.transfer != 0;
+   ftpWriters[address]   = writer;
 
-      if (rcvSz < sizeof(PDU))
-         errCode = dpc->ERROR_BAD_DGRAM;
+   if (options.transfer != 0)
+      transfers[options.transfer] = writer;
 
-      PDU inPdu;
-      memcpy(&inPdu, dpc->_buffer, sizeof(PDU));
+   if (tookEarly)
+   {
+      notePriority(writer, early, earlySz);
+      writer->pushToChannel(early, earlySz);
+      std::cout << "Took " << earlySz - ftpHeaderSz(Status::NEW) << " bytes of " << std::string(first->fileName, strnlen(first->fileName, sizeof(first->fileName)))
+                << " with the CONNECT from " << address << std::endl;
+   }
 
-      if (inPdu.dgram_sz > buffSz)
-         errCode = dpc->BUFF_UNDERSIZED;
+   writers->submit([writer] {
+      writer->serverLoop();
+      delete writer;
+   });
 
-      if (errCode == dpc->NO_ERROR)
-      {
-         if (inPdu.dgram_sz == 0)
-            dpc->seqNums[inet_ntoa(dpc->getOutSockAddr()->addr.sin_addr)]++;
-         else
-            dpc->seqNums[inet_ntoa(dpc->getOutSockAddr()->addr.sin_addr)] += inPdu.dgram_sz;
-      }
-      else
-      {
-         dpc->seqNums[inet_ntoa(dpc->getOutSockAddr()->addr.sin_addr)]++;
-      }
+   std::cout << "Connection established OK!" << std::endl;
+}
+
+void server::handleDatagram(const FlowKey& address, int rcvSz)
+{
+   int errCode = dpc->NO_ERROR;
+   int buffSz  = sizeof(dpc->_buffer);
+
+   PDU inPdu;
+   memcpy(&inPdu, dpc->_buffer, sizeof(PDU));
+
+   char* payload   = dpc->_buffer + sizeof(PDU);
+   int   payloadSz = rcvSz - (int) sizeof(PDU);
+
+   auto it = ftpWriters.find(address);
+
+   if (rcvSz < (int) sizeof(PDU))
+      errCode = dpc->ERROR_BAD_DGRAM;
+   else if (inPdu.dgram_sz > buffSz)
+      errCode = dpc->BUFF_UNDERSIZED;
+   else if (!inPdu.verify(payload, payloadSz))
+      errCode = dpc->ERROR_BAD_DGRAM;
+   else if (it == ftpWriters.end())
+      errCode = dpc->ERROR_PROTOCOL;
+   else if (!openPayload(address, inPdu, payload, payloadSz))
+      errCode = dpc->ERROR_AUTH;
 
-      PDU outPdu;
-      outPdu.dgram_sz = 0;
-      outPdu.seqnum   = dpc->seqNums[inet_ntoa(dpc->getOutSockAddr()->addr.sin_addr)];
-      outPdu.err_num  = errCode;
+   PDU outPdu;
+   outPdu.dgram_sz = 0;
+   outPdu.err_num  = errCode;
 
-      int actSndSz = 0;
-      if (errCode != dpc->NO_ERROR)
+   int actSndSz = 0;
+   if (errCode != dpc->NO_ERROR)
+   {
+      std::cerr << "ERROR: rejecting datagram from " << address << " with error " << errCode << std::endl;
+      outPdu.seqnum = inPdu.seqnum;
+      outPdu.mtype  = MsgType::ERROR;
+      actSndSz      = dpc->sendRaw(&outPdu, sizeof(PDU));
+      if (actSndSz != sizeof(PDU))
+         std::cerr << "ERROR: not no error" << inPdu.mtype << std::endl;
+
+      // A client without the server's key never gets a datagram through, not even the CLOSE that would end its writer.
+      if (errCode == dpc->ERROR_AUTH && (inPdu.mtype == MsgType::CLOSE || ++authFails[address] >= MAX_AUTH_FAILS))
       {
-         outPdu.mtype = MsgType::ERROR;
-         actSndSz     = dpc->sendRaw(&outPdu, sizeof(PDU));
-         if (actSndSz != sizeof(PDU))
-            std::cerr << "ERROR: not no error" << inPdu.mtype << std::endl;
+         std::cerr << "Dropping " << address << ", its datagrams do not authenticate" << std::endl;
+         releaseFlow(address);
       }
-      else if ((inPdu.mtype & MsgType::FRAGMENT) == MsgType::FRAGMENT)
+      return;
+   }
+
+   if (inPdu.mtype == MsgType::FECSND)
+   {
+      handleStripe(address, inPdu, payload, payloadSz);
+      return;
+   }
+
+   // Sequence numbers count bytes and wrap, a resend from just before the wrap is still behind.
+   unsigned int& expected  = dpc->seqNums[address];
+   bool          duplicate = (int) (inPdu.seqnum - expected) < 0;
+
+   // Refused before it is counted, the client sends the same datagram again after the delay.
+   // Urgent transfers may borrow a burst, so a small push gets through while the host's backup drained the bucket.
+   if (!duplicate && inPdu.mtype != MsgType::CLOSE)
+   {
+      notePriority(it->second, payload, payloadSz);
+
+      auto priority = priorities.find(address);
+      bool urgent   = priority != priorities.end() && priority->second == Priority::URGENT;
+      int  retryMs  = throttle(address, payloadSz, urgent ? BURST_MS : 0);
+      if (retryMs > 0)
       {
-         outPdu.mtype = MsgType::SENDFRAGMENTACK;
-         actSndSz     = dpc->sendRaw(&outPdu, sizeof(PDU));
-         if (actSndSz != sizeof(PDU))
-            std::cerr << "ERROR: in frag " << inPdu.mtype << std::endl;
+         refuse(inPdu.seqnum, retryMs);
+         return;
       }
-      else
+   }
+
+   // Counted from the datagram, not added up, the flow stays in step after FEC shards, which are not counted here.
+   if (!duplicate)
+      expected = inPdu.seqnum + ((inPdu.dgram_sz == 0) ? 1 : inPdu.dgram_sz);
+
+   outPdu.seqnum = expected;
+
+   FTPFileWriter* writer = it->second;
+
+   if (inPdu.mtype == MsgType::CLOSE)
+   {
+      outPdu.mtype = MsgType::CLOSEACK;
+
+      // Verifying and syncing the file can take a while, the writer answers a COMMIT itself and the other flows go on.
+      bool committed = payloadSz >= (int) sizeof(FTP_PDU);
+      if (committed)
+         writer->pushCommit(payload, payloadSz, dpc, *dpc->getOutSockAddr(), outPdu.seqnum);
+
+      releaseFlow(address);
+      if (committed)
+         return;
+
+      actSndSz = dpc->sendRaw(&outPdu, sizeof(PDU));
+      if (actSndSz != sizeof(PDU))
+         std::cerr << "ERROR: Unexpected or bad mtype in header " << inPdu.mtype << std::endl;
+      return;
+   }
+
+   if ((inPdu.mtype & MsgType::FRAGMENT) == MsgType::FRAGMENT)
+   {
+      outPdu.mtype = MsgType::SENDFRAGMENTACK;
+   }
+   else if (inPdu.mtype == MsgType::SND)
+   {
+      outPdu.mtype = MsgType::SNDACK;
+   }
+   else
+   {
+      std::cerr << "ERROR: Unexpected or bad mtype in header " << inPdu.mtype << std::endl;
+      return;
+   }
+
+   actSndSz = dpc->sendRaw(&outPdu, sizeof(PDU));
+   if (actSndSz != sizeof(PDU))
+      std::cerr << "ERROR: Unexpected or bad mtype in header " << inPdu.mtype << std::endl;
+
+   if (duplicate)
+   {
+      std::cout << "Duplicate seq " << inPdu.seqnum << " from " << address << ", already written" << std::endl;
+      return;
+   }
+
+   const FTP_PDU* request = reinterpret_cast<const FTP_PDU*>(payload);
+   if (payloadSz >= (int) sizeof(FTP_PDU) &&
+       (request->status == Status::GET || request->status == Status::LIST || request->status == Status::STAT) &&
+       payloadSz >= (int) ftpHeaderSz(request->status))
+   {
+      FTP_TRANSFER transfer;
+      memcpy(&transfer, payload + sizeof(FTP_PDU), sizeof(transfer));
+      startDownload(address, *request, transfer.priority);
+      return;
+   }
+
+   writer->pushToChannel(payload, payloadSz);
+}
+
+bool server::openPayload(const FlowKey& address, const PDU& inPdu, char* payload, int& payloadSz)
+{
+   auto cipher = ciphers.find(address);
+   if (cipher == ciphers.end())
+      return true;
+
+   if (inPdu.dgram_sz < 0 || payloadSz != inPdu.dgram_sz + Crypto::TAG_SZ)
+      return false;
+
+   PDU aad      = inPdu;
+   aad.checksum = 0;
+
+   if (!cipher->second->open(inPdu.seqnum, &aad, sizeof(PDU), payload, inPdu.dgram_sz, (uint8_t*) payload + inPdu.dgram_sz))
+      return false;
+
+   payloadSz = inPdu.dgram_sz;
+   authFails.erase(address);
+   return true;
+}
+
+void server::handleStripe(const FlowKey& address, const PDU& inPdu, char* payload, int payloadSz)
+{
+   auto decoder = stripes.find(address);
+   if (decoder == stripes.end() || payloadSz < (int) sizeof(Fec::StripeHeader))
+   {
+      std::cerr << "ERROR: unexpected FEC shard from " << address << std::endl;
+      return;
+   }
+
+   Fec::StripeHeader hdr;
+   memcpy(&hdr, payload, sizeof(hdr));
+
+   std::vector<std::string> delivered;
+   int status = decoder->second->add(hdr, payload + sizeof(hdr), payloadSz - sizeof(hdr), delivered);
+
+   // A refused shard would look like loss and raise the parity. Shards are charged as they come, a stripe
+   // that leaves the host in debt is not acknowledged until the debt is paid, and its resent shards are free.
+   if (status == Fec::StripeDecoder::PENDING || status == Fec::StripeDecoder::COMPLETE)
+      throttle(address, payloadSz, NEVER_REFUSE);
+
+   if (status != Fec::StripeDecoder::COMPLETE && status != Fec::StripeDecoder::ACK_AGAIN)
+      return;
+
+   FTPFileWriter* writer = ftpWriters[address];
+   for (std::string& dgram : delivered)
+   {
+      writer->pushToChannel(dgram.data(), dgram.size());
+   }
+
+   int retryMs = throttle(address, 0, 0);
+   if (retryMs > 0)
+   {
+      refuse(inPdu.seqnum, retryMs);
+      return;
+   }
+
+   Fec::StripeAck ack = decoder->second->ack();
+
+   PDU outPdu;
+   outPdu.mtype    = MsgType::FECACK;
+   outPdu.seqnum   = inPdu.seqnum;
+   outPdu.dgram_sz = sizeof(ack);
+   outPdu.err_num  = dpc->NO_ERROR;
+
+   char reply[sizeof(PDU) + sizeof(Fec::StripeAck)];
+   memcpy(reply, &outPdu, sizeof(PDU));
+   memcpy(reply + sizeof(PDU), &ack, sizeof(ack));
+
+   if (dpc->sendRaw(reply, sizeof(reply)) != sizeof(reply))
+      std::cerr << "ERROR: cannot acknowledge stripe " << ack.stripe << std::endl;
+}
+
+void server::releaseFlow(const FlowKey& address)
+{
+   auto writer = ftpWriters.find(address);
+   if (writer != ftpWriters.end())
+   {
+      FTPFileWriter* shared = writer->second;
+      ftpWriters.erase(writer);
+
+      // A multipath writer serves every subflow of its transfer and goes with the last of them.
+      bool last = std::none_of(ftpWriters.begin(), ftpWriters.end(), [shared](const auto& flow) { return flow.second == shared; });
+      if (last)
       {
-         switch (inPdu.mtype)
+         shared->getChannel()->close();
+         for (auto transfer = transfers.begin(); transfer != transfers.end(); ++transfer)
          {
-            case MsgType::SND:
-               outPdu.mtype = MsgType::SNDACK;
-               actSndSz     = dpc->sendRaw(&outPdu, sizeof(PDU));
-               if (actSndSz != sizeof(PDU))
-                  std::cerr << "ERROR: Unexpected or bad mtype in header " << inPdu.mtype << std::endl;
-               // return dpc->ERROR_PROTOCOL;
+            if (transfer->second == shared)
+            {
+               transfers.erase(transfer);
                break;
-            case MsgType::CLOSE:
-               outPdu.mtype = MsgType::CLOSEACK;
-               actSndSz     = dpc->sendRaw(&outPdu, sizeof(PDU));
-               if (actSndSz != sizeof(PDU))
-                  std::cerr << "ERROR: Unexpected or bad mtype in header " << inPdu.mtype << std::endl;
-               ftpWriters[address]->getChannel()->close();
-            default:
-               std::cerr << "ERROR: Unexpected or bad mtype in header " << inPdu.mtype << std::endl;
+            }
          }
       }
-      ftpWriters[address]->pushToChannel(dpc->_buffer + sizeof(PDU), rcvSz - sizeof(PDU));
    }
+   dpc->seqNums.erase(address);
+   windows.erase(address);
+   priorities.erase(address);
+
+   auto cipher = ciphers.find(address);
+   if (cipher != ciphers.end())
+   {
+      delete cipher->second;
+      ciphers.erase(cipher);
+   }
+   authFails.erase(address);
+
+   auto decoder = stripes.find(address);
+   if (decoder != stripes.end())
+   {
+      delete decoder->second;
+      stripes.erase(decoder);
+   }
+
+   // The host's budget goes with its last flow.
+   FlowKey host = address.host();
+   for (const auto& flow : ftpWriters)
+   {
+      if (flow.first.host() == host)
+         return;
+   }
+   buckets.erase(host);
+}
+
+void server::notePriority(FTPFileWriter* writer, const char* payload, int payloadSz)
+{
+   if (payloadSz < (int) sizeof(FTP_PDU))
+      return;
+
+   // APPENDs and COMMITs carry no FTP_TRANSFER, the flow keeps what its first datagram said.
+   size_t headerSz = ftpHeaderSz(reinterpret_cast<const FTP_PDU*>(payload)->status);
+   if (headerSz == sizeof(FTP_PDU) || payloadSz < (int) headerSz)
+      return;
+
+   FTP_TRANSFER transfer;
+   memcpy(&transfer, payload + sizeof(FTP_PDU), sizeof(transfer));
+
+   for (const auto& flow : ftpWriters)
+   {
+      if (flow.second == writer)
+         priorities[flow.first] = transfer.priority;
+   }
+}
+
+int server::throttle(const FlowKey& address, int bytes, int overdraftMs)
+{
+   if (clientRate == 0)
+      return 0;
+
+   FlowKey     host  = address.host();
+   double      burst = std::max<double>(clientRate * BURST_MS / 1000.0, connection::MAX_DGRAM_SZ);
+   auto        now   = std::chrono::steady_clock::now();
+
+   auto it = buckets.find(host);
+   if (it == buckets.end())
+      it = buckets.emplace(host, TokenBucket{burst, now}).first;
+
+   TokenBucket& bucket = it->second;
+   bucket.tokens       = std::min(burst, bucket.tokens + std::chrono::duration<double>(now - bucket.last).count() * clientRate);
+   bucket.last         = now;
+
+   double floor = -(double) overdraftMs * clientRate / 1000;
+   if (bucket.tokens - bytes < floor)
+      return std::max(1, (int) std::ceil((bytes + floor - bucket.tokens) * 1000.0 / clientRate));
+
+   bucket.tokens -= bytes;
+   return 0;
+}
+
+uint64_t server::issueTicket(const FlowKey& address)
+{
+   auto now = std::chrono::steady_clock::now();
+
+   if (tickets.size() >= MAX_TICKETS)
+   {
+      for (auto ticket = tickets.begin(); ticket != tickets.end();)
+      {
+         ticket = (ticket->second.expires <= now) ? tickets.erase(ticket) : std::next(ticket);
+      }
+      if (tickets.size() >= MAX_TICKETS)
+         return 0;
+   }
+
+   static std::random_device random;
+
+   uint64_t id;
+   do
+   {
+      id = (uint64_t) random() << 32 | random();
+   } while (id == 0 || tickets.count(id) > 0);
+
+   tickets[id] = SessionTicket{address.host(), now + std::chrono::seconds(TICKET_LIFETIME_S)};
+   return id;
+}
+
+bool server::redeemTicket(const FlowKey& address, uint64_t id)
+{
+   auto ticket = tickets.find(id);
+   if (ticket == tickets.end())
+      return false;
+
+   bool valid = ticket->second.host == address.host() && ticket->second.expires > std::chrono::steady_clock::now();
+   tickets.erase(ticket);
+   return valid;
+}
+
+void server::refuse(int seqnum, int retryMs)
+{
+   PDU outPdu;
+   outPdu.seqnum   = seqnum;
+   outPdu.mtype    = MsgType::ERROR;
+   outPdu.dgram_sz = retryMs;
+   outPdu.err_num  = dpc->ERROR_BUSY;
+
+   if (dpc->sendRaw(&outPdu, sizeof(PDU)) != sizeof(PDU))
+      std::cerr << "ERROR: cannot refuse seq " << seqnum << std::endl;
+}
+
+void server::startDownload(const FlowKey& address, const FTP_PDU& request, int priority)
+{
+   // Only files under the server's directory are served, whatever path the client sent.
+   std::string name(request.fileName, strnlen(request.fileName, sizeof(request.fileName)));
+   if (!safeRelativePath(name))
+      name = std::filesystem::path{name}.filename().string();
+
+   // The session turns into a download, its writer is not needed. The download goes on with the session's
+   // sequence numbers, so the client's acknowledgements carry the ones the sender waits for.
+   unsigned int seqnum = dpc->seqNums[address];
+   releaseFlow(address);
+
+   static const char* names[] = {"GET", "LIST", "STAT"};
+   std::cout << names[request.status - Status::GET] << " " << name << " from " << address << std::endl;
+
+   FTPFileSender* download = new FTPFileSender{*dpc->getOutSockAddr(), name, seqnum, priority, busyPollUs};
+   MetadataCache* metadata = cache;
+   int            status   = request.status;
+
+   // Queries may have to hash changed files, that happens on the sender's thread too.
+   senders->submit([download, metadata, status, priority] {
+      ioPriority(priority);
+      if (status == Status::GET)
+         download->serverLoop();
+      else
+         download->answerQuery(status, *metadata);
+      delete download;
+      ioPriority(Priority::NORMAL);
+   });
+}
+
+bool server::attachXdp(const std::string& ifname)
+{
+   xdp = new XdpDatapath(ifname, *dpc->getUdpSock(), addressPort(dpc->getInSockAddr()->addr));
+   if (!xdp->valid())
+   {
+      delete xdp;
+      xdp = nullptr;
+      return false;
+   }
+
+   dpc->setDatapath(xdp);
+   return true;
+}
 
-   std::this_thread::sleep_for(std::chrono::seconds(3));
+void server::tuneBuffers()
+{
+   long inFlight = 0;
+   for (const auto& window : windows)
+      inFlight += window.second;
+
+   long wanted = BUFFER_HEADROOM * inFlight * connection::DGRAM_TRUESIZE;
+   rcvBuf      = dpc->growBuffers(std::min<long>(wanted, RCVBUF_MAX), 0);
+}
+
+void server::checkDrops()
+{
+   uint32_t total = dpc->kernelDrops();
+   if (total == drops)
+      return;
+
+   int before = rcvBuf;
+   rcvBuf     = dpc->growBuffers(std::min<long>(2L * rcvBuf, RCVBUF_MAX), 0);
+
+   std::cerr << "Kernel dropped " << total - drops << " datagrams (" << total << " in total) on a full receive buffer of " << before
+             << " bytes";
+   if (rcvBuf > before)
+      std::cerr << ", grown to " << rcvBuf << std::endl;
+   else
+      std::cerr << ", cannot grow it, raise net.core.rmem_max or grant CAP_NET_ADMIN" << std::endl;
+
+   drops = total;
+}
+
+void server::setBusyPoll(int us)
+{
+   busyPollUs = std::max(us, 0);
+   dpc->setBusyPoll(busyPollUs);
 }
 
 server::~FTPServer()
-{}
+{
+   dpc->setDatapath(nullptr);
+   delete xdp;
+   for (auto& cipher : ciphers)
+      delete cipher.second;
+   for (auto& decoder : stripes)
+      delete decoder.second;
+   delete cache;
+}
 
 DrexelProtocol::connection* server::newConnection()
 {
@@ -0,0 +1,226 @@
+/**
+ * @file stripe.cpp
+ * @brief Implementation of the FEC stripe encoder and decoder.
+ */
+
+#include "fec/stripe.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "fec/reedsolomon.h"
+
+using Fec::StripeDecoder;
+using Fec::StripeEncoder;
+
+namespace
+{
+
+constexpr double LOSS_GAIN  = 0.125; ///< Weight of a new loss sample.
+constexpr double RTT_GAIN   = 0.125; ///< Weight of a new RTT sample.
+constexpr double HEADROOM   = 1.5;   ///< Parity is sized for this multiple of the measured loss.
+constexpr int    RTO_MIN_MS = 50;
+constexpr int    RTO_MAX_MS = 3000;
+constexpr int    RTO_INIT   = 250;
+constexpr double RATE_GAIN  = 0.25;  ///< Weight of a new delivery rate sample.
+constexpr double PACE_GAIN  = 1.25;  ///< Pacing above the delivery rate probes for more bandwidth.
+
+}  // namespace
+
+StripeEncoder::StripeEncoder(int k, int minParity)
+    : k(std::clamp(k, 1, MAX_K)), minParity(std::clamp(minParity, 0, MAX_M))
+{}
+
+bool StripeEncoder::add(const char* data, size_t len)
+{
+   symbols.emplace_back(data, len);
+   return static_cast<int>(symbols.size()) >= k;
+}
+
+bool StripeEncoder::empty() const
+{
+   return symbols.empty();
+}
+
+int StripeEncoder::parity() const
+{
+   // Enough parity to absorb HEADROOM times the loss rate, the expected losses of a stripe of n = k + m being n * loss.
+   double target = std::min(loss * HEADROOM, 0.5);
+   int    m      = static_cast<int>(std::ceil(k * target / (1.0 - target)));
+
+   return std::clamp(std::max(m, minParity), 0, std::min(k, MAX_M));
+}
+
+std::vector<std::string> StripeEncoder::encode()
+{
+   int    n     = static_cast<int>(symbols.size());
+   int    m     = parity();
+   size_t symSz = 0;
+
+   for (const std::string& s : symbols)
+   {
+      symSz = std::max(symSz, LEN_SZ + s.size());
+   }
+
+   // Data shards are padded for the parity computation only, they are sent at their real size.
+   std::vector<std::vector<uint8_t>> data(n, std::vector<uint8_t>(symSz, 0));
+   std::vector<std::vector<uint8_t>> check(m, std::vector<uint8_t>(symSz));
+   std::vector<const uint8_t*>       dataPtrs(n);
+   std::vector<uint8_t*>             checkPtrs(m);
+
+   for (int i = 0; i < n; i++)
+   {
+      uint16_t len = static_cast<uint16_t>(symbols[i].size());
+      std::memcpy(data[i].data(), &len, LEN_SZ);
+      std::memcpy(data[i].data() + LEN_SZ, symbols[i].data(), len);
+      dataPtrs[i] = data[i].data();
+   }
+   for (int j = 0; j < m; j++)
+   {
+      checkPtrs[j] = check[j].data();
+   }
+
+   ReedSolomon{n, m}.encode(dataPtrs.data(), checkPtrs.data(), symSz);
+
+   StripeHeader hdr{stripe, 0, static_cast<uint8_t>(n), static_cast<uint8_t>(m), static_cast<uint16_t>(symSz), round++};
+   std::vector<std::string> dgrams;
+   dgrams.reserve(n + m);
+
+   for (int i = 0; i < n + m; i++)
+   {
+      const uint8_t* shard = (i < n) ? data[i].data() : check[i - n].data();
+      size_t         len   = (i < n) ? LEN_SZ + symbols[i].size() : symSz;
+
+      hdr.index = static_cast<uint16_t>(i);
+
+      std::string dgram(sizeof(hdr) + len, '\0');
+      std::memcpy(&dgram[0], &hdr, sizeof(hdr));
+      std::memcpy(&dgram[sizeof(hdr)], shard, len);
+      dgrams.push_back(std::move(dgram));
+   }
+
+   return dgrams;
+}
+
+void StripeEncoder::acknowledged(const StripeAck& ack, double rttMs)
+{
+   double sample = (ack.seen > ack.k) ? static_cast<double>(ack.seen - ack.k) / ack.seen : 0.0;
+
+   loss = (1 - LOSS_GAIN) * loss + LOSS_GAIN * sample;
+   srtt = (srtt == 0) ? rttMs : (1 - RTT_GAIN) * srtt + RTT_GAIN * rttMs;
+
+   symbols.clear();
+   round = 0;
+   stripe++;
+}
+
+void StripeEncoder::timedOut()
+{
+   // More than m of the k + m datagrams went missing (or the acknowledgement did).
+   double n = static_cast<double>(symbols.size() + parity());
+   loss     = std::max(loss, (parity() + 1) / n);
+}
+
+int StripeEncoder::rtoMs() const
+{
+   if (srtt == 0)
+      return RTO_INIT;
+   return std::clamp(static_cast<int>(2 * srtt) + 10, RTO_MIN_MS, RTO_MAX_MS);
+}
+
+void StripeEncoder::delivered(size_t bytes, double elapsedMs)
+{
+   if (elapsedMs <= 0)
+      return;
+
+   double sample = bytes / elapsedMs;
+   rate          = (rate == 0) ? sample : (1 - RATE_GAIN) * rate + RATE_GAIN * sample;
+}
+
+uint64_t StripeEncoder::pacingRate() const
+{
+   return static_cast<uint64_t>(PACE_GAIN * rate * 1000);
+}
+
+uint32_t StripeEncoder::current() const
+{
+   return stripe;
+}
+
+int StripeDecoder::add(const StripeHeader& hdr, const char* sym, size_t len, std::vector<std::string>& out)
+{
+   if (hdr.stripe != next)
+   {
+      // The sender only resends the previous stripe when our acknowledgement of it got lost.
+      if (next > 0 && hdr.stripe == next - 1 && hdr.round > ackedRound)
+      {
+         ackedRound = hdr.round;
+         return ACK_AGAIN;
+      }
+      return IGNORED;
+   }
+
+   int n = hdr.k + hdr.m;
+   if (hdr.k == 0 || hdr.k > MAX_K || hdr.m > MAX_M || hdr.index >= n || hdr.symSz < LEN_SZ || len > hdr.symSz ||
+       (hdr.index >= hdr.k && len != hdr.symSz))
+      return IGNORED;
+
+   if (k == 0)
+   {
+      k     = hdr.k;
+      symSz = hdr.symSz;
+      shards.assign(k + MAX_M, std::string());
+      present.assign(k + MAX_M, false);
+   }
+   else if (hdr.k != k || hdr.symSz != symSz)
+      return IGNORED;
+
+   if (present[hdr.index])
+      return PENDING;
+
+   shards[hdr.index] = std::string(symSz, '\0');
+   std::memcpy(&shards[hdr.index][0], sym, len);
+   present[hdr.index] = true;
+   have++;
+   seen = std::max(seen, hdr.index + 1);
+
+   if (have < k)
+      return PENDING;
+
+   // Parity row j only depends on k and j, so rounds sending different amounts of parity still mix.
+   int                   highest = k + MAX_M;
+   std::vector<uint8_t*> ptrs(highest);
+   for (int i = 0; i < highest; i++)
+   {
+      if (shards[i].empty())
+         shards[i].assign(symSz, '\0');
+      ptrs[i] = reinterpret_cast<uint8_t*>(&shards[i][0]);
+   }
+
+   if (!ReedSolomon{k, MAX_M}.reconstruct(ptrs.data(), present, symSz))
+      return PENDING;
+
+   for (int i = 0; i < k; i++)
+   {
+      uint16_t dataLen;
+      std::memcpy(&dataLen, shards[i].data(), LEN_SZ);
+      out.emplace_back(shards[i].data() + LEN_SZ, std::min<size_t>(dataLen, symSz - LEN_SZ));
+   }
+
+   last       = StripeAck{next, static_cast<uint16_t>(seen), static_cast<uint16_t>(k)};
+   ackedRound = hdr.round;
+   next++;
+   k    = 0;
+   have = 0;
+   seen = 0;
+   shards.clear();
+   present.clear();
+
+   return COMPLETE;
+}
+
+Fec::StripeAck StripeDecoder::ack() const
+{
+   return last;
+}
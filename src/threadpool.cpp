@@ -13,11 +13,13 @@
 
 thread_local unsigned int                           ThreadPool::myIndex        = 0;
 thread_local WorkStealQueue<std::function<void()>>* ThreadPool::localWorkQueue = nullptr;
+thread_local ThreadPool*                            ThreadPool::localPool      = nullptr;
 
 void ThreadPool::workerThread(unsigned myIndex_)
 {
    myIndex        = myIndex_;
    localWorkQueue = queues[myIndex].get();
+   localPool      = this;
    while (!done)
    {
       runPendingTask();
@@ -25,7 +27,10 @@ void ThreadPool::workerThread(unsigned myIndex_)
    }
 }
 
-ThreadPool::ThreadPool() : threadCount(std::thread::hardware_concurrency()), done(false), joiner(threads)
+ThreadPool::ThreadPool() : ThreadPool(std::thread::hardware_concurrency())
+{}
+
+ThreadPool::ThreadPool(unsigned threadCount_) : threadCount(threadCount_ > 0 ? threadCount_ : 1), done(false), joiner(threads)
 {
    try
    {
@@ -78,7 +83,7 @@ ThreadPool::~ThreadPool()
 
 bool ThreadPool::popLocal(std::function<void()>& task)
 {
-   return localWorkQueue && localWorkQueue->tryPop(task);
+   return localPool == this && localWorkQueue->tryPop(task);
 }
 
 bool ThreadPool::popPoolQueue(std::function<void()>& task)
@@ -114,7 +119,8 @@ void ThreadPool::runPendingTask()
 
 void ThreadPool::submit(std::function<void()> task)
 {
-   if (localWorkQueue)
+   // A task of another pool submitting here must not land in its own pool's queue, no thread of this one looks there.
+   if (localPool == this)
    {
       localWorkQueue->push(std::move(task));
    }
@@ -41,6 +41,7 @@ private:
    ThreadedQueue<std::function<void()>>                                workQueue;      ///< Queue of tasks for the threads to execute.
    std::vector<std::unique_ptr<WorkStealQueue<std::function<void()>>>> queues;         ///< Vector of work-stealing queues for the threads.
    thread_local static WorkStealQueue<std::function<void()>>*          localWorkQueue; ///< Thread-local pointer to the work-stealing queue.
+   thread_local static ThreadPool*                                     localPool;      ///< Thread-local pointer to the pool the worker thread belongs to.
    thread_local static unsigned                                        myIndex;        ///< Thread-local index of the worker thread.
    mutable std::mutex                                                  mutex;          ///< Mutex for synchronizing access.
    std::condition_variable                                             cv;             ///< Condition variable for task notification.
@@ -54,10 +55,17 @@ private:
 
 public:
    /**
-    * @brief Construct a new ThreadPool object.
+    * @brief Construct a new ThreadPool object with one thread per hardware thread.
     */
    ThreadPool();
 
+   /**
+    * @brief Construct a new ThreadPool object with a fixed number of threads.
+    *
+    * @param threadCount_ The number of worker threads, at least one is always started.
+    */
+   explicit ThreadPool(unsigned threadCount_);
+
    /**
     * @brief Get the number of threads in the pool.
     * 
@@ -0,0 +1,115 @@
+/**
+ * @file tree.cpp
+ * @brief Implementation of the directory tree helpers.
+ */
+
+#include "drexelprotocol/tree.h"
+
+#include <drexelprotocol/ftp.h>
+
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+
+#include "channel/channel.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+/**
+ * @struct Scan
+ * @brief State shared by the directory tasks of one scanTree() call.
+ */
+struct Scan
+{
+   fs::path                              root;  ///< The root of the tree, names are relative to it.
+   ThreadPool&                           pool;  ///< Runs the directory tasks.
+   std::mutex                            mutex; ///< Guards files.
+   std::vector<DrexelProtocol::TreeFile> files; ///< Files found so far.
+   channel<int>*                         done;  ///< Every task reports the number of tasks it spawned.
+};
+
+void scanDirectory(Scan& scan, const fs::path& dir)
+{
+   std::vector<DrexelProtocol::TreeFile> found;
+   std::error_code                       ec;
+   int                                   spawned = 0;
+
+   for (const auto& item : fs::directory_iterator(dir, fs::directory_options::skip_permission_denied, ec))
+   {
+      if (item.is_symlink(ec) && item.is_directory(ec))
+         continue;
+
+      if (item.is_directory(ec))
+      {
+         fs::path sub = item.path();
+         scan.pool.submit([&scan, sub] { scanDirectory(scan, sub); });
+         spawned++;
+         continue;
+      }
+
+      if (!item.is_regular_file(ec))
+         continue;
+
+      std::string name = item.path().lexically_relative(scan.root).generic_string();
+      if (name.size() >= sizeof(DrexelProtocol::FTP_PDU::fileName))
+      {
+         std::cerr << "ERROR:  Name too long, skipping " << item.path().string() << std::endl;
+         continue;
+      }
+
+      found.push_back(DrexelProtocol::TreeFile{item.path().string(), name, static_cast<uint64_t>(item.file_size(ec))});
+   }
+
+   if (ec)
+      std::cerr << "ERROR:  Cannot list " << dir.string() << ": " << ec.message() << std::endl;
+
+   {
+      std::lock_guard<std::mutex> lock(scan.mutex);
+      scan.files.insert(scan.files.end(), found.begin(), found.end());
+   }
+
+   scan.done->send(spawned);
+}
+
+}  // namespace
+
+bool DrexelProtocol::safeRelativePath(const std::string& name)
+{
+   fs::path path{name};
+
+   if (name.empty() || !path.is_relative() || path.has_root_name())
+      return false;
+
+   for (const fs::path& part : path)
+   {
+      if (part == "..")
+         return false;
+   }
+
+   return true;
+}
+
+bool DrexelProtocol::partialFile(const std::string& name)
+{
+   return fs::path{name}.filename().string().rfind(PARTIAL_PREFIX, 0) == 0;
+}
+
+std::vector<DrexelProtocol::TreeFile> DrexelProtocol::scanTree(const std::string& root, ThreadPool& pool)
+{
+   Scan scan{fs::path{root}, pool, {}, {}, makeChannel<int>(64)};
+   int  outstanding = 1;
+
+   pool.submit([&scan] { scanDirectory(scan, scan.root); });
+
+   // Each finished task is replaced by the subdirectories it found.
+   while (outstanding > 0)
+   {
+      outstanding += scan.done->receive() - 1;
+   }
+   delete scan.done;
+
+   return scan.files;
+}
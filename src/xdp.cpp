@@ -0,0 +1,611 @@
+/**
+ * @file xdp.cpp
+ * @brief Implementation of the AF_XDP datapath.
+ */
+
+#include "drexelprotocol/xdp.h"
+
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+using DrexelProtocol::XdpDatapath;
+
+namespace
+{
+
+constexpr uint32_t ETH_HDR_SZ  = 14; ///< Ethernet header without VLAN tag.
+constexpr uint32_t IP_HDR_SZ   = 20; ///< IPv4 header without options, the program lets the others through.
+constexpr uint32_t UDP_HDR_SZ  = 8;  ///< UDP header.
+constexpr uint32_t HEADERS_SZ  = ETH_HDR_SZ + IP_HDR_SZ + UDP_HDR_SZ;
+constexpr int      BPF_LOG_SZ  = 16384; ///< Room for the verifier's complaint if the program is refused.
+
+long bpf(int cmd, union bpf_attr& attr)
+{
+   return syscall(SYS_bpf, cmd, &attr, sizeof(attr));
+}
+
+struct bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+   struct bpf_insn ins;
+   memset(&ins, 0, sizeof(ins));
+   ins.code    = code;
+   ins.dst_reg = dst;
+   ins.src_reg = src;
+   ins.off     = off;
+   ins.imm     = imm;
+   return ins;
+}
+
+/**
+ * @brief Maps one ring of an AF_XDP socket.
+ */
+bool mapRing(int fd, const struct xdp_ring_offset& off, size_t entrySz, off_t pgoff, void*& area, size_t& areaSz)
+{
+   areaSz = off.desc + XdpDatapath::RING_SZ * entrySz;
+   area   = mmap(nullptr, areaSz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+   if (area == MAP_FAILED)
+   {
+      area = nullptr;
+      perror("mmap of AF_XDP ring failed");
+      return false;
+   }
+   return true;
+}
+
+uint16_t ipChecksum(const uint8_t* hdr, size_t len)
+{
+   uint32_t sum = 0;
+   for (size_t i = 0; i < len; i += 2)
+      sum += (hdr[i] << 8) | hdr[i + 1];
+   while (sum >> 16)
+      sum = (sum & 0xffff) + (sum >> 16);
+   return htons(~sum & 0xffff);
+}
+
+uint64_t routeKey(const DrexelProtocol::FlowKey& key)
+{
+   uint32_t ip;
+   memcpy(&ip, key.addr, 4);
+   return (static_cast<uint64_t>(ip) << 16) | key.port;
+}
+
+/**
+ * @brief Counts the receive queues of an interface, one socket is bound to each.
+ */
+unsigned rxQueues(const std::string& ifname)
+{
+   std::error_code ec;
+   unsigned        count = 0;
+
+   for (const auto& item : std::filesystem::directory_iterator("/sys/class/net/" + ifname + "/queues", ec))
+   {
+      if (item.path().filename().string().rfind("rx-", 0) == 0)
+         count++;
+   }
+
+   return std::max(count, 1u);
+}
+
+}  // namespace
+
+XdpDatapath::XdpDatapath(const std::string& ifname, int udpSock, uint16_t port) : ifname(ifname), udpSock(udpSock), port(port)
+{
+   // IPv4 peers of a dual-stack socket are reported IPv4-mapped, like the kernel does.
+   socklen_t familySz = sizeof(family);
+   getsockopt(udpSock, SOL_SOCKET, SO_DOMAIN, &family, &familySz);
+
+   ifindex = if_nametoindex(ifname.c_str());
+   if (ifindex == 0)
+   {
+      perror("if_nametoindex failed");
+      return;
+   }
+
+   unsigned count = rxQueues(ifname);
+   for (unsigned id = 0; id < count; id++)
+   {
+      queues.push_back(new Queue());
+      queues.back()->id = id;
+   }
+
+   if (!loadProgram())
+      return;
+
+   for (Queue* queue : queues)
+   {
+      if (!openQueue(*queue))
+         return;
+
+      union bpf_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.map_fd = mapFd;
+      attr.key    = reinterpret_cast<uint64_t>(&queue->id);
+      attr.value  = reinterpret_cast<uint64_t>(&queue->fd);
+      attr.flags  = BPF_ANY;
+      if (bpf(BPF_MAP_UPDATE_ELEM, attr) < 0)
+      {
+         perror("bpf(BPF_MAP_UPDATE_ELEM) failed");
+         return;
+      }
+   }
+
+   // Drivers with native XDP run the program before any allocation, the others in generic mode.
+   for (uint32_t mode : {0u, (uint32_t) XDP_FLAGS_SKB_MODE})
+   {
+      union bpf_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.link_create.prog_fd        = progFd;
+      attr.link_create.target_ifindex = ifindex;
+      attr.link_create.attach_type    = BPF_XDP;
+      attr.link_create.flags          = mode;
+
+      linkFd = bpf(BPF_LINK_CREATE, attr);
+      if (linkFd >= 0)
+         break;
+   }
+   if (linkFd < 0)
+   {
+      perror("bpf(BPF_LINK_CREATE) failed");
+      return;
+   }
+
+   running = true;
+   for (Queue* queue : queues)
+      queue->thread = std::thread(&XdpDatapath::rxLoop, this, queue);
+   kernelThread = std::thread(&XdpDatapath::kernelLoop, this);
+
+   std::cout << "AF_XDP datapath on " << ifname << ", " << queues.size() << " queue(s)" << std::endl;
+}
+
+XdpDatapath::~XdpDatapath()
+{
+   running = false;
+   for (Queue* queue : queues)
+   {
+      if (queue->thread.joinable())
+         queue->thread.join();
+   }
+   if (kernelThread.joinable())
+      kernelThread.join();
+
+   // Detach first, the driver stops using the UMEMs before they are freed.
+   if (linkFd >= 0)
+      close(linkFd);
+   if (progFd >= 0)
+      close(progFd);
+   if (mapFd >= 0)
+      close(mapFd);
+
+   for (Queue* queue : queues)
+   {
+      closeQueue(*queue);
+      delete queue;
+   }
+
+   if (dropped > 0)
+      std::cerr << "AF_XDP datapath dropped " << dropped << " datagrams on a full inbox" << std::endl;
+}
+
+bool XdpDatapath::valid() const
+{
+   return running;
+}
+
+bool XdpDatapath::loadProgram()
+{
+   union bpf_attr attr;
+   memset(&attr, 0, sizeof(attr));
+   attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+   attr.key_size    = sizeof(uint32_t);
+   attr.value_size  = sizeof(uint32_t);
+   attr.max_entries = queues.size();
+
+   mapFd = bpf(BPF_MAP_CREATE, attr);
+   if (mapFd < 0)
+   {
+      perror("bpf(BPF_MAP_CREATE) failed");
+      return false;
+   }
+
+   // r6 = ctx; if the frame is an unfragmented IPv4 UDP datagram without options to our port,
+   // redirect it to the socket of its queue, falling back to XDP_PASS if there is none.
+   const int16_t   pass    = 23;
+   struct bpf_insn prog[]  = {
+      insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),                                     // 0: r6 = ctx
+      insn(BPF_LDX | BPF_MEM | BPF_W, 2, 6, offsetof(struct xdp_md, data), 0),           // 1: r2 = data
+      insn(BPF_LDX | BPF_MEM | BPF_W, 3, 6, offsetof(struct xdp_md, data_end), 0),       // 2: r3 = data_end
+      insn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),                                     // 3: r4 = data
+      insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, HEADERS_SZ),                            // 4: r4 += headers
+      insn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, pass - 6, 0),                                // 5: short frame
+      insn(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0),                                      // 6: ethertype
+      insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, pass - 8, htons(0x0800)),                    // 7: not IPv4
+      insn(BPF_LDX | BPF_MEM | BPF_B, 5, 2, ETH_HDR_SZ, 0),                              // 8: version and length
+      insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, pass - 10, 0x45),                            // 9: options
+      insn(BPF_LDX | BPF_MEM | BPF_B, 5, 2, ETH_HDR_SZ + 9, 0),                          // 10: protocol
+      insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, pass - 12, IPPROTO_UDP),                     // 11: not UDP
+      insn(BPF_LDX | BPF_MEM | BPF_H, 5, 2, ETH_HDR_SZ + 6, 0),                          // 12: flags and fragment offset
+      insn(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, htons(0x3fff)),                         // 13: more fragments, offset
+      insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, pass - 15, 0),                               // 14: a fragment
+      insn(BPF_LDX | BPF_MEM | BPF_H, 5, 2, ETH_HDR_SZ + IP_HDR_SZ + 2, 0),              // 15: destination port
+      insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, pass - 17, htons(port)),                     // 16: not ours
+      insn(BPF_LDX | BPF_MEM | BPF_W, 2, 6, offsetof(struct xdp_md, rx_queue_index), 0), // 17: r2 = queue
+      insn(BPF_LD | BPF_IMM | BPF_DW, 1, BPF_PSEUDO_MAP_FD, 0, mapFd),                   // 18: r1 = map
+      insn(0, 0, 0, 0, 0),                                                               // 19
+      insn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),                              // 20: r3 = fallback
+      insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),                          // 21
+      insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),                                              // 22
+      insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),                              // 23: pass
+      insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),                                              // 24
+   };
+   static char license[] = "Dual BSD/GPL";
+   static char log[BPF_LOG_SZ];
+
+   memset(&attr, 0, sizeof(attr));
+   attr.prog_type = BPF_PROG_TYPE_XDP;
+   attr.insn_cnt  = sizeof(prog) / sizeof(prog[0]);
+   attr.insns     = reinterpret_cast<uint64_t>(prog);
+   attr.license   = reinterpret_cast<uint64_t>(license);
+   attr.log_level = 1;
+   attr.log_size  = sizeof(log);
+   attr.log_buf   = reinterpret_cast<uint64_t>(log);
+
+   progFd = bpf(BPF_PROG_LOAD, attr);
+   if (progFd < 0)
+   {
+      perror("bpf(BPF_PROG_LOAD) failed");
+      std::cerr << log << std::endl;
+      return false;
+   }
+
+   return true;
+}
+
+bool XdpDatapath::openQueue(Queue& queue)
+{
+   queue.fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+   if (queue.fd < 0)
+   {
+      perror("AF_XDP socket creation failed");
+      return false;
+   }
+
+   void* umem = mmap(nullptr, (size_t) NUM_FRAMES * FRAME_SZ, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (umem == MAP_FAILED)
+   {
+      perror("mmap of UMEM failed");
+      return false;
+   }
+   queue.umem = static_cast<char*>(umem);
+
+   struct xdp_umem_reg reg;
+   memset(&reg, 0, sizeof(reg));
+   reg.addr       = reinterpret_cast<uint64_t>(queue.umem);
+   reg.len        = (uint64_t) NUM_FRAMES * FRAME_SZ;
+   reg.chunk_size = FRAME_SZ;
+   reg.headroom   = 0;
+
+   int ringSz = RING_SZ;
+   if (setsockopt(queue.fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+       setsockopt(queue.fd, SOL_XDP, XDP_UMEM_FILL_RING, &ringSz, sizeof(ringSz)) < 0 ||
+       setsockopt(queue.fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ringSz, sizeof(ringSz)) < 0 ||
+       setsockopt(queue.fd, SOL_XDP, XDP_RX_RING, &ringSz, sizeof(ringSz)) < 0 ||
+       setsockopt(queue.fd, SOL_XDP, XDP_TX_RING, &ringSz, sizeof(ringSz)) < 0)
+   {
+      perror("AF_XDP ring setup failed");
+      return false;
+   }
+
+   struct xdp_mmap_offsets off;
+   socklen_t               offSz = sizeof(off);
+   if (getsockopt(queue.fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &offSz) < 0)
+   {
+      perror("getsockopt(XDP_MMAP_OFFSETS) failed");
+      return false;
+   }
+
+   struct
+   {
+      Ring&                         ring;
+      const struct xdp_ring_offset& off;
+      size_t                        entrySz;
+      off_t                         pgoff;
+   } rings[] = {
+      {queue.rx, off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING},
+      {queue.tx, off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING},
+      {queue.fill, off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING},
+      {queue.done, off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING},
+   };
+
+   for (auto& r : rings)
+   {
+      if (!mapRing(queue.fd, r.off, r.entrySz, r.pgoff, r.ring.area, r.ring.areaSz))
+         return false;
+
+      char* base      = static_cast<char*>(r.ring.area);
+      r.ring.producer = reinterpret_cast<uint32_t*>(base + r.off.producer);
+      r.ring.consumer = reinterpret_cast<uint32_t*>(base + r.off.consumer);
+      r.ring.flags    = reinterpret_cast<uint32_t*>(base + r.off.flags);
+      r.ring.descs    = base + r.off.desc;
+      r.ring.mask     = RING_SZ - 1;
+   }
+
+   // The first half of the frames is lent to the driver for receiving, the second half builds replies.
+   uint64_t* fill = static_cast<uint64_t*>(queue.fill.descs);
+   for (uint32_t i = 0; i < RING_SZ; i++)
+      fill[i] = (uint64_t) i * FRAME_SZ;
+   __atomic_store_n(queue.fill.producer, RING_SZ, __ATOMIC_RELEASE);
+
+   for (uint32_t i = RING_SZ; i < NUM_FRAMES; i++)
+      queue.txFree.push_back((uint64_t) i * FRAME_SZ);
+
+   struct sockaddr_xdp sxdp;
+   memset(&sxdp, 0, sizeof(sxdp));
+   sxdp.sxdp_family   = AF_XDP;
+   sxdp.sxdp_ifindex  = ifindex;
+   sxdp.sxdp_queue_id = queue.id;
+   sxdp.sxdp_flags    = XDP_USE_NEED_WAKEUP;
+
+   if (bind(queue.fd, (const struct sockaddr*) &sxdp, sizeof(sxdp)) < 0)
+   {
+      perror("bind of AF_XDP socket failed");
+      return false;
+   }
+
+   return true;
+}
+
+void XdpDatapath::closeQueue(Queue& queue)
+{
+   for (Ring* ring : {&queue.rx, &queue.tx, &queue.fill, &queue.done})
+   {
+      if (ring->area != nullptr)
+         munmap(ring->area, ring->areaSz);
+   }
+   if (queue.fd >= 0)
+      close(queue.fd);
+   if (queue.umem != nullptr)
+      munmap(queue.umem, (size_t) NUM_FRAMES * FRAME_SZ);
+}
+
+void XdpDatapath::rxLoop(Queue* queue)
+{
+   struct pollfd         pfd = {queue->fd, POLLIN, 0};
+   std::vector<Datagram> batch;
+
+   batch.reserve(BATCH);
+
+   while (running)
+   {
+      if (poll(&pfd, 1, POLL_MS) <= 0)
+         continue;
+
+      uint32_t cons  = *queue->rx.consumer;
+      uint32_t avail = __atomic_load_n(queue->rx.producer, __ATOMIC_ACQUIRE) - cons;
+      uint32_t count = std::min(avail, BATCH);
+      uint32_t prod  = *queue->fill.producer;
+
+      const struct xdp_desc* descs = static_cast<const struct xdp_desc*>(queue->rx.descs);
+      uint64_t*              fill  = static_cast<uint64_t*>(queue->fill.descs);
+
+      for (uint32_t i = 0; i < count; i++)
+      {
+         const struct xdp_desc& desc = descs[(cons + i) & queue->rx.mask];
+
+         Datagram datagram;
+         if (parse(queue, reinterpret_cast<const uint8_t*>(queue->umem + desc.addr), desc.len, datagram))
+            batch.push_back(std::move(datagram));
+
+         // The frame goes straight back to the driver, the payload was copied out.
+         fill[(prod + i) & queue->fill.mask] = desc.addr & ~(uint64_t) (FRAME_SZ - 1);
+      }
+
+      __atomic_store_n(queue->rx.consumer, cons + count, __ATOMIC_RELEASE);
+      __atomic_store_n(queue->fill.producer, prod + count, __ATOMIC_RELEASE);
+
+      deliver(batch);
+   }
+}
+
+void XdpDatapath::kernelLoop()
+{
+   struct pollfd         pfd = {udpSock, POLLIN, 0};
+   std::vector<Datagram> batch(1);
+   char                  buff[FRAME_SZ];
+
+   while (running)
+   {
+      if (poll(&pfd, 1, POLL_MS) <= 0)
+         continue;
+
+      Datagram& datagram = batch[0];
+      datagram.fromSz    = sizeof(datagram.from);
+      ssize_t len        = recvfrom(udpSock, buff, sizeof(buff), MSG_DONTWAIT, (struct sockaddr*) &datagram.from, &datagram.fromSz);
+      if (len < 0)
+         continue;
+
+      datagram.data.assign(buff, len);
+      deliver(batch);
+      batch.resize(1);
+   }
+}
+
+bool XdpDatapath::parse(Queue* queue, const uint8_t* frame, uint32_t len, Datagram& out)
+{
+   if (len < HEADERS_SZ)
+      return false;
+
+   const uint8_t* ip     = frame + ETH_HDR_SZ;
+   const uint8_t* udp    = ip + IP_HDR_SZ;
+   uint16_t       udpLen = (udp[4] << 8) | udp[5];
+
+   if (udpLen < UDP_HDR_SZ || ETH_HDR_SZ + IP_HDR_SZ + udpLen > len)
+      return false;
+
+   memset(&out.from, 0, sizeof(out.from));
+   if (family == AF_INET6)
+   {
+      struct sockaddr_in6* from   = (struct sockaddr_in6*) &out.from;
+      from->sin6_family           = AF_INET6;
+      from->sin6_addr.s6_addr[10] = 0xff;
+      from->sin6_addr.s6_addr[11] = 0xff;
+      memcpy(from->sin6_addr.s6_addr + 12, ip + 12, 4);
+      memcpy(&from->sin6_port, udp, 2);
+      out.fromSz = sizeof(*from);
+   }
+   else
+   {
+      struct sockaddr_in* from = (struct sockaddr_in*) &out.from;
+      from->sin_family         = AF_INET;
+      memcpy(&from->sin_addr.s_addr, ip + 12, 4);
+      memcpy(&from->sin_port, udp, 2);
+      out.fromSz = sizeof(*from);
+   }
+   out.data.assign(reinterpret_cast<const char*>(udp + UDP_HDR_SZ), udpLen - UDP_HDR_SZ);
+
+   Route route;
+   memcpy(route.peerMac, frame + 6, 6);
+   memcpy(route.localMac, frame, 6);
+   memcpy(&route.localIp, ip + 16, 4);
+   route.queue = queue;
+
+   std::lock_guard<std::mutex> lock(routeLock);
+   routes[routeKey(FlowKey(out.from))] = route;
+   return true;
+}
+
+void XdpDatapath::deliver(std::vector<Datagram>& batch)
+{
+   if (batch.empty())
+      return;
+
+   {
+      std::lock_guard<std::mutex> lock(inboxLock);
+      for (Datagram& datagram : batch)
+      {
+         if (inbox.size() < INBOX_SZ)
+            inbox.push_back(std::move(datagram));
+         else
+            dropped++;
+      }
+   }
+   batch.clear();
+   inboxReady.notify_one();
+}
+
+int XdpDatapath::recv(void* buff, int buffSz, struct sockaddr_storage& from, socklen_t& fromSz)
+{
+   std::unique_lock<std::mutex> lock(inboxLock);
+   inboxReady.wait(lock, [this] { return !inbox.empty(); });
+
+   Datagram datagram = std::move(inbox.front());
+   inbox.pop_front();
+   lock.unlock();
+
+   int len = std::min<int>(buffSz, datagram.data.size());
+   memcpy(buff, datagram.data.data(), len);
+   from   = datagram.from;
+   fromSz = datagram.fromSz;
+   return len;
+}
+
+int XdpDatapath::send(const void* buff, int len, const struct sockaddr_storage& to, socklen_t toSz)
+{
+   FlowKey peer{to};
+   Route   route;
+   bool    known = false;
+
+   // Only IPv4 reaches the AF_XDP sockets, IPv6 peers are always answered through the kernel.
+   if (peer.family == AF_INET)
+   {
+      std::lock_guard<std::mutex> lock(routeLock);
+      auto                        it = routes.find(routeKey(peer));
+      if (it != routes.end())
+      {
+         route = it->second;
+         known = true;
+      }
+   }
+
+   if (known && len + HEADERS_SZ <= FRAME_SZ && transmit(route, buff, len, peer))
+      return len;
+
+   return sendto(udpSock, buff, len, 0, (const struct sockaddr*) &to, toSz);
+}
+
+bool XdpDatapath::transmit(const Route& route, const void* buff, int len, const FlowKey& to)
+{
+   Queue*                      queue = route.queue;
+   std::lock_guard<std::mutex> lock(queue->txLock);
+
+   // Take back the frames the driver is done with.
+   uint32_t  cons = *queue->done.consumer;
+   uint32_t  sent = __atomic_load_n(queue->done.producer, __ATOMIC_ACQUIRE) - cons;
+   uint64_t* done = static_cast<uint64_t*>(queue->done.descs);
+   for (uint32_t i = 0; i < sent; i++)
+      queue->txFree.push_back(done[(cons + i) & queue->done.mask]);
+   __atomic_store_n(queue->done.consumer, cons + sent, __ATOMIC_RELEASE);
+
+   uint32_t prod = *queue->tx.producer;
+   if (queue->txFree.empty() || prod - __atomic_load_n(queue->tx.consumer, __ATOMIC_ACQUIRE) >= RING_SZ)
+      return false;
+
+   uint64_t addr = queue->txFree.back();
+   queue->txFree.pop_back();
+
+   uint8_t* frame = reinterpret_cast<uint8_t*>(queue->umem + addr);
+   uint8_t* ip    = frame + ETH_HDR_SZ;
+   uint8_t* udp   = ip + IP_HDR_SZ;
+
+   memcpy(frame, route.peerMac, 6);
+   memcpy(frame + 6, route.localMac, 6);
+   frame[12] = 0x08;
+   frame[13] = 0x00;
+
+   uint16_t totalLen = htons(IP_HDR_SZ + UDP_HDR_SZ + len);
+   uint16_t flags    = htons(0x4000);
+   memset(ip, 0, IP_HDR_SZ);
+   ip[0] = 0x45;
+   memcpy(ip + 2, &totalLen, 2);
+   memcpy(ip + 6, &flags, 2);
+   ip[8] = 64;
+   ip[9] = IPPROTO_UDP;
+   memcpy(ip + 12, &route.localIp, 4);
+   memcpy(ip + 16, to.addr, 4);
+   uint16_t check = ipChecksum(ip, IP_HDR_SZ);
+   memcpy(ip + 10, &check, 2);
+
+   // A zero UDP checksum means none over IPv4, the PDU carries its own CRC32C.
+   uint16_t srcPort = htons(port);
+   uint16_t udpLen  = htons(UDP_HDR_SZ + len);
+   memcpy(udp, &srcPort, 2);
+   memcpy(udp + 2, &to.port, 2);
+   memcpy(udp + 4, &udpLen, 2);
+   memset(udp + 6, 0, 2);
+   memcpy(udp + UDP_HDR_SZ, buff, len);
+
+   struct xdp_desc* descs  = static_cast<struct xdp_desc*>(queue->tx.descs);
+   struct xdp_desc& desc   = descs[prod & queue->tx.mask];
+   desc.addr               = addr;
+   desc.len                = HEADERS_SZ + len;
+   desc.options            = 0;
+   __atomic_store_n(queue->tx.producer, prod + 1, __ATOMIC_RELEASE);
+
+   if (__atomic_load_n(queue->tx.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)
+      sendto(queue->fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+
+   return true;
+}
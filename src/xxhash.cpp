@@ -0,0 +1,171 @@
+/**
+ * @file xxhash.cpp
+ * @brief Implementation of the streaming XXH64 hasher.
+ */
+
+#include "checksum/xxhash.h"
+
+#include <cstring>
+
+using Checksum::XXH64;
+
+namespace
+{
+
+constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+   return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const uint8_t* p)
+{
+   uint64_t v;
+   std::memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+inline uint32_t read32(const uint8_t* p)
+{
+   uint32_t v;
+   std::memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input)
+{
+   acc += input * PRIME2;
+   acc = rotl(acc, 31);
+   return acc * PRIME1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t val)
+{
+   acc ^= round(0, val);
+   return acc * PRIME1 + PRIME4;
+}
+
+}  // namespace
+
+XXH64::XXH64(uint64_t seed)
+{
+   reset(seed);
+}
+
+void XXH64::reset(uint64_t seed_)
+{
+   seed     = seed_;
+   totalLen = 0;
+   memSize  = 0;
+   acc[0]   = seed + PRIME1 + PRIME2;
+   acc[1]   = seed + PRIME2;
+   acc[2]   = seed;
+   acc[3]   = seed - PRIME1;
+}
+
+void XXH64::update(const void* data, size_t len)
+{
+   const uint8_t* p   = static_cast<const uint8_t*>(data);
+   const uint8_t* end = p + len;
+
+   totalLen += len;
+
+   if (memSize + len < sizeof(mem))
+   {
+      std::memcpy(mem + memSize, p, len);
+      memSize += len;
+      return;
+   }
+
+   if (memSize > 0)
+   {
+      size_t fill = sizeof(mem) - memSize;
+      std::memcpy(mem + memSize, p, fill);
+      acc[0] = round(acc[0], read64(mem));
+      acc[1] = round(acc[1], read64(mem + 8));
+      acc[2] = round(acc[2], read64(mem + 16));
+      acc[3] = round(acc[3], read64(mem + 24));
+      p += fill;
+      memSize = 0;
+   }
+
+   uint64_t v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+   while (p + 32 <= end)
+   {
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+      p += 32;
+   }
+   acc[0] = v1, acc[1] = v2, acc[2] = v3, acc[3] = v4;
+
+   if (p < end)
+   {
+      memSize = end - p;
+      std::memcpy(mem, p, memSize);
+   }
+}
+
+uint64_t XXH64::digest() const
+{
+   uint64_t h;
+
+   if (totalLen >= 32)
+   {
+      h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+      h = mergeRound(h, acc[0]);
+      h = mergeRound(h, acc[1]);
+      h = mergeRound(h, acc[2]);
+      h = mergeRound(h, acc[3]);
+   }
+   else
+   {
+      h = seed + PRIME5;
+   }
+
+   h += totalLen;
+
+   const uint8_t* p   = mem;
+   const uint8_t* end = mem + memSize;
+
+   while (p + 8 <= end)
+   {
+      h ^= round(0, read64(p));
+      h = rotl(h, 27) * PRIME1 + PRIME4;
+      p += 8;
+   }
+
+   if (p + 4 <= end)
+   {
+      h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+      h = rotl(h, 23) * PRIME2 + PRIME3;
+      p += 4;
+   }
+
+   while (p < end)
+   {
+      h ^= (*p++) * PRIME5;
+      h = rotl(h, 11) * PRIME1;
+   }
+
+   h ^= h >> 33;
+   h *= PRIME2;
+   h ^= h >> 29;
+   h *= PRIME3;
+   h ^= h >> 32;
+
+   return h;
+}
+
+uint64_t XXH64::hash(const void* data, size_t len, uint64_t seed)
+{
+   XXH64 state(seed);
+   state.update(data, len);
+   return state.digest();
+}